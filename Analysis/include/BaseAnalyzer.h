@@ -81,14 +81,18 @@ public:
           anaDataFinalSelection(outputFile, "final_selection"),
           maxNumberOfEvents(_maxNumberOfEvents),
           mvaMetProducer(config.MvaMet_dZcut(), config.MvaMet_inputFileNameU(), config.MvaMet_inputFileNameDPhi(),
-                         config.MvaMet_inputFileNameCovU1(), config.MvaMet_inputFileNameCovU2())
+                         config.MvaMet_inputFileNameCovU1(), config.MvaMet_inputFileNameCovU2(),
+                         config.MvaMet_validateIncremental()),
+          firedTriggerPathsValid(false)
     {
         if ( _prefix != "external" ){
             progressReporter = std::shared_ptr<tools::ProgressReporter>(
                         new tools::ProgressReporter(config.ReportInterval(), std::cout));
             treeExtractor = std::shared_ptr<TreeExtractor>(
                         new TreeExtractor(_prefix == "none" ? "" : _prefix, inputFileName, config.extractMCtruth(),
-                                          config.MaxTreeVersion()));
+                                          config.MaxTreeVersion(), config.ReadAheadDepth(),
+                                          config.TreeCacheSize(), config.UseForestIndex(),
+                                          config.ForestIndexPath()));
 
         }
         TH1::SetDefaultSumw2();
@@ -109,6 +113,13 @@ public:
         auto _event = std::shared_ptr<EventDescriptor>(new EventDescriptor());
         if (!treeExtractor || !progressReporter)
             throw exception("treeExtractor not initialized");
+        if(config.RunSingleEvent() && treeExtractor->CanSeek()) {
+            if(!treeExtractor->ExtractEvent(config.SingleEventId(), *_event))
+                throw exception("Event ") << config.SingleEventId() << " not found.";
+            ProcessEventWithEnergyUncertainties(_event);
+            progressReporter->Report(1, true);
+            return;
+        }
         for(; ( !maxNumberOfEvents || n < maxNumberOfEvents ) && treeExtractor->ExtractNext(*_event); ++n) {
             progressReporter->Report(n);
 //            std::cout << "event = " << _event->eventId().eventId << std::endl;
@@ -117,10 +128,18 @@ public:
             if(config.RunSingleEvent()) break;
         }
         progressReporter->Report(n, true);
+        treeExtractor->PrintPrefetchStatistics(std::cout);
     }
 
     void ProcessEventWithEnergyUncertainties(std::shared_ptr<const EventDescriptor> _event)
     {
+        mvaMetProducer.NewEvent();
+        firedTriggerPathsValid = false;
+        if(config.EstimateJetEnergyUncertainties()) {
+            jetsUp = jetsDown = _event->jets();
+            jetEnergyUncertaintyCorrector->ApplyCorrection(jetsUp, true);
+            jetEnergyUncertaintyCorrector->ApplyCorrection(jetsDown, false);
+        }
         TryProcessEvent(_event, EventEnergyScale::Central);
         if(config.EstimateTauEnergyUncertainties()) {
             TryProcessEvent(_event, EventEnergyScale::TauUp);
@@ -145,7 +164,8 @@ private:
     {
         eventEnergyScale = energyScale;
         scaledTaus = _event->taus();
-        scaledJets = _event->jets();
+        scaledJets = energyScale == EventEnergyScale::JetUp ? jetsUp
+                   : energyScale == EventEnergyScale::JetDown ? jetsDown : _event->jets();
         if(energyScale == EventEnergyScale::TauUp || energyScale == EventEnergyScale::TauDown) {
             const double sign = energyScale == EventEnergyScale::TauUp ? +1 : -1;
             const double sf = 1.0 + sign * cuts::Htautau_Summer13::tauCorrections::energyUncertainty;
@@ -157,9 +177,6 @@ private:
                 tau.phi = scaled_momentum.Phi();
                 tau.mass = scaled_momentum.M();
             }
-        } else if(energyScale == EventEnergyScale::JetUp || energyScale == EventEnergyScale::JetDown) {
-            const bool scale_up = energyScale == EventEnergyScale::JetUp;
-            jetEnergyUncertaintyCorrector->ApplyCorrection(scaledJets, scale_up);
         }
 
         event = _event;
@@ -185,26 +202,37 @@ protected:
     const ntuple::TauVector& GetNtupleTaus() const { return scaledTaus; }
     const ntuple::JetVector& GetNtupleJets() const { return scaledJets; }
 
-    bool HaveTriggerFired(const std::set<std::string>& interestinghltPaths) const
+    /// Paths which have fired with prescale 1 in the current event.
+    const TriggerPathSet& GetFiredTriggerPaths()
     {
-        for (const ntuple::Trigger& trigger : event->triggers()){
-            for (size_t n = 0; HaveTriggerMatched(trigger.hltpaths, interestinghltPaths, n); ++n){
-                if (trigger.hltresults.at(n) == 1 && trigger.hltprescales.at(n) == 1)
-                    return true;
+        if(!firedTriggerPathsValid) {
+            firedTriggerPaths.Clear();
+            for (const ntuple::Trigger& trigger : event->triggers()){
+                for (size_t n = 0; n < trigger.hltpaths.size(); ++n){
+                    if (trigger.hltresults.at(n) == 1 && trigger.hltprescales.at(n) == 1)
+                        firedTriggerPaths.Insert(triggerPaths.GetId(trigger.hltpaths.at(n)));
+                }
             }
+            firedTriggerPathsValid = true;
         }
-        return false;
+        return firedTriggerPaths;
+    }
+
+    bool HaveTriggerFired(const std::set<std::string>& interestinghltPaths)
+    {
+        const TriggerPathSet& firedPaths = GetFiredTriggerPaths();
+        return firedPaths.Intersects(triggerPaths.GetMask(interestinghltPaths));
     }
 
     std::vector<std::string> CollectPathsForTriggerFired(const std::set<std::string>& interestinghltPaths)
     {
+        const TriggerPathSet& interestingPathMask = triggerPaths.GetMask(interestinghltPaths);
         std::vector<std::string> firedPaths;
         for (const ntuple::Trigger& trigger : event->triggers()){
-            for (size_t n = 0; HaveTriggerMatched(trigger.hltpaths, interestinghltPaths, n); ++n){
-                if (trigger.hltresults.at(n) == 1 && trigger.hltprescales.at(n) == 1){
-                    std::string firedPath = trigger.hltpaths.at(n);
-                    firedPaths.push_back(firedPath);
-                }
+            for (size_t n = 0; n < trigger.hltpaths.size(); ++n){
+                if (trigger.hltresults.at(n) == 1 && trigger.hltprescales.at(n) == 1
+                        && interestingPathMask.Contains(triggerPaths.GetId(trigger.hltpaths.at(n))))
+                    firedPaths.push_back(trigger.hltpaths.at(n));
             }
         }
         return firedPaths;
@@ -586,10 +614,10 @@ protected:
     {
         CandidatePtrVector triggeredHiggses;
         for (const auto& higgs : higgses){
-            if(!useStandardTriggerMatch && HaveTriggerMatched(event->triggerObjects(), hltPaths, *higgs,
-                                                                        cuts::Htautau_Summer13::DeltaR_triggerMatch))
+            if(!useStandardTriggerMatch && HaveTriggerMatched(triggerPaths, event->triggerObjects(), hltPaths, *higgs,
+                                                              cuts::Htautau_Summer13::DeltaR_triggerMatch))
                 triggeredHiggses.push_back(higgs);
-            if (useStandardTriggerMatch && HaveTriggerMatched(hltPaths, *higgs))
+            if (useStandardTriggerMatch && HaveTriggerMatched(triggerPaths, hltPaths, *higgs))
                 triggeredHiggses.push_back(higgs);
         }
         return triggeredHiggses;
@@ -909,6 +937,13 @@ protected:
             originalDaughters.push_back(original);
         }
         CandidatePtr originalHiggs(new Candidate(higgs->GetType(), originalDaughters.at(0), originalDaughters.at(1)));
+        if(eventEnergyScale == EventEnergyScale::Central && config.EstimateJetEnergyUncertainties()) {
+            // MVAs for the jet energy scale variations, which usually have the same signal candidate, are evaluated
+            // together with the central one
+            const std::vector<const ntuple::JetVector*> jetCollections = { &GetNtupleJets(), &jetsUp, &jetsDown };
+            mvaMetProducer.PrepareMvaMet(originalHiggs, event->pfCandidates(), jetCollections, primaryVertex,
+                                         goodVertices);
+        }
         return mvaMetProducer.ComputeMvaMet(originalHiggs, event->pfCandidates(), GetNtupleJets(), primaryVertex,
                                             goodVertices);
     }
@@ -926,11 +961,14 @@ protected:
     MvaMetProducer mvaMetProducer;
     ntuple::TauVector correctedTaus;
     EventEnergyScale eventEnergyScale;
+    TriggerPathDictionary triggerPaths;
     std::shared_ptr<JetEnergyUncertaintyCorrector> jetEnergyUncertaintyCorrector;
 
 private:
     ntuple::TauVector scaledTaus;
-    ntuple::JetVector scaledJets;
+    ntuple::JetVector scaledJets, jetsUp, jetsDown;
+    TriggerPathSet firedTriggerPaths;
+    bool firedTriggerPathsValid;
 };
 
 } // analysis
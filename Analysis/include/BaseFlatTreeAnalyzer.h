@@ -35,9 +35,11 @@
 #include <set>
 #include <list>
 #include <locale>
+#include <mutex>
 
 #include <TColor.h>
 #include <TLorentzVector.h>
+#include <TThread.h>
 
 
 #include "AnalysisBase/include/FlatEventInfo.h"
@@ -45,6 +47,7 @@
 #include "AnalysisBase/include/AnalysisTypes.h"
 #include "AnalysisBase/include/exception.h"
 #include "AnalysisBase/include/Particles.h"
+#include "AnalysisBase/include/ThreadTools.h"
 #include "PrintTools/include/RootPrintToPdf.h"
 
 #include "MVASelections/include/MvaReader.h"
@@ -73,14 +76,22 @@ public:
 
     const DataCategoryTypeSet& DataCategoryTypeToProcessForQCD() const { return dataCategoryTypeForQCD; }
 
+    /// If branchWhitelistFileName is not empty, only the flat tree branches listed in it are read. The whitelist should
+    /// contain all branches returned by RequiredFlatTreeBranches, otherwise the processing of the data sources fails.
+    /// If numberOfThreads > 1, data sources are processed concurrently, each into a separate data collection shard.
     BaseFlatTreeAnalyzer(const DataCategoryCollection& _dataCategoryCollection, const std::string& _inputPath,
-                         const std::string& _outputFileName, bool _applyPostFitCorrections, bool saveFullOutput)
+                         const std::string& _outputFileName, bool _applyPostFitCorrections, bool saveFullOutput,
+                         const std::string& branchWhitelistFileName = "", size_t _numberOfThreads = 1)
         : inputPath(_inputPath), outputFileName(_outputFileName), dataCategoryCollection(_dataCategoryCollection),
           anaDataCollection(outputFileName + "_full.root", saveFullOutput),
-          applyPostFitCorrections(_applyPostFitCorrections)
+          applyPostFitCorrections(_applyPostFitCorrections), numberOfThreads(_numberOfThreads)
     {
         TH1::SetDefaultSumw2();
         gROOT->SetMustClean(kFALSE);
+        if(numberOfThreads > 1)
+            TThread::Initialize();
+        if(branchWhitelistFileName.size())
+            branchWhitelist = root_ext::SmartTree::ReadBranchWhitelist(branchWhitelistFileName);
         if(applyPostFitCorrections) {
             ConfigReader configReader("Analysis/config/postfit_sf.cfg");
             postfitCorrectionsCollection =
@@ -94,85 +105,49 @@ public:
     void Run()
     {
         std::cout << "Processing data categories... " << std::endl;
+        std::vector<DataSourceTask> tasks;
         for(const DataCategory* dataCategory : dataCategoryCollection.GetAllCategories()) {
             if(!dataCategory->sources_sf.size()) continue;
             std::cout << *dataCategory << std::endl;
             for(const auto& source_entry : dataCategory->sources_sf) {
-                const std::string fullFileName = inputPath + "/" + source_entry.first;
-                auto file = root_ext::OpenRootFile(fullFileName);
-                std::shared_ptr<ntuple::FlatTree> tree(new ntuple::FlatTree("flatTree", file.get(), true));
-                ProcessDataSource(*dataCategory, tree, source_entry.second);
+                const DataSourceTask task = { dataCategory, source_entry.first, source_entry.second };
+                tasks.push_back(task);
             }
         }
-
-        static const std::set< std::pair<std::string, EventSubCategory> > interesting_histograms = {
-            { FlatAnalyzerData_semileptonic::m_sv_Name(), EventSubCategory::NoCuts },
-            { FlatAnalyzerData_semileptonic::m_sv_Name(), EventSubCategory::MassWindow },
-            { FlatAnalyzerData::m_ttbb_kinfit_Name(), EventSubCategory::KinematicFitConverged },
-            { FlatAnalyzerData::m_ttbb_kinfit_Name(), EventSubCategory::KinematicFitConvergedWithMassWindow },
-        };
+        ProcessDataSources(tasks);
 
         static const std::set<std::string> complete_histogram_names = {
             FlatAnalyzerData_semileptonic::m_sv_Name(), FlatAnalyzerData::m_ttbb_kinfit_Name()
         };
 
+        std::vector<BackgroundEstimationTask> estimationTasks;
         for (const auto& hist_name : FlatAnalyzerData::GetOriginalHistogramNames<TH1D>()) {
             for(EventSubCategory subCategory : AllEventSubCategories) {
                 for(EventEnergyScale energyScale : AllEventEnergyScales) {
                     if(energyScale != EventEnergyScale::Central && !complete_histogram_names.count(hist_name))
                         continue;
-                    std::cout << "Processing '" << hist_name << "' in " << subCategory << "/" << energyScale
-                              << "..." << std::endl;
-
-                    std::ostringstream ss_debug;
-                    std::ostream& s_out = interesting_histograms.count(std::make_pair(hist_name, subCategory))
-                                        && energyScale == EventEnergyScale::Central ? std::cout : ss_debug;
-
-                    for (EventCategory eventCategory : EventCategoriesToProcess()) {
-                        const FlatAnalyzerDataMetaId_noRegion_noName anaDataMetaId(eventCategory, subCategory,
-                                                                                   energyScale);
-                        const auto ZTT_matched_yield = CalculateZTTmatchedYield(anaDataMetaId, hist_name, true);
-                        for (const auto yield_entry : ZTT_matched_yield)
-                            s_out << eventCategory << ": ZTT MC yield in " << yield_entry.first << " = "
-                                  << yield_entry.second << ".\n";
-
-                        CreateHistogramForZTT(anaDataMetaId, hist_name, ZTT_matched_yield, true);
-                        CreateHistogramForZcategory(anaDataMetaId, hist_name);
-                        CreateHistogramForVVcategory(anaDataMetaId, hist_name);
-                    }
-
-                    for (EventCategory eventCategory : EventCategoriesToProcess()) {
-                        const FlatAnalyzerDataMetaId_noRegion_noName anaDataMetaId(eventCategory, subCategory,
-                                                                                   energyScale);
-
-                        const auto wjets_yields = CalculateWjetsYields(anaDataMetaId, hist_name, false);
-                        for (const auto yield_entry : wjets_yields){
-                            s_out << eventCategory << ": W+jets yield in " << yield_entry.first << " = "
-                                  << yield_entry.second << ".\n";
-                        }
-                        EstimateWjets(anaDataMetaId, hist_name, wjets_yields);
-                    }
-
-                    for (EventCategory eventCategory : EventCategoriesToProcess()) {
-                        const FlatAnalyzerDataMetaId_noRegion_noName anaDataMetaId(eventCategory, subCategory,
-                                                                                   energyScale);
-
-                        for (DataCategoryType dataCategoryType : DataCategoryTypeToProcessForQCD()) {
-                            const auto qcd_yield = CalculateQCDYield(anaDataMetaId, hist_name, dataCategoryType, s_out);
-                            s_out << eventCategory << ": QCD yield = " << qcd_yield << ".\n";
-                            EstimateQCD(anaDataMetaId, hist_name, qcd_yield, dataCategoryType);
-                        }
-                        if(applyPostFitCorrections)
-                            ApplyPostFitCorrections(anaDataMetaId, hist_name, false);
-                        ProcessCompositDataCategories(anaDataMetaId, hist_name);
-                        if(applyPostFitCorrections)
-                            ApplyPostFitCorrections(anaDataMetaId, hist_name, true);
-                    }
-                    s_out << std::endl;
+                    const BackgroundEstimationTask task = { hist_name, subCategory, energyScale };
+                    estimationTasks.push_back(task);
                 }
             }
         }
 
+        typedef std::pair<std::string, std::string> EstimationLog;
+        tools::OrderedCollector<EstimationLog> estimationLogs(estimationTasks.size(), [](EstimationLog& log) {
+            std::cout << log.first << std::flush;
+            std::cerr << log.second << std::flush;
+        });
+        tools::RunParallel(estimationTasks.size(), numberOfThreads, [&](size_t task_id) {
+            std::ostringstream log, errors;
+            try {
+                EstimateBackgrounds(estimationTasks.at(task_id), log, errors);
+            } catch(...) {
+                estimationLogs.Add(task_id, EstimationLog(log.str(), errors.str()));
+                throw;
+            }
+            estimationLogs.Add(task_id, EstimationLog(log.str(), errors.str()));
+        });
+
         std::cout << "\nSaving tables... " << std::endl;
         PrintTables("comma", L",");
         PrintTables("semicolon", L";");
@@ -198,13 +173,29 @@ protected:
     virtual EventRegion DetermineEventRegion(const ntuple::Flat& event, EventCategory eventCategory) = 0;
     virtual bool PassMvaCut(const FlatEventInfo& eventInfo, EventCategory eventCategory) { return true; }
 
+    /// Flat tree branches that are read through ntuple::Flat by the analyzer, FlatEventInfo and FlatAnalyzerData.
+    /// Derived analyzers should add the branches that they read.
+    virtual std::set<std::string> RequiredFlatTreeBranches() const
+    {
+        return {
+            "evt", "channel", "eventEnergyScale", "eventType", "weight", "n_extraJets_MC",
+            "pt_1", "eta_1", "phi_1", "m_1", "mt_1", "byCombinedIsolationDeltaBetaCorrRaw3Hits_1",
+            "pt_2", "eta_2", "phi_2", "m_2", "mt_2", "byCombinedIsolationDeltaBetaCorrRaw3Hits_2",
+            "mvamet", "mvametphi", "mvacov00", "mvacov01", "mvacov10", "mvacov11", "m_sv_MC",
+            "kinfit_bb_tt_mass", "kinfit_bb_tt_convergence", "kinfit_bb_tt_chi2", "kinfit_bb_tt_pull_balance",
+            "njets", "nBjets_retagged", "pt_Bjets", "eta_Bjets", "phi_Bjets", "energy_Bjets", "csv_Bjets"
+        };
+    }
+
     virtual PhysicalValue CalculateQCDYield(const FlatAnalyzerDataMetaId_noRegion_noName& anaDataMetaId,
                                             const std::string& hist_name, DataCategoryType dataCategoryType,
                                             std::ostream& s_out) = 0;
     virtual void EstimateQCD(const FlatAnalyzerDataMetaId_noRegion_noName& anaDataMetaId, const std::string& hist_name,
-                             const PhysicalValue& scale_factor, DataCategoryType dataCategoryType) = 0;
+                             const PhysicalValue& scale_factor, DataCategoryType dataCategoryType,
+                             std::ostream& s_err) = 0;
     virtual PhysicalValueMap CalculateWjetsYields(const FlatAnalyzerDataMetaId_noRegion_noName& anaDataMetaId,
-                                                  const std::string& hist_name, bool fullEstimate) = 0;
+                                                  const std::string& hist_name, bool fullEstimate,
+                                                  std::ostream& s_out) = 0;
     virtual void CreateHistogramForZTT(const FlatAnalyzerDataMetaId_noRegion_noName& anaDataMetaId,
                                        const std::string& hist_name, const PhysicalValueMap& ztt_yield,
                                        bool useEmbedded) = 0;
@@ -322,11 +313,9 @@ protected:
         const auto data_yield = Integral(*hist_data, true);
         const PhysicalValue yield = data_yield - bkg_yield;
         s_out << "Data yield = " << data_yield << "\nData-MC yield = " << yield << std::endl;
-        if(yield.GetValue() < 0) {
-            std::cout << bkg_yield_debug << "\nData yield = " << data_yield << std::endl;
+        if(yield.GetValue() < 0)
             throw exception("Negative QCD yield for histogram '") << hist_name << "' in " << anaDataMetaId.eventCategory
                                                                   << " " << eventRegion << ".";
-        }
         return yield;
     }
 
@@ -431,8 +420,135 @@ protected:
         return selected_pair;
     }
 
+    struct BackgroundEstimationTask {
+        std::string hist_name;
+        EventSubCategory subCategory;
+        EventEnergyScale energyScale;
+    };
+
+    /// Estimates backgrounds for a single histogram, subcategory and energy scale. The estimation doesn't read or
+    /// modify histograms of other tasks, so different tasks can be processed concurrently. The log of the estimation
+    /// is written into s_log and warnings into s_err. If the estimation fails, the detailed debug output is appended to
+    /// s_log as well.
+    void EstimateBackgrounds(const BackgroundEstimationTask& task, std::ostream& s_log, std::ostream& s_err)
+    {
+        static const std::set< std::pair<std::string, EventSubCategory> > interesting_histograms = {
+            { FlatAnalyzerData_semileptonic::m_sv_Name(), EventSubCategory::NoCuts },
+            { FlatAnalyzerData_semileptonic::m_sv_Name(), EventSubCategory::MassWindow },
+            { FlatAnalyzerData::m_ttbb_kinfit_Name(), EventSubCategory::KinematicFitConverged },
+            { FlatAnalyzerData::m_ttbb_kinfit_Name(), EventSubCategory::KinematicFitConvergedWithMassWindow },
+        };
+
+        const std::string& hist_name = task.hist_name;
+        const EventSubCategory subCategory = task.subCategory;
+        const EventEnergyScale energyScale = task.energyScale;
+
+        std::ostringstream ss_out, ss_debug;
+        ss_out << "Processing '" << hist_name << "' in " << subCategory << "/" << energyScale << "...\n";
+        std::ostream& s_out = interesting_histograms.count(std::make_pair(hist_name, subCategory))
+                            && energyScale == EventEnergyScale::Central ? ss_out : ss_debug;
+
+        try {
+            EstimateBackgrounds(hist_name, subCategory, energyScale, s_out, s_err);
+        } catch(...) {
+            s_log << ss_out.str() << ss_debug.str();
+            throw;
+        }
+        s_log << ss_out.str();
+    }
+
+    void EstimateBackgrounds(const std::string& hist_name, EventSubCategory subCategory,
+                             EventEnergyScale energyScale, std::ostream& s_out, std::ostream& s_err)
+    {
+
+        for (EventCategory eventCategory : EventCategoriesToProcess()) {
+            const FlatAnalyzerDataMetaId_noRegion_noName anaDataMetaId(eventCategory, subCategory, energyScale);
+            const auto ZTT_matched_yield = CalculateZTTmatchedYield(anaDataMetaId, hist_name, true);
+            for (const auto yield_entry : ZTT_matched_yield)
+                s_out << eventCategory << ": ZTT MC yield in " << yield_entry.first << " = "
+                      << yield_entry.second << ".\n";
+
+            CreateHistogramForZTT(anaDataMetaId, hist_name, ZTT_matched_yield, true);
+            CreateHistogramForZcategory(anaDataMetaId, hist_name);
+            CreateHistogramForVVcategory(anaDataMetaId, hist_name);
+        }
+
+        for (EventCategory eventCategory : EventCategoriesToProcess()) {
+            const FlatAnalyzerDataMetaId_noRegion_noName anaDataMetaId(eventCategory, subCategory, energyScale);
+
+            const auto wjets_yields = CalculateWjetsYields(anaDataMetaId, hist_name, false, s_out);
+            for (const auto yield_entry : wjets_yields){
+                s_out << eventCategory << ": W+jets yield in " << yield_entry.first << " = "
+                      << yield_entry.second << ".\n";
+            }
+            EstimateWjets(anaDataMetaId, hist_name, wjets_yields);
+        }
+
+        for (EventCategory eventCategory : EventCategoriesToProcess()) {
+            const FlatAnalyzerDataMetaId_noRegion_noName anaDataMetaId(eventCategory, subCategory, energyScale);
+
+            for (DataCategoryType dataCategoryType : DataCategoryTypeToProcessForQCD()) {
+                const auto qcd_yield = CalculateQCDYield(anaDataMetaId, hist_name, dataCategoryType, s_out);
+                s_out << eventCategory << ": QCD yield = " << qcd_yield << ".\n";
+                EstimateQCD(anaDataMetaId, hist_name, qcd_yield, dataCategoryType, s_err);
+            }
+            if(applyPostFitCorrections)
+                ApplyPostFitCorrections(anaDataMetaId, hist_name, false);
+            ProcessCompositDataCategories(anaDataMetaId, hist_name);
+            if(applyPostFitCorrections)
+                ApplyPostFitCorrections(anaDataMetaId, hist_name, true);
+        }
+        s_out << "\n";
+    }
+
+    struct DataSourceTask {
+        const DataCategory* dataCategory;
+        std::string fileName;
+        double scale_factor;
+    };
+
+    /// Processes all data sources. In the multi-threaded mode each source is filled into its own data collection
+    /// shard. Shards are added to the main collection in the order of the tasks as soon as all preceding shards are
+    /// merged, so the result doesn't depend on which source has been processed first.
+    void ProcessDataSources(const std::vector<DataSourceTask>& tasks)
+    {
+        if(numberOfThreads <= 1) {
+            for(const DataSourceTask& task : tasks)
+                ProcessDataSource(task, anaDataCollection);
+            return;
+        }
+
+        std::cout << "Processing " << tasks.size() << " data sources using " << numberOfThreads << " threads..."
+                  << std::endl;
+        typedef std::shared_ptr<FlatAnalyzerDataCollection> ShardPtr;
+        tools::OrderedCollector<ShardPtr> shards(tasks.size(), [&](ShardPtr& shard) {
+            anaDataCollection.Merge(*shard, ChannelId());
+        });
+
+        tools::RunParallel(tasks.size(), numberOfThreads, [&](size_t task_id) {
+            ShardPtr shard(new FlatAnalyzerDataCollection("", false));
+            ProcessDataSource(tasks.at(task_id), *shard);
+            shards.Add(task_id, shard);
+        });
+    }
+
+    void ProcessDataSource(const DataSourceTask& task, FlatAnalyzerDataCollection& targetCollection)
+    {
+        const std::string fullFileName = inputPath + "/" + task.fileName;
+        auto file = root_ext::OpenRootFile(fullFileName);
+        std::shared_ptr<ntuple::FlatTree> tree(new ntuple::FlatTree("flatTree", file.get(), true));
+        if(branchWhitelist.size()) {
+            const size_t n_disabled = tree->ApplyBranchWhitelist(branchWhitelist, RequiredFlatTreeBranches());
+            std::ostringstream ss;
+            ss << "Reading " << tree->GetNumberOfBranches() - n_disabled << " of "
+               << tree->GetNumberOfBranches() << " flat tree branches.\n";
+            std::cout << ss.str() << std::flush;
+        }
+        ProcessDataSource(*task.dataCategory, tree, task.scale_factor, targetCollection);
+    }
+
     void ProcessDataSource(const DataCategory& dataCategory, std::shared_ptr<ntuple::FlatTree> tree,
-                           double scale_factor)
+                           double scale_factor, FlatAnalyzerDataCollection& targetCollection)
     {
 
         static const bool applyMVAcut = false;
@@ -445,7 +561,7 @@ protected:
 
         for(Long64_t current_entry = 0; current_entry < tree->GetEntries(); ++current_entry) {
             tree->GetEntry(current_entry);
-            const ntuple::Flat& event = tree->data;
+            const ntuple::Flat& event = tree->data();
             const FlatEventInfo::BjetPair selected_bjet_pair = SelectBjetPair(event, apply_cuts_on_bjets);
             const bool useRetag = dataCategory.IsData() || dataCategory.name == DY_Embedded.name  ? false : true;
             const EventCategoryVector eventCategories = DetermineEventCategories(event.csv_Bjets,
@@ -479,7 +595,7 @@ protected:
                 if(applyMVAcut && !PassMvaCut(*eventInfo, eventCategory)) continue;
 
                 if(dataCategory.name == DYJets_excl.name || dataCategory.name == DYJets_incl.name)
-                    FillDYjetHistograms(*eventInfo, eventCategory, eventRegion, weight);
+                    FillDYjetHistograms(*eventInfo, eventCategory, eventRegion, weight, targetCollection);
 
                 const FlatAnalyzerDataMetaId_noSub_noES metaId_noSub_noES(eventCategory, eventRegion,
                                                                           dataCategory.name);
@@ -487,19 +603,19 @@ protected:
                         metaId_noSub_noES.MakeMetaId(eventInfo->eventEnergyScale);
 
                 if (dataCategory.IsData())
-                    anaDataCollection.FillAllEnergyScales(metaId_noSub_noES, ChannelId(), *eventInfo, weight);
+                    targetCollection.FillAllEnergyScales(metaId_noSub_noES, ChannelId(), *eventInfo, weight);
                 else if(dataCategory.name == DY_Embedded.name
                         && eventInfo->eventEnergyScale == EventEnergyScale::Central)
-                    anaDataCollection.FillCentralAndJetRelatedScales(metaId_noSub_noES, ChannelId(),
-                                                                     *eventInfo, weight);
+                    targetCollection.FillCentralAndJetRelatedScales(metaId_noSub_noES, ChannelId(),
+                                                                    *eventInfo, weight);
                 else
-                    anaDataCollection.FillSubCategories(metaId_noSub, ChannelId(), *eventInfo, weight);
+                    targetCollection.FillSubCategories(metaId_noSub, ChannelId(), *eventInfo, weight);
             }
         }
     }
 
     void FillDYjetHistograms(const FlatEventInfo& eventInfo, EventCategory eventCategory, EventRegion eventRegion,
-                             double weight)
+                             double weight, FlatAnalyzerDataCollection& targetCollection)
     {
         const DataCategory& ZL_MC = dataCategoryCollection.GetUniqueCategory(DataCategoryType::ZL_MC);
         const DataCategory& ZJ_MC = dataCategoryCollection.GetUniqueCategory(DataCategoryType::ZJ_MC);
@@ -515,7 +631,7 @@ protected:
             const std::string& name = type_category_map.at(eventInfo.eventType);
             const FlatAnalyzerDataMetaId_noSub anaDataMetaId(eventCategory, eventRegion, eventInfo.eventEnergyScale,
                                                              name);
-            anaDataCollection.FillSubCategories(anaDataMetaId, ChannelId(), eventInfo, weight);
+            targetCollection.FillSubCategories(anaDataMetaId, ChannelId(), eventInfo, weight);
         }
     }
 
@@ -528,6 +644,8 @@ protected:
 
         auto getMVA = [&](bool calc_MVA, MVA_Selections::MvaMethod method) -> double {
             if(calc_MVA) {
+                static std::mutex mva_mutex;
+                std::lock_guard<std::mutex> lock(mva_mutex);
                 auto mvaReader = MVA_Selections::MvaReader::Get(ChannelName(), category_name.str(), method);
                 if(mvaReader)
                     return mvaReader->GetMva(eventInfo.lepton_momentums.at(0), eventInfo.lepton_momentums.at(1),
@@ -733,12 +851,10 @@ protected:
         const PhysicalValue original_Integral = Integral(histogram, true);
         ss_debug << "Integral after bkg subtraction: " << original_Integral << ".\n";
         debug_info = ss_debug.str();
-        if (original_Integral.GetValue() < 0) {
-            std::cout << debug_info << std::endl;
+        if (original_Integral.GetValue() < 0)
             throw exception("Integral after bkg subtraction is negative for histogram '")
                 << histogram.GetName() << "' in event category " << anaDataMetaId.eventCategory
-                << " for event region " << eventRegion << ".";
-        }
+                << " for event region " << eventRegion << ".\n" << debug_info;
 
         std::ostringstream ss_negative;
 
@@ -824,13 +940,11 @@ protected:
         ss_debug << "Full integral: " << integral << ".\n";
         debug_info = ss_debug.str();
 
-        if(!hist_found && expect_at_least_one_contribution) {
-            std::cout << debug_info << std::endl;
+        if(!hist_found && expect_at_least_one_contribution)
             throw exception("No histogram with name '")
                 << hist_name << "' was found in the given data category set (" << dataCategories
                 << "), in eventCategory: '" << anaDataMetaId.MakeMetaId(eventRegion)
-                << "' to calculate full integral.";
-        }
+                << "' to calculate full integral.\n" << debug_info;
 
         return integral;
     }
@@ -978,6 +1092,8 @@ protected:
     FlatAnalyzerDataCollection anaDataCollection;
     bool applyPostFitCorrections;
     std::shared_ptr<PostfitCorrectionsCollection> postfitCorrectionsCollection;
+    std::set<std::string> branchWhitelist;
+    size_t numberOfThreads;
 };
 
 } // namespace analysis
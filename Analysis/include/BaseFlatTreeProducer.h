@@ -26,6 +26,9 @@
 
 #pragma once
 
+#include <cstdlib>
+#include <sstream>
+
 #include "AnalysisBase/include/FlatTree.h"
 
 #include "BaseAnalyzer.h"
@@ -39,10 +42,25 @@ public:
                          size_t _maxNumberOfEvents = 0,
                          std::shared_ptr<ntuple::FlatTree> _flatTree = std::shared_ptr<ntuple::FlatTree>())
         : BaseAnalyzer(inputFileName, outputFileName, configFileName, _prefix, _maxNumberOfEvents),
-          flatTree(_flatTree), writeFlatTree(!flatTree)
+          flatTree(_flatTree), writeFlatTree(!flatTree), svFitter(true, true)
     {
         if(!flatTree)
             flatTree = std::shared_ptr<ntuple::FlatTree>(new ntuple::FlatTree("flatTree", outputFile.get(), false));
+        sv_fit::FitSettings svFitSettings;
+        svFitSettings.adaptiveMassScan = config.SVfitAdaptiveMassScan();
+        svFitSettings.massScanTolerance = config.SVfitMassScanTolerance();
+        svFitSettings.massScanMaxCalls = config.SVfitMassScanMaxCalls();
+        svFitSettings.numberOfMarkovChains = config.SVfitNumberOfMarkovChains();
+        svFitSettings.numberOfThreads = config.SVfitNumberOfThreads();
+        svFitSettings.numberOfMarkovChainProposals = config.SVfitMarkovChainProposals();
+        svFitSettings.convergencePrecision = config.SVfitConvergencePrecision();
+        svFitSettings.convergenceCheckInterval = config.SVfitConvergenceCheckInterval();
+        svFitSettings.convergenceMaxRhat = config.SVfitConvergenceMaxRhat();
+        svFitSettings.markovChainWarmStart = config.SVfitMarkovChainWarmStart();
+        svFitSettings.warmStartBurninFraction = config.SVfitWarmStartBurninFraction();
+        svFitter.SetFitSettings(svFitSettings);
+        if(config.UseSVfitCache())
+            svFitter.EnableCache(SVfitCacheFileName(inputFileName), config.RefreshSVfitCache());
     }
 
     virtual ~BaseFlatTreeProducer() override
@@ -51,13 +69,20 @@ public:
             flatTree->Write();
     }
 
+    virtual void Run() override
+    {
+        BaseAnalyzer::Run();
+        svFitter.PrintStatistics(std::cout);
+    }
+
     virtual void ProcessEvent() override
     {
         using namespace analysis;
 
         SelectionResults& selection = ApplyBaselineSelection();
-        selection.svfitResults = sv_fit::CombinedFit({ selection.GetLeg(1), selection.GetLeg(2) },
-                                                     selection.MET_with_recoil_corrections, true, true);
+        svFitter.SetEvent(event->eventId());
+        selection.svfitResults = svFitter.Fit(sv_fit::FitInput({ selection.GetLeg(1), selection.GetLeg(2) },
+                                                               selection.MET_with_recoil_corrections));
         selection.kinfitResults = RunKinematicFit(selection.bjets_all, *selection.higgs,
                                                   selection.MET_with_recoil_corrections);
 
@@ -70,6 +95,9 @@ public:
         FillFlatTree(selection);
     }
 
+    const ntuple::FlatTree& GetFlatTree() const { return *flatTree; }
+    const sv_fit::BatchFitter& GetSVfitter() const { return svFitter; }
+
 protected:
     virtual void FillFlatTree(const SelectionResults& selection)
     {
@@ -175,7 +203,7 @@ protected:
 
         // needs to be filles with NUP!
         // https://github.com/rmanzoni/HTT/blob/master/CMGTools/H2TauTau/python/proto/analyzers/TauTauAnalyzer.py#L51
-        if (config.MaxTreeVersion() == 2)
+        if (config.MaxTreeVersion() >= 2)
             flatTree->n_extraJets_MC() = event->genEvent().nup;
         else
             flatTree->n_extraJets_MC() = default_value;
@@ -296,8 +324,30 @@ protected:
         flatTree->z_PV() = primaryVertex->GetPosition().z();
     }
 
+    /// SVfit results are cached per input dataset. The cache name contains a hash of the full input path, so inputs
+    /// with the same file name from different directories don't share a cache.
+    std::string SVfitCacheFileName(const std::string& inputFileName) const
+    {
+        char* resolvedPath = realpath(inputFileName.c_str(), nullptr);
+        const std::string fullPath = resolvedPath ? resolvedPath : inputFileName;
+        std::free(resolvedPath);
+
+        unsigned long long pathHash = 14695981039346656037ULL;
+        for(char c : fullPath) {
+            pathHash ^= static_cast<unsigned char>(c);
+            pathHash *= 1099511628211ULL;
+        }
+
+        const size_t name_pos = inputFileName.find_last_of('/');
+        const std::string baseName = name_pos == std::string::npos ? inputFileName : inputFileName.substr(name_pos + 1);
+        std::ostringstream ss_name;
+        ss_name << config.SVfitCachePath() << "/" << baseName << "_" << std::hex << pathHash << ".svfit_cache";
+        return ss_name.str();
+    }
+
 protected:
     std::shared_ptr<ntuple::FlatTree> flatTree;
     bool writeFlatTree;
+    sv_fit::BatchFitter svFitter;
 };
 } // analysis
@@ -25,6 +25,8 @@
 
 #pragma once
 
+#include <Rtypes.h>
+
 #include "AnalysisBase/include/BaseConfig.h"
 
 namespace analysis {
@@ -38,6 +40,28 @@ public:
     ANA_CONFIG_PARAMETER(unsigned, SingleEventId, 0)
     ANA_CONFIG_PARAMETER(unsigned, MaxTreeVersion, 1)
 
+    ANA_CONFIG_PARAMETER(unsigned, NumberOfThreads, 1)
+    ANA_CONFIG_PARAMETER(unsigned, EventQueueSize, 100)
+    ANA_CONFIG_PARAMETER(bool, PreserveEventOrder, true)
+    ANA_CONFIG_PARAMETER(unsigned, ReadAheadDepth, 0)
+    ANA_CONFIG_PARAMETER(unsigned, TreeCacheSizeMB, 0)
+    ANA_CONFIG_PARAMETER(bool, UseForestIndex, false)
+    ANA_CONFIG_PARAMETER(std::string, ForestIndexPath, ".")
+    ANA_CONFIG_PARAMETER(bool, UseSVfitCache, false)
+    ANA_CONFIG_PARAMETER(bool, RefreshSVfitCache, false)
+    ANA_CONFIG_PARAMETER(std::string, SVfitCachePath, ".")
+    ANA_CONFIG_PARAMETER(bool, SVfitAdaptiveMassScan, false)
+    ANA_CONFIG_PARAMETER(double, SVfitMassScanTolerance, 1.0)
+    ANA_CONFIG_PARAMETER(unsigned, SVfitMassScanMaxCalls, 80000)
+    ANA_CONFIG_PARAMETER(unsigned, SVfitNumberOfMarkovChains, 1)
+    ANA_CONFIG_PARAMETER(unsigned, SVfitNumberOfThreads, 1)
+    ANA_CONFIG_PARAMETER(unsigned, SVfitMarkovChainProposals, 1)
+    ANA_CONFIG_PARAMETER(double, SVfitConvergencePrecision, 0.)
+    ANA_CONFIG_PARAMETER(unsigned, SVfitConvergenceCheckInterval, 1000)
+    ANA_CONFIG_PARAMETER(double, SVfitConvergenceMaxRhat, 1.1)
+    ANA_CONFIG_PARAMETER(bool, SVfitMarkovChainWarmStart, false)
+    ANA_CONFIG_PARAMETER(double, SVfitWarmStartBurninFraction, 0.1)
+
     ANA_CONFIG_PARAMETER(bool, isMC, false)
     ANA_CONFIG_PARAMETER(bool, ApplyTauESCorrection, false)
     ANA_CONFIG_PARAMETER(bool, ApplyRecoilCorrection, false)
@@ -70,6 +94,7 @@ public:
     ANA_CONFIG_PARAMETER(std::string, MvaMet_inputFileNameDPhi, "")
     ANA_CONFIG_PARAMETER(std::string, MvaMet_inputFileNameCovU1, "")
     ANA_CONFIG_PARAMETER(std::string, MvaMet_inputFileNameCovU2, "")
+    ANA_CONFIG_PARAMETER(bool, MvaMet_validateIncremental, false)
 
     ANA_CONFIG_PARAMETER(std::string, RecoilCorrection_fileCorrectTo_MuTau, "")
     ANA_CONFIG_PARAMETER(std::string, RecoilCorrection_fileZmmData_MuTau, "")
@@ -92,6 +117,8 @@ public:
 
     bool IsEmbeddedSample() { return isDYEmbeddedSample() || isTTEmbeddedSample(); }
 
+    Long64_t TreeCacheSize() const { return static_cast<Long64_t>(TreeCacheSizeMB()) * 1024 * 1024; }
+
 };
 
 } // analysis
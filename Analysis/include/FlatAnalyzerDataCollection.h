@@ -289,6 +289,7 @@ public:
 
     FlatAnalyzerData& Get(const FlatAnalyzerDataId& id, Channel channel)
     {
+        std::lock_guard<std::mutex> lock(mutex);
         auto& anaData = anaDataMap[id];
         if(!anaData)
             anaData = MakeAnaData(id, channel);
@@ -345,6 +346,14 @@ public:
         FillEnergyScales(meta_id, channel, eventInfo, weight, AllEventEnergyScales);
     }
 
+    /// Adds histograms of the other collection. The analyzer data are processed in the order of their ids, so the
+    /// result doesn't depend on the order in which the other collection was filled.
+    void Merge(const FlatAnalyzerDataCollection& other, Channel channel)
+    {
+        for(const auto& entry : other.anaDataMap)
+            Get(entry.first, channel).Add(*entry.second);
+    }
+
 private:
     FlatAnalyzerDataPtr MakeAnaData(const FlatAnalyzerDataId& id, Channel channel) const
     {
@@ -379,6 +388,7 @@ private:
 private:
     std::shared_ptr<TFile> outputFile;
     FlatAnalyzerDataMap anaDataMap;
+    std::mutex mutex;
 };
 
 class FlatAnalyzerDataCollectionReader {
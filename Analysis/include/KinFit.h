@@ -30,6 +30,7 @@
 #include "HHKinFit/src/HHDiJetKinFit.cpp"
 #include "HHKinFit/src/HHDiJetKinFitMaster.cpp"
 #include "HHKinFit/src/HHEventRecord.cpp"
+#include "HHKinFit/src/HHFitCore.cpp"
 #include "HHKinFit/src/HHKinFit.cpp"
 #include "HHKinFit/src/HHKinFitMaster.cpp"
 #include "HHKinFit/src/HHParticle.cpp"
@@ -43,6 +44,7 @@
 #include "TreeProduction/interface/MET.h"
 #include "AnalysisBase/include/Candidate.h"
 #include "AnalysisBase/include/RootExt.h"
+#include "AnalysisBase/include/ThreadTools.h"
 
 namespace analysis {
 
@@ -97,7 +99,9 @@ struct FitResults {
     {}
 };
 
-inline FitResults Fit(const FitInput& input)
+inline FitResults Fit(const TLorentzVector& b1, const TLorentzVector& b2, const TLorentzVector& tau1,
+                      const TLorentzVector& tau2, const TLorentzVector& mvaMET, const TMatrixD& metCov,
+                      bool analytic_derivatives = false)
 {
     static const bool debug = false;
     static const Int_t higgs_mass_hypotesis = 125;
@@ -105,50 +109,37 @@ inline FitResults Fit(const FitInput& input)
 //    static const Double_t chi2_cut = 25;
 //    static const Double_t pull_balance_cut = 0;
 
-    const std::vector<Int_t> hypo_mh1 = { higgs_mass_hypotesis };
-    const std::vector<Int_t> hypo_mh2 = { higgs_mass_hypotesis };
-
     if(debug) {
         std::cout << "Format: (Pt, eta, phi, E)\n";
-        std::cout << "b1 momentum: " << input.bjet_momentums.at(0) << std::endl;
-        std::cout << "b2 momentum: " << input.bjet_momentums.at(1) << std::endl;
-        std::cout << "tau1 momentum: " << input.tau_momentums.at(0) << std::endl;
-        std::cout << "tau2 momentum: " << input.tau_momentums.at(1) << std::endl;
-        std::cout << "MET: " << input.mvaMET << std::endl;
+        std::cout << "b1 momentum: " << b1 << std::endl;
+        std::cout << "b2 momentum: " << b2 << std::endl;
+        std::cout << "tau1 momentum: " << tau1 << std::endl;
+        std::cout << "tau2 momentum: " << tau2 << std::endl;
+        std::cout << "MET: " << mvaMET << std::endl;
         std::cout << "MET covariance:\n";
-        input.metCov.Print();
-        std::cout << "metDet = " << input.metCov.Determinant() << std::endl;
+        metCov.Print();
+        std::cout << "metDet = " << metCov.Determinant() << std::endl;
     }
 
-    //intance of fitter master class
-    TLorentzVector b1(input.bjet_momentums.at(0)), b2(input.bjet_momentums.at(1)),
-            tau1(input.tau_momentums.at(0)), tau2(input.tau_momentums.at(1)),
-            mvaMET(input.mvaMET);
-    HHKinFitMaster kinFit(&b1, &b2, &tau1, &tau2);
-    kinFit.setAdvancedBalance(&mvaMET, input.metCov);
-    //kinFits.setSimpleBalance(ptmiss.Pt(),10); //alternative which uses only the absolute value of ptmiss in the fit
-    kinFit.addMh1Hypothesis(hypo_mh1);
-    kinFit.addMh2Hypothesis(hypo_mh2);
-    kinFit.doFullFit();
-
-    if(debug) {
-        const Double_t chi2_best = kinFit.getBestChi2FullFit();
-        const Double_t mh_best = kinFit.getBestMHFullFit();
-        const std::pair<Int_t, Int_t> bestHypo = kinFit.getBestHypoFullFit();
-
-        std::cout << "best chi2:       " << chi2_best << std::endl;
-        std::cout << "best hypothesis: " << bestHypo.first << " " << bestHypo.second << std::endl;
-        std::cout << "best mH=         " << mh_best << std::endl;
-    }
-
-    const std::pair<Int_t, Int_t> hypo(hypo_mh1.at(0), hypo_mh2.at(0));
-    const Int_t convergence = kinFit.getConvergenceFullFit().at(hypo);
-    const Double_t chi2 = kinFit.getChi2FullFit().at(hypo);
-    const Double_t fitprob = kinFit.getFitProbFullFit().at(hypo);
-    const Double_t pull_b1 = kinFit.getPullB1FullFit().at(hypo);
-    const Double_t pull_b2 = kinFit.getPullB2FullFit().at(hypo);
-    const Double_t pull_balance = kinFit.getPullBalanceFullFit().at(hypo);
-    const Double_t mH = kinFit.getMHFullFit().at(hypo);
+    // the fit core is used directly to avoid the heap allocations of HHKinFitMaster
+    HHFitInput fitInput;
+    fitInput.SetBJets(b1, HHKinFitMaster::GetBjetResolution(b1.Eta(), b1.Et()),
+                      b2, HHKinFitMaster::GetBjetResolution(b2.Eta(), b2.Et()));
+    fitInput.SetTauVis(tau1, tau2);
+    fitInput.SetAdvancedBalance(mvaMET, metCov);
+    fitInput.SetHypothesis(higgs_mass_hypotesis, higgs_mass_hypotesis);
+    fitInput.m_maxloops = 20000;
+    fitInput.m_analyticDerivatives = analytic_derivatives;
+
+    HHFitCore fitter(fitInput);
+    const HHFitResult& fitResult = fitter.Fit();
+    const Int_t convergence = fitResult.m_convergence;
+    const Double_t chi2 = fitResult.m_chi2;
+    const Double_t fitprob = TMath::Prob(chi2, 2);
+    const Double_t pull_b1 = fitResult.m_pullB1;
+    const Double_t pull_b2 = fitResult.m_pullB2;
+    const Double_t pull_balance = fitResult.m_pullBalance;
+    const Double_t mH = fitResult.m_fittedmH;
 
     if (debug) {
         std::cout << "fit convergence =  " << convergence << std::endl;
@@ -177,6 +168,55 @@ inline FitResults Fit(const FitInput& input)
     return result;
 }
 
+inline FitResults Fit(const FitInput& input, bool analytic_derivatives = false)
+{
+    return Fit(input.bjet_momentums.at(0), input.bjet_momentums.at(1), input.tau_momentums.at(0),
+               input.tau_momentums.at(1), input.mvaMET, input.metCov, analytic_derivatives);
+}
+
+/// Inputs of many fits in the structure-of-arrays form: the n-th fit uses the n-th element of each array.
+struct FitInputBatch {
+    std::vector<TLorentzVector> bjet1_momentums, bjet2_momentums;
+    std::vector<TLorentzVector> tau1_momentums, tau2_momentums;
+    std::vector<TLorentzVector> mvaMETs;
+    std::vector<TMatrixD> metCovs;
+
+    size_t size() const { return bjet1_momentums.size(); }
+
+    void reserve(size_t n)
+    {
+        bjet1_momentums.reserve(n);
+        bjet2_momentums.reserve(n);
+        tau1_momentums.reserve(n);
+        tau2_momentums.reserve(n);
+        mvaMETs.reserve(n);
+        metCovs.reserve(n);
+    }
+
+    void push_back(const FitInput& input)
+    {
+        bjet1_momentums.push_back(input.bjet_momentums.at(0));
+        bjet2_momentums.push_back(input.bjet_momentums.at(1));
+        tau1_momentums.push_back(input.tau_momentums.at(0));
+        tau2_momentums.push_back(input.tau_momentums.at(1));
+        mvaMETs.push_back(input.mvaMET);
+        metCovs.push_back(input.metCov);
+    }
+};
+
+/// Fits all inputs of the batch using up to n_threads threads. Each fit is independent and allocation free, so the
+/// results are returned in the order of the inputs and don't depend on the number of threads.
+inline std::vector<FitResults> Fit(const FitInputBatch& batch, size_t n_threads, bool analytic_derivatives = false)
+{
+    std::vector<FitResults> results(batch.size());
+    tools::RunParallel(batch.size(), n_threads, [&](size_t n) {
+        results.at(n) = Fit(batch.bjet1_momentums.at(n), batch.bjet2_momentums.at(n), batch.tau1_momentums.at(n),
+                            batch.tau2_momentums.at(n), batch.mvaMETs.at(n), batch.metCovs.at(n),
+                            analytic_derivatives);
+    });
+    return results;
+}
+
 } // namespace four_body
 
 namespace two_body {
@@ -66,7 +66,8 @@ public:
     LightBaseFlatTreeAnalyzer(const std::string& inputFileName, const std::string& outputFileName)
         : inputFile(root_ext::OpenRootFile(inputFileName)),
           outputFile(root_ext::CreateRootFile(outputFileName)),
-          flatTree(new ntuple::FlatTree("flatTree", inputFile.get(), true)), recalc_kinfit(false), do_retag(true)
+          flatTree(new ntuple::FlatTree("flatTree", inputFile.get(), true)), recalc_kinfit(false), do_retag(true),
+          kinfit_number_of_threads(1)
     {
         TH1::SetDefaultSumw2();
     }
@@ -75,19 +76,13 @@ public:
 
     void Run()
     {
-        for(Long64_t current_entry = 0; current_entry < flatTree->GetEntries(); ++current_entry) {
-            eventInfoMap.clear();
-            flatTree->GetEntry(current_entry);
-            const ntuple::Flat& event = flatTree->data;
-            const auto& pairSelectionMap = SelectBjetPairs(event);
-            for(const auto& selection_entry : pairSelectionMap) {
-                const std::string& selection_label = selection_entry.first;
-                const FlatEventInfo::BjetPair& bjet_pair = selection_entry.second;
-                const MetaIdSet metaIds = CreateMetaIdSet(event, bjet_pair);
-                for (const auto& metaId : metaIds) {
-                    const FlatEventInfo& eventInfo = GetFlatEventInfo(event, bjet_pair);
-                    AnalyzeEvent(eventInfo, metaId, selection_label);
-                }
+        if(recalc_kinfit && kinfit_number_of_threads > 1)
+            RunWithKinFitBatches();
+        else {
+            for(Long64_t current_entry = 0; current_entry < flatTree->GetEntries(); ++current_entry) {
+                eventInfoMap.clear();
+                flatTree->GetEntry(current_entry);
+                ProcessEvent(flatTree->data());
             }
         }
         EndOfRun();
@@ -112,10 +107,28 @@ protected:
     virtual const EventSubCategorySet GetSubCategoriesToProcess() const { return AllEventSubCategories; }
 
     MetaIdSet CreateMetaIdSet(const ntuple::Flat& event, const FlatEventInfo::BjetPair& bjet_pair)
+    {
+        MetaIdSet result;
+        const EventEnergyScale energyScale = static_cast<EventEnergyScale>(event.eventEnergyScale);
+        for(const auto& categoryAndRegion : DetermineCategoriesAndRegionsToProcess(event, bjet_pair)) {
+            const auto subCategories = DetermineEventSubCategories(GetFlatEventInfo(event, bjet_pair));
+            for(EventSubCategory subCategory : subCategories) {
+                if(!GetSubCategoriesToProcess().count(subCategory)) continue;
+                result.insert(MetaId(categoryAndRegion.first, subCategory, categoryAndRegion.second, energyScale));
+            }
+        }
+
+        return result;
+    }
+
+    /// Categories and regions of the event to process. They don't depend on the kinematic fit, so they also define
+    /// for which b-jet pairs the fit is needed.
+    std::vector<std::pair<EventCategory, EventRegion>> DetermineCategoriesAndRegionsToProcess(
+            const ntuple::Flat& event, const FlatEventInfo::BjetPair& bjet_pair) const
     {
         using namespace cuts::Htautau_Summer13::btag;
 
-        MetaIdSet result;
+        std::vector<std::pair<EventCategory, EventRegion>> result;
 
         const EventEnergyScale energyScale = static_cast<EventEnergyScale>(event.eventEnergyScale);
         if(GetEnergyScalesToProcess().count(energyScale)) return result;
@@ -126,12 +139,7 @@ protected:
             if(!GetCategoriesToProcess().count(category)) continue;
             const EventRegion region = DetermineEventRegion(event, category);
             if(!GetRegionsToProcess().count(region)) continue;
-
-            const auto subCategories = DetermineEventSubCategories(GetFlatEventInfo(event, bjet_pair));
-            for(EventSubCategory subCategory : subCategories) {
-                if(!GetSubCategoriesToProcess().count(subCategory)) continue;
-                result.insert(MetaId(category, subCategory, region, energyScale));
-            }
+            result.push_back(std::make_pair(category, region));
         }
 
         return result;
@@ -252,6 +260,69 @@ protected:
         return *eventInfoMap.at(bjet_pair);
     }
 
+private:
+    void ProcessEvent(const ntuple::Flat& event)
+    {
+        const auto& pairSelectionMap = SelectBjetPairs(event);
+        for(const auto& selection_entry : pairSelectionMap) {
+            const std::string& selection_label = selection_entry.first;
+            const FlatEventInfo::BjetPair& bjet_pair = selection_entry.second;
+            const MetaIdSet metaIds = CreateMetaIdSet(event, bjet_pair);
+            for (const auto& metaId : metaIds) {
+                const FlatEventInfo& eventInfo = GetFlatEventInfo(event, bjet_pair);
+                AnalyzeEvent(eventInfo, metaId, selection_label);
+            }
+        }
+    }
+
+    /// Reads the flat tree in blocks of events. The kinematic fits of all b-jet pairs that are needed for the events
+    /// of a block are done as one batch on kinfit_number_of_threads threads, then the events are analyzed in the
+    /// original order. The same fits are done as in the serial loop, so the results are identical. Fits requested by
+    /// SelectBjetPairs itself are done while the pairs are selected.
+    void RunWithKinFitBatches()
+    {
+        static const Long64_t block_size = 1000;
+
+        std::vector<ntuple::Flat> events;
+        std::vector<FlatEventInfoMap> eventInfoMaps;
+        for(Long64_t first_entry = 0; first_entry < flatTree->GetEntries(); first_entry += block_size) {
+            const Long64_t n_events = std::min(block_size, flatTree->GetEntries() - first_entry);
+            events.resize(n_events);
+            eventInfoMaps.assign(n_events, FlatEventInfoMap());
+
+            kinematic_fit::four_body::FitInputBatch fitInputs;
+            std::vector<FlatEventInfo*> fittedEventInfos;
+            for(Long64_t n = 0; n < n_events; ++n) {
+                flatTree->GetEntry(first_entry + n);
+                events.at(n) = flatTree->data();
+                eventInfoMap.swap(eventInfoMaps.at(n));
+                const PairSelectionMap pairSelectionMap = SelectBjetPairs(events.at(n));
+                eventInfoMap.swap(eventInfoMaps.at(n));
+                for(const auto& selection_entry : pairSelectionMap) {
+                    const FlatEventInfo::BjetPair& bjet_pair = selection_entry.second;
+                    if(eventInfoMaps.at(n).count(bjet_pair)
+                            || DetermineCategoriesAndRegionsToProcess(events.at(n), bjet_pair).empty()) continue;
+                    const FlatEventInfoPtr eventInfo(new FlatEventInfo(events.at(n), bjet_pair, false));
+                    eventInfoMaps.at(n)[bjet_pair] = eventInfo;
+                    if(!eventInfo->has_bjet_pair) continue;
+                    eventInfo->recalculate_mass_KinFit = true;
+                    fitInputs.push_back(eventInfo->CreateKinFitInput());
+                    fittedEventInfos.push_back(eventInfo.get());
+                }
+            }
+
+            const auto fitResults = kinematic_fit::four_body::Fit(fitInputs, kinfit_number_of_threads);
+            for(size_t n = 0; n < fittedEventInfos.size(); ++n)
+                fittedEventInfos.at(n)->SetKinFitResults(fitResults.at(n));
+
+            for(Long64_t n = 0; n < n_events; ++n) {
+                eventInfoMap.swap(eventInfoMaps.at(n));
+                ProcessEvent(events.at(n));
+            }
+            eventInfoMap.clear();
+        }
+    }
+
 private:
     std::shared_ptr<TFile> inputFile, outputFile;
     std::shared_ptr<ntuple::FlatTree> flatTree;
@@ -260,6 +331,10 @@ private:
 protected:
     bool recalc_kinfit;
     bool do_retag;
+
+    /// If recalc_kinfit is set and kinfit_number_of_threads > 1, the kinematic fits are done in batches on this number
+    /// of threads.
+    size_t kinfit_number_of_threads;
 };
 
 } // namespace analysis
@@ -26,11 +26,20 @@
 
 #pragma once
 
-#include "METPUSubtraction/source/GBRForest.cxx"
-#include "METPUSubtraction/source/GBRTree.cxx"
+#include <cstring>
+
+#include "MvaMetForests.h"
 #include "METPUSubtraction/source/mvaMEtUtilities.cc"
 #include "METPUSubtraction/source/PFMETAlgorithmMVA.cc"
 
+// The MVA MET regressions can be compiled into the code instead of being read from the weight files: the header
+// produced by the MvaMetCodeGenerator tool is included by defining its path at compile time, e.g.
+// -DMVA_MET_COMPILED_FORESTS='"METPUSubtraction/generated/MvaMetForests.h"'.
+// MvaMetCompiledForestsCheck verifies that the compiled regressions correspond to the weight files.
+#ifdef MVA_MET_COMPILED_FORESTS
+#include MVA_MET_COMPILED_FORESTS
+#endif
+
 #include "AnalysisBase/include/Candidate.h"
 #include "AnalysisBase/include/AnalysisTools.h"
 
@@ -38,13 +47,92 @@
 
 namespace analysis {
 
+/// PF candidate information used by the MVA MET: it doesn't depend on the energy scale variations, so it is computed
+/// once for the first MET computation of an event and shared by all further computations of the same event, together
+/// with the PF candidate sums entering the recoils.
+/// The cache is also recomputed if it is requested for a different PF candidate collection or vertex.
+class PFCandidateInfoCache {
+public:
+    typedef std::vector<mvaMEtUtilities::pfCandInfo> InfoVector;
+
+    static double DefaultDeltaZ() { return -999.; }
+
+    static InfoVector Compute(const ntuple::PFCandVector& pfCandidates, const TVector3& vertex)
+    {
+        InfoVector infos;
+        infos.reserve(pfCandidates.size());
+        for(const ntuple::PFCand& candidate : pfCandidates) {
+            mvaMEtUtilities::pfCandInfo info;
+            info.p4_.SetPtEtaPhiM(candidate.pt, candidate.eta, candidate.phi, candidate.mass); //with energy is the same
+            if(candidate.haveTrackInfo) {
+                const TVector3 trkV(candidate.trk_vx, candidate.trk_vy, candidate.trk_vz);
+                TVector3 trkP;
+                trkP.SetPtEtaPhi(candidate.pt, candidate.eta, candidate.phi);
+                info.dZ_ = std::abs(Calculate_dz(trkV, vertex, trkP));
+            }
+            else
+                info.dZ_ = DefaultDeltaZ();
+            infos.push_back(info);
+        }
+        return infos;
+    }
+
+    PFCandidateInfoCache() : pfCandidates(nullptr), valid(false), hasSums(false) {}
+
+    void Invalidate() { valid = false; }
+
+    const InfoVector& Get(const ntuple::PFCandVector& _pfCandidates, const TVector3& _vertex)
+    {
+        if(!valid || pfCandidates != &_pfCandidates || infos.size() != _pfCandidates.size() || vertex != _vertex) {
+            pfCandidates = &_pfCandidates;
+            vertex = _vertex;
+            infos = Compute(*pfCandidates, vertex);
+            valid = true;
+            hasSums = false;
+        }
+        return infos;
+    }
+
+    /// Sums of the PF candidates returned by the last call of Get.
+    const PFMETAlgorithmMVA::PFCandSums& GetSums(PFMETAlgorithmMVA& metAlgo)
+    {
+        if(!valid)
+            throw exception("PF candidate sums requested before the PF candidate information.");
+        if(!hasSums) {
+            sums = metAlgo.computePFCandSums(infos);
+            hasSums = true;
+        }
+        return sums;
+    }
+
+private:
+    const ntuple::PFCandVector* pfCandidates;
+    TVector3 vertex;
+    bool valid, hasSums;
+    InfoVector infos;
+    PFMETAlgorithmMVA::PFCandSums sums;
+};
+
+/// MVA MET is computed incrementally: the PF candidate information and sums are computed once per event, and the MVAs
+/// are evaluated only if the MVA input differs from the inputs already evaluated for the same event. It is the case
+/// for the tau energy scale variations, for which the MET is computed from the original taus and the jets don't
+/// change. With validateIncremental, each MET is also fully recomputed and an exception is thrown if the results
+/// are not identical.
+/// The MVAs for several jet collections of an event (e.g. the jet energy scale variations) can be evaluated in one
+/// batch with PrepareMvaMet before the MET is computed for each of them.
 class MvaMetProducer {
 public:
     MvaMetProducer(double dZcut, const std::string& inputFileNameU, const std::string& inputFileNameDPhi,
-                   const std::string& inputFileNameCovU1, const std::string& inputFileNameCovU2)
-        : metAlgo(dZcut), useType1Correction(false), minCorrJetPt(-1)
+                   const std::string& inputFileNameCovU1, const std::string& inputFileNameCovU2,
+                   bool _validateIncremental = false)
+        : metAlgo(dZcut), useType1Correction(false), minCorrJetPt(-1), validateIncremental(_validateIncremental)
     {
+#ifdef MVA_MET_COMPILED_FORESTS
+        metAlgo.initialize(&mva_met_compiled::U, &mva_met_compiled::DPhi, &mva_met_compiled::CovU1,
+                           &mva_met_compiled::CovU2);
+#else
         metAlgo.initialize(inputFileNameU, inputFileNameDPhi, inputFileNameCovU1, inputFileNameCovU2);
+#endif
     }
 
     ntuple::MET ComputeMvaMet(const CandidatePtr& signalCandidate, const ntuple::PFCandVector& pfCandidates,
@@ -53,27 +141,33 @@ public:
     {
         const static bool debug = false;
         const auto leptonInfo = ComputeLeptonInfo(signalCandidate);
-        auto pfCandidateInfo = ComputePFCandidateInfo(pfCandidates, selectedVertex->GetPosition());
+        const auto& pfCandidateInfo = pfCandidateInfoCache.Get(pfCandidates, selectedVertex->GetPosition());
         const auto vertexInfo = ComputeVertexInfo(goodVertices);
-        const auto jetInfo = ComputeJetInfo(jets, leptonInfo, pfCandidateInfo);
-        metAlgo.setInput(leptonInfo, jetInfo, pfCandidateInfo, vertexInfo);
-        metAlgo.setHasPhotons(false);
-        metAlgo.evaluateMVA();
+        PFCandidateInfoCache::InfoVector type1Candidates;
+        const auto jetInfo = ComputeJetInfo(jets, leptonInfo, type1Candidates);
+        SetInput(leptonInfo, jetInfo, type1Candidates, vertexInfo);
+        metAlgo.setOutput(EvaluateMVA(metAlgo.getEventInput()));
         const TLorentzVector& metMomentum = metAlgo.getMEt();
         const TMatrix& metCov = metAlgo.getMEtCov();
         ntuple::MET mvaMET;
         mvaMET.phi = metMomentum.Phi();
         mvaMET.pt = metMomentum.Pt();
         mvaMET.significanceMatrix = ntuple::SignificanceMatrixToVector(metCov);
+        if(validateIncremental) // leaves metAlgo in the same state if the validation succeeds
+            ValidateIncremental(leptonInfo, jetInfo, type1Candidates, vertexInfo, pfCandidates,
+                                selectedVertex->GetPosition(), mvaMET);
         if (debug){
             std::cout << "SIGNAL:\n";
             for ( const auto& lepton : leptonInfo ){
                 std::cout << lepton.p4_ << ", charge fraction= " << lepton.chargedFrac_ << std::endl;
             }
-            std::cout << "PFCandidates: " << pfCandidateInfo.size() << "\n";
+            std::cout << "PFCandidates: " << pfCandidateInfo.size() + type1Candidates.size() << "\n";
             for ( const auto& pfCand : pfCandidateInfo ){
                 std::cout << pfCand.p4_ << ", dZ= " << pfCand.dZ_ << std::endl;
             }
+            for ( const auto& pfCand : type1Candidates ){
+                std::cout << pfCand.p4_ << ", dZ= " << pfCand.dZ_ << std::endl;
+            }
             std::cout << "Jets: " << jetInfo.size() << "\n";
             for ( const auto& jet : jetInfo ){
                 std::cout << jet.p4_ << ", mva= " << jet.mva_ << ", neutralFrac= " << jet.neutralEnFrac_ << std::endl;
@@ -93,7 +187,7 @@ public:
 
     ntuple::MET ComputePFMet(const ntuple::PFCandVector& pfCandidates, const VertexPtr& selectedVertex)
     {
-        auto pfCandidateInfo = ComputePFCandidateInfo(pfCandidates, selectedVertex->GetPosition());
+        const auto& pfCandidateInfo = pfCandidateInfoCache.Get(pfCandidates, selectedVertex->GetPosition());
         mvaMEtUtilities metUtilities;
         CommonMETData pfCandSum = metUtilities.computePFCandSum(pfCandidateInfo, 0.1, 2);
         const TVector2 vectorialMET(-pfCandSum.mex,-pfCandSum.mey);
@@ -104,8 +198,103 @@ public:
         return pfMET;
     }
 
+    /// Evaluates with one batched call the MVAs for the MET computed with each of the given jet collections. The
+    /// results are kept for the current event, so ComputeMvaMet doesn't evaluate the MVAs again for the same input.
+    void PrepareMvaMet(const CandidatePtr& signalCandidate, const ntuple::PFCandVector& pfCandidates,
+                       const std::vector<const ntuple::JetVector*>& jetCollections, const VertexPtr& selectedVertex,
+                       const VertexPtrVector& goodVertices)
+    {
+        const auto leptonInfo = ComputeLeptonInfo(signalCandidate);
+        pfCandidateInfoCache.Get(pfCandidates, selectedVertex->GetPosition());
+        const auto vertexInfo = ComputeVertexInfo(goodVertices);
+        std::vector<PFMETAlgorithmMVA::EventInput> inputs;
+        for(const ntuple::JetVector* jets : jetCollections) {
+            PFCandidateInfoCache::InfoVector type1Candidates;
+            const auto jetInfo = ComputeJetInfo(*jets, leptonInfo, type1Candidates);
+            SetInput(leptonInfo, jetInfo, type1Candidates, vertexInfo);
+            const PFMETAlgorithmMVA::EventInput input = metAlgo.getEventInput();
+            if(FindEvaluatedMVA(input)) continue;
+            bool isNewInput = true;
+            for(const PFMETAlgorithmMVA::EventInput& other : inputs)
+                isNewInput = isNewInput && !IsSameInput(input, other);
+            if(isNewInput)
+                inputs.push_back(input);
+        }
+        if(inputs.empty()) return;
+        std::vector<PFMETAlgorithmMVA::EventOutput> outputs;
+        metAlgo.evaluateMVA(inputs, outputs);
+        for(size_t n = 0; n < inputs.size(); ++n)
+            evaluatedMVAs.push_back(EvaluatedMVA(inputs.at(n), outputs.at(n)));
+    }
+
+    /// Should be called before the first MET computation of each event.
+    void NewEvent()
+    {
+        pfCandidateInfoCache.Invalidate();
+        evaluatedMVAs.clear();
+    }
+
 private:
-    static double DefaultDeltaZ() { return -999.; }
+    typedef std::pair<PFMETAlgorithmMVA::EventInput, PFMETAlgorithmMVA::EventOutput> EvaluatedMVA;
+
+    static bool IsSameInput(const PFMETAlgorithmMVA::EventInput& first, const PFMETAlgorithmMVA::EventInput& second)
+    {
+        return !std::memcmp(first.variables, second.variables, sizeof(first.variables))
+                && !std::memcmp(&first.sumLeptonPx, &second.sumLeptonPx, sizeof(first.sumLeptonPx))
+                && !std::memcmp(&first.sumLeptonPy, &second.sumLeptonPy, sizeof(first.sumLeptonPy));
+    }
+
+    void SetInput(const std::vector<mvaMEtUtilities::leptonInfo>& leptonInfo,
+                  const std::vector<mvaMEtUtilities::JetInfo>& jetInfo,
+                  const PFCandidateInfoCache::InfoVector& type1Candidates, const std::vector<TVector3>& vertexInfo)
+    {
+        // type-1 correction candidates depend on the jet energy scale, so they are added to a copy of the cached sums
+        PFMETAlgorithmMVA::PFCandSums pfCandSums = pfCandidateInfoCache.GetSums(metAlgo);
+        if(type1Candidates.size())
+            metAlgo.addToPFCandSums(pfCandSums, type1Candidates);
+        metAlgo.setInput(leptonInfo, jetInfo, pfCandSums, vertexInfo);
+        metAlgo.setHasPhotons(false);
+    }
+
+    const PFMETAlgorithmMVA::EventOutput* FindEvaluatedMVA(const PFMETAlgorithmMVA::EventInput& input) const
+    {
+        for(const EvaluatedMVA& evaluated : evaluatedMVAs) {
+            if(IsSameInput(evaluated.first, input))
+                return &evaluated.second;
+        }
+        return nullptr;
+    }
+
+    const PFMETAlgorithmMVA::EventOutput& EvaluateMVA(const PFMETAlgorithmMVA::EventInput& input)
+    {
+        const PFMETAlgorithmMVA::EventOutput* evaluated = FindEvaluatedMVA(input);
+        if(evaluated)
+            return *evaluated;
+        std::vector<PFMETAlgorithmMVA::EventOutput> outputs;
+        metAlgo.evaluateMVA(std::vector<PFMETAlgorithmMVA::EventInput>(1, input), outputs);
+        evaluatedMVAs.push_back(EvaluatedMVA(input, outputs.front()));
+        return evaluatedMVAs.back().second;
+    }
+
+    void ValidateIncremental(const std::vector<mvaMEtUtilities::leptonInfo>& leptonInfo,
+                             const std::vector<mvaMEtUtilities::JetInfo>& jetInfo,
+                             const PFCandidateInfoCache::InfoVector& type1Candidates,
+                             const std::vector<TVector3>& vertexInfo, const ntuple::PFCandVector& pfCandidates,
+                             const TVector3& selectedVertex, const ntuple::MET& mvaMET)
+    {
+        PFCandidateInfoCache::InfoVector pfCandidateInfo = PFCandidateInfoCache::Compute(pfCandidates, selectedVertex);
+        pfCandidateInfo.insert(pfCandidateInfo.end(), type1Candidates.begin(), type1Candidates.end());
+        metAlgo.setInput(leptonInfo, jetInfo, pfCandidateInfo, vertexInfo);
+        metAlgo.setHasPhotons(false);
+        metAlgo.evaluateMVA();
+        const TLorentzVector& metMomentum = metAlgo.getMEt();
+        const auto significanceMatrix = ntuple::SignificanceMatrixToVector(TMatrix(metAlgo.getMEtCov()));
+        if(metMomentum.Pt() != mvaMET.pt || metMomentum.Phi() != mvaMET.phi
+                || significanceMatrix != mvaMET.significanceMatrix)
+            throw exception("Incremental MVA MET (pt = ") << mvaMET.pt << ", phi = " << mvaMET.phi
+                    << ") differs from the full recomputation (pt = " << metMomentum.Pt() << ", phi = "
+                    << metMomentum.Phi() << ").";
+    }
 
     std::vector<mvaMEtUtilities::leptonInfo> ComputeLeptonInfo(const CandidatePtr& signalCandidate)
     {
@@ -119,26 +308,6 @@ private:
         return leptonInfos;
     }
 
-    std::vector<mvaMEtUtilities::pfCandInfo> ComputePFCandidateInfo(const ntuple::PFCandVector& pfCandidates,
-                                                                    const TVector3& selectedVertex)
-    {
-        std::vector<mvaMEtUtilities::pfCandInfo> candInfos;
-        for(const ntuple::PFCand& candidate : pfCandidates) {
-            mvaMEtUtilities::pfCandInfo info;
-            info.p4_.SetPtEtaPhiM(candidate.pt, candidate.eta, candidate.phi, candidate.mass); //with energy is the same
-            if(candidate.haveTrackInfo) {
-                const TVector3 trkV(candidate.trk_vx, candidate.trk_vy, candidate.trk_vz);
-                TVector3 trkP;
-                trkP.SetPtEtaPhi(candidate.pt, candidate.eta, candidate.phi);
-                info.dZ_ = std::abs(Calculate_dz(trkV, selectedVertex, trkP));
-            }
-            else
-                info.dZ_ = DefaultDeltaZ();
-            candInfos.push_back(info);
-        }
-        return candInfos;
-    }
-
     std::vector<TVector3> ComputeVertexInfo(const VertexPtrVector& goodVertices)
     {
         std::vector<TVector3> vertexInfos;
@@ -149,7 +318,7 @@ private:
 
     std::vector<mvaMEtUtilities::JetInfo> ComputeJetInfo(const ntuple::JetVector& jets,
                                                          const std::vector<mvaMEtUtilities::leptonInfo>& signalLeptons,
-                                                         std::vector<mvaMEtUtilities::pfCandInfo>& pfCandidates)
+                                                         PFCandidateInfoCache::InfoVector& type1Candidates)
     {
         const static bool debug = false;
         static const double MinDeltaRtoSignalObjects = 0.5;
@@ -175,8 +344,8 @@ private:
                 if(jet.pt > MinJetPtForPFcandCreation && !pOnLepton) {
                     mvaMEtUtilities::pfCandInfo candInfo;
                     candInfo.p4_ = pType1Corr;
-                    candInfo.dZ_ = DefaultDeltaZ();
-                    pfCandidates.push_back(candInfo);
+                    candInfo.dZ_ = PFCandidateInfoCache::DefaultDeltaZ();
+                    type1Candidates.push_back(candInfo);
                 }
                 //lType1Corr = pCorr*jet.pt_raw - jet.pt_raw;
                 lType1Corr /= jet.pt;
@@ -218,8 +387,11 @@ private:
 
 private:
     PFMETAlgorithmMVA metAlgo;
+    PFCandidateInfoCache pfCandidateInfoCache;
     bool useType1Correction;
     double minCorrJetPt;
+    bool validateIncremental;
+    std::vector<EvaluatedMVA> evaluatedMVAs;
 };
 
 } // analysis
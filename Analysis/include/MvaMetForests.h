@@ -0,0 +1,68 @@
+/*!
+ * \file MvaMetForests.h
+ * \brief Definition of the MVA MET regressions and of the reading of their forests from the weight files.
+ * \author Konstantin Androsov (University of Siena, INFN Pisa)
+ *
+ * Copyright 2015 Konstantin Androsov <konstantin.androsov@gmail.com>
+ *
+ * This file is part of X->HH->bbTauTau.
+ *
+ * X->HH->bbTauTau is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * X->HH->bbTauTau is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with X->HH->bbTauTau.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+// The implementation of GBRForest and GBRTree has no include guards, so it should be included only here.
+#include "METPUSubtraction/source/GBRForest.cxx"
+#include "METPUSubtraction/source/GBRTree.cxx"
+#include "METPUSubtraction/interface/GBRForestCodeGenerator.h"
+
+#include "AnalysisBase/include/RootExt.h"
+
+namespace analysis {
+namespace mva_met {
+
+/// MVA MET regression: name of its forest in the weight file and name of the function it is compiled into.
+struct Regression {
+    std::string forestName, functionName;
+    Regression(const std::string& _forestName, const std::string& _functionName)
+        : forestName(_forestName), functionName(_functionName) {}
+};
+
+/// Regressions in the order of the weight file names accepted by MvaMetProducer: U, DPhi, CovU1 and CovU2.
+/// The forest names are the ones read by PFMETAlgorithmMVA::initialize.
+inline const std::vector<Regression>& Regressions()
+{
+    static const std::vector<Regression> regressions = {
+        Regression("U1Correction", "U"), Regression("PhiCorrection", "DPhi"),
+        Regression("CovU1", "CovU1"), Regression("CovU2", "CovU2")
+    };
+    return regressions;
+}
+
+inline std::shared_ptr<const GBRForest> ReadForest(const std::string& fileName, const std::string& forestName)
+{
+    std::shared_ptr<TFile> file = root_ext::OpenRootFile(fileName);
+    GBRForest* forest = nullptr;
+    file->GetObject(forestName.c_str(), forest);
+    if(!forest)
+        throw exception("Forest '") << forestName << "' not found in '" << fileName << "'.";
+    return std::shared_ptr<const GBRForest>(forest);
+}
+
+} // namespace mva_met
+} // namespace analysis
@@ -0,0 +1,295 @@
+/*!
+ * \file ParallelEventLoop.h
+ * \brief Definition of the event loop that runs the flat tree producers of several channels on several threads.
+ * \author Konstantin Androsov (University of Siena, INFN Pisa)
+ *
+ * Copyright 2015 Konstantin Androsov <konstantin.androsov@gmail.com>
+ *
+ * This file is part of X->HH->bbTauTau.
+ *
+ * X->HH->bbTauTau is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * X->HH->bbTauTau is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with X->HH->bbTauTau.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <thread>
+#include <exception>
+#include <cstdio>
+
+#include <TROOT.h>
+#include <TKey.h>
+#include <TH1.h>
+#include <TThread.h>
+
+#include "AnalysisBase/include/ThreadTools.h"
+#include "AnalysisBase/include/ProgressReporter.h"
+
+#include "BaseFlatTreeProducer.h"
+
+namespace analysis {
+
+/// Runs the event loop of the flat tree producers of one or more channels on NumberOfThreads worker threads.
+/// The calling thread reads events into a bounded queue of EventQueueSize decoded events. Each worker owns a complete
+/// producer per channel (selection state, event weights, MVA MET producer and flat tree), which writes into a
+/// temporary output file, and processes every event with all channels in the order in which they were added, as the
+/// serial FlatTreeProducer does. At the end of the job the histograms of all workers are summed and the flat tree
+/// entries are copied into the output file of each channel, in the same order as in the serial run if
+/// PreserveEventOrder is set.
+/// Random numbers used during the event processing are seeded per event (SVfit, b-tag re-tagging), so the output does
+/// not depend on the number of threads. The state that SVfit and HHKinFit keep between the calls of one fit is
+/// thread local. The single event mode is supported only with one worker thread.
+class ParallelEventLoop {
+private:
+    struct QueueItem {
+        size_t sequence_id;
+        std::shared_ptr<const EventDescriptor> event;
+    };
+
+    /// Number of flat tree entries filled by a worker for the event with the given sequence id.
+    typedef std::pair<size_t, Long64_t> EventEntries;
+    typedef std::vector<EventEntries> EventEntriesVector;
+
+    struct Channel {
+        std::string outputFileName;
+        std::vector<std::string> workerOutputFileNames;
+        std::vector< std::shared_ptr<BaseFlatTreeProducer> > producers;
+        std::vector<EventEntriesVector> eventEntries;
+    };
+
+    struct MergedHistogram {
+        TDirectory* directory;
+        std::shared_ptr<TH1> histogram;
+    };
+
+public:
+    ParallelEventLoop(const std::string& _inputFileName, const std::string& _configFileName,
+                      const std::string& _prefix = "none", size_t _maxNumberOfEvents = 0)
+        : config(_configFileName), inputFileName(_inputFileName), configFileName(_configFileName),
+          maxNumberOfEvents(_maxNumberOfEvents), n_workers(std::max(config.NumberOfThreads(), 1u)),
+          treeExtractor(_prefix == "none" ? "" : _prefix, inputFileName, config.extractMCtruth(),
+                        config.MaxTreeVersion(), config.ReadAheadDepth(), config.TreeCacheSize(),
+                        config.UseForestIndex(), config.ForestIndexPath()),
+          eventQueue(std::max(config.EventQueueSize(), 1u)), workerErrors(n_workers)
+    {
+        if(config.RunSingleEvent() && n_workers > 1)
+            throw exception("Single event mode is not supported with ") << n_workers << " worker threads.";
+        TThread::Initialize();
+    }
+
+    /// Adds a channel processed by producers of the given type, whose merged output is written to outputFileName.
+    template<typename Producer>
+    void AddChannel(const std::string& outputFileName)
+    {
+        Channel channel;
+        channel.outputFileName = outputFileName;
+        for(size_t n = 0; n < n_workers; ++n) {
+            channel.workerOutputFileNames.push_back(WorkerOutputFileName(outputFileName, n));
+            channel.producers.push_back(std::shared_ptr<BaseFlatTreeProducer>(
+                                            new Producer(inputFileName, channel.workerOutputFileNames.back(),
+                                                         configFileName, "external", maxNumberOfEvents)));
+        }
+        channel.eventEntries.resize(n_workers);
+        channels.push_back(channel);
+    }
+
+    void Run()
+    {
+        if(channels.empty())
+            throw exception("No channels to process.");
+
+        tools::ProgressReporter progressReporter(config.ReportInterval(), std::cout);
+        std::vector<std::thread> workers;
+        for(size_t worker_id = 0; worker_id < n_workers; ++worker_id)
+            workers.push_back(std::thread(&ParallelEventLoop::ProcessEvents, this, worker_id));
+
+        size_t n = 0;
+        try {
+            for(; !maxNumberOfEvents || n < maxNumberOfEvents; ++n) {
+                std::shared_ptr<EventDescriptor> event(new EventDescriptor());
+                if(!treeExtractor.ExtractNext(*event)) break;
+                progressReporter.Report(n);
+                if(config.RunSingleEvent() && event->eventId().eventId != config.SingleEventId()) continue;
+                const QueueItem item = { n, event };
+                if(!eventQueue.Push(item) || config.RunSingleEvent()) break;
+            }
+        } catch(std::exception&) {
+            eventQueue.Close();
+            for(std::thread& worker : workers)
+                worker.join();
+            throw;
+        }
+
+        eventQueue.Close();
+        for(std::thread& worker : workers)
+            worker.join();
+        progressReporter.Report(n, true);
+        treeExtractor.PrintPrefetchStatistics(std::cout);
+        for(const std::exception_ptr& error : workerErrors) {
+            if(error)
+                std::rethrow_exception(error);
+        }
+
+        for(Channel& channel : channels) {
+            sv_fit::BatchFitter svFitter(true, true);
+            for(const auto& producer : channel.producers)
+                svFitter.AddStatistics(producer->GetSVfitter());
+            svFitter.PrintStatistics(std::cout);
+            channel.producers.clear();
+            MergeOutputs(channel);
+        }
+    }
+
+private:
+    static std::string WorkerOutputFileName(const std::string& outputFileName, size_t worker_id)
+    {
+        static const std::string extension = ".root";
+        const size_t extension_pos = outputFileName.rfind(extension);
+        const std::string base_name = extension_pos != std::string::npos
+                ? outputFileName.substr(0, extension_pos) : outputFileName;
+        std::ostringstream ss;
+        ss << base_name << "_worker" << worker_id << extension;
+        return ss.str();
+    }
+
+    void ProcessEvents(size_t worker_id)
+    {
+        try {
+            QueueItem item;
+            while(eventQueue.Pop(item)) {
+                for(Channel& channel : channels) {
+                    BaseFlatTreeProducer& producer = *channel.producers.at(worker_id);
+                    const Long64_t n_entries_before = producer.GetFlatTree().GetEntries();
+                    producer.ProcessEventWithEnergyUncertainties(item.event);
+                    const Long64_t n_filled = producer.GetFlatTree().GetEntries() - n_entries_before;
+                    if(n_filled)
+                        channel.eventEntries.at(worker_id).push_back(EventEntries(item.sequence_id, n_filled));
+                }
+            }
+        } catch(...) {
+            workerErrors.at(worker_id) = std::current_exception();
+            eventQueue.Close();
+        }
+    }
+
+    void MergeOutputs(const Channel& channel)
+    {
+        std::vector< std::shared_ptr<TFile> > workerFiles;
+        for(const std::string& fileName : channel.workerOutputFileNames)
+            workerFiles.push_back(root_ext::OpenRootFile(fileName));
+
+        std::shared_ptr<TFile> outputFile = root_ext::CreateRootFile(channel.outputFileName);
+        for(const auto& workerFile : workerFiles)
+            CollectHistograms(workerFile.get(), outputFile.get(), "");
+        for(const auto& entry : histograms)
+            root_ext::WriteObject(*entry.second.histogram, entry.second.directory);
+        histograms.clear();
+        MergeFlatTrees(workerFiles, channel.eventEntries, outputFile);
+
+        workerFiles.clear();
+        for(const std::string& fileName : channel.workerOutputFileNames)
+            std::remove(fileName.c_str());
+        std::cout << "Outputs of " << channel.workerOutputFileNames.size() << " workers are merged into '"
+                  << channel.outputFileName << "'." << std::endl;
+    }
+
+    void CollectHistograms(TDirectory* source, TDirectory* destination, const std::string& path)
+    {
+        TIter nextkey(source->GetListOfKeys());
+        for(TKey* key; (key = static_cast<TKey*>(nextkey()));) {
+            TClass* cl = gROOT->GetClass(key->GetClassName());
+            if(!cl) continue;
+            const std::string name = key->GetName();
+            const std::string full_name = path + "/" + name;
+            if(cl->InheritsFrom("TDirectory")) {
+                TDirectory* subdir_source = static_cast<TDirectory*>(source->Get(name.c_str()));
+                TDirectory* subdir_destination = destination->GetDirectory(name.c_str());
+                if(!subdir_destination)
+                    subdir_destination = destination->mkdir(name.c_str());
+                CollectHistograms(subdir_source, subdir_destination, full_name);
+            } else if(cl->InheritsFrom("TH1")) {
+                std::shared_ptr<TH1> histogram(static_cast<TH1*>(key->ReadObj()));
+                histogram->SetDirectory(nullptr);
+                const auto iter = histograms.find(full_name);
+                if(iter == histograms.end()) {
+                    const MergedHistogram merged = { destination, histogram };
+                    histograms[full_name] = merged;
+                } else
+                    iter->second.histogram->Add(histogram.get());
+            } else if(full_name != "/" + FlatTreeName())
+                std::cerr << "Warning: object '" << full_name << "' of type '" << key->GetClassName()
+                          << "' is not merged." << std::endl;
+        }
+    }
+
+    void MergeFlatTrees(const std::vector< std::shared_ptr<TFile> >& workerFiles,
+                        const std::vector<EventEntriesVector>& eventEntries, std::shared_ptr<TFile> outputFile)
+    {
+        std::vector< std::shared_ptr<ntuple::FlatTree> > inputTrees;
+        for(const auto& workerFile : workerFiles)
+            inputTrees.push_back(std::shared_ptr<ntuple::FlatTree>(
+                                     new ntuple::FlatTree(FlatTreeName(), workerFile.get(), true)));
+        ntuple::FlatTree outputTree(FlatTreeName(), outputFile.get(), false);
+
+        if(config.PreserveEventOrder()) {
+            std::vector<size_t> positions(inputTrees.size(), 0);
+            std::vector<Long64_t> first_entries(inputTrees.size(), 0);
+            for(;;) {
+                size_t best_worker = inputTrees.size();
+                for(size_t n = 0; n < inputTrees.size(); ++n) {
+                    if(positions.at(n) >= eventEntries.at(n).size()) continue;
+                    if(best_worker == inputTrees.size() || eventEntries.at(n).at(positions.at(n)).first
+                            < eventEntries.at(best_worker).at(positions.at(best_worker)).first)
+                        best_worker = n;
+                }
+                if(best_worker == inputTrees.size()) break;
+                const Long64_t n_entries = eventEntries.at(best_worker).at(positions.at(best_worker)++).second;
+                CopyEntries(*inputTrees.at(best_worker), outputTree, first_entries.at(best_worker), n_entries);
+                first_entries.at(best_worker) += n_entries;
+            }
+        } else {
+            for(const auto& inputTree : inputTrees)
+                CopyEntries(*inputTree, outputTree, 0, inputTree->GetEntries());
+        }
+        outputTree.Write();
+    }
+
+    static void CopyEntries(ntuple::FlatTree& input, ntuple::FlatTree& output, Long64_t first_entry,
+                            Long64_t n_entries)
+    {
+        for(Long64_t entry = first_entry; entry < first_entry + n_entries; ++entry) {
+            if(input.GetEntry(entry) < 0)
+                throw exception("An I/O error while reading flat tree.");
+            output.data() = input.data();
+            output.Fill();
+        }
+    }
+
+    static const std::string& FlatTreeName()
+    {
+        static const std::string name = "flatTree";
+        return name;
+    }
+
+private:
+    Config config;
+    std::string inputFileName, configFileName;
+    size_t maxNumberOfEvents, n_workers;
+    TreeExtractor treeExtractor;
+    tools::BoundedQueue<QueueItem> eventQueue;
+    std::vector<Channel> channels;
+    std::vector<std::exception_ptr> workerErrors;
+    std::map<std::string, MergedHistogram> histograms;
+};
+
+} // namespace analysis
@@ -26,6 +26,10 @@
 
 #pragma once
 
+#include <fstream>
+#include <unordered_map>
+#include <mutex>
+
 #include "SVfit/source/generalAuxFunctions.cc"
 #include "SVfit/source/LikelihoodFunctions.cc"
 #include "SVfit/source/MarkovChainIntegrator.cc"
@@ -36,6 +40,7 @@
 #include "TreeProduction/interface/MET.h"
 
 #include "AnalysisBase/include/Candidate.h"
+#include "AnalysisBase/include/EventId.h"
 
 namespace analysis {
 
@@ -59,7 +64,11 @@ struct FitResults {
     bool has_valid_momentum;
     TLorentzVector momentum;
 
-    FitResults() : has_valid_mass(false), mass(default_value), has_valid_momentum(false) {}
+    /// Number of sampling moves made by all Markov Chains, which is below the configured one if the sampling
+    /// has converged earlier. Zero for the VEGAS integration.
+    unsigned n_iterations;
+
+    FitResults() : has_valid_mass(false), mass(default_value), has_valid_momentum(false), n_iterations(0) {}
 };
 
 struct CombinedFitResults {
@@ -67,38 +76,136 @@ struct CombinedFitResults {
     FitResults fit_mc;
 };
 
-inline FitResults Fit(FitAlgorithm fitAlgorithm, const CandidatePtrVector& higgsLegs, const ntuple::MET& met)
-{
-    static const bool debug = false;
-
-    static const std::map<Candidate::Type, NSVfitStandalone::kDecayType> decayTypeMap = {
-        { Candidate::Type::Electron, NSVfitStandalone::kLepDecay },
-        { Candidate::Type::Muon, NSVfitStandalone::kLepDecay },
-        { Candidate::Type::Tau, NSVfitStandalone::kHadDecay }
+/// Measured quantities used as an input for SVfit. SVfit integrators always start with the same random seed, so
+/// inputs that are equal bit by bit produce equal fit results.
+struct FitInput {
+    struct Leg {
+        NSVfitStandalone::kDecayType decayType;
+        double px, py, pz, E;
     };
 
-    if (higgsLegs.size() != 2)
-        throw exception("Invalid number of legs to perform svFit");
+    std::vector<Leg> legs;
+    double met_pt, met_phi;
+    std::vector<Float_t> met_significance;
 
-    const Candidate higgsCandidate(Candidate::Type::Higgs, higgsLegs.at(0), higgsLegs.at(1));
-    const NSVfitStandalone::Vector measuredMET(met.pt * std::cos(met.phi), met.pt * std::sin(met.phi), 0.0);
-    const TMatrixD covMET = ntuple::VectorToSignificanceMatrix(met.significanceMatrix);
+    FitInput(const CandidatePtrVector& higgsLegs, const ntuple::MET& met)
+        : met_pt(met.pt), met_phi(met.phi), met_significance(met.significanceMatrix)
+    {
+        static const std::map<Candidate::Type, NSVfitStandalone::kDecayType> decayTypeMap = {
+            { Candidate::Type::Electron, NSVfitStandalone::kLepDecay },
+            { Candidate::Type::Muon, NSVfitStandalone::kLepDecay },
+            { Candidate::Type::Tau, NSVfitStandalone::kHadDecay }
+        };
 
-    std::vector<NSVfitStandalone::MeasuredTauLepton> measuredTauLeptons;
-    for (const auto& leg : higgsLegs){
-        if(!decayTypeMap.count(leg->GetType()))
-            throw exception("leg is not compatible with leptonic or hadronic tau decay");
+        if (higgsLegs.size() != 2)
+            throw exception("Invalid number of legs to perform svFit");
 
-        const NSVfitStandalone::kDecayType decayType = decayTypeMap.at(leg->GetType());
-        const NSVfitStandalone::LorentzVector lepton(leg->GetMomentum().Px(), leg->GetMomentum().Py(),
-                                                     leg->GetMomentum().Pz(), leg->GetMomentum().E());
+        for (const auto& leg : higgsLegs){
+            if(!decayTypeMap.count(leg->GetType()))
+                throw exception("leg is not compatible with leptonic or hadronic tau decay");
+            const TLorentzVector& momentum = leg->GetMomentum();
+            const Leg input_leg = { decayTypeMap.at(leg->GetType()), momentum.Px(), momentum.Py(), momentum.Pz(),
+                                    momentum.E() };
+            legs.push_back(input_leg);
+        }
+    }
+
+    FitInput(const std::vector<Leg>& _legs, const TLorentzVector& met, const TMatrixD& metCovariance)
+        : legs(_legs), met_pt(met.Pt()), met_phi(met.Phi())
+    {
+        met_significance.push_back(metCovariance(0, 0));
+        met_significance.push_back(metCovariance(0, 1));
+        met_significance.push_back(metCovariance(1, 0));
+        met_significance.push_back(metCovariance(1, 1));
+    }
 
-        measuredTauLeptons.push_back(NSVfitStandalone::MeasuredTauLepton(decayType, lepton));
+    bool operator< (const FitInput& other) const
+    {
+        if(legs.size() != other.legs.size()) return legs.size() < other.legs.size();
+        for(size_t n = 0; n < legs.size(); ++n) {
+            const Leg& a = legs.at(n);
+            const Leg& b = other.legs.at(n);
+            if(std::tie(a.decayType, a.px, a.py, a.pz, a.E) != std::tie(b.decayType, b.px, b.py, b.pz, b.E))
+                return std::tie(a.decayType, a.px, a.py, a.pz, a.E) < std::tie(b.decayType, b.px, b.py, b.pz, b.E);
+        }
+        if(met_pt != other.met_pt) return met_pt < other.met_pt;
+        if(met_phi != other.met_phi) return met_phi < other.met_phi;
+        return met_significance < other.met_significance;
     }
+};
 
-    NSVfitStandalone::NSVfitStandaloneAlgorithm algo(measuredTauLeptons, measuredMET, covMET, 0);
-    algo.addLogM(false);
+typedef std::shared_ptr<NSVfitStandalone::NSVfitStandaloneAlgorithm> AlgorithmPtr;
+typedef NSVfitStandalone::MarkovChainIntegrator::ChainPositions ChainPositions;
+
+/// Integration options. See NSVfitStandaloneAlgorithm::vegasScanMode, NSVfitStandaloneAlgorithm::markovChains,
+/// NSVfitStandaloneAlgorithm::markovChainProposals, NSVfitStandaloneAlgorithm::markovChainConvergence and
+/// NSVfitStandaloneAlgorithm::markovChainWarmStart.
+struct FitSettings {
+    bool adaptiveMassScan;
+    double massScanTolerance;
+    unsigned massScanMaxCalls;
+    unsigned numberOfMarkovChains, numberOfThreads, numberOfMarkovChainProposals;
+    double convergencePrecision;
+    unsigned convergenceCheckInterval;
+    double convergenceMaxRhat;
+    bool markovChainWarmStart;
+    double warmStartBurninFraction;
+
+    FitSettings() : adaptiveMassScan(false), massScanTolerance(1.), massScanMaxCalls(80000), numberOfMarkovChains(1),
+                    numberOfThreads(1), numberOfMarkovChainProposals(1), convergencePrecision(0.),
+                    convergenceCheckInterval(1000), convergenceMaxRhat(1.1), markovChainWarmStart(false),
+                    warmStartBurninFraction(0.1) {}
+
+    /// Options that change the fit results. The number of threads doesn't affect them.
+    std::vector<double> ResultDefiningOptions() const
+    {
+        std::vector<double> options;
+        options.push_back(adaptiveMassScan);
+        if(adaptiveMassScan) {
+            options.push_back(massScanTolerance);
+            options.push_back(massScanMaxCalls);
+        }
+        options.push_back(numberOfMarkovChains);
+        options.push_back(numberOfMarkovChainProposals);
+        options.push_back(convergencePrecision);
+        if(convergencePrecision > 0) {
+            options.push_back(convergenceCheckInterval);
+            options.push_back(convergenceMaxRhat);
+        }
+        options.push_back(markovChainWarmStart);
+        if(markovChainWarmStart)
+            options.push_back(warmStartBurninFraction);
+        return options;
+    }
+};
+
+inline AlgorithmPtr CreateAlgorithm(const FitInput& input, const FitSettings& settings = FitSettings())
+{
+    const NSVfitStandalone::Vector measuredMET(input.met_pt * std::cos(input.met_phi),
+                                               input.met_pt * std::sin(input.met_phi), 0.0);
+    const TMatrixD covMET = ntuple::VectorToSignificanceMatrix(input.met_significance);
+
+    std::vector<NSVfitStandalone::MeasuredTauLepton> measuredTauLeptons;
+    for (const FitInput::Leg& leg : input.legs) {
+        const NSVfitStandalone::LorentzVector lepton(leg.px, leg.py, leg.pz, leg.E);
+        measuredTauLeptons.push_back(NSVfitStandalone::MeasuredTauLepton(leg.decayType, lepton));
+    }
 
+    AlgorithmPtr algo(new NSVfitStandalone::NSVfitStandaloneAlgorithm(measuredTauLeptons, measuredMET, covMET, 0));
+    algo->addLogM(false);
+    if(settings.adaptiveMassScan)
+        algo->vegasScanMode(NSVfitStandalone::NSVfitStandaloneAlgorithm::kAdaptiveScan, settings.massScanTolerance,
+                            settings.massScanMaxCalls);
+    algo->markovChains(settings.numberOfMarkovChains, settings.numberOfThreads);
+    algo->markovChainProposals(settings.numberOfMarkovChainProposals);
+    if(settings.convergencePrecision > 0)
+        algo->markovChainConvergence(settings.convergencePrecision, settings.convergenceCheckInterval,
+                                     settings.convergenceMaxRhat);
+    return algo;
+}
+
+inline FitResults Fit(FitAlgorithm fitAlgorithm, NSVfitStandalone::NSVfitStandaloneAlgorithm& algo)
+{
     if(fitAlgorithm == FitAlgorithm::Vegas)
         algo.integrateVEGAS();
     else if(fitAlgorithm == FitAlgorithm::MarkovChain)
@@ -114,18 +221,30 @@ inline FitResults Fit(FitAlgorithm fitAlgorithm, const CandidatePtrVector& higgs
         if(fitAlgorithm == FitAlgorithm::MarkovChain) {
             result.momentum.SetPtEtaPhiM(algo.pt(), algo.eta(), algo.phi(), algo.mass());
             result.has_valid_momentum = true;
+            result.n_iterations = algo.numMarkovChainMoves();
         }
     } else
         std::cerr << "Can't fit with " << fitAlgorithm << std::endl;
 
+    return result;
+}
+
+inline FitResults Fit(FitAlgorithm fitAlgorithm, const CandidatePtrVector& higgsLegs, const ntuple::MET& met)
+{
+    static const bool debug = false;
+
+    const AlgorithmPtr algo = CreateAlgorithm(FitInput(higgsLegs, met));
+    const FitResults result = Fit(fitAlgorithm, *algo);
+
     if(debug) {
+        const Candidate higgsCandidate(Candidate::Type::Higgs, higgsLegs.at(0), higgsLegs.at(1));
         std::cout << std::fixed << std::setprecision(4)
                   << "\nOriginal mass = " << higgsCandidate.GetMomentum().M()
                   << "\nOriginal momentum = " << higgsCandidate.GetMomentum()
                   << "\nFirst daughter momentum = " << higgsCandidate.GetDaughters().at(0)->GetMomentum()
                   << "\nSecond daughter momentum = " << higgsCandidate.GetDaughters().at(1)->GetMomentum()
                   << "\nMET momentum = (" << met.pt << ", " << met.phi << ")"
-                  << "\nMET covariance: " << covMET
+                  << "\nMET covariance: " << ntuple::VectorToSignificanceMatrix(met.significanceMatrix)
                   << "\nSVfit algorithm = " << fitAlgorithm;
         if(result.has_valid_mass)
             std::cout << "\nSVfit mass = " << result.mass;
@@ -137,17 +256,341 @@ inline FitResults Fit(FitAlgorithm fitAlgorithm, const CandidatePtrVector& higgs
     return result;
 }
 
-CombinedFitResults CombinedFit(const CandidatePtrVector& higgsLegs, const ntuple::MET& met, bool fitWithVegas,
-                               bool fitWithMarkovChain)
+/// Both algorithms are run using the same SVfit setup. The Markov Chain integration is warm-started from
+/// warmStartPositions, if they are provided, and the final chain positions are stored in finalPositions, if requested.
+inline CombinedFitResults CombinedFit(const FitInput& input, bool fitWithVegas, bool fitWithMarkovChain,
+                                      const FitSettings& settings = FitSettings(),
+                                      const ChainPositions* warmStartPositions = nullptr,
+                                      ChainPositions* finalPositions = nullptr)
 {
     CombinedFitResults result;
+    if(!fitWithVegas && !fitWithMarkovChain)
+        return result;
+    const AlgorithmPtr algo = CreateAlgorithm(input, settings);
     if(fitWithVegas)
-        result.fit_vegas = Fit(FitAlgorithm::Vegas, higgsLegs, met);
-    if(fitWithMarkovChain)
-        result.fit_mc = Fit(FitAlgorithm::MarkovChain, higgsLegs, met);
+        result.fit_vegas = Fit(FitAlgorithm::Vegas, *algo);
+    if(fitWithMarkovChain) {
+        if(warmStartPositions)
+            algo->markovChainWarmStart(*warmStartPositions, settings.warmStartBurninFraction);
+        result.fit_mc = Fit(FitAlgorithm::MarkovChain, *algo);
+        if(finalPositions)
+            *finalPositions = algo->markovChainPositions();
+    }
     return result;
 }
 
+inline CombinedFitResults CombinedFit(const CandidatePtrVector& higgsLegs, const ntuple::MET& met, bool fitWithVegas,
+                                      bool fitWithMarkovChain)
+{
+    return CombinedFit(FitInput(higgsLegs, met), fitWithVegas, fitWithMarkovChain);
+}
+
+/// Persistent storage of SVfit results. Fit inputs are quantized, so the same ntuple entries produce the same key when
+/// the ntuples are reprocessed and the stored results are used instead of running SVfit. New results are appended to
+/// the cache file as soon as they are obtained. A cache file can be used only with the same fit setup (algorithms and
+/// result defining integration options) that was used to create it, otherwise it is recreated.
+class ResultCache {
+public:
+    typedef std::vector<long long> Key;
+
+    /// Returns the cache associated with the given file. All producers of the same job share one cache instance.
+    static std::shared_ptr<ResultCache> Get(const std::string& fileName, bool fitWithVegas, bool fitWithMarkovChain,
+                                            const FitSettings& settings, bool refresh)
+    {
+        static std::mutex registry_mutex;
+        static std::map<std::string, std::weak_ptr<ResultCache>> registry;
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        std::shared_ptr<ResultCache> cache = registry[fileName].lock();
+        if(!cache) {
+            cache = std::shared_ptr<ResultCache>(new ResultCache(fileName, fitWithVegas, fitWithMarkovChain,
+                                                                 settings, refresh));
+            registry[fileName] = cache;
+        }
+        return cache;
+    }
+
+    ~ResultCache()
+    {
+        std::cout << "SVfit cache '" << fileName << "': " << n_hits << " hits, " << n_misses << " misses, "
+                  << results.size() << " entries." << std::endl;
+    }
+
+    bool Find(const FitInput& input, CombinedFitResults& result)
+    {
+        Key key;
+        std::lock_guard<std::mutex> lock(mutex);
+        if(MakeKey(input, key)) {
+            const auto iter = results.find(key);
+            if(iter != results.end()) {
+                ++n_hits;
+                result = iter->second;
+                return true;
+            }
+        }
+        ++n_misses;
+        return false;
+    }
+
+    void Add(const FitInput& input, const CombinedFitResults& result)
+    {
+        Key key;
+        if(!MakeKey(input, key)) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!results.insert(std::make_pair(key, result)).second) return;
+        WriteEntry(key, result);
+        file.flush();
+    }
+
+private:
+    /// Quantization steps: 0.1 MeV for momenta, 1 urad for angles and 0.1 MeV^2 for the MET covariance.
+    static constexpr double MomentumStep = 1e-4;
+    static constexpr double AngleStep = 1e-6;
+    static constexpr double CovarianceStep = 1e-7;
+    /// Upper limit on the stored key size, which protects against huge allocations when reading a corrupted file.
+    static constexpr size_t MaxKeySize = 64;
+
+    struct StoredFitResults {
+        char has_valid_mass, has_valid_momentum;
+        double mass, px, py, pz, E;
+        unsigned n_iterations;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const
+        {
+            unsigned long long hash = 14695981039346656037ULL;
+            for(long long value : key) {
+                hash ^= static_cast<unsigned long long>(value);
+                hash *= 1099511628211ULL;
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    static unsigned FormatVersion() { return 3; }
+
+    static bool Quantize(double value, double step, Key& key)
+    {
+        if(!std::isfinite(value)) return false;
+        key.push_back(std::llround(value / step));
+        return true;
+    }
+
+    static bool MakeKey(const FitInput& input, Key& key)
+    {
+        key.clear();
+        for(const FitInput::Leg& leg : input.legs) {
+            key.push_back(leg.decayType);
+            if(!Quantize(leg.px, MomentumStep, key) || !Quantize(leg.py, MomentumStep, key)
+                    || !Quantize(leg.pz, MomentumStep, key) || !Quantize(leg.E, MomentumStep, key))
+                return false;
+        }
+        if(!Quantize(input.met_pt, MomentumStep, key) || !Quantize(input.met_phi, AngleStep, key))
+            return false;
+        for(Float_t element : input.met_significance) {
+            if(!Quantize(element, CovarianceStep, key))
+                return false;
+        }
+        return true;
+    }
+
+    static StoredFitResults Store(const FitResults& result)
+    {
+        const StoredFitResults stored = { result.has_valid_mass, result.has_valid_momentum, result.mass,
+                                          result.momentum.Px(), result.momentum.Py(), result.momentum.Pz(),
+                                          result.momentum.E(), result.n_iterations };
+        return stored;
+    }
+
+    static FitResults Restore(const StoredFitResults& stored)
+    {
+        FitResults result;
+        result.has_valid_mass = stored.has_valid_mass;
+        result.mass = stored.mass;
+        result.has_valid_momentum = stored.has_valid_momentum;
+        result.momentum.SetPxPyPzE(stored.px, stored.py, stored.pz, stored.E);
+        result.n_iterations = stored.n_iterations;
+        return result;
+    }
+
+    ResultCache(const std::string& _fileName, bool fitWithVegas, bool fitWithMarkovChain,
+                const FitSettings& settings, bool refresh)
+        : fileName(_fileName), n_hits(0), n_misses(0)
+    {
+        setup.push_back(fitWithVegas);
+        setup.push_back(fitWithMarkovChain);
+        const std::vector<double> options = settings.ResultDefiningOptions();
+        setup.insert(setup.end(), options.begin(), options.end());
+
+        const bool is_consistent = !refresh && Read();
+        file.open(fileName.c_str(), std::ios::binary | (is_consistent ? std::ios::app : std::ios::trunc));
+        if(!file.is_open())
+            throw exception("Unable to open SVfit cache file '") << fileName << "'.";
+        if(!is_consistent) {
+            const unsigned version = FormatVersion();
+            file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+            const size_t setup_size = setup.size();
+            file.write(reinterpret_cast<const char*>(&setup_size), sizeof(setup_size));
+            file.write(reinterpret_cast<const char*>(setup.data()), setup_size * sizeof(double));
+            for(const auto& entry : results)
+                WriteEntry(entry.first, entry.second);
+            file.flush();
+        }
+    }
+
+    /// Reads all complete entries from the cache file. Returns false if the file should be rewritten.
+    bool Read()
+    {
+        std::ifstream f(fileName.c_str(), std::ios::binary);
+        if(!f.is_open()) return false;
+        unsigned version = 0;
+        size_t setup_size = 0;
+        f.read(reinterpret_cast<char*>(&version), sizeof(version));
+        f.read(reinterpret_cast<char*>(&setup_size), sizeof(setup_size));
+        std::vector<double> stored_setup(f.good() && version == FormatVersion() && setup_size == setup.size()
+                                         ? setup_size : 0);
+        f.read(reinterpret_cast<char*>(stored_setup.data()), stored_setup.size() * sizeof(double));
+        if(!f.good() || version != FormatVersion() || stored_setup != setup) {
+            std::cerr << "Warning: SVfit cache '" << fileName << "' is incompatible with the current setup. "
+                      << "It will be recreated." << std::endl;
+            return false;
+        }
+        for(;;) {
+            size_t key_size = 0;
+            f.read(reinterpret_cast<char*>(&key_size), sizeof(key_size));
+            if(f.eof() && !f.gcount()) return true;
+            if(!f.good() || key_size > MaxKeySize) {
+                std::cerr << "Warning: SVfit cache '" << fileName << "' has a corrupted entry. "
+                          << "It will be rewritten." << std::endl;
+                return false;
+            }
+            Key key(key_size);
+            StoredFitResults stored[2];
+            f.read(reinterpret_cast<char*>(key.data()), key_size * sizeof(long long));
+            f.read(reinterpret_cast<char*>(stored), sizeof(stored));
+            if(!f.good()) {
+                std::cerr << "Warning: SVfit cache '" << fileName << "' has an incomplete entry. "
+                          << "It will be rewritten." << std::endl;
+                return false;
+            }
+            CombinedFitResults& result = results[key];
+            result.fit_vegas = Restore(stored[0]);
+            result.fit_mc = Restore(stored[1]);
+        }
+    }
+
+    void WriteEntry(const Key& key, const CombinedFitResults& result)
+    {
+        const size_t key_size = key.size();
+        const StoredFitResults stored[2] = { Store(result.fit_vegas), Store(result.fit_mc) };
+        file.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+        file.write(reinterpret_cast<const char*>(key.data()), key_size * sizeof(long long));
+        file.write(reinterpret_cast<const char*>(stored), sizeof(stored));
+    }
+
+private:
+    std::string fileName;
+    std::vector<double> setup;
+    std::unordered_map<Key, CombinedFitResults, KeyHash> results;
+    std::ofstream file;
+    std::mutex mutex;
+    size_t n_hits, n_misses;
+};
+
+/// SVfit front-end for all energy scale variations of an event. Each unique input is fitted only once, and
+/// variations with bit-identical inputs (e.g. jet and b-tag variations, for which tau legs and MET usually don't
+/// change) share the fit results. Results are kept until a different event is set. If a persistent cache is used,
+/// SVfit is run only for inputs that are not found in the cache.
+/// If the Markov Chain warm start is enabled, the first input fitted for an event (i.e. the central energy scale)
+/// is fitted as usual and the final positions of its chains are kept with the event results. The Markov Chains of the
+/// other inputs of the event start from these positions with a shorter burn-in stage. The first input is fitted even if
+/// it is found in the cache, so the results of the other inputs don't depend on the content of the cache.
+class BatchFitter {
+public:
+    BatchFitter(bool _fitWithVegas, bool _fitWithMarkovChain)
+        : fitWithVegas(_fitWithVegas), fitWithMarkovChain(_fitWithMarkovChain), hasWarmStartPositions(false),
+          n_requests(0), n_fits(0) {}
+
+    /// Should be called before the cache is enabled.
+    void SetFitSettings(const FitSettings& _settings) { settings = _settings; }
+
+    void EnableCache(const std::string& fileName, bool refresh)
+    {
+        cache = ResultCache::Get(fileName, fitWithVegas, fitWithMarkovChain, settings, refresh);
+    }
+
+    void SetEvent(const EventId& _eventId)
+    {
+        if(_eventId == eventId) return;
+        eventId = _eventId;
+        results.clear();
+        hasWarmStartPositions = false;
+        warmStartPositions.clear();
+    }
+
+    const CombinedFitResults& Fit(const FitInput& input)
+    {
+        ++n_requests;
+        auto iter = results.find(input);
+        if(iter == results.end()) {
+            ++n_fits;
+            CombinedFitResults result;
+            const bool useWarmStart = settings.markovChainWarmStart && fitWithMarkovChain;
+            const bool isCached = cache && cache->Find(input, result);
+            if(!isCached || (useWarmStart && !hasWarmStartPositions)) {
+                const ChainPositions* startPositions = useWarmStart && hasWarmStartPositions
+                        ? &warmStartPositions : nullptr;
+                ChainPositions* finalPositions = useWarmStart && !hasWarmStartPositions
+                        ? &warmStartPositions : nullptr;
+                const CombinedFitResults fit_result = CombinedFit(input, fitWithVegas, fitWithMarkovChain, settings,
+                                                                  startPositions, finalPositions);
+                if(finalPositions)
+                    hasWarmStartPositions = true;
+                if(!isCached) {
+                    result = fit_result;
+                    if(cache)
+                        cache->Add(input, result);
+                }
+            }
+            iter = results.insert(std::make_pair(input, result)).first;
+        }
+        return iter->second;
+    }
+
+    /// Fits all variations of the current event. Results are returned in the order of the inputs.
+    std::vector<CombinedFitResults> Fit(const std::vector<FitInput>& inputs)
+    {
+        std::vector<CombinedFitResults> fit_results;
+        for(const FitInput& input : inputs)
+            fit_results.push_back(Fit(input));
+        return fit_results;
+    }
+
+    /// Adds the fit statistics of another fitter, e.g. of a different worker thread.
+    void AddStatistics(const BatchFitter& other)
+    {
+        n_requests += other.n_requests;
+        n_fits += other.n_fits;
+    }
+
+    void PrintStatistics(std::ostream& s) const
+    {
+        if(!n_requests) return;
+        s << "SVfit: " << n_fits << " unique inputs fitted for " << n_requests << " requests ("
+          << n_requests - n_fits << " fits are reused)." << std::endl;
+    }
+
+private:
+    bool fitWithVegas, fitWithMarkovChain;
+    FitSettings settings;
+    EventId eventId;
+    std::map<FitInput, CombinedFitResults> results;
+    bool hasWarmStartPositions;
+    ChainPositions warmStartPositions;
+    std::shared_ptr<ResultCache> cache;
+    size_t n_requests, n_fits;
+};
+
 } // namespace sv_fit
 
 } // namespace analysis
@@ -33,13 +33,21 @@ namespace analysis {
 class SemileptonicFlatTreeAnalyzer : public BaseFlatTreeAnalyzer {
 public:
     SemileptonicFlatTreeAnalyzer(const DataCategoryCollection& _dataCategoryCollection, const std::string& _inputPath,
-                                 const std::string& _outputFileName, bool applyPostFitCorrections, bool saveFullOutput)
+                                 const std::string& _outputFileName, bool applyPostFitCorrections, bool saveFullOutput,
+                                 const std::string& branchWhitelistFileName = "", size_t numberOfThreads = 1)
          : BaseFlatTreeAnalyzer(_dataCategoryCollection, _inputPath, _outputFileName, applyPostFitCorrections,
-                                saveFullOutput)
+                                saveFullOutput, branchWhitelistFileName, numberOfThreads)
     {
     }
 
 protected:
+    virtual std::set<std::string> RequiredFlatTreeBranches() const override
+    {
+        std::set<std::string> branches = BaseFlatTreeAnalyzer::RequiredFlatTreeBranches();
+        branches.insert({ "pfRelIso_1", "q_1", "q_2" });
+        return branches;
+    }
+
     static bool IsHighMtRegion(const ntuple::Flat& event, analysis::EventCategory eventCategory)
     {
         using namespace cuts;
@@ -132,7 +140,8 @@ protected:
     }
 
     virtual void EstimateQCD(const FlatAnalyzerDataMetaId_noRegion_noName& anaDataMetaId, const std::string& hist_name,
-                             const analysis::PhysicalValue& scale_factor, DataCategoryType dataCategoryType) override
+                             const analysis::PhysicalValue& scale_factor, DataCategoryType dataCategoryType,
+                             std::ostream& /*s_err*/) override
     {
         static const EventCategorySet categories=
             { EventCategory::TwoJets_OneBtag, EventCategory::TwoJets_TwoBtag, EventCategory::TwoJets_AtLeastOneBtag };
@@ -178,8 +187,8 @@ protected:
     }
 
     virtual PhysicalValueMap CalculateWjetsYields(const FlatAnalyzerDataMetaId_noRegion_noName& anaDataMetaId,
-                                                  const std::string& hist_name,
-                                                  bool /*fullEstimate*/) override
+                                                  const std::string& hist_name, bool /*fullEstimate*/,
+                                                  std::ostream& s_out) override
     {
         PhysicalValueMap valueMap;
 
@@ -209,12 +218,12 @@ protected:
             auto hist_data = GetHistogram(anaDataMetaId, eventRegion.first, data.name, hist_name);
             if(!hist_data)
                 throw exception("Unable to find data histograms for Wjet scale factors estimation");
-            std::cout << "Data Integral in Wjets Yield: " << Integral(*hist_data, true) << std::endl;
 
             const auto data_yield = Integral(*hist_data, true);
+            s_out << "Data Integral in Wjets Yield: " << data_yield << "\n";
             const PhysicalValue yield = data_yield - bkg_yield;
             if(yield.GetValue() < 0) {
-                std::cout << bkg_yield_debug << "\nData yield = " << data_yield << std::endl;
+                s_out << bkg_yield_debug;
                 throw exception("Negative Wjets yield for histogram '")
                         << hist_name << "' in " << anaDataMetaId.eventCategory << " " << eventRegion.first << ".";
             }
@@ -37,6 +37,7 @@
 #include "AnalysisMath.h"
 #include "GenParticle.h"
 #include "Candidate.h"
+#include "TriggerPaths.h"
 
 namespace analysis {
 
@@ -52,95 +53,98 @@ inline bool IsLeptonicTau(const GenParticle& genParticle)
                 FindDecayProducts(genParticle,TauElectronDecay,tauProducts,false);
 }
 
-inline bool HaveTriggerMatched(const std::vector<std::string>& objectMatchedPaths,
-                               const std::set<std::string>& interestinghltPaths, size_t& n)
+inline bool HaveTriggerMatched(TriggerPathDictionary& triggerPaths, const std::vector<std::string>& objectMatchedPaths,
+                               const TriggerPathSet& interestingPathMask)
 {
-    for (; n < objectMatchedPaths.size(); ++n){
-        for (const std::string& interestingPath : interestinghltPaths){
-            const std::string& objectMatchedPath = objectMatchedPaths.at(n);
-            const size_t found = objectMatchedPath.find(interestingPath);
-            if (found != std::string::npos) return true;
-        }
+    for (const std::string& objectMatchedPath : objectMatchedPaths){
+        if (interestingPathMask.Contains(triggerPaths.GetId(objectMatchedPath))) return true;
     }
     return false;
 }
 
-inline bool HaveTriggerMatched(const std::vector<std::string>& objectMatchedPaths,
-                               const std::set<std::string>& interestinghltPaths)
-{
-    size_t n = 0;
-    return HaveTriggerMatched(objectMatchedPaths, interestinghltPaths, n);
-}
-
-inline bool HaveTriggerMatched(const ntuple::TriggerObjectVector& triggerObjects, const std::string& interestingPath,
-                               const Candidate& candidate, double deltaR_Limit)
+inline bool HaveTriggerMatched(TriggerPathDictionary& triggerPaths, const ntuple::TriggerObjectVector& triggerObjects,
+                               const TriggerPathSet& interestingPathMask, const Candidate& candidate,
+                               double deltaR_Limit)
 {
     if(candidate.GetFinalStateDaughters().size()) {
         for(const auto& daughter : candidate.GetFinalStateDaughters()) {
-            if(!HaveTriggerMatched(triggerObjects, interestingPath, *daughter, deltaR_Limit))
+            if(!HaveTriggerMatched(triggerPaths, triggerObjects, interestingPathMask, *daughter, deltaR_Limit))
                 return false;
         }
         return true;
     }
 
     for (const ntuple::TriggerObject& triggerObject : triggerObjects){
+        bool pathMatched = false;
+        for (unsigned n = 0; !pathMatched && n < triggerObject.pathNames.size(); ++n){
+            pathMatched = triggerObject.pathValues.at(n) == 1
+                    && interestingPathMask.Contains(triggerPaths.GetId(triggerObject.pathNames.at(n)));
+        }
+        if (!pathMatched) continue;
         TLorentzVector triggerObjectMomentum;
         triggerObjectMomentum.SetPtEtaPhiM(triggerObject.pt, triggerObject.eta, triggerObject.phi, triggerObject.mass);
-        for (unsigned n = 0; n < triggerObject.pathNames.size(); ++n){
-            const std::string& objectMatchedPath = triggerObject.pathNames.at(n);
-            const size_t found = objectMatchedPath.find(interestingPath);
-            if (found != std::string::npos && triggerObject.pathValues.at(n) == 1 &&
-                    triggerObjectMomentum.DeltaR(candidate.GetMomentum()) < deltaR_Limit)
-                return true;
-        }
+        if (triggerObjectMomentum.DeltaR(candidate.GetMomentum()) < deltaR_Limit)
+            return true;
     }
     return false;
 }
 
-inline bool HaveTriggerMatched(const std::string& interestingPath, const Candidate& candidate)
+inline bool HaveTriggerMatched(TriggerPathDictionary& triggerPaths, const ntuple::TriggerObjectVector& triggerObjects,
+                               const std::string& interestingPath, const Candidate& candidate, double deltaR_Limit)
+{
+    return HaveTriggerMatched(triggerPaths, triggerObjects, triggerPaths.GetMask(interestingPath), candidate,
+                              deltaR_Limit);
+}
+
+inline bool HaveTriggerMatched(TriggerPathDictionary& triggerPaths, const TriggerPathSet& interestingPathMask,
+                               const Candidate& candidate)
 {
     if(candidate.GetFinalStateDaughters().size()) {
         for(const auto& daughter : candidate.GetFinalStateDaughters()) {
-            if(!HaveTriggerMatched(interestingPath, *daughter))
+            if(!HaveTriggerMatched(triggerPaths, interestingPathMask, *daughter))
                 return false;
         }
         return true;
     }
 
-    std::vector<std::string> objectMatchedPaths;
+    const std::vector<std::string>* objectMatchedPaths;
     if(candidate.GetType() == Candidate::Type::Tau)
-        objectMatchedPaths = candidate.GetNtupleObject<ntuple::Tau>().matchedTriggerPaths;
+        objectMatchedPaths = &candidate.GetNtupleObject<ntuple::Tau>().matchedTriggerPaths;
     else if(candidate.GetType() == Candidate::Type::Jet)
-        objectMatchedPaths = candidate.GetNtupleObject<ntuple::Jet>().matchedTriggerPaths;
+        objectMatchedPaths = &candidate.GetNtupleObject<ntuple::Jet>().matchedTriggerPaths;
     else if(candidate.GetType() == Candidate::Type::Muon)
-        objectMatchedPaths = candidate.GetNtupleObject<ntuple::Muon>().matchedTriggerPaths;
+        objectMatchedPaths = &candidate.GetNtupleObject<ntuple::Muon>().matchedTriggerPaths;
     else if(candidate.GetType() == Candidate::Type::Electron)
-        objectMatchedPaths = candidate.GetNtupleObject<ntuple::Electron>().matchedTriggerPaths;
+        objectMatchedPaths = &candidate.GetNtupleObject<ntuple::Electron>().matchedTriggerPaths;
     else
         throw exception("Unknow candidate to match trigger.");
 
-    for (unsigned n = 0; n < objectMatchedPaths.size(); ++n){
-        const std::string& objectMatchedPath = objectMatchedPaths.at(n);
-        const size_t found = objectMatchedPath.find(interestingPath);
-        if (found != std::string::npos) return true;
-    }
-    return false;
+    return HaveTriggerMatched(triggerPaths, *objectMatchedPaths, interestingPathMask);
+}
+
+inline bool HaveTriggerMatched(TriggerPathDictionary& triggerPaths, const std::string& interestingPath,
+                               const Candidate& candidate)
+{
+    return HaveTriggerMatched(triggerPaths, triggerPaths.GetMask(interestingPath), candidate);
 }
 
-inline bool HaveTriggerMatched(const ntuple::TriggerObjectVector& triggerObjects,
+/// All final state daughters of the candidate should be matched to the same interesting path.
+inline bool HaveTriggerMatched(TriggerPathDictionary& triggerPaths, const ntuple::TriggerObjectVector& triggerObjects,
                                const std::set<std::string>& interestingPaths, const Candidate& candidate,
                                double deltaR_Limit)
 {
     for (const std::string& interestinPath : interestingPaths){
-        if (HaveTriggerMatched(triggerObjects,interestinPath,candidate, deltaR_Limit)) return true;
+        if (HaveTriggerMatched(triggerPaths, triggerObjects, interestinPath, candidate, deltaR_Limit)) return true;
     }
     return false;
 }
 
-inline bool HaveTriggerMatched(const std::set<std::string>& interestingPaths, const Candidate& candidate)
+/// All final state daughters of the candidate should be matched to the same interesting path.
+inline bool HaveTriggerMatched(TriggerPathDictionary& triggerPaths, const std::set<std::string>& interestingPaths,
+                               const Candidate& candidate)
 {
     for (const std::string& interestinPath : interestingPaths){
-        if (HaveTriggerMatched(interestinPath, candidate)) return true;
+        if (HaveTriggerMatched(triggerPaths, interestinPath, candidate)) return true;
     }
     return false;
 }
@@ -32,6 +32,8 @@
 #include <stdexcept>
 #include <sstream>
 #include <typeindex>
+#include <mutex>
+#include <atomic>
 
 #include <TH1D.h>
 #include <TH2D.h>
@@ -80,7 +82,7 @@
 namespace root_ext {
 class AnalyzerData {
 private:
-    typedef std::vector<AbstractHistogram*> DataVector;
+    typedef std::vector<std::atomic<AbstractHistogram*>> DataVector;
     typedef std::map<std::string, AbstractHistogram*> DataMap;
 
     template<typename ValueType>
@@ -103,6 +105,14 @@ private:
         return index_map;
     }
 
+    /// Guards the static name and index registries, which are shared between the analyzer data instances
+    /// that may be filled from different threads.
+    static std::mutex& RegistryMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
     static constexpr size_t MaxIndex = 1000;
 
 public:
@@ -114,6 +124,7 @@ public:
 
     static size_t GetUniqueIndex(const std::string& name)
     {
+        std::lock_guard<std::mutex> lock(RegistryMutex());
         const auto iter = IndexMap().find(name);
         if(iter != IndexMap().end())
             return iter->second;
@@ -123,24 +134,19 @@ public:
     }
 
 public:
-    AnalyzerData() : directory(nullptr)
-    {
-        data_vector.assign(MaxIndex, nullptr);
-    }
+    AnalyzerData() : directory(nullptr), data_vector(MaxIndex) {}
 
     explicit AnalyzerData(const std::string& outputFileName)
-        : outputFile(CreateRootFile(outputFileName))
+        : outputFile(CreateRootFile(outputFileName)), data_vector(MaxIndex)
     {
-        data_vector.assign(MaxIndex, nullptr);
         directory = outputFile.get();
     }
 
     explicit AnalyzerData(std::shared_ptr<TFile> _outputFile, const std::string& directoryName = "")
-        : outputFile(_outputFile)
+        : outputFile(_outputFile), data_vector(MaxIndex)
     {
         if(!outputFile)
             throw analysis::exception("Output file is nullptr.");
-        data_vector.assign(MaxIndex, nullptr);
         if (directoryName.size()){
             outputFile->mkdir(directoryName.c_str());
             directory = outputFile->GetDirectory(directoryName.c_str());
@@ -160,23 +166,29 @@ public:
     }
 
     std::shared_ptr<TFile> getOutputFile() { return outputFile; }
-    bool Contains(const std::string& name) const { return data.find(name) != data.end(); }
+    bool Contains(const std::string& name) const
+    {
+        std::lock_guard<std::recursive_mutex> lock(data_mutex);
+        return data.find(name) != data.end();
+    }
 
     void Erase(const std::string& name)
     {
+        std::lock_guard<std::recursive_mutex> lock(data_mutex);
         auto iter = data.find(name);
         if(iter != data.end()) {
             delete iter->second;
             data.erase(iter);
             auto index_iter = IndexMap().find(name);
             if(index_iter != IndexMap().end() && index_iter->second < MaxIndex)
-                data_vector.at(index_iter->second) = nullptr;
+                data_vector.at(index_iter->second).store(nullptr, std::memory_order_release);
         }
     }
 
     template<typename ValueType>
     bool CheckType(const std::string& name) const
     {
+        std::lock_guard<std::recursive_mutex> lock(data_mutex);
         const auto iter = data.find(name);
         if(iter == data.end())
             analysis::exception("Histogram '") << name << "' not found.";
@@ -186,6 +198,7 @@ public:
 
     std::vector<std::string> KeysCollection() const
     {
+        std::lock_guard<std::recursive_mutex> lock(data_mutex);
         std::vector<std::string> keys;
         for(const auto& iter : data)
             keys.push_back(iter.first);
@@ -218,6 +231,7 @@ public:
     template<typename ValueType>
     SmartHistogram<ValueType>* GetPtr(const std::string& name) const
     {
+        std::lock_guard<std::recursive_mutex> lock(data_mutex);
         if(!Contains(name) || !CheckType<ValueType>(name)) return nullptr;
         return &GetAt<ValueType>(data.find(name));
     }
@@ -225,24 +239,39 @@ public:
     template<typename ValueType>
     SmartHistogram<ValueType>& Clone(const SmartHistogram<ValueType>& original)
     {
+        std::lock_guard<std::recursive_mutex> data_lock(data_mutex);
         if(data.count(original.Name()))
             throw analysis::exception("histogram already exists");
         SmartHistogram<ValueType>* h = new SmartHistogram<ValueType>(original);
         data[h->Name()] = h;
+        std::lock_guard<std::mutex> lock(RegistryMutex());
         HistogramNames<ValueType>().insert(h->Name());
         h->SetOutputDirectory(directory);
         auto index_iter = IndexMap().find(h->Name());
         if(index_iter != IndexMap().end() && index_iter->second < MaxIndex)
-            data_vector.at(index_iter->second) = h;
+            data_vector.at(index_iter->second).store(h, std::memory_order_release);
         return *h;
     }
 
+    /// Adds content of all histograms of the other analyzer data. Histograms that don't exist yet are cloned.
+    void Add(const AnalyzerData& other)
+    {
+        std::lock_guard<std::recursive_mutex> lock(data_mutex);
+        for(const auto& iter : other.data) {
+            if(!AddHistogram<TH1D>(iter.second) && !AddHistogram<TH2D>(iter.second))
+                throw analysis::exception("Unable to add histogram '") << iter.first << "': unsupported type.";
+        }
+    }
+
 protected:
     template<typename ValueType, typename ...Args>
     SmartHistogram<ValueType>& GetFast(const ValueType* ptr, const std::string& name, size_t index, Args... args)
     {
-        if(index < MaxIndex && data_vector[index] != nullptr)
-            return *static_cast< SmartHistogram<ValueType>* >(data_vector[index]);
+        if(index < MaxIndex) {
+            AbstractHistogram* h = data_vector[index].load(std::memory_order_acquire);
+            if(h != nullptr)
+                return *static_cast< SmartHistogram<ValueType>* >(h);
+        }
         return GetByFullName(ptr, name, name, args...);
     }
 
@@ -251,21 +280,36 @@ private:
     SmartHistogram<ValueType>& GetByFullName(const ValueType*, const std::string& name, const std::string& full_name,
                                              Args... args)
     {
+        std::lock_guard<std::recursive_mutex> data_lock(data_mutex);
         auto iter = data.find(full_name);
         if(iter == data.end()) {
             AbstractHistogram* h = HistogramFactory<ValueType>::Make(full_name, args...);
             data[full_name] = h;
+            std::lock_guard<std::mutex> lock(RegistryMutex());
             HistogramNames<ValueType>().insert(h->Name());
             OriginalHistogramNames<ValueType>().insert(name);
             h->SetOutputDirectory(directory);
             iter = data.find(full_name);
             auto index_iter = IndexMap().find(full_name);
             if(index_iter != IndexMap().end() && index_iter->second < MaxIndex)
-                data_vector.at(index_iter->second) = h;
+                data_vector.at(index_iter->second).store(h, std::memory_order_release);
         }
         return GetAt<ValueType>(iter);
     }
 
+    template<typename ValueType>
+    bool AddHistogram(const AbstractHistogram* other)
+    {
+        const SmartHistogram<ValueType>* other_hist = dynamic_cast<const SmartHistogram<ValueType>*>(other);
+        if(!other_hist) return false;
+        SmartHistogram<ValueType>* hist = GetPtr<ValueType>(other_hist->Name());
+        if(hist)
+            hist->Add(other_hist);
+        else
+            Clone(*other_hist);
+        return true;
+    }
+
     template<typename ValueType>
     SmartHistogram<ValueType>& GetAt(const DataMap::const_iterator& iter) const
     {
@@ -283,6 +327,13 @@ private:
     TDirectory* directory;
 
     DataMap data;
+
+    /// Histograms by unique index for GetFast. Entries are written only under data_mutex, when a histogram is created
+    /// or removed, so GetFast can read them without locking.
     DataVector data_vector;
+
+    /// Guards the histogram collection, which can be accessed from different threads (e.g. during the background
+    /// estimation, when each thread processes histograms with a different name).
+    mutable std::recursive_mutex data_mutex;
 };
 } // root_ext
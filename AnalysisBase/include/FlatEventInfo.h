@@ -114,16 +114,7 @@ struct FlatEventInfo {
             Hbb = bjet_momentums.at(selected_bjets.first) + bjet_momentums.at(selected_bjets.second);
             resonance = Htt_MET + Hbb;
             if (recalculate_mass_KinFit){
-                using namespace analysis::kinematic_fit;
-                const four_body::FitInput four_body_input(bjet_momentums.at(selected_bjets.first),
-                                                          bjet_momentums.at(selected_bjets.second),
-                                                          lepton_momentums.at(0), lepton_momentums.at(1),
-                                                          MET, MET_covariance);
-
-                fitResults = Fit(four_body_input);
-                if (fitResults.convergence == 0){
-                    std::cout << "kin fit has convergence = 0! event = " << event->evt << std::endl;
-                }
+                SetKinFitResults(kinematic_fit::four_body::Fit(CreateKinFitInput()));
             } else {
                 fitResults.convergence = event->kinfit_bb_tt_convergence;
                 fitResults.chi2 = event->kinfit_bb_tt_chi2;
@@ -134,6 +125,23 @@ struct FlatEventInfo {
 
         }
     }
+
+    /// Input of the kinematic fit of the selected b-jet pair.
+    kinematic_fit::four_body::FitInput CreateKinFitInput() const
+    {
+        return kinematic_fit::four_body::FitInput(bjet_momentums.at(selected_bjets.first),
+                                                  bjet_momentums.at(selected_bjets.second),
+                                                  lepton_momentums.at(0), lepton_momentums.at(1),
+                                                  MET, MET_covariance);
+    }
+
+    void SetKinFitResults(const kinematic_fit::four_body::FitResults& _fitResults)
+    {
+        fitResults = _fitResults;
+        if (fitResults.convergence == 0){
+            std::cout << "kin fit has convergence = 0! event = " << event->evt << std::endl;
+        }
+    }
 };
 
 typedef std::shared_ptr<FlatEventInfo> FlatEventInfoPtr;
@@ -340,33 +340,35 @@ private:
 
     typedef std::map<std::string, HistogramParameters> HistogramParametersMap;
 
+    static HistogramParametersMap LoadParameters(const std::string& configName)
+    {
+        HistogramParametersMap parameters;
+        std::ifstream cfg(configName);
+        while (cfg.good()) {
+            std::string cfgLine;
+            std::getline(cfg,cfgLine);
+            if (!cfgLine.size() || cfgLine.at(0) == '#') continue;
+            std::istringstream ss(cfgLine);
+            std::string param_name;
+            HistogramParameters param;
+            ss >> param_name;
+            ss >> param.nbins;
+            ss >> param.low;
+            ss >> param.high;
+            if(parameters.count(param_name)) {
+                std::ostringstream ss_error;
+                ss_error << "Redefinition of default parameters for histogram '" << param_name << "'.";
+                throw std::runtime_error(ss_error.str());
+            }
+            parameters[param_name] = param;
+        }
+        return parameters;
+    }
+
     static const HistogramParameters& GetParameters(const std::string& name)
     {
         static const std::string configName = "Analysis/config/histograms.cfg";
-        static bool parametersLoaded = false;
-        static HistogramParametersMap parameters;
-        if(!parametersLoaded) {
-            std::ifstream cfg(configName);
-            while (cfg.good()) {
-                std::string cfgLine;
-                std::getline(cfg,cfgLine);
-                if (!cfgLine.size() || cfgLine.at(0) == '#') continue;
-                std::istringstream ss(cfgLine);
-                std::string param_name;
-                HistogramParameters param;
-                ss >> param_name;
-                ss >> param.nbins;
-                ss >> param.low;
-                ss >> param.high;
-                if(parameters.count(param_name)) {
-                    std::ostringstream ss_error;
-                    ss_error << "Redefinition of default parameters for histogram '" << param_name << "'.";
-                    throw std::runtime_error(ss_error.str());
-                }
-                parameters[param_name] = param;
-              }
-            parametersLoaded = true;
-        }
+        static const HistogramParametersMap parameters = LoadParameters(configName);
         std::string best_name = name;
         for(size_t pos = name.find_last_of('_'); !parameters.count(best_name) && pos != 0 && pos != std::string::npos;
             pos = name.find_last_of('_', pos - 1))
@@ -0,0 +1,172 @@
+/*!
+ * \file ThreadTools.h
+ * \brief Definition of the tools to run parts of the analysis concurrently.
+ * \author Konstantin Androsov (University of Siena, INFN Pisa)
+ *
+ * Copyright 2015 Konstantin Androsov <konstantin.androsov@gmail.com>
+ *
+ * This file is part of X->HH->bbTauTau.
+ *
+ * X->HH->bbTauTau is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * X->HH->bbTauTau is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with X->HH->bbTauTau.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <queue>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+
+namespace analysis {
+namespace tools {
+
+/// FIFO queue with a limited capacity that can be shared between producer and consumer threads.
+/// Push blocks while the queue is full, Pop blocks while the queue is empty. After Close is called, Push is
+/// rejected and Pop returns false as soon as all already queued items are consumed.
+template<typename Item>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t _max_size)
+        : max_size(_max_size), closed(false)
+    {
+        if(!max_size)
+            throw std::runtime_error("Bounded queue capacity should be positive.");
+    }
+
+    bool Push(const Item& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [&]() { return closed || items.size() < max_size; });
+        if(closed) return false;
+        items.push(item);
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool Pop(Item& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [&]() { return closed || !items.empty(); });
+        if(items.empty()) return false;
+        item = items.front();
+        items.pop();
+        not_full.notify_one();
+        return true;
+    }
+
+    /// Takes the first item without waiting. Returns false if the queue is currently empty.
+    bool TryPop(Item& item)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(items.empty()) return false;
+        item = items.front();
+        items.pop();
+        not_full.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    size_t max_size;
+    bool closed;
+    std::queue<Item> items;
+    std::mutex mutex;
+    std::condition_variable not_full, not_empty;
+};
+
+/// Collects results of tasks that can be finished in any order and passes them to the consumer in the order of
+/// their indices, as soon as all results with lower indices have been consumed. Results are released after
+/// consumption. Add can be called from different threads; the consumer is always called under the internal lock.
+template<typename Result>
+class OrderedCollector {
+public:
+    typedef std::function<void(Result&)> Consumer;
+
+    OrderedCollector(size_t n_results, const Consumer& _consumer)
+        : results(n_results), ready(n_results, false), n_consumed(0), consumer(_consumer) {}
+
+    void Add(size_t index, const Result& result)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(ready.at(index))
+            throw std::runtime_error("Result of the task is already collected.");
+        results.at(index) = result;
+        ready.at(index) = true;
+        for(; n_consumed < results.size() && ready.at(n_consumed); ++n_consumed) {
+            consumer(results.at(n_consumed));
+            results.at(n_consumed) = Result();
+        }
+    }
+
+private:
+    std::vector<Result> results;
+    std::vector<bool> ready;
+    size_t n_consumed;
+    Consumer consumer;
+    std::mutex mutex;
+};
+
+/// Calls task(n) for each n in [0, n_tasks) using up to n_threads threads. Tasks are started in the order of their
+/// indices. If n_threads <= 1, all tasks are executed in the calling thread. After all threads are finished, the
+/// exception thrown by the task with the lowest index (if any) is rethrown in the calling thread. Once a task has
+/// failed, tasks that have not started yet are skipped.
+template<typename Task>
+void RunParallel(size_t n_tasks, size_t n_threads, const Task& task)
+{
+    if(n_threads <= 1 || n_tasks <= 1) {
+        for(size_t n = 0; n < n_tasks; ++n)
+            task(n);
+        return;
+    }
+
+    std::atomic<size_t> next_task(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::exception_ptr> errors(n_tasks);
+    auto worker = [&]() {
+        for(size_t n; !failed && (n = next_task++) < n_tasks;) {
+            try {
+                task(n);
+            } catch(...) {
+                errors.at(n) = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(size_t n = 0; n < std::min(n_threads, n_tasks); ++n)
+        threads.push_back(std::thread(worker));
+    for(std::thread& thread : threads)
+        thread.join();
+    for(const std::exception_ptr& error : errors) {
+        if(error)
+            std::rethrow_exception(error);
+    }
+}
+
+} // namespace tools
+} // namespace analysis
@@ -30,9 +30,14 @@
 #include <iostream>
 #include <queue>
 #include <fstream>
+#include <thread>
+#include <exception>
+
+#include <TThread.h>
 
 #include "EventDescriptor.h"
 #include "RootExt.h"
+#include "ThreadTools.h"
 
 namespace analysis {
 
@@ -48,6 +53,64 @@ struct TreeVersionTag<ntuple::GenEventTree> {
     static unsigned GetVersion() { return 2; }
 };
 
+template<>
+struct TreeVersionTag<ntuple::PFCandColumnsTree> {
+    static unsigned GetVersion() { return 3; }
+};
+
+template<>
+struct TreeVersionTag<ntuple::TriggerObjectColumnsTree> {
+    static unsigned GetVersion() { return 3; }
+};
+
+template<>
+struct TreeVersionTag<ntuple::CompactTriggerTree> {
+    static unsigned GetVersion() { return 4; }
+};
+
+template<>
+struct TreeVersionTag<ntuple::CompactTriggerObjectColumnsTree> {
+    static unsigned GetVersion() { return 4; }
+};
+
+/// Collection that can be stored either with one tree entry per object (RowTree) or in the columnar layout with one
+/// tree entry per event (ColumnTree). Only one of the trees is opened for a given input file.
+template<typename _RowTree, typename _ColumnTree>
+struct DualLayoutTree {
+    typedef _RowTree RowTree;
+    typedef _ColumnTree ColumnTree;
+
+    static bool IsMCtruth() { return RowTree::IsMCtruth(); }
+
+    std::shared_ptr<RowTree> rows;
+    std::shared_ptr<ColumnTree> columns;
+};
+
+typedef DualLayoutTree<ntuple::PFCandTree, ntuple::PFCandColumnsTree> PFCandDualTree;
+typedef DualLayoutTree<ntuple::TriggerObjectTree, ntuple::TriggerObjectColumnsTree> TriggerObjectDualTree;
+
+/// Trigger information that can be stored either in the full format (FullTree) or in the compact format, where the
+/// path names are stored once per run in PathTableTree and each entry of CompactTree refers to the paths by their
+/// index in the table. CompactTree has exactly one entry per event, which is expanded into the same objects that are
+/// read from FullTree.
+template<typename _FullTree, typename _CompactTree, typename _PathTableTree>
+struct CompactFormatTree {
+    typedef _FullTree FullTree;
+    typedef _CompactTree CompactTree;
+    typedef _PathTableTree PathTableTree;
+
+    static bool IsMCtruth() { return FullTree::IsMCtruth(); }
+
+    std::shared_ptr<FullTree> full;
+    std::shared_ptr<CompactTree> compact;
+    ntuple::TriggerPathTables pathTables;
+};
+
+typedef CompactFormatTree<ntuple::TriggerTree, ntuple::CompactTriggerTree, ntuple::TriggerPathTableTree>
+        TriggerFormatTree;
+typedef CompactFormatTree<TriggerObjectDualTree, ntuple::CompactTriggerObjectColumnsTree,
+                          ntuple::TriggerObjectPathTableTree> TriggerObjectFormatTree;
+
 const std::vector<std::string> treeNames = { "events", "electrons", "muons", "taus", "PFCand", "jets", "vertices",
                                              "genParticles", "triggers", "triggerObjects", "METs", "METsPF", "METsTC",
                                              "genMETs", "genEvents"
@@ -57,12 +120,12 @@ typedef std::tuple< std::shared_ptr<ntuple::EventTree>,
                     std::shared_ptr<ntuple::ElectronTree>,
                     std::shared_ptr<ntuple::MuonTree>,
                     std::shared_ptr<ntuple::TauTree>,
-                    std::shared_ptr<ntuple::PFCandTree>,
+                    std::shared_ptr<PFCandDualTree>,
                     std::shared_ptr<ntuple::JetTree>,
                     std::shared_ptr<ntuple::VertexTree>,
                     std::shared_ptr<ntuple::GenParticleTree>,
-                    std::shared_ptr<ntuple::TriggerTree>,
-                    std::shared_ptr<ntuple::TriggerObjectTree>,
+                    std::shared_ptr<TriggerFormatTree>,
+                    std::shared_ptr<TriggerObjectFormatTree>,
                     std::shared_ptr<ntuple::METTree>,
                     std::shared_ptr<ntuple::METTree>,
                     std::shared_ptr<ntuple::METTree>,
@@ -77,6 +140,38 @@ inline void CreateTree(std::shared_ptr<Tree>& tree, std::shared_ptr<TFile> input
     tree = createTree ? std::shared_ptr<Tree>( new Tree(treeName, inputFile.get(), true) ) : std::shared_ptr<Tree>();
 }
 
+/// The columnar layout is used if it is allowed by maxVersion and it is present in the input file.
+template<typename RowTree, typename ColumnTree>
+inline void CreateTree(std::shared_ptr< DualLayoutTree<RowTree, ColumnTree> >& tree, std::shared_ptr<TFile> inputFile,
+                       const std::string& treeName, bool extractMCtruth, unsigned maxVersion)
+{
+    tree = std::shared_ptr< DualLayoutTree<RowTree, ColumnTree> >(new DualLayoutTree<RowTree, ColumnTree>());
+    if(TreeVersionTag<ColumnTree>::GetVersion() <= maxVersion && inputFile->Get(ColumnTree::Name().c_str()))
+        CreateTree(tree->columns, inputFile, ColumnTree::Name(), extractMCtruth, maxVersion);
+    else
+        CreateTree(tree->rows, inputFile, treeName, extractMCtruth, maxVersion);
+    if(!tree->rows && !tree->columns)
+        tree.reset();
+}
+
+/// The compact format is used if it is allowed by maxVersion and it is present in the input file.
+template<typename FullTree, typename CompactTree, typename PathTableTree>
+inline void CreateTree(std::shared_ptr< CompactFormatTree<FullTree, CompactTree, PathTableTree> >& tree,
+                       std::shared_ptr<TFile> inputFile, const std::string& treeName, bool extractMCtruth,
+                       unsigned maxVersion)
+{
+    tree = std::shared_ptr< CompactFormatTree<FullTree, CompactTree, PathTableTree> >(
+                new CompactFormatTree<FullTree, CompactTree, PathTableTree>());
+    if(TreeVersionTag<CompactTree>::GetVersion() <= maxVersion && inputFile->Get(CompactTree::Name().c_str())) {
+        CreateTree(tree->compact, inputFile, CompactTree::Name(), extractMCtruth, maxVersion);
+        if(tree->compact)
+            tree->pathTables.template Read<PathTableTree>(inputFile.get());
+    } else
+        CreateTree(tree->full, inputFile, treeName, extractMCtruth, maxVersion);
+    if(!tree->full && !tree->compact)
+        tree.reset();
+}
+
 template<size_t N = 0>
 inline typename std::enable_if< N == std::tuple_size<Forest>::value >::type
 CreateForest(Forest& forest, std::shared_ptr<TFile> inputFile, bool extractMCtruth, unsigned maxVersion) {}
@@ -89,6 +184,41 @@ CreateForest(Forest& forest, std::shared_ptr<TFile> inputFile, bool extractMCtru
     CreateForest<N + 1>(forest, inputFile, extractMCtruth, maxVersion);
 }
 
+template<typename Tree>
+inline void EnableTreeCache(std::shared_ptr<Tree>& tree, Long64_t cacheSize)
+{
+    if(tree) tree->EnableCache(cacheSize);
+}
+
+template<typename RowTree, typename ColumnTree>
+inline void EnableTreeCache(std::shared_ptr< DualLayoutTree<RowTree, ColumnTree> >& tree, Long64_t cacheSize)
+{
+    if(!tree) return;
+    EnableTreeCache(tree->rows, cacheSize);
+    EnableTreeCache(tree->columns, cacheSize);
+}
+
+template<typename FullTree, typename CompactTree, typename PathTableTree>
+inline void EnableTreeCache(std::shared_ptr< CompactFormatTree<FullTree, CompactTree, PathTableTree> >& tree,
+                            Long64_t cacheSize)
+{
+    if(!tree) return;
+    EnableTreeCache(tree->full, cacheSize);
+    EnableTreeCache(tree->compact, cacheSize);
+}
+
+template<size_t N = 0>
+inline typename std::enable_if< N == std::tuple_size<Forest>::value >::type
+EnableForestCache(Forest& forest, Long64_t cacheSize) {}
+
+template<size_t N = 0>
+inline typename std::enable_if< (N < std::tuple_size<Forest>::value) >::type
+EnableForestCache(Forest& forest, Long64_t cacheSize)
+{
+    EnableTreeCache(std::get<N>(forest), cacheSize);
+    EnableForestCache<N + 1>(forest, cacheSize);
+}
+
 template<typename Tree, typename ObjectType>
 void ReadTree(std::shared_ptr<Tree>& tree, ObjectType& container, Long64_t& current_entry, EventId& currentEventId)
 {
@@ -98,11 +228,11 @@ void ReadTree(std::shared_ptr<Tree>& tree, ObjectType& container, Long64_t& curr
         ++current_entry;
     if(tree->GetEntry(current_entry) < 0)
         throw std::runtime_error("An I/O error while reading tree.");
-    const EventId treeEventId(tree->data.run,tree->data.lumis,tree->data.EventId);
+    const EventId treeEventId(tree->run(), tree->lumis(), tree->EventId());
     if(currentEventId != EventId::Undef_event() && treeEventId != currentEventId)
         throw std::runtime_error("Inconsistent tree structure.");
     currentEventId = treeEventId;
-    container = tree->data;
+    container = tree->data();
 }
 
 template<typename Tree, typename ObjectType>
@@ -114,12 +244,52 @@ void ReadTree(std::shared_ptr<Tree>& tree, std::vector<ObjectType>& container, L
     for(Long64_t n = tree->GetReadEntry(); n < tree->GetEntries();) {
         const EventId treeEventId(tree->RunId(),tree->LumiBlock(),tree->EventId());
         if (currentEventId != treeEventId) break;
-        container.push_back(tree->data);
+        container.push_back(tree->data());
         if(tree->GetEntry(++n) < 0)
             throw std::runtime_error("An I/O error while reading tree.");
     }
 }
 
+/// In the columnar layout all objects of the event are read by a single GetEntry call.
+template<typename RowTree, typename ColumnTree, typename ObjectType>
+void ReadTree(std::shared_ptr< DualLayoutTree<RowTree, ColumnTree> >& tree, std::vector<ObjectType>& container,
+              Long64_t current_entry, EventId currentEventId)
+{
+    if(!tree) return;
+    if(tree->rows) {
+        ReadTree(tree->rows, container, current_entry, currentEventId);
+        return;
+    }
+    ColumnTree& columns = *tree->columns;
+    const Long64_t n = columns.GetReadEntry();
+    if(n < 0 || n >= columns.GetEntries()) return;
+    const EventId treeEventId(columns.RunId(), columns.LumiBlock(), columns.EventId());
+    if(currentEventId != treeEventId) return;
+    ntuple::ExtractFromColumns(columns.data(), container);
+    if(n + 1 < columns.GetEntries() && columns.GetEntry(n + 1) < 0)
+        throw std::runtime_error("An I/O error while reading tree.");
+}
+
+/// In the compact format the event is expanded using the path table of its run.
+template<typename FullTree, typename CompactTree, typename PathTableTree, typename ObjectType>
+void ReadTree(std::shared_ptr< CompactFormatTree<FullTree, CompactTree, PathTableTree> >& tree,
+              std::vector<ObjectType>& container, Long64_t current_entry, EventId currentEventId)
+{
+    if(!tree) return;
+    if(tree->full) {
+        ReadTree(tree->full, container, current_entry, currentEventId);
+        return;
+    }
+    CompactTree& compact = *tree->compact;
+    const Long64_t n = compact.GetReadEntry();
+    if(n < 0 || n >= compact.GetEntries()) return;
+    const EventId treeEventId(compact.RunId(), compact.LumiBlock(), compact.EventId());
+    if(currentEventId != treeEventId) return;
+    ntuple::ExpandFromCompact(compact.data(), tree->pathTables.Get(compact.RunId()), container);
+    if(n + 1 < compact.GetEntries() && compact.GetEntry(n + 1) < 0)
+        throw std::runtime_error("An I/O error while reading tree.");
+}
+
 template<size_t N = 0>
 inline typename std::enable_if< N == std::tuple_size<Forest>::value, bool >::type
 ReadForest(Forest& forest, EventTuple& data, Long64_t& current_entry,
@@ -136,12 +306,301 @@ ReadForest(Forest& forest, EventTuple& data, Long64_t& current_entry,
     return true;
 }
 
+struct EntryRange {
+    Long64_t begin, end;
+    EntryRange() : begin(0), end(0) {}
+    EntryRange(Long64_t _begin, Long64_t _end) : begin(_begin), end(_end) {}
+};
+
+/// Maps each entry of the events tree to the range of entries [begin, end) of every tree in the forest that belong
+/// to the same event. The index is built once per input file by reading only the event id branches and can be
+/// cached in a sidecar file.
+class ForestIndex {
+public:
+    static constexpr size_t NumberOfTrees = std::tuple_size<Forest>::value;
+
+    Long64_t GetNumberOfEvents() const { return eventIds.size(); }
+    const EventId& GetEventId(Long64_t entry) const { return eventIds.at(entry); }
+    const EntryRange& GetRange(Long64_t entry, size_t treeIndex) const
+    {
+        return ranges.at(entry * NumberOfTrees + treeIndex);
+    }
+
+    bool FindEvent(unsigned eventId, Long64_t& entry) const
+    {
+        for(Long64_t n = 0; n < GetNumberOfEvents(); ++n) {
+            if(eventIds.at(n).eventId == eventId) {
+                entry = n;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Build(Forest& forest)
+    {
+        eventIds.clear();
+        ranges.clear();
+        treeSizes = CollectTreeSizes(forest);
+        BuildForestIndex(forest);
+    }
+
+    /// Reads the index from the sidecar file. Returns false if the file doesn't exist or it was created for a different
+    /// input file, identified by inputKey, or for a different forest layout.
+    bool Read(const std::string& fileName, const std::string& inputKey, Forest& forest)
+    {
+        static const size_t max_key_size = 1024;
+        std::ifstream f(fileName.c_str(), std::ios::binary);
+        if(!f.is_open()) return false;
+        unsigned version = 0;
+        size_t key_size = 0, n_trees = 0, n_events = 0;
+        f.read(reinterpret_cast<char*>(&version), sizeof(version));
+        f.read(reinterpret_cast<char*>(&key_size), sizeof(key_size));
+        if(!f.good() || version != FormatVersion() || key_size > max_key_size) return false;
+        std::string storedKey(key_size, '\0');
+        f.read(&storedKey[0], key_size);
+        if(!f.good() || storedKey != inputKey) return false;
+        f.read(reinterpret_cast<char*>(&n_trees), sizeof(n_trees));
+        if(!f.good() || n_trees != NumberOfTrees) return false;
+        std::vector<Long64_t> storedTreeSizes(n_trees);
+        f.read(reinterpret_cast<char*>(storedTreeSizes.data()), n_trees * sizeof(Long64_t));
+        if(!f.good() || storedTreeSizes != CollectTreeSizes(forest)) return false;
+        f.read(reinterpret_cast<char*>(&n_events), sizeof(n_events));
+        if(!f.good()) return false;
+        eventIds.resize(n_events);
+        ranges.resize(n_events * NumberOfTrees);
+        f.read(reinterpret_cast<char*>(eventIds.data()), n_events * sizeof(EventId));
+        f.read(reinterpret_cast<char*>(ranges.data()), ranges.size() * sizeof(EntryRange));
+        if(!f.good()) {
+            eventIds.clear();
+            ranges.clear();
+            return false;
+        }
+        treeSizes = storedTreeSizes;
+        return true;
+    }
+
+    void Write(const std::string& fileName, const std::string& inputKey) const
+    {
+        std::ofstream f(fileName.c_str(), std::ios::binary);
+        if(!f.is_open()) {
+            std::cerr << "Warning: unable to write forest index into '" << fileName << "'." << std::endl;
+            return;
+        }
+        const unsigned version = FormatVersion();
+        const size_t key_size = inputKey.size(), n_trees = NumberOfTrees, n_events = eventIds.size();
+        f.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        f.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+        f.write(inputKey.data(), key_size);
+        f.write(reinterpret_cast<const char*>(&n_trees), sizeof(n_trees));
+        f.write(reinterpret_cast<const char*>(treeSizes.data()), n_trees * sizeof(Long64_t));
+        f.write(reinterpret_cast<const char*>(&n_events), sizeof(n_events));
+        f.write(reinterpret_cast<const char*>(eventIds.data()), n_events * sizeof(EventId));
+        f.write(reinterpret_cast<const char*>(ranges.data()), ranges.size() * sizeof(EntryRange));
+    }
+
+private:
+    static unsigned FormatVersion() { return 2; }
+
+    template<typename Tree>
+    static Long64_t GetTreeSize(const std::shared_ptr<Tree>& tree) { return tree ? tree->GetEntries() : -1; }
+
+    template<typename RowTree, typename ColumnTree>
+    static Long64_t GetTreeSize(const std::shared_ptr< DualLayoutTree<RowTree, ColumnTree> >& tree)
+    {
+        if(!tree) return -1;
+        return tree->rows ? GetTreeSize(tree->rows) : GetTreeSize(tree->columns);
+    }
+
+    template<typename FullTree, typename CompactTree, typename PathTableTree>
+    static Long64_t GetTreeSize(const std::shared_ptr< CompactFormatTree<FullTree, CompactTree, PathTableTree> >& tree)
+    {
+        if(!tree) return -1;
+        return tree->full ? GetTreeSize(tree->full) : GetTreeSize(tree->compact);
+    }
+
+    template<size_t N = 0>
+    static typename std::enable_if< N == NumberOfTrees >::type
+    CollectTreeSizes(Forest& forest, std::vector<Long64_t>& sizes) {}
+
+    template<size_t N = 0>
+    static typename std::enable_if< (N < NumberOfTrees) >::type
+    CollectTreeSizes(Forest& forest, std::vector<Long64_t>& sizes)
+    {
+        sizes.push_back(GetTreeSize(std::get<N>(forest)));
+        CollectTreeSizes<N + 1>(forest, sizes);
+    }
+
+    static std::vector<Long64_t> CollectTreeSizes(Forest& forest)
+    {
+        std::vector<Long64_t> sizes;
+        CollectTreeSizes(forest, sizes);
+        return sizes;
+    }
+
+    template<size_t N = 0>
+    typename std::enable_if< N == NumberOfTrees >::type BuildForestIndex(Forest& forest) {}
+
+    template<size_t N = 0>
+    typename std::enable_if< (N < NumberOfTrees) >::type BuildForestIndex(Forest& forest)
+    {
+        typedef typename std::tuple_element<N, EventTuple>::type ObjectType;
+        IndexTree(std::get<N>(forest), static_cast<const ObjectType*>(nullptr), N);
+        BuildForestIndex<N + 1>(forest);
+    }
+
+    /// The tree that contains one entry per event defines the event order.
+    template<typename Tree, typename ObjectType>
+    void IndexTree(std::shared_ptr<Tree>& tree, const ObjectType*, size_t treeIndex)
+    {
+        if(!tree)
+            throw std::runtime_error("Unable to build forest index without events tree.");
+        const Long64_t n_entries = tree->GetEntries();
+        eventIds.reserve(n_entries);
+        for(Long64_t n = 0; n < n_entries; ++n) {
+            if(tree->GetBranchEntry("run", n) < 0 || tree->GetBranchEntry("lumis", n) < 0
+                    || tree->GetBranchEntry("EventId", n) < 0)
+                throw std::runtime_error("An I/O error while reading tree.");
+            eventIds.push_back(EventId(tree->run(), tree->lumis(), tree->EventId()));
+        }
+        ranges.assign(n_entries * NumberOfTrees, EntryRange());
+        for(Long64_t n = 0; n < n_entries; ++n)
+            ranges.at(n * NumberOfTrees + treeIndex) = EntryRange(n, n + 1);
+    }
+
+    template<typename Tree, typename ObjectType>
+    void IndexTree(std::shared_ptr<Tree>& tree, const std::vector<ObjectType>*, size_t treeIndex)
+    {
+        if(!tree) return;
+        const Long64_t n_entries = tree->GetEntries();
+        Long64_t position = 0;
+        for(Long64_t n = 0; n < GetNumberOfEvents(); ++n) {
+            EntryRange& range = ranges.at(n * NumberOfTrees + treeIndex);
+            range.begin = position;
+            for(; position < n_entries; ++position) {
+                if(tree->GetBranchEntry("RunId", position) < 0 || tree->GetBranchEntry("LumiBlock", position) < 0
+                        || tree->GetBranchEntry("EventId", position) < 0)
+                    throw std::runtime_error("An I/O error while reading tree.");
+                const EventId treeEventId(tree->RunId(), tree->LumiBlock(), tree->EventId());
+                if(treeEventId != eventIds.at(n)) break;
+            }
+            range.end = position;
+        }
+        if(position != n_entries)
+            throw std::runtime_error("Inconsistent tree structure.");
+    }
+
+    /// The columnar tree has the same event id branches as the row tree, but at most one entry per event.
+    template<typename RowTree, typename ColumnTree, typename ObjectType>
+    void IndexTree(std::shared_ptr< DualLayoutTree<RowTree, ColumnTree> >& tree, const std::vector<ObjectType>* object,
+                   size_t treeIndex)
+    {
+        if(!tree) return;
+        if(tree->rows)
+            IndexTree(tree->rows, object, treeIndex);
+        else
+            IndexTree(tree->columns, object, treeIndex);
+    }
+
+    template<typename FullTree, typename CompactTree, typename PathTableTree, typename ObjectType>
+    void IndexTree(std::shared_ptr< CompactFormatTree<FullTree, CompactTree, PathTableTree> >& tree,
+                   const std::vector<ObjectType>* object, size_t treeIndex)
+    {
+        if(!tree) return;
+        if(tree->full)
+            IndexTree(tree->full, object, treeIndex);
+        else
+            IndexTree(tree->compact, object, treeIndex);
+    }
+
+private:
+    std::vector<EventId> eventIds;
+    std::vector<EntryRange> ranges;
+    std::vector<Long64_t> treeSizes;
+};
+
+template<typename Tree, typename ObjectType>
+void ReadTreeRange(std::shared_ptr<Tree>& tree, ObjectType& container, const EntryRange& range)
+{
+    if(!tree) return;
+    if(tree->GetEntry(range.begin) < 0)
+        throw std::runtime_error("An I/O error while reading tree.");
+    container = tree->data();
+}
+
+template<typename Tree, typename ObjectType>
+void ReadTreeRange(std::shared_ptr<Tree>& tree, std::vector<ObjectType>& container, const EntryRange& range)
+{
+    if(!tree) return;
+    for(Long64_t n = range.begin; n < range.end; ++n) {
+        if(tree->GetEntry(n) < 0)
+            throw std::runtime_error("An I/O error while reading tree.");
+        container.push_back(tree->data());
+    }
+}
+
+template<typename RowTree, typename ColumnTree, typename ObjectType>
+void ReadTreeRange(std::shared_ptr< DualLayoutTree<RowTree, ColumnTree> >& tree, std::vector<ObjectType>& container,
+                   const EntryRange& range)
+{
+    if(!tree) return;
+    if(tree->rows) {
+        ReadTreeRange(tree->rows, container, range);
+        return;
+    }
+    for(Long64_t n = range.begin; n < range.end; ++n) {
+        if(tree->columns->GetEntry(n) < 0)
+            throw std::runtime_error("An I/O error while reading tree.");
+        ntuple::ExtractFromColumns(tree->columns->data(), container);
+    }
+}
+
+template<typename FullTree, typename CompactTree, typename PathTableTree, typename ObjectType>
+void ReadTreeRange(std::shared_ptr< CompactFormatTree<FullTree, CompactTree, PathTableTree> >& tree,
+                   std::vector<ObjectType>& container, const EntryRange& range)
+{
+    if(!tree) return;
+    if(tree->full) {
+        ReadTreeRange(tree->full, container, range);
+        return;
+    }
+    CompactTree& compact = *tree->compact;
+    for(Long64_t n = range.begin; n < range.end; ++n) {
+        if(compact.GetEntry(n) < 0)
+            throw std::runtime_error("An I/O error while reading tree.");
+        ntuple::ExpandFromCompact(compact.data(), tree->pathTables.Get(compact.RunId()), container);
+    }
+}
+
+template<size_t N = 0>
+inline typename std::enable_if< N == std::tuple_size<Forest>::value >::type
+ReadIndexedForest(Forest& forest, const ForestIndex& index, Long64_t entry, EventTuple& data) {}
+
+template<size_t N = 0>
+inline typename std::enable_if< (N < std::tuple_size<Forest>::value) >::type
+ReadIndexedForest(Forest& forest, const ForestIndex& index, Long64_t entry, EventTuple& data)
+{
+    ReadTreeRange(std::get<N>(forest), std::get<N>(data), index.GetRange(entry, N));
+    ReadIndexedForest<N + 1>(forest, index, entry, data);
+}
+
 } // detail
 
 class TreeExtractor{
 public:
-    TreeExtractor(const std::string& prefix, const std::string& input, bool _extractMCtruth, unsigned _maxTreeVersion)
-        :  extractMCtruth(_extractMCtruth), maxTreeVersion(_maxTreeVersion)
+    /// If readAheadDepth is positive, events are read and decompressed by a background thread, which keeps up to
+    /// readAheadDepth decoded events ready for the analyzer. The thread is started by the first ExtractNext, i.e. after
+    /// the analyzer has created its output files, and it only reads the trees of the current input file: the input
+    /// files are opened by the calling thread. If treeCacheSize is positive, a TTreeCache of that size
+    /// (in bytes) is enabled for each tree of the forest.
+    /// If useIndex is true, a ForestIndex is used to read exactly the entries that belong to each event and to allow
+    /// random access to events. The index is cached in indexPath, if it is not empty.
+    TreeExtractor(const std::string& prefix, const std::string& input, bool _extractMCtruth, unsigned _maxTreeVersion,
+                  size_t _readAheadDepth = 0, Long64_t _treeCacheSize = 0, bool _useIndex = false,
+                  const std::string& _indexPath = "")
+        :  extractMCtruth(_extractMCtruth), maxTreeVersion(_maxTreeVersion), treeCacheSize(_treeCacheSize),
+           useIndex(_useIndex), indexPath(_indexPath), readAheadDepth(_readAheadDepth), n_prefetch_hits(0),
+           n_prefetch_stalls(0)
     {
         if (input.find(".root") != std::string::npos)
             inputFileNames.push(input);
@@ -159,24 +618,125 @@ public:
             throw std::runtime_error("No inputFile found");
     }
 
+    ~TreeExtractor()
+    {
+        if(prefetchQueue) {
+            prefetchQueue->Close();
+            prefetchThread.join();
+        }
+    }
+
     bool ExtractNext(EventDescriptor& descriptor)
     {
-        descriptor.Clear();
+        if(readAheadDepth)
+            return ExtractPrefetched(descriptor);
+        return ReadNext(descriptor);
+    }
+
+    bool CanSeek() const { return useIndex && !readAheadDepth; }
+
+    /// Reads the first event with the given event number. The search starts from the current input file.
+    bool ExtractEvent(unsigned eventId, EventDescriptor& descriptor)
+    {
+        if(!CanSeek())
+            throw std::runtime_error("Random access to events is available only in the indexed mode without read-ahead.");
         do {
-            if (detail::ReadForest(*forest, descriptor.data(), current_entry))
+            Long64_t entry;
+            if(index.FindEvent(eventId, entry)) {
+                descriptor.Clear();
+                current_entry = entry;
+                detail::ReadIndexedForest(*forest, index, current_entry, descriptor.data());
                 return true;
+            }
         } while (OpenNextFile());
         return false;
     }
 
+    void PrintPrefetchStatistics(std::ostream& s) const
+    {
+        if(!readAheadDepth) return;
+        s << "Read-ahead statistics: events ready when requested = " << n_prefetch_hits
+          << ", analyzer stalls waiting for input = " << n_prefetch_stalls << "." << std::endl;
+    }
+
 private:
-    bool extractMCtruth;
-    unsigned maxTreeVersion;
-    std::shared_ptr<TFile> inputFile;
-    std::queue<std::string> inputFileNames;
-    std::shared_ptr<detail::Forest> forest;
-    Long64_t current_entry;
-    std::string prefix;
+    typedef tools::BoundedQueue< std::shared_ptr<EventDescriptor> > PrefetchQueue;
+
+    bool ReadNext(EventDescriptor& descriptor)
+    {
+        do {
+            if(ReadFromCurrentFile(descriptor))
+                return true;
+        } while (OpenNextFile());
+        return false;
+    }
+
+    bool ReadFromCurrentFile(EventDescriptor& descriptor)
+    {
+        descriptor.Clear();
+        if(useIndex) {
+            if(current_entry + 1 >= index.GetNumberOfEvents()) return false;
+            detail::ReadIndexedForest(*forest, index, ++current_entry, descriptor.data());
+            return true;
+        }
+        return detail::ReadForest(*forest, descriptor.data(), current_entry);
+    }
+
+    /// When the prefetching thread reaches the end of the current file, it stops. The next file is opened here and
+    /// a new thread is started for it. The final pop at the end of a file isn't counted as a stall.
+    bool ExtractPrefetched(EventDescriptor& descriptor)
+    {
+        std::shared_ptr<EventDescriptor> prefetched;
+        for(;;) {
+            if(!prefetchQueue)
+                StartPrefetching();
+            if(prefetchQueue->TryPop(prefetched)) {
+                ++n_prefetch_hits;
+                break;
+            }
+            if(prefetchQueue->Pop(prefetched)) {
+                ++n_prefetch_stalls;
+                break;
+            }
+            StopPrefetching();
+            if(!OpenNextFile()) return false;
+        }
+        std::swap(descriptor.data(), prefetched->data());
+        return true;
+    }
+
+    void StartPrefetching()
+    {
+        TThread::Initialize();
+        prefetchQueue = std::shared_ptr<PrefetchQueue>(new PrefetchQueue(readAheadDepth));
+        prefetchThread = std::thread(&TreeExtractor::PrefetchEvents, this);
+    }
+
+    void StopPrefetching()
+    {
+        prefetchQueue->Close();
+        prefetchThread.join();
+        prefetchQueue.reset();
+        if(prefetchError) {
+            const std::exception_ptr error = prefetchError;
+            prefetchError = std::exception_ptr();
+            std::rethrow_exception(error);
+        }
+    }
+
+    /// Reads the events of the current input file.
+    void PrefetchEvents()
+    {
+        try {
+            for(;;) {
+                std::shared_ptr<EventDescriptor> descriptor(new EventDescriptor());
+                if(!ReadFromCurrentFile(*descriptor) || !prefetchQueue->Push(descriptor)) break;
+            }
+        } catch(...) {
+            prefetchError = std::current_exception();
+        }
+        prefetchQueue->Close();
+    }
 
     bool OpenNextFile()
     {
@@ -188,8 +748,51 @@ private:
         std::cout << "File " << fileName << " is opened." << std::endl;
         current_entry = -1;
         detail::CreateForest(*forest, inputFile, extractMCtruth, maxTreeVersion);
+        if(useIndex)
+            LoadIndex(fileName);
+        if(treeCacheSize > 0)
+            detail::EnableForestCache(*forest, treeCacheSize);
         return true;
     }
+
+    /// The index is keyed on the UUID of the input file, which is unique for each written ROOT file, so that inputs
+    /// with the same name from different datasets don't share the index.
+    void LoadIndex(const std::string& fileName)
+    {
+        const std::string inputKey = inputFile->GetUUID().AsString();
+        const std::string indexFileName = IndexFileName(fileName, inputKey);
+        if(indexFileName.size() && index.Read(indexFileName, inputKey, *forest)) return;
+        index.Build(*forest);
+        if(indexFileName.size())
+            index.Write(indexFileName, inputKey);
+    }
+
+    std::string IndexFileName(const std::string& fileName, const std::string& inputKey) const
+    {
+        if(!indexPath.size()) return "";
+        const size_t name_pos = fileName.find_last_of('/');
+        const std::string baseName = name_pos == std::string::npos ? fileName : fileName.substr(name_pos + 1);
+        return indexPath + "/" + baseName + "_" + inputKey + ".index";
+    }
+
+private:
+    bool extractMCtruth;
+    unsigned maxTreeVersion;
+    Long64_t treeCacheSize;
+    bool useIndex;
+    std::string indexPath;
+    detail::ForestIndex index;
+    std::shared_ptr<TFile> inputFile;
+    std::queue<std::string> inputFileNames;
+    std::shared_ptr<detail::Forest> forest;
+    Long64_t current_entry;
+    std::string prefix;
+
+    size_t readAheadDepth;
+    std::shared_ptr<PrefetchQueue> prefetchQueue;
+    std::thread prefetchThread;
+    std::exception_ptr prefetchError;
+    size_t n_prefetch_hits, n_prefetch_stalls;
 };
 
 } // analysis
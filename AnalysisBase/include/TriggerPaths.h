@@ -0,0 +1,157 @@
+/*!
+ * \file TriggerPaths.h
+ * \brief Definition of TriggerPathDictionary class, which assigns integer ids to the trigger path names, and of
+ *        TriggerPathSet class, which represents a set of trigger paths as a bitset of their ids.
+ * \author Konstantin Androsov (University of Siena, INFN Pisa)
+ *
+ * Copyright 2015 Konstantin Androsov <konstantin.androsov@gmail.com>
+ *
+ * This file is part of X->HH->bbTauTau.
+ *
+ * X->HH->bbTauTau is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * X->HH->bbTauTau is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with X->HH->bbTauTau.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace analysis {
+
+/// Set of trigger paths represented by the bits of their ids in a TriggerPathDictionary.
+class TriggerPathSet {
+public:
+    typedef unsigned long long Word;
+    static const size_t WordSize = 64;
+
+    void Insert(size_t id)
+    {
+        const size_t n = id / WordSize;
+        if(n >= words.size())
+            words.resize(n + 1, 0);
+        words[n] |= Word(1) << (id % WordSize);
+    }
+
+    bool Contains(size_t id) const
+    {
+        const size_t n = id / WordSize;
+        return n < words.size() && (words[n] >> (id % WordSize)) & 1;
+    }
+
+    bool Intersects(const TriggerPathSet& other) const
+    {
+        const size_t n_words = std::min(words.size(), other.words.size());
+        for(size_t n = 0; n < n_words; ++n) {
+            if(words[n] & other.words[n]) return true;
+        }
+        return false;
+    }
+
+    bool Empty() const
+    {
+        return std::all_of(words.begin(), words.end(), [](Word word) { return !word; });
+    }
+
+    void Clear() { std::fill(words.begin(), words.end(), 0); }
+
+private:
+    std::vector<Word> words;
+};
+
+/// Assigns an integer id to each trigger path name the first time it is seen.
+/// A set of interesting paths is resolved into a mask of the ids of all paths that contain one of the interesting
+/// paths as a substring, so that the interesting path names can omit the version suffix. The mask is computed once
+/// per set of interesting paths and is extended each time a new path is interned.
+class TriggerPathDictionary {
+public:
+    typedef size_t PathId;
+
+    PathId GetId(const std::string& path)
+    {
+        const auto iter = ids.find(path);
+        if(iter != ids.end())
+            return iter->second;
+        const PathId id = names.size();
+        names.push_back(path);
+        ids[path] = id;
+        for(Mask& mask : masks) {
+            if(Matches(path, mask.interestingPaths))
+                mask.paths.Insert(id);
+        }
+        return id;
+    }
+
+    const std::string& GetName(PathId id) const { return names.at(id); }
+    size_t GetNumberOfPaths() const { return names.size(); }
+
+    const TriggerPathSet& GetMask(const std::set<std::string>& interestingPaths)
+    {
+        const auto iter = setMasks.find(interestingPaths);
+        if(iter != setMasks.end())
+            return *iter->second;
+        const TriggerPathSet* mask = &CreateMask(interestingPaths);
+        setMasks[interestingPaths] = mask;
+        return *mask;
+    }
+
+    const TriggerPathSet& GetMask(const std::string& interestingPath)
+    {
+        const auto iter = pathMasks.find(interestingPath);
+        if(iter != pathMasks.end())
+            return *iter->second;
+        const TriggerPathSet* mask = &CreateMask(std::set<std::string>({ interestingPath }));
+        pathMasks[interestingPath] = mask;
+        return *mask;
+    }
+
+private:
+    struct Mask {
+        std::set<std::string> interestingPaths;
+        TriggerPathSet paths;
+    };
+
+    static bool Matches(const std::string& path, const std::set<std::string>& interestingPaths)
+    {
+        for(const std::string& interestingPath : interestingPaths) {
+            if(path.find(interestingPath) != std::string::npos) return true;
+        }
+        return false;
+    }
+
+    const TriggerPathSet& CreateMask(const std::set<std::string>& interestingPaths)
+    {
+        masks.push_back(Mask());
+        Mask& mask = masks.back();
+        mask.interestingPaths = interestingPaths;
+        for(PathId id = 0; id < names.size(); ++id) {
+            if(Matches(names[id], interestingPaths))
+                mask.paths.Insert(id);
+        }
+        return mask.paths;
+    }
+
+private:
+    std::vector<std::string> names;
+    std::unordered_map<std::string, PathId> ids;
+    std::deque<Mask> masks; // deque keeps the references returned by GetMask valid
+    std::map<std::set<std::string>, const TriggerPathSet*> setMasks;
+    std::unordered_map<std::string, const TriggerPathSet*> pathMasks;
+};
+
+} // namespace analysis
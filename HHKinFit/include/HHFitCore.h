@@ -0,0 +1,142 @@
+/*
+ * HHFitCore.h
+ *
+ * Value-type core of the full event fit H -> h(tau tau) h(b b).
+ * All four-vectors are fixed-size structs and the event record has a fixed capacity, so HHFitCore::Fit does not
+ * allocate memory on the heap. The results are identical to the ones of HHKinFit run on an HHEventRecord with
+ * print, log and graphics levels set to 0, which remains the reference implementation.
+ */
+
+#ifndef HHFITCORE_H_
+#define HHFITCORE_H_
+
+#include <Rtypes.h>
+#include <cmath>
+#include "TLorentzVector.h"
+#include "TMatrixD.h"
+
+// 4-vector in (E, eta, phi, m) with the same arithmetic as HHV4Vector
+class HHFitV4 {
+public:
+  HHFitV4(Double_t e=0., Double_t eta=0., Double_t phi=0., Double_t m=0.)
+    : m_e(e), m_eta(eta), m_phi(phi), m_m(m), m_dE(0) {}
+
+  Double_t E() const    {return(m_e);}
+  Double_t Eta() const  {return(m_eta);}
+  Double_t Theta() const{return(2.*atan(exp(-m_eta)));}
+  Double_t Phi() const  {return(m_phi);}
+  Double_t M() const    {return(m_m);}
+  Double_t dE() const   {return(m_dE);}
+
+  Double_t P() const   {return(sqrt((m_e-m_m)*(m_e+m_m)));}
+  Double_t Px() const  {return(P() * sin(2.*atan(exp(-m_eta))) * cos(m_phi));}
+  Double_t Py() const  {return(P() * sin(2.*atan(exp(-m_eta))) * sin(m_phi));}
+  Double_t Pz() const  {return(P() * cos(2.*atan(exp(-m_eta))));}
+  Double_t Pt() const  {return(P() * sin(2.*atan(exp(-m_eta))));}
+  // Px(), Py() and Pz() with a single evaluation of the polar angle
+  void PxPyPz(Double_t& px, Double_t& py, Double_t& pz) const;
+
+  TLorentzVector LorentzVector() const {return(TLorentzVector(Px(), Py(), Pz(), E()));}
+
+  void SetVector(const TLorentzVector& v) {m_e = v.E(); m_eta = v.Eta(); m_phi=v.Phi(); m_m=v.M();}
+  void SetPxPyPzE(Double_t px, Double_t py, Double_t pz, Double_t e);
+  void SetEEtaPhiM(Double_t e,Double_t eta,Double_t phi,Double_t m) { m_e=e; m_eta=eta; m_phi=phi; m_m=m ; }
+  void SetEkeepM(Double_t e) {m_e=e;}
+  // only the energy resolution is used by the full event fit
+  void SetdE(Double_t de)    {m_dE=de;}
+
+  void Sum(const HHFitV4& q1, const HHFitV4& q2);
+  // transverse covariance from the energy resolution, as HHV4Vector::CalcCov
+  void CalcCov(Double_t cov[2][2]) const;
+
+private:
+  Double_t m_e, m_eta, m_phi, m_m;
+  Double_t m_dE;
+};
+
+// fixed-capacity event record with the decay chain of HHEventRecord::DecayChain,
+// the entries are indexed by HHEventRecord::entry
+class HHFitEventRecord {
+public:
+  enum { nEntries = 12 };
+
+  HHFitV4& operator[](Int_t i)             {return(m_entries[i]);}
+  const HHFitV4& operator[](Int_t i) const {return(m_entries[i]);}
+
+  // recombine all mothers of the given entry up to H
+  void UpdateMothers(Int_t ivDaughter);
+
+  static Int_t Mother(Int_t i);
+  static Int_t Daughter(Int_t i, Int_t n);
+
+private:
+  HHFitV4 m_entries[nEntries];
+};
+
+// measured event and hypothesis of a single fit
+struct HHFitInput {
+  HHFitInput();
+
+  void SetBJets(const TLorentzVector& bjet1, Double_t dE1, const TLorentzVector& bjet2, Double_t dE2);
+  void SetTauVis(const TLorentzVector& tauvis1, const TLorentzVector& tauvis2);
+  void SetAdvancedBalance(const TLorentzVector& met, const TMatrixD& met_cov);
+  // advanced balance without MET measurement, as HHKinFitMaster::setAdvancedBalance with invalid MET
+  void SetAdvancedBalance();
+  void SetSimpleBalance(Double_t balancePt, Double_t balanceUncert);
+  void SetHypothesis(Double_t mh1, Double_t mh2) { m_mh1 = mh1; m_mh2 = mh2; }
+
+  HHFitV4 m_bjet1, m_bjet2, m_tauvis1, m_tauvis2, m_MET;
+  Double_t m_MET_COV[2][2];
+  Bool_t m_advancedBalance;
+  Double_t m_mh1, m_mh2;
+  Int_t m_maxloops;
+  // use the analytic gradient and Hesse matrix of the chi2 in the Newton steps of PSMath::PSfit
+  // instead of the numerical ones of PSMath::PSderivative
+  Bool_t m_analyticDerivatives;
+};
+
+struct HHFitResult {
+  HHFitResult();
+
+  Double_t m_chi2;
+  Double_t m_chi2_b1;
+  Double_t m_chi2_b2;
+  Double_t m_chi2_balance;
+  Int_t m_convergence;
+  Double_t m_fittedmH;
+  Double_t m_pullB1;
+  Double_t m_pullB2;
+  Double_t m_pullBalance;
+  Double_t m_pullBalanceX;
+  Double_t m_pullBalanceY;
+  Bool_t m_fixedCovMatrix;
+
+  HHFitV4 m_bjet1, m_bjet2, m_tau1, m_tau2;
+};
+
+class HHFitCore {
+public:
+  HHFitCore(const HHFitInput& input);
+
+  // fit with the algorithm of HHKinFit::Fit and compute the pulls
+  const HHFitResult& Fit();
+  const HHFitResult& GetResult() const {return(m_result);}
+
+private:
+  void ConstrainE2(Int_t iv4, Int_t iv41, Int_t iv42);
+  Double_t Chi2V4(const HHFitV4& recobject, Int_t iv4) const;
+  Double_t Chi2Balance() const;
+  void InverseCovRecoil(Double_t Vinv[]) const;
+  // gradient g[2] and Hesse matrix H[2*2] of the chi2 w.r.t. E(b1) and E(tau1) at the current fit record
+  void Chi2Derivatives(Double_t g[], Double_t H[]) const;
+  void FillPulls();
+  Double_t HypothesisMass(Int_t iv4) const;
+
+  const HHFitInput& m_input;
+  HHFitEventRecord m_fitrecord;
+  HHFitResult m_result;
+  Double_t m_covRecoil[2][2];
+  Double_t m_px_H_reco, m_py_H_reco;
+};
+
+#endif /* HHFITCORE_H_ */
@@ -6,15 +6,48 @@
 #include <TMatrixD.h>
 #include <TGraph2D.h>
 #include <TCanvas.h>
+#include <exception>
 #include <map>
 #include <utility>
 #include <vector>
 #include <sstream>
 
 #include "TLorentzVector.h"
+#include "HHFitCore.h"
 
 typedef std::map<std::pair<double, double>, double> Chi2Map;
 
+// Results of the full event fit with one entry per mass hypothesis. The hypothesis (mh1[i1], mh2[i2]) has the
+// index i1 * mh2.size() + i2, i.e. the hypotheses are ordered as in the nested loop over mh1 and mh2.
+struct HHFullFitResults
+{
+  std::vector< Int_t > mh1;
+  std::vector< Int_t > mh2;
+  std::vector< Double_t > chi2;
+  std::vector< Double_t > chi2BJet1;
+  std::vector< Double_t > chi2BJet2;
+  std::vector< Double_t > chi2Balance;
+  std::vector< Double_t > fitProb;
+  std::vector< Double_t > mH;
+  std::vector< Double_t > pullB1;
+  std::vector< Double_t > pullB2;
+  std::vector< Double_t > pullBalance;
+  std::vector< Double_t > pullBalanceX;
+  std::vector< Double_t > pullBalanceY;
+  std::vector< Int_t > convergence;
+  std::vector< TLorentzVector > bjet1Fitted;
+  std::vector< TLorentzVector > bjet2Fitted;
+  std::vector< TLorentzVector > tau1Fitted;
+  std::vector< TLorentzVector > tau2Fitted;
+  std::vector< Int_t > fixedCovMatrix; // not std::vector<bool>, since the entries are written concurrently
+
+  size_t size() const { return chi2.size(); }
+  void resize(size_t n);
+
+  // index of the first entry with the given hypothesis, or size() if the hypothesis was not fitted
+  size_t index(Int_t m1, Int_t m2) const;
+};
+
 class HHKinFitMaster
 {
 public:
@@ -25,8 +58,14 @@ public:
   //Setters
   void setAdvancedBalance(const TLorentzVector* met, TMatrixD met_cov);
   void setSimpleBalance(Double_t balancePt, Double_t balanceUncert);
+  // maximal number of threads used to fit the mass hypotheses concurrently (default is 1);
+  // the results do not depend on the number of threads
+  void setNumThreads(unsigned numThreads) { m_numThreads = numThreads; }
+  // use analytic instead of numerical chi2 derivatives in the Newton steps of the fit (default is false)
+  void setAnalyticDerivatives(Bool_t analyticDerivatives) { m_analyticDerivatives = analyticDerivatives; }
   
   //Getters for fit results
+  const HHFullFitResults& getFullFitResults() const { return m_fullFitResults; }
   Double_t getBestChi2FullFit();
   Double_t getBestMHFullFit();
   std::pair< Int_t, Int_t > getBestHypoFullFit();
@@ -40,9 +79,9 @@ public:
   std::map< std::pair< Int_t, Int_t >, Double_t > getPullBalanceFullFitY();
   std::map< std::pair< Int_t, Int_t >, Int_t > getConvergenceFullFit();
 
-  std::map< std::pair< Int_t, Int_t >, Double_t > getChi2B1FullFit(){return m_fullFitResultChi2BJet1;}
-  std::map< std::pair< Int_t, Int_t >, Double_t > getChi2B2FullFit(){return m_fullFitResultChi2BJet2;}
-  std::map< std::pair< Int_t, Int_t >, Double_t > getChi2BalanceFullFit(){return m_fullFitResultChi2Balance;}
+  std::map< std::pair< Int_t, Int_t >, Double_t > getChi2B1FullFit();
+  std::map< std::pair< Int_t, Int_t >, Double_t > getChi2B2FullFit();
+  std::map< std::pair< Int_t, Int_t >, Double_t > getChi2BalanceFullFit();
   //Hypotheses
   void addMh1Hypothesis(std::vector<Int_t> v);
   void addMh1Hypothesis(Double_t m1, Double_t m2=0, Double_t m3=0, Double_t m4=0, Double_t m5=0, Double_t m6=0, Double_t m7=0, Double_t m8=0, Double_t m9=0, Double_t m10=0);
@@ -50,7 +89,12 @@ public:
   void addMh2Hypothesis(Double_t m1, Double_t m2=0, Double_t m3=0, Double_t m4=0, Double_t m5=0, Double_t m6=0, Double_t m7=0, Double_t m8=0, Double_t m9=0, Double_t m10=0);
 
   //Resolution  
-  Double_t GetBjetResolution(Double_t eta, Double_t et);
+  static Double_t GetBjetResolution(Double_t eta, Double_t et);
+  // the parametrization evaluated branch by branch, reference for the binned lookup of GetBjetResolution
+  static Double_t GetBjetResolutionReference(Double_t eta, Double_t et);
+  // largest relative difference between GetBjetResolution and GetBjetResolutionReference
+  // on an (eta, Et) grid with Et in [1, 2001] GeV and all |eta| bin edges
+  static Double_t ValidateBjetResolution(Int_t nEta=601, Int_t nEt=500);
 
   TLorentzVector m_bjet1_fitted;
   TLorentzVector m_bjet2_fitted;
@@ -63,6 +107,12 @@ public:
   double m_bjet2Smear;
   bool m_fixedCovMatrix;
 private:
+  void setupFitInput(HHFitInput& input);
+  void fitHypothesis(size_t index);
+  void fitHypotheses(unsigned first, unsigned step, std::exception_ptr& error);
+  template<typename T>
+  std::map< std::pair< Int_t, Int_t >, T > makeHypoMap(const std::vector<T>& values) const;
+
   //hypotheses
   std::vector< Int_t > m_mh1;
   std::vector< Int_t > m_mh2;
@@ -81,18 +131,10 @@ private:
   Bool_t m_advancedBalance;
   Double_t m_simpleBalancePt;
   Double_t m_simpleBalanceUncert;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitResultChi2;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitResultChi2BJet1;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitResultChi2BJet2;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitResultChi2Balance;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitResultFitProb;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitResultMH;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitPullB1;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitPullB2;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitPullBalance;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitPullBalanceX;
-  std::map< std::pair< Int_t, Int_t >, Double_t > m_fullFitPullBalanceY;
-  std::map< std::pair< Int_t, Int_t >, Int_t > m_fullFitConvergence;
+  unsigned m_numThreads;
+  Bool_t m_analyticDerivatives;
+  HHFitInput m_fitInput;
+  HHFullFitResults m_fullFitResults;
 
   Double_t m_bestChi2FullFit;
   Double_t m_bestMHFullFit;
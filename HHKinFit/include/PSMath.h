@@ -10,7 +10,8 @@ class PSMath {
 	      Bool_t &noNewtonShifts, Int_t printlevel,
 	      Int_t np, Double_t a[], Double_t astart[], Double_t alimit[][2], 
 	      Double_t aprec[], Double_t daN[], Double_t h[], Double_t aMemory[][5],
-	      Double_t chi2, Double_t chi2iter[], Double_t g[], Double_t H[], Double_t Hinv[] );
+	      Double_t chi2, Double_t chi2iter[], Double_t g[], Double_t H[], Double_t Hinv[],
+	      Bool_t analyticDerivatives = false );
 
   static void PSNewtonLimitShift(Int_t sign, Int_t np, Double_t a[], Double_t alimit[][2], Double_t aprec[],
 			  Double_t daN[], Double_t h[], Double_t g[], Double_t H[]);
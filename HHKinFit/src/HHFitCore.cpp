@@ -0,0 +1,662 @@
+/*
+ * HHFitCore.cpp
+ *
+ * Value-type core of the full event fit, see HHFitCore.h.
+ */
+
+#include "../include/HHFitCore.h"
+#include "../include/HHEventRecord.h"
+#include "../include/PSMath.h"
+
+namespace {
+  const Double_t mtau = 1.777;
+
+  // momentum of a fitted object and its first two derivatives w.r.t. its energy:
+  // b-jets keep their velocity in the fit (p = beta*E), taus keep their mass (p = sqrt(E^2 - m^2))
+  void MomentumDerivatives(const HHFitV4& v, Bool_t jet, Double_t& p, Double_t& dp, Double_t& d2p)
+  {
+    p = v.P();
+    if (jet) {
+      dp = p / v.E();
+      d2p = 0;
+    }
+    else {
+      dp = v.E() / p;
+      d2p = -v.M() * v.M() / (p * p * p);
+    }
+  }
+
+  // derivatives of a mother constrained by ConstrainE2 w.r.t. the energy E1 of its free daughter v1:
+  // dE2 and d2E2 of the energy of the constrained daughter v2, which follow from M^2(E1, E2) = Mc^2
+  // as implicit function, and dpx, dpy, d2px and d2py of the transverse momentum of the mother
+  void ConstrainedDerivatives(const HHFitV4& v1, const HHFitV4& v2, Bool_t jet,
+                              Double_t& dE2, Double_t& d2E2,
+                              Double_t& dpx, Double_t& dpy, Double_t& d2px, Double_t& d2py)
+  {
+    Double_t p1, dp1, d2p1, p2, dp2, d2p2;
+    MomentumDerivatives(v1, jet, p1, dp1, d2p1);
+    MomentumDerivatives(v2, jet, p2, dp2, d2p2);
+    const Double_t E1 = v1.E();
+    const Double_t E2 = v2.E();
+    const Double_t nx1 = sin(v1.Theta()) * cos(v1.Phi());
+    const Double_t ny1 = sin(v1.Theta()) * sin(v1.Phi());
+    const Double_t nx2 = sin(v2.Theta()) * cos(v2.Phi());
+    const Double_t ny2 = sin(v2.Theta()) * sin(v2.Phi());
+    const Double_t c = nx1 * nx2 + ny1 * ny2 + cos(v1.Theta()) * cos(v2.Theta());
+
+    // M^2 = (E1 + E2)^2 - |p1 n1 + p2 n2|^2
+    const Double_t F1 = 2. * (E1 + E2 - p1 * dp1 - dp1 * p2 * c);
+    const Double_t F2 = 2. * (E1 + E2 - p2 * dp2 - p1 * dp2 * c);
+    const Double_t F11 = 2. * (1. - dp1 * dp1 - p1 * d2p1 - d2p1 * p2 * c);
+    const Double_t F22 = 2. * (1. - dp2 * dp2 - p2 * d2p2 - p1 * d2p2 * c);
+    const Double_t F12 = 2. * (1. - dp1 * dp2 * c);
+    dE2 = -F1 / F2;
+    d2E2 = -(F11 + 2. * F12 * dE2 + F22 * dE2 * dE2) / F2;
+
+    const Double_t d2p2E1 = d2p2 * dE2 * dE2 + dp2 * d2E2;
+    dpx = dp1 * nx1 + dp2 * dE2 * nx2;
+    dpy = dp1 * ny1 + dp2 * dE2 * ny2;
+    d2px = d2p1 * nx1 + d2p2E1 * nx2;
+    d2py = d2p1 * ny1 + d2p2E1 * ny2;
+  }
+}
+
+void
+HHFitV4::SetPxPyPzE(Double_t px, Double_t py, Double_t pz, Double_t e)
+{
+  m_e = e;
+  Double_t p2 = px * px + py * py + pz * pz;
+  if (p2 == 0.) {
+    m_eta = 0.;
+    m_phi = 0.;
+  }
+  else {
+    Double_t p = sqrt(p2);
+    if (e - p < 0.) {
+      p = e;
+      m_m = 0;
+    }
+    else
+      m_m = sqrt((e - p) * (e + p));
+
+    m_phi = atan2(py, px);
+    Double_t theta = acos(pz / p);
+    m_eta = -log(tan(theta / 2.));
+  }
+}
+
+void
+HHFitV4::PxPyPz(Double_t& px, Double_t& py, Double_t& pz) const
+{
+  const Double_t p = P();
+  const Double_t theta = 2.*atan(exp(-m_eta));
+  px = p * sin(theta) * cos(m_phi);
+  py = p * sin(theta) * sin(m_phi);
+  pz = p * cos(theta);
+}
+
+void
+HHFitV4::Sum(const HHFitV4& q1, const HHFitV4& q2)
+{
+  Double_t px1, py1, pz1, px2, py2, pz2;
+  q1.PxPyPz(px1, py1, pz1);
+  q2.PxPyPz(px2, py2, pz2);
+  SetPxPyPzE(px1 + px2, py1 + py2, pz1 + pz2, q1.E() + q2.E());
+}
+
+void
+HHFitV4::CalcCov(Double_t cov[2][2]) const
+{
+  cov[0][0] = 0;
+  cov[0][1] = 0;
+  cov[1][0] = 0;
+  cov[1][1] = 0;
+
+  if (P()>0){
+    Double_t dp = E()/P()*dE(); // error propagation p=sqrt(e^2-m^2)
+    Double_t dpt = sin(Theta())*dp;
+
+    cov[0][0] = pow(cos(Phi())*dpt,2);
+    cov[1][1] = pow(sin(Phi())*dpt,2);
+    cov[0][1] = sin(Phi())*cos(Phi())*dpt*dpt;
+    cov[1][0] = sin(Phi())*cos(Phi())*dpt*dpt;
+  }
+}
+
+Int_t
+HHFitEventRecord::Mother(Int_t i)
+{
+  static const Int_t mothers[nEntries] = {
+    HHEventRecord::undef,                          // MET
+    HHEventRecord::undef,                          // H
+    HHEventRecord::H, HHEventRecord::H,            // htau, hb
+    HHEventRecord::htau, HHEventRecord::htau,      // tau1, tau2
+    HHEventRecord::hb, HHEventRecord::hb,          // b1, b2
+    HHEventRecord::tau1, HHEventRecord::tau1,      // tauvis1, tauinvis1
+    HHEventRecord::tau2, HHEventRecord::tau2       // tauvis2, tauinvis2
+  };
+  return mothers[i];
+}
+
+Int_t
+HHFitEventRecord::Daughter(Int_t i, Int_t n)
+{
+  // all decays are two-body decays, the daughters of a mother are stored next to each other
+  static const Int_t firstDaughters[nEntries] = {
+    HHEventRecord::undef, HHEventRecord::htau, HHEventRecord::tau1, HHEventRecord::b1,
+    HHEventRecord::tauvis1, HHEventRecord::tauvis2,
+    HHEventRecord::undef, HHEventRecord::undef, HHEventRecord::undef, HHEventRecord::undef,
+    HHEventRecord::undef, HHEventRecord::undef
+  };
+  return firstDaughters[i] + n;
+}
+
+void
+HHFitEventRecord::UpdateMothers(Int_t ivdaughter)
+{
+  // recombine mother particles from daughter, as HHEventRecord::UpdateMothers:
+  // the mother is reset to (0,0,0,0), which has momentum components +0, and the daughters are added one by one
+  for (Int_t ivmother = Mother(ivdaughter); ivmother >= 0; ivmother = Mother(ivmother)) {
+    HHFitV4& motherentry = m_entries[ivmother];
+    const HHFitV4& daughter1 = m_entries[Daughter(ivmother, 0)];
+    Double_t px, py, pz;
+    daughter1.PxPyPz(px, py, pz);
+    motherentry.SetEEtaPhiM(0., 0., 0., 0.);
+    motherentry.SetPxPyPzE(0. + px, 0. + py, 0. + pz, 0. + daughter1.E());
+    motherentry.Sum(motherentry, m_entries[Daughter(ivmother, 1)]);
+  }
+}
+
+HHFitInput::HHFitInput()
+  : m_advancedBalance(false),
+    m_mh1(125.), m_mh2(100.),
+    m_maxloops(500),
+    m_analyticDerivatives(false)
+{
+  SetSimpleBalance(0.0, 10.0);
+}
+
+void
+HHFitInput::SetBJets(const TLorentzVector& bjet1, Double_t dE1, const TLorentzVector& bjet2, Double_t dE2)
+{
+  m_bjet1.SetVector(bjet1);
+  m_bjet1.SetdE(dE1);
+  m_bjet2.SetVector(bjet2);
+  m_bjet2.SetdE(dE2);
+}
+
+void
+HHFitInput::SetTauVis(const TLorentzVector& tauvis1, const TLorentzVector& tauvis2)
+{
+  m_tauvis1.SetVector(tauvis1);
+  m_tauvis2.SetVector(tauvis2);
+}
+
+void
+HHFitInput::SetAdvancedBalance(const TLorentzVector& met, const TMatrixD& met_cov)
+{
+  m_advancedBalance = true;
+  m_MET = HHFitV4();
+  m_MET.SetVector(met);
+  m_MET_COV[0][0] = met_cov(0,0);
+  m_MET_COV[0][1] = met_cov(0,1);
+  m_MET_COV[1][0] = met_cov(1,0);
+  m_MET_COV[1][1] = met_cov(1,1);
+}
+
+void
+HHFitInput::SetAdvancedBalance()
+{
+  m_advancedBalance = true;
+  m_MET = HHFitV4();
+  m_MET.CalcCov(m_MET_COV);
+}
+
+void
+HHFitInput::SetSimpleBalance(Double_t balancePt, Double_t balanceUncert)
+{
+  m_advancedBalance = false;
+  m_MET = HHFitV4(balancePt, 0, 0, 0);
+  m_MET.SetdE(balanceUncert);
+  m_MET.CalcCov(m_MET_COV);
+}
+
+HHFitResult::HHFitResult()
+  : m_chi2(-1), m_chi2_b1(-1), m_chi2_b2(-1), m_chi2_balance(-1),
+    m_convergence(0), m_fittedmH(-1),
+    m_pullB1(0), m_pullB2(0), m_pullBalance(-99), m_pullBalanceX(-999), m_pullBalanceY(-999),
+    m_fixedCovMatrix(false)
+{
+}
+
+HHFitCore::HHFitCore(const HHFitInput& input)
+  : m_input(input), m_px_H_reco(0), m_py_H_reco(0)
+{
+}
+
+Double_t
+HHFitCore::HypothesisMass(Int_t iv4) const
+{
+  return iv4 == HHEventRecord::htau ? m_input.m_mh1 : m_input.m_mh2;
+}
+
+const HHFitResult&
+HHFitCore::Fit()
+{
+  //  ----------  for PSfit -----
+  const Int_t np = 2;
+  Double_t a[np];
+  Double_t astart[np];
+  Double_t alimit[np][2];
+  Double_t aprec[np];
+  Double_t daN[np];
+  Double_t h[np];
+  Double_t chi2iter[1], aMemory[np][5], g[np], H[np * np], Hinv[np * np];
+  Bool_t noNewtonShifts = false;
+
+  Int_t iter = 0;             //  number of iterations
+  Int_t method = 1;           //  initial fit method, see PSfit()
+  Int_t mode = 1;             //  mode =1 for start of a new fit by PSfit()
+
+  m_result = HHFitResult();
+  m_fitrecord[HHEventRecord::b1] = m_input.m_bjet1;
+  m_fitrecord[HHEventRecord::b2] = m_input.m_bjet2;
+
+  const HHFitV4& tauvis1 = m_input.m_tauvis1;
+  const HHFitV4& tauvis2 = m_input.m_tauvis2;
+  HHFitV4& b1 = m_fitrecord[HHEventRecord::b1];
+  HHFitV4& b2 = m_fitrecord[HHEventRecord::b2];
+  HHFitV4& tau1 = m_fitrecord[HHEventRecord::tau1];
+  HHFitV4& tau2 = m_fitrecord[HHEventRecord::tau2];
+
+  Double_t bjet1UpperLimit = m_input.m_bjet1.E() + 5.0 * m_input.m_bjet1.dE();
+  Double_t bjet1LowerLimit = m_input.m_bjet1.E() - 5.0 * m_input.m_bjet1.dE();
+  Double_t bjet2UpperLimit = m_input.m_bjet2.E() + 5.0 * m_input.m_bjet2.dE();
+  Double_t bjet2LowerLimit = m_input.m_bjet2.E() - 5.0 * m_input.m_bjet2.dE();
+
+  Double_t tau1LowerLimit = tauvis1.E();
+  Double_t tau2LowerLimit = tauvis2.E();
+
+  //the measured transverse momentum of H does not change during the fit
+  m_px_H_reco = m_input.m_MET.Px() + m_input.m_bjet1.Px() + m_input.m_bjet2.Px() + tauvis1.Px() + tauvis2.Px();
+  m_py_H_reco = m_input.m_MET.Py() + m_input.m_bjet1.Py() + m_input.m_bjet2.Py() + tauvis1.Py() + tauvis2.Py();
+
+  //Calculate Recoil CovMatrix
+  Double_t Cov_b1[2][2], Cov_b2[2][2], Cov_tauvis1[2][2], Cov_tauvis2[2][2];
+  m_input.m_bjet1.CalcCov(Cov_b1);
+  m_input.m_bjet2.CalcCov(Cov_b2);
+  tauvis1.CalcCov(Cov_tauvis1);
+  tauvis2.CalcCov(Cov_tauvis2);
+  for (Int_t i = 0; i < 2; i++) {
+    for (Int_t j = 0; j < 2; j++) {
+      m_covRecoil[i][j] = m_input.m_MET_COV[i][j] - (Cov_b1[i][j] + Cov_b2[i][j] + Cov_tauvis1[i][j] + Cov_tauvis2[i][j]);
+    }
+  }
+
+  //a 2x2 matrix has a negative eigenvalue (or a negative real part of complex eigenvalues)
+  //if its determinant or its trace is negative
+  const Double_t covRecoilDet = m_covRecoil[0][0] * m_covRecoil[1][1] - m_covRecoil[0][1] * m_covRecoil[1][0];
+  const Double_t covRecoilTrace = m_covRecoil[0][0] + m_covRecoil[1][1];
+  if (covRecoilDet < 0 || covRecoilTrace < 0){
+    m_result.m_fixedCovMatrix = true;
+    m_covRecoil[0][0] = 100;
+    m_covRecoil[1][1] = 100;
+    m_covRecoil[1][0] = 0;
+    m_covRecoil[0][1] = 0;
+  }
+
+  // initialise tau1 and tau2 vectors
+  if(tauvis1.E() > mtau)
+    tau1.SetEEtaPhiM(tauvis1.E(), tauvis1.Eta(), tauvis1.Phi(), mtau);
+  else
+    tau1.SetEEtaPhiM(pow(tauvis1.P(),2)+pow(mtau,2), tauvis1.Eta(), tauvis1.Phi(), mtau);
+
+  if(tau2LowerLimit > mtau)
+    tau2.SetEEtaPhiM(tau2LowerLimit, tauvis2.Eta(), tauvis2.Phi(), mtau);
+  else
+    tau2.SetEEtaPhiM(pow(tauvis2.P(),2)+pow(mtau,2), tauvis2.Eta(), tauvis2.Phi(), mtau);
+
+  //firstly, compute upper limit of E(tau1) by having set E(tau2)=E(tau2)_min and compute E(tau1)
+  ConstrainE2(HHEventRecord::htau, HHEventRecord::tau2, HHEventRecord::tau1);
+  Double_t maxEtau1 = tau1.E();
+  Double_t minEtau1 = tau1LowerLimit;
+
+  //Reset taus
+  if(tauvis2.E() > mtau)
+    tau2.SetEEtaPhiM(tauvis2.E(), tauvis2.Eta(), tauvis2.Phi(), mtau);
+  else
+    tau2.SetEEtaPhiM(pow(tauvis2.P(),2)+pow(mtau,2), tauvis2.Eta(), tauvis2.Phi(), mtau);
+
+  //the reset of a soft tau1 overwrites tau2, as in HHKinFit::Fit
+  if(tauvis1.E() > mtau)
+    tau1.SetEEtaPhiM(tauvis1.E(), tauvis1.Eta(), tauvis1.Phi(), mtau);
+  else
+    tau2.SetEEtaPhiM(pow(tauvis1.P(),2)+pow(mtau,2), tauvis1.Eta(), tauvis1.Phi(), mtau);
+
+  ConstrainE2(HHEventRecord::htau, HHEventRecord::tau1, HHEventRecord::tau2);
+
+  m_fitrecord.UpdateMothers(HHEventRecord::b1);
+  m_fitrecord.UpdateMothers(HHEventRecord::tau1);
+
+  if (!(maxEtau1>=tauvis1.E()) ){
+    m_result.m_convergence=-1;
+    m_result.m_chi2=9999;
+    m_result.m_chi2_b1=9999;
+    m_result.m_chi2_b2=9999;
+    m_result.m_chi2_balance=9999;
+    m_result.m_fittedmH=-1;
+    FillPulls();
+    return m_result;
+  }
+
+  // fill initial tau fit parameters
+  astart[1] = tau1.E();         // energy of first tau
+  aprec[1] = 0.1;               // precision for fit
+  astart[0] = b1.E();           // energy of first b-jet
+  aprec[0] = astart[0]*0.002;   // precision for fit
+  // fill initial step width
+  h[0] = 0.5*b1.dE();
+  h[1] = 0.1*minEtau1;
+
+  daN[0] = 1.0;                 // initial search direction in Eb-Etau diagonal
+  daN[1] = 1.0;
+
+  // fit range
+  alimit[0][0] = bjet1LowerLimit;
+  if (alimit[0][0]<0.01) alimit[0][0]=0.01;
+  alimit[0][1] = bjet1UpperLimit;
+
+  //EBJet2 Constraints
+  double E_bjet2 = b2.E();
+  double E_bjet2Low = bjet2LowerLimit;
+  double E_bjet2High = bjet2UpperLimit;
+  if( E_bjet2Low <= 0.01)
+    E_bjet2Low = 0.01;
+
+  b2.SetEEtaPhiM(E_bjet2Low, b2.Eta(), b2.Phi(), b2.M() * E_bjet2Low/E_bjet2);   //Set b2 to lower b2 limit
+  ConstrainE2(HHEventRecord::hb, HHEventRecord::b2, HHEventRecord::b1);          //Calculate b1 with b2 fixed
+  if(alimit[0][1] > b1.E())
+    alimit[0][1] = b1.E();                                                       //Modify b1 limit if b2 limit is tighter
+
+  b2.SetEEtaPhiM(E_bjet2High, b2.Eta(), b2.Phi(), b2.M() * E_bjet2High/E_bjet2Low); //Set b2 to upper b2 limit
+  ConstrainE2(HHEventRecord::hb, HHEventRecord::b2, HHEventRecord::b1);             //Calculate b1 with b2 fixed
+  if(alimit[0][0] < b1.E())
+    alimit[0][0] = b1.E();                                                          //Modify b1 limit if b2 limit is tighter
+
+  //Fill initial bjet fit parameters
+  if(alimit[0][1] - alimit[0][0] > 0.5*b1.dE()){
+    astart[0] = alimit[0][0] + (alimit[0][1] - alimit[0][0])/2.0;         // energy of first b-jet
+  }
+  else{
+    m_result.m_convergence=-2;
+    m_result.m_chi2=9999;
+    m_result.m_chi2_b1=9999;
+    m_result.m_chi2_b2=9999;
+    m_result.m_chi2_balance=9999;
+    m_result.m_fittedmH=-1;
+    FillPulls();
+    return m_result;
+  }
+
+  b1.SetEEtaPhiM(astart[0], b1.Eta(), b1.Phi(), b1.M()*astart[0]/b1.E());
+  ConstrainE2(HHEventRecord::hb, HHEventRecord::b1, HHEventRecord::b2);
+
+  alimit[1][0] = minEtau1;              // tau: minimum is visible tau1 energy
+  alimit[1][1] = maxEtau1;              //      maximum as computed above
+
+  // tau: check initial values against fit range
+  if (astart[1] - h[1] < alimit[1][0]) {
+    astart[1] = alimit[1][0] + h[1];
+  }
+  else if (astart[1] + h[1] > alimit[1][1]) {
+    astart[1] = alimit[1][1] - h[1];
+  }
+
+  for (Int_t ip = 0; ip < np; ip++) {
+    a[ip] = astart[ip];
+  }
+  //HHKinFit::Fit leaves aMemory[ip][4] uninitialized, although PSfit reads it
+  for (Int_t ip = 0; ip < np; ip++) {
+    aMemory[ip][0] = -999.0;
+    aMemory[ip][1] = -995.0;
+    aMemory[ip][2] = -990.0;
+    aMemory[ip][3] = -985.0;
+    aMemory[ip][4] = -980.0;
+  }
+
+  ConstrainE2(HHEventRecord::htau, HHEventRecord::tau1, HHEventRecord::tau2);
+  ConstrainE2(HHEventRecord::hb, HHEventRecord::b1, HHEventRecord::b2);
+
+  for (Int_t iloop = 0; iloop < m_input.m_maxloops * 10 && iter < m_input.m_maxloops; iloop++) { // FIT loop
+    b1.SetEEtaPhiM(a[0], b1.Eta(), b1.Phi(), b1.M()*a[0]/b1.E());
+    tau1.SetEkeepM(a[1]);
+    ConstrainE2(HHEventRecord::hb, HHEventRecord::b1, HHEventRecord::b2);
+    ConstrainE2(HHEventRecord::htau, HHEventRecord::tau1, HHEventRecord::tau2);
+
+    m_result.m_chi2_b1 = Chi2V4(m_input.m_bjet1, HHEventRecord::b1);
+    m_result.m_chi2_b2 = Chi2V4(m_input.m_bjet2, HHEventRecord::b2);
+    m_result.m_chi2_balance = Chi2Balance();
+    m_result.m_chi2 = m_result.m_chi2_b1 + m_result.m_chi2_b2 + m_result.m_chi2_balance; // chi2 calculation
+
+    if (m_result.m_convergence != 0) {
+      break;
+    }
+    if (m_input.m_analyticDerivatives && method == 2)
+      Chi2Derivatives(g, H);
+    m_result.m_convergence = PSMath::PSfit(iloop, iter, method, mode, noNewtonShifts, 0,
+                                           np, a, astart, alimit, aprec,
+                                           daN, h, aMemory, m_result.m_chi2, chi2iter, g, H,
+                                           Hinv, m_input.m_analyticDerivatives);
+  }
+  // ------ end of FIT loop
+  m_result.m_fittedmH = m_fitrecord[HHEventRecord::H].M();
+
+  Int_t& convergence = m_result.m_convergence;
+  if(convergence != 0 && convergence != 5){
+    if(a[0] < (alimit[0][0] + 2*aprec[0]) )
+      convergence = 3;
+    if(a[0] > (alimit[0][1] - 2*aprec[0]) )
+      convergence = 3;
+    if(a[1] < (alimit[1][0] + 2*aprec[1]) )
+      convergence = convergence == 3 ? 5 : 4;
+    if(a[1] > (alimit[1][1] - 2*aprec[1]) )
+      convergence = convergence == 3 ? 5 : 4;
+  }
+
+  FillPulls();
+  return m_result;
+}
+
+void
+HHFitCore::ConstrainE2(Int_t iv4, Int_t iv41, Int_t iv42)
+{
+  Double_t M1, M2, M, Mc, E1, E2, b2, beta2;
+  m_fitrecord.UpdateMothers(iv41);
+  Mc = HypothesisMass(iv4);
+  M = m_fitrecord[iv4].M();
+
+  // b-jets change their mass together with the energy, the taus keep it
+  const Bool_t jet = iv42 == HHEventRecord::b1 || iv42 == HHEventRecord::b2;
+  HHFitV4& v41 = m_fitrecord[iv41];
+  HHFitV4& v42 = m_fitrecord[iv42];
+
+  while(fabs(M-Mc) > 0.000001){
+    E1 = v41.E();
+    M1 = v41.M();
+    E2 = v42.E();
+    M2 = v42.M();
+
+    if (M2 == 0.) { // massless case
+      v42.SetEkeepM(E2 * (Mc / M) * (Mc / M)); // only changes absolute value and keeps eta, phi, m untouched
+      m_fitrecord.UpdateMothers(iv42);
+      return;
+    }
+
+    beta2 = sqrt(E2 * E2 - M2 * M2) / E2;
+    if (!jet)
+      b2 = (M2 / E2) * (M2 / E2);
+    else
+      b2 = 1 - beta2 * beta2;
+
+    Double_t d = (M * M - M1 * M1 - M2 * M2) / (2. * E1 * E2);
+    Double_t E2lin = (Mc * Mc - M1 * M1) / (2. * E1 * d);
+    Double_t E2N = E1 * d / b2;
+    Double_t E2new = E2N * (-1. + sqrt(1. + 2. * E2lin / E2N));
+
+    if (!jet)
+      v42.SetEkeepM(E2new);
+    else
+      v42.SetEEtaPhiM(E2new, v42.Eta(), v42.Phi(), M2 * E2new / E2);
+
+    m_fitrecord.UpdateMothers(iv42);
+    M = m_fitrecord[iv4].M();
+  }
+}
+
+Double_t
+HHFitCore::Chi2V4(const HHFitV4& recobject, Int_t iv4) const
+{
+  const HHFitV4& fitobject = m_fitrecord[iv4];
+  Double_t chi2_E = 0;
+  if (recobject.dE() > 0.) {
+    chi2_E = ((recobject.E() - fitobject.E()) / recobject.dE())
+        * ((recobject.E() - fitobject.E()) / recobject.dE());
+  }
+  return chi2_E;
+}
+
+Double_t
+HHFitCore::Chi2Balance() const
+{
+  const HHFitV4& fitH = m_fitrecord[HHEventRecord::H];
+
+  Double_t px_H_reco = m_px_H_reco + 1.0;   //+ 1.0 as in HHKinFit::Chi2Balance
+  Double_t py_H_reco = m_py_H_reco + 1.0;
+
+  if (!m_input.m_advancedBalance){
+    Double_t pt_H_reco = sqrt(pow(px_H_reco,2) + pow(py_H_reco,2));
+    return pow(( pt_H_reco - fitH.Pt()), 2) / pow((m_input.m_MET.dE()), 2);
+  }
+
+  Double_t res[2];
+  res[0] = fitH.Px() - px_H_reco;    // residuum in Pt_H
+  res[1] = fitH.Py() - py_H_reco;    // residuum in Pt_H
+
+  Double_t Vinv[2 * 2];
+  InverseCovRecoil(Vinv);
+
+  return res[0] * (Vinv[0] * res[0] + Vinv[1] * res[1]) // chi2 = res_transponiert * Vinv * res
+       + res[1] * (Vinv[2] * res[0] + Vinv[3] * res[1]);
+}
+
+void
+HHFitCore::InverseCovRecoil(Double_t Vinv[]) const
+{
+  Double_t Vxx = m_covRecoil[0][0];
+  Double_t Vyy = m_covRecoil[1][1];
+  Double_t Vxy = m_covRecoil[0][1];
+
+  Double_t det = Vxx * Vyy - Vxy * Vxy;
+  Vinv[0] = Vyy / det;
+  Vinv[1] = -Vxy / det;
+  Vinv[2] = Vinv[1];
+  Vinv[3] = Vxx / det;
+}
+
+void
+HHFitCore::Chi2Derivatives(Double_t g[], Double_t H[]) const
+{
+  const Int_t np = 2;
+  const HHFitV4& b2 = m_fitrecord[HHEventRecord::b2];
+  const HHFitV4& fitH = m_fitrecord[HHEventRecord::H];
+
+  // fit parameters a[0] = E(b1) and a[1] = E(tau1) move b2 and tau2 through the mass constraints,
+  // the b-jet and the tau systems are independent, so the second derivatives of pt(H) are diagonal
+  Double_t dE2[np], d2E2[np], dpx[np], dpy[np], d2px[np], d2py[np];
+  ConstrainedDerivatives(m_fitrecord[HHEventRecord::b1], b2, true,
+                         dE2[0], d2E2[0], dpx[0], dpy[0], d2px[0], d2py[0]);
+  ConstrainedDerivatives(m_fitrecord[HHEventRecord::tau1], m_fitrecord[HHEventRecord::tau2], false,
+                         dE2[1], d2E2[1], dpx[1], dpy[1], d2px[1], d2py[1]);
+
+  for (Int_t ip = 0; ip < np * np; ip++) {
+    if (ip < np)
+      g[ip] = 0;
+    H[ip] = 0;
+  }
+
+  // b-jet energies, as Chi2V4
+  const Double_t dEb1 = m_input.m_bjet1.dE();
+  const Double_t dEb2 = m_input.m_bjet2.dE();
+  if (dEb1 > 0.) {
+    g[0] += -2. * (m_input.m_bjet1.E() - m_fitrecord[HHEventRecord::b1].E()) / (dEb1 * dEb1);
+    H[0] += 2. / (dEb1 * dEb1);
+  }
+  if (dEb2 > 0.) {
+    const Double_t res = m_input.m_bjet2.E() - b2.E();
+    g[0] += -2. * res * dE2[0] / (dEb2 * dEb2);
+    H[0] += 2. * (dE2[0] * dE2[0] - res * d2E2[0]) / (dEb2 * dEb2);
+  }
+
+  // balance, as Chi2Balance
+  Double_t px, py, pz;
+  fitH.PxPyPz(px, py, pz);
+  if (m_input.m_advancedBalance) {
+    Double_t Vinv[2 * 2];
+    InverseCovRecoil(Vinv);
+    const Double_t res[2] = { px - (m_px_H_reco + 1.0), py - (m_py_H_reco + 1.0) };
+    const Double_t w[2] = { Vinv[0] * res[0] + Vinv[1] * res[1], Vinv[2] * res[0] + Vinv[3] * res[1] };
+    for (Int_t ip = 0; ip < np; ip++) {
+      g[ip] += 2. * (dpx[ip] * w[0] + dpy[ip] * w[1]);
+      for (Int_t jp = 0; jp < np; jp++) {
+        H[ip * np + jp] += 2. * (dpx[ip] * (Vinv[0] * dpx[jp] + Vinv[1] * dpy[jp])
+                                 + dpy[ip] * (Vinv[2] * dpx[jp] + Vinv[3] * dpy[jp]));
+      }
+      H[ip * np + ip] += 2. * (d2px[ip] * w[0] + d2py[ip] * w[1]);
+    }
+  }
+  else {
+    const Double_t sigma2 = pow(m_input.m_MET.dE(), 2);
+    const Double_t pt = fitH.Pt();
+    const Double_t res = sqrt(pow(m_px_H_reco + 1.0, 2) + pow(m_py_H_reco + 1.0, 2)) - pt;
+    Double_t dpt[np];
+    for (Int_t ip = 0; ip < np; ip++)
+      dpt[ip] = (px * dpx[ip] + py * dpy[ip]) / pt;
+    for (Int_t ip = 0; ip < np; ip++) {
+      g[ip] += -2. * res * dpt[ip] / sigma2;
+      for (Int_t jp = 0; jp < np; jp++) {
+        Double_t d2pt = (dpx[ip] * dpx[jp] + dpy[ip] * dpy[jp] - dpt[ip] * dpt[jp]) / pt;
+        if (ip == jp)
+          d2pt += (px * d2px[ip] + py * d2py[ip]) / pt;
+        H[ip * np + jp] += 2. * (dpt[ip] * dpt[jp] - res * d2pt) / sigma2;
+      }
+    }
+  }
+}
+
+void
+HHFitCore::FillPulls()
+{
+  const HHFitV4& fitH = m_fitrecord[HHEventRecord::H];
+
+  m_result.m_bjet1 = m_fitrecord[HHEventRecord::b1];
+  m_result.m_bjet2 = m_fitrecord[HHEventRecord::b2];
+  m_result.m_tau1 = m_fitrecord[HHEventRecord::tau1];
+  m_result.m_tau2 = m_fitrecord[HHEventRecord::tau2];
+
+  m_result.m_pullB1 = (m_result.m_bjet1.E() - m_input.m_bjet1.E()) / m_input.m_bjet1.dE();
+  m_result.m_pullB2 = (m_result.m_bjet2.E() - m_input.m_bjet2.E()) / m_input.m_bjet2.dE();
+
+  m_result.m_pullBalance = -99;
+  m_result.m_pullBalanceX = -999;
+  m_result.m_pullBalanceY = -999;
+  if (m_input.m_advancedBalance){
+    if(m_result.m_chi2_balance >= 0)
+      m_result.m_pullBalance = sqrt(m_result.m_chi2_balance);
+    m_result.m_pullBalanceX = (m_px_H_reco - fitH.Px()) / sqrt(m_covRecoil[0][0]);
+    m_result.m_pullBalanceY = (m_py_H_reco - fitH.Py()) / sqrt(m_covRecoil[1][1]);
+  }
+  else{
+    Double_t pt_H_reco = sqrt(pow(m_px_H_reco,2) + pow(m_py_H_reco,2));
+    m_result.m_pullBalance = (pt_H_reco - fitH.Pt()) / m_input.m_MET.dE();
+  }
+}
@@ -19,7 +19,8 @@
 #include <iostream>
 
 HHKinFit::HHKinFit(HHEventRecord* recrecord)
-    : m_chi2(-1), m_chi2_b1(-1), m_chi2_b2(-1), m_chi2_balance(-1),
+    : m_fixedCovMatrix(false),
+      m_chi2(-1), m_chi2_b1(-1), m_chi2_b2(-1), m_chi2_balance(-1),
       m_convergence(0), m_fittedmH(-1),
       m_covRecoil(2,2),
       m_printlevel(0), m_graphicslevel(0),
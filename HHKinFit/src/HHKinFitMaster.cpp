@@ -1,178 +1,180 @@
 #include "../include/HHKinFitMaster.h"
 
-#include "../include/HHEventRecord.h"
-#include "../include/HHKinFit.h"
-#include "../include/HHParticleList.h"
-#include "../include/HHPID.h"
-#include "../include/HHV4Vector.h"
 #include "TMatrixD.h"
 
 #include "TRandom3.h"
 
 #include <TMath.h>
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <functional>
 #include <iterator>
+#include <thread>
 
 void
-HHKinFitMaster::doFullFit()
+HHFullFitResults::resize(size_t n)
 {
-  //Setup event
-  HHParticleList* particlelist = new HHParticleList();
-  HHEventRecord eventrecord_rec(particlelist);
+  mh1.resize(n);
+  mh2.resize(n);
+  chi2.resize(n);
+  chi2BJet1.resize(n);
+  chi2BJet2.resize(n);
+  chi2Balance.resize(n);
+  fitProb.resize(n);
+  mH.resize(n);
+  pullB1.resize(n);
+  pullB2.resize(n);
+  pullBalance.resize(n);
+  pullBalanceX.resize(n);
+  pullBalanceY.resize(n);
+  convergence.resize(n);
+  bjet1Fitted.resize(n);
+  bjet2Fitted.resize(n);
+  tau1Fitted.resize(n);
+  tau2Fitted.resize(n);
+  fixedCovMatrix.resize(n);
+}
 
-  eventrecord_rec.UpdateEntry(HHEventRecord::tauvis1)->SetVector(*m_tauvis1);
-  eventrecord_rec.UpdateEntry(HHEventRecord::tauvis2)->SetVector(*m_tauvis2);
+size_t
+HHFullFitResults::index(Int_t m1, Int_t m2) const
+{
+  for(size_t n = 0; n < size(); ++n){
+    if (mh1[n] == m1 && mh2[n] == m2) return n;
+  }
+  return size();
+}
 
-  eventrecord_rec.UpdateEntry(HHEventRecord::b1)->SetVector(*m_bjet1);
-  if(m_truthInput)
-    eventrecord_rec.UpdateEntry(HHEventRecord::b1)->SetErrors(m_bjet1Smear, 0, 0);
-  else
-    eventrecord_rec.UpdateEntry(HHEventRecord::b1)->SetErrors(GetBjetResolution(m_bjet1->Eta(),m_bjet1->Et()), 0, 0);
+void
+HHKinFitMaster::doFullFit()
+{
+  m_fullFitResults.resize(0);
+  m_fullFitResults.resize(m_mh1.size() * m_mh2.size());
+  for(size_t n = 0; n < m_fullFitResults.size(); ++n){
+    m_fullFitResults.mh1[n] = m_mh1[n / m_mh2.size()];
+    m_fullFitResults.mh2[n] = m_mh2[n % m_mh2.size()];
+  }
 
-  eventrecord_rec.UpdateEntry(HHEventRecord::b2)->SetVector(*m_bjet2);
-  if(m_truthInput)
-    eventrecord_rec.UpdateEntry(HHEventRecord::b2)->SetErrors(m_bjet2Smear, 0, 0);
-  else
-    eventrecord_rec.UpdateEntry(HHEventRecord::b2)->SetErrors(GetBjetResolution(m_bjet2->Eta(),m_bjet2->Et()), 0, 0);
+  //the measured event is the same for all hypotheses
+  setupFitInput(m_fitInput);
 
-  if (!m_advancedBalance){
-    eventrecord_rec.UpdateEntry(HHEventRecord::MET)->SetEEtaPhiM(m_simpleBalancePt,0,0,0);
-    eventrecord_rec.UpdateEntry(HHEventRecord::MET)->SetErrors(m_simpleBalanceUncert,0,0);
+  //fit all hypotheses, each one with its own copy of the fit input
+  const unsigned numThreads = std::min<size_t>(std::max(m_numThreads, 1u), std::max<size_t>(m_fullFitResults.size(), 1));
+  std::vector<std::exception_ptr> errors(numThreads);
+  if (numThreads == 1){
+    fitHypotheses(0, 1, errors[0]);
   }
   else{
-    if ((m_MET != NULL) && (m_MET_COV.IsValid())){
-      eventrecord_rec.UpdateEntry(HHEventRecord::MET)->SetVector(*m_MET);
-      eventrecord_rec.UpdateEntry(HHEventRecord::MET)->SetCov(m_MET_COV);
+    std::vector<std::thread> threads;
+    for(unsigned iThread = 0; iThread < numThreads; ++iThread){
+      threads.push_back(std::thread(&HHKinFitMaster::fitHypotheses, this, iThread, numThreads, std::ref(errors[iThread])));
+    }
+    for(std::vector<std::thread>::iterator thread = threads.begin(); thread != threads.end(); ++thread){
+      thread->join();
     }
   }
-  //loop over all hypotheses
-  for(std::vector<Int_t>::iterator mh1 = m_mh1.begin(); mh1 != m_mh1.end(); mh1++){
-    for(std::vector<Int_t>::iterator mh2 = m_mh2.begin(); mh2 != m_mh2.end(); mh2++){
-      particlelist->UpdateMass(HHPID::h1, *mh1);
-      particlelist->UpdateMass(HHPID::h2, *mh2);
-
-      HHKinFit advancedfitter(&eventrecord_rec);
-      advancedfitter.SetPrintLevel(0);
-      advancedfitter.SetLogLevel(0);
-      advancedfitter.SetAdvancedBalance(m_advancedBalance);
-      advancedfitter.SetMaxLoops(20000);
-      advancedfitter.Fit();
-
-      Double_t chi2_full = advancedfitter.GetChi2();
-      Double_t chi2_bjet1 = advancedfitter.GetChi2_b1();
-      Double_t chi2_bjet2 = advancedfitter.GetChi2_b2();
-      Double_t chi2_balance = advancedfitter.GetChi2_balance();
-      Double_t prob_full = TMath::Prob(chi2_full,2);
-      Double_t mH_full   = advancedfitter.GetFittedMH();
-      std::pair< Int_t, Int_t > hypo_full(*mh1,*mh2);
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_chi2_full (hypo_full, chi2_full);
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_chi2_bjet1 (hypo_full, chi2_bjet1);
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_chi2_bjet2 (hypo_full, chi2_bjet2);
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_chi2_balance (hypo_full, chi2_balance);
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_fitprob_full (hypo_full, prob_full);
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_mH_full (hypo_full, mH_full);
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_pullb1_full (hypo_full, advancedfitter.GetPullE(HHEventRecord::b1));
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_pullb2_full (hypo_full, advancedfitter.GetPullE(HHEventRecord::b2));
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_pullbalance_full (hypo_full, advancedfitter.GetPullBalance());
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_pullbalance_fullX (hypo_full, advancedfitter.GetPullBalanceX());
-      std::pair< std::pair< Int_t, Int_t >, Double_t > entry_pullbalance_fullY (hypo_full, advancedfitter.GetPullBalanceY());
-      std::pair< std::pair< Int_t, Int_t >, Int_t >    entry_convergence_full (hypo_full, advancedfitter.GetConvergence());
-      m_fullFitResultChi2.insert(entry_chi2_full);
-      m_fullFitResultChi2BJet1.insert(entry_chi2_bjet1);
-      m_fullFitResultChi2BJet2.insert(entry_chi2_bjet2);
-      m_fullFitResultChi2Balance.insert(entry_chi2_balance);
-      m_fullFitResultFitProb.insert(entry_fitprob_full);
-      m_fullFitResultMH.insert(entry_mH_full);
-      m_fullFitPullB1.insert(entry_pullb1_full);
-      m_fullFitPullB2.insert(entry_pullb2_full);
-      m_fullFitPullBalance.insert(entry_pullbalance_full);
-      m_fullFitPullBalanceX.insert(entry_pullbalance_fullX);
-      m_fullFitPullBalanceY.insert(entry_pullbalance_fullY);
-      m_fullFitConvergence.insert(entry_convergence_full);
-      if (chi2_full<m_bestChi2FullFit) {
-        m_bestChi2FullFit = chi2_full;
-        m_bestHypoFullFit = hypo_full;
-        m_bestMHFullFit = mH_full;
-      }
-      
-      m_bjet1_fitted = advancedfitter.GetFitParticle(HHEventRecord::b1);
-      m_bjet2_fitted = advancedfitter.GetFitParticle(HHEventRecord::b2);
-      m_tau1_fitted = advancedfitter.GetFitParticle(HHEventRecord::tau1);
-      m_tau2_fitted = advancedfitter.GetFitParticle(HHEventRecord::tau2);
-      m_fixedCovMatrix = advancedfitter.m_fixedCovMatrix;
-      
-
-
-      /*
-      if( entry_convergence_full.second == 0 ){
-      	Chi2Map chi2Map = advancedfitter.CreateChi2Map(15, 100);
-	
-	TCanvas* c1 = new TCanvas("canvas1");
-	TGraph2D* graph2d = new TGraph2D( chi2Map.size() );
-	
-	int pointN = 0;
-	for(Chi2Map::iterator iter = chi2Map.begin(); iter != chi2Map.end(); iter++){
-	  graph2d->SetPoint(pointN, iter->first.first, iter->first.second, iter->second);
-	  pointN++;
-	}
-	
-	std::stringstream fileNameStream;
-	TString fileName;
-	fileNameStream << "MinB1_" << m_bjet1_fitted.E() << "_MinTau1_" << m_tau1_fitted.E() << std::endl;
-	fileNameStream >> fileName;
-	
-	graph2d->Draw("Cont3COLZ");
-	c1->SaveAs(fileName + ".pdf");
-	
-	Chi2Map chi2MapAroundStartvalues = advancedfitter.CreateChi2MapAroundStartvalues(15, 10);
-	
-	TCanvas* c2 = new TCanvas("canvas2");
-	TGraph2D* graph2dAroundStartvalues = new TGraph2D( chi2MapAroundStartvalues.size() );
-	
-	pointN = 0;
-	for(Chi2Map::iterator iter = chi2MapAroundStartvalues.begin(); iter != chi2MapAroundStartvalues.end(); iter++){
-	  graph2dAroundStartvalues->SetPoint(pointN, iter->first.first, iter->first.second, iter->second);
-	  pointN++;
-	}
-	
-	graph2dAroundStartvalues->Draw("Cont3COLZ");
-	c2->SaveAs(fileName + "AroundStartvalues.pdf");
-	
-	Chi2Map chi2MapTauValues = advancedfitter.CreateChi2Map(0, 100);
-
-	TCanvas* c3 = new TCanvas("canvas3");
-	TGraph* graph1dTauValues = new TGraph( chi2MapTauValues.size() );
-	
-	pointN = 0;
-	for(Chi2Map::iterator iter = chi2MapTauValues.begin(); iter != chi2MapTauValues.end(); iter++){
-	  graph1dTauValues->SetPoint(pointN, iter->first.second, iter->second);
-	  pointN++;
-	}
-
-	graph1dTauValues->Draw("AC*");
-	c3->SaveAs(fileName + "TauValues.pdf");
-	
-	
-	delete graph1dTauValues;
-	//delete graph2dAroundStartvalues;
-	//delete c2;
-	
-	delete c3;
-	
-	delete c1;
-	delete graph2d;
-      }
-      */
+  for(std::vector<std::exception_ptr>::const_iterator error = errors.begin(); error != errors.end(); ++error){
+    if (*error) std::rethrow_exception(*error);
+  }
+
+  //the first hypothesis with the lowest chi2 in the order of the hypothesis index is the best one
+  m_bestChi2FullFit = 999;
+  m_bestMHFullFit = -1;
+  m_bestHypoFullFit = std::pair<Int_t, Int_t>(-1,-1);
+  for(size_t n = 0; n < m_fullFitResults.size(); ++n){
+    if (m_fullFitResults.chi2[n] < m_bestChi2FullFit) {
+      m_bestChi2FullFit = m_fullFitResults.chi2[n];
+      m_bestHypoFullFit = std::pair<Int_t, Int_t>(m_fullFitResults.mh1[n], m_fullFitResults.mh2[n]);
+      m_bestMHFullFit = m_fullFitResults.mH[n];
     }
   }
-  
-  delete particlelist;
+
+  //fitted particles are taken from the last hypothesis
+  if (m_fullFitResults.size()){
+    const size_t last = m_fullFitResults.size() - 1;
+    m_bjet1_fitted = m_fullFitResults.bjet1Fitted[last];
+    m_bjet2_fitted = m_fullFitResults.bjet2Fitted[last];
+    m_tau1_fitted = m_fullFitResults.tau1Fitted[last];
+    m_tau2_fitted = m_fullFitResults.tau2Fitted[last];
+    m_fixedCovMatrix = m_fullFitResults.fixedCovMatrix[last];
+  }
 }
 
+void
+HHKinFitMaster::fitHypotheses(unsigned first, unsigned step, std::exception_ptr& error)
+{
+  try {
+    for(size_t n = first; n < m_fullFitResults.size(); n += step){
+      fitHypothesis(n);
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+}
 
+void
+HHKinFitMaster::setupFitInput(HHFitInput& input)
+{
+  input.SetTauVis(*m_tauvis1, *m_tauvis2);
+  if(m_truthInput)
+    input.SetBJets(*m_bjet1, m_bjet1Smear, *m_bjet2, m_bjet2Smear);
+  else
+    input.SetBJets(*m_bjet1, GetBjetResolution(m_bjet1->Eta(),m_bjet1->Et()),
+                   *m_bjet2, GetBjetResolution(m_bjet2->Eta(),m_bjet2->Et()));
+
+  if (!m_advancedBalance)
+    input.SetSimpleBalance(m_simpleBalancePt, m_simpleBalanceUncert);
+  else if ((m_MET != NULL) && (m_MET_COV.IsValid()))
+    input.SetAdvancedBalance(*m_MET, m_MET_COV);
+  else
+    input.SetAdvancedBalance();
+
+  input.m_maxloops = 20000;
+  input.m_analyticDerivatives = m_analyticDerivatives;
+}
+
+void
+HHKinFitMaster::fitHypothesis(size_t index)
+{
+  HHFitInput input(m_fitInput);
+  input.SetHypothesis(m_fullFitResults.mh1[index], m_fullFitResults.mh2[index]);
+
+  HHFitCore fitter(input);
+  const HHFitResult& result = fitter.Fit();
+
+  m_fullFitResults.chi2[index] = result.m_chi2;
+  m_fullFitResults.chi2BJet1[index] = result.m_chi2_b1;
+  m_fullFitResults.chi2BJet2[index] = result.m_chi2_b2;
+  m_fullFitResults.chi2Balance[index] = result.m_chi2_balance;
+  m_fullFitResults.fitProb[index] = TMath::Prob(m_fullFitResults.chi2[index],2);
+  m_fullFitResults.mH[index] = result.m_fittedmH;
+  m_fullFitResults.pullB1[index] = result.m_pullB1;
+  m_fullFitResults.pullB2[index] = result.m_pullB2;
+  m_fullFitResults.pullBalance[index] = result.m_pullBalance;
+  m_fullFitResults.pullBalanceX[index] = result.m_pullBalanceX;
+  m_fullFitResults.pullBalanceY[index] = result.m_pullBalanceY;
+  m_fullFitResults.convergence[index] = result.m_convergence;
+
+  m_fullFitResults.bjet1Fitted[index] = result.m_bjet1.LorentzVector();
+  m_fullFitResults.bjet2Fitted[index] = result.m_bjet2.LorentzVector();
+  m_fullFitResults.tau1Fitted[index] = result.m_tau1.LorentzVector();
+  m_fullFitResults.tau2Fitted[index] = result.m_tau2.LorentzVector();
+  m_fullFitResults.fixedCovMatrix[index] = result.m_fixedCovMatrix;
+}
+
+template<typename T>
+std::map< std::pair< Int_t, Int_t >, T >
+HHKinFitMaster::makeHypoMap(const std::vector<T>& values) const
+{
+  std::map< std::pair< Int_t, Int_t >, T > hypoMap;
+  for(size_t n = 0; n < values.size(); ++n){
+    hypoMap.insert(std::make_pair(std::pair< Int_t, Int_t >(m_fullFitResults.mh1[n], m_fullFitResults.mh2[n]), values[n]));
+  }
+  return hypoMap;
+}
 
 HHKinFitMaster::HHKinFitMaster(TLorentzVector* bjet1, TLorentzVector* bjet2, TLorentzVector* tauvis1, TLorentzVector* tauvis2, Bool_t truthinput, TLorentzVector* heavyhiggsgen):
+    m_fixedCovMatrix(false),
     m_mh1(std::vector<Int_t>()),
     m_mh2(std::vector<Int_t>()),
 
@@ -188,8 +190,8 @@ HHKinFitMaster::HHKinFitMaster(TLorentzVector* bjet1, TLorentzVector* bjet2, TLo
     m_advancedBalance(false),
     m_simpleBalancePt(0.0),
     m_simpleBalanceUncert(10.0),
-    m_fullFitResultChi2(std::map< std::pair<Int_t,Int_t> , Double_t>()),
-    m_fullFitResultMH(std::map< std::pair<Int_t,Int_t> , Double_t>()),
+    m_numThreads(1),
+    m_analyticDerivatives(false),
     m_bestChi2FullFit(999),
     m_bestMHFullFit(-1),
     m_bestHypoFullFit(std::pair<Int_t, Int_t>(-1,-1) )
@@ -273,47 +275,62 @@ HHKinFitMaster::getBestMHFullFit()
 
 std::map< std::pair< Int_t, Int_t >, Double_t >
 HHKinFitMaster::getChi2FullFit(){
-  return m_fullFitResultChi2;
+  return makeHypoMap(m_fullFitResults.chi2);
 }
 
 std::map< std::pair< Int_t, Int_t >, Double_t >
 HHKinFitMaster::getFitProbFullFit(){
-  return m_fullFitResultFitProb;
+  return makeHypoMap(m_fullFitResults.fitProb);
 }
 
 std::map< std::pair< Int_t, Int_t >, Double_t >
 HHKinFitMaster::getMHFullFit(){
-  return m_fullFitResultMH;
+  return makeHypoMap(m_fullFitResults.mH);
 }
 
 std::map< std::pair< Int_t, Int_t >, Double_t >
 HHKinFitMaster::getPullB1FullFit(){
-  return m_fullFitPullB1;
+  return makeHypoMap(m_fullFitResults.pullB1);
 }
 
 std::map< std::pair< Int_t, Int_t >, Double_t >
 HHKinFitMaster::getPullB2FullFit(){
-  return m_fullFitPullB2;
+  return makeHypoMap(m_fullFitResults.pullB2);
 }
 
 std::map< std::pair< Int_t, Int_t >, Double_t >
 HHKinFitMaster::getPullBalanceFullFit(){
-  return m_fullFitPullBalance;
+  return makeHypoMap(m_fullFitResults.pullBalance);
 }
 
 std::map< std::pair< Int_t, Int_t >, Double_t >
 HHKinFitMaster::getPullBalanceFullFitX(){
-  return m_fullFitPullBalanceX;
+  return makeHypoMap(m_fullFitResults.pullBalanceX);
 }
 
 std::map< std::pair< Int_t, Int_t >, Double_t >
 HHKinFitMaster::getPullBalanceFullFitY(){
-  return m_fullFitPullBalanceY;
+  return makeHypoMap(m_fullFitResults.pullBalanceY);
 }
 
 std::map< std::pair< Int_t, Int_t >, Int_t >
 HHKinFitMaster::getConvergenceFullFit(){
-  return m_fullFitConvergence;
+  return makeHypoMap(m_fullFitResults.convergence);
+}
+
+std::map< std::pair< Int_t, Int_t >, Double_t >
+HHKinFitMaster::getChi2B1FullFit(){
+  return makeHypoMap(m_fullFitResults.chi2BJet1);
+}
+
+std::map< std::pair< Int_t, Int_t >, Double_t >
+HHKinFitMaster::getChi2B2FullFit(){
+  return makeHypoMap(m_fullFitResults.chi2BJet2);
+}
+
+std::map< std::pair< Int_t, Int_t >, Double_t >
+HHKinFitMaster::getChi2BalanceFullFit(){
+  return makeHypoMap(m_fullFitResults.chi2Balance);
 }
 
 std::pair<Int_t, Int_t>
@@ -381,8 +398,121 @@ HHKinFitMaster::setSimpleBalance(Double_t balancePt, Double_t balanceUncert)
   m_simpleBalanceUncert = balanceUncert;
 }
 
+namespace {
+  // b-jet energy resolution in bins of |eta|: dEt = Et * sqrt(a^2 + b^2/Et + c^2/Et^2) and dE = dEt/sin(theta)
+  // with theta at the centre of the bin
+  struct HHBjetResolutionBin {
+    Double_t etaLow, etaHigh, invSinTheta, a, b, c;
+  };
+
+#define HH_BJET_RESOLUTION_BIN(etaLow, etaHigh, a, b, c) \
+  { etaLow, etaHigh, 1.0/sin(2 * atan(exp(-(etaLow+etaHigh)/2))), a, b, c }
+
+  // contiguous bins ordered in |eta|, built once at static initialization and only read afterwards
+  const HHBjetResolutionBin bjetResolutionBins[] = {
+    HH_BJET_RESOLUTION_BIN(0.000, 0.087, 0.0686, 1.03, 1.68),
+    HH_BJET_RESOLUTION_BIN(0.087, 0.174, 0.0737, 1.01, 1.74),
+    HH_BJET_RESOLUTION_BIN(0.174, 0.261, 0.0657, 1.07, 5.16e-06),
+    HH_BJET_RESOLUTION_BIN(0.261, 0.348, 0.062, 1.07, 0.000134),
+    HH_BJET_RESOLUTION_BIN(0.348, 0.435, 0.0605, 1.07, 1.84e-07),
+    HH_BJET_RESOLUTION_BIN(0.435, 0.522, 0.059, 1.08, 9.06e-09),
+    HH_BJET_RESOLUTION_BIN(0.522, 0.609, 0.0577, 1.08, 5.46e-06),
+    HH_BJET_RESOLUTION_BIN(0.609, 0.696, 0.0525, 1.09, 4.05e-05),
+    HH_BJET_RESOLUTION_BIN(0.696, 0.783, 0.0582, 1.09, 1.17e-05),
+    HH_BJET_RESOLUTION_BIN(0.783, 0.870, 0.0649, 1.08, 7.85e-06),
+    HH_BJET_RESOLUTION_BIN(0.870, 0.957, 0.0654, 1.1, 1.09e-07),
+    HH_BJET_RESOLUTION_BIN(0.957, 1.044, 0.0669, 1.11, 1.87e-06),
+    HH_BJET_RESOLUTION_BIN(1.044, 1.131, 0.0643, 1.15, 2.76e-05),
+    HH_BJET_RESOLUTION_BIN(1.131, 1.218, 0.0645, 1.16, 1.04e-06),
+    HH_BJET_RESOLUTION_BIN(1.218, 1.305, 0.0637, 1.19, 1.08e-07),
+    HH_BJET_RESOLUTION_BIN(1.305, 1.392, 0.0695, 1.21, 5.75e-06),
+    HH_BJET_RESOLUTION_BIN(1.392, 1.479, 0.0748, 1.2, 5.15e-08),
+    HH_BJET_RESOLUTION_BIN(1.479, 1.566, 0.0624, 1.23, 2.28e-05),
+    HH_BJET_RESOLUTION_BIN(1.566, 1.653, 0.0283, 1.25, 4.79e-07),
+    HH_BJET_RESOLUTION_BIN(1.653, 1.740, 0.0316, 1.21, 5e-05),
+    HH_BJET_RESOLUTION_BIN(1.740, 1.830, 2.29e-07, 1.2, 1.71e-05),
+    HH_BJET_RESOLUTION_BIN(1.830, 1.930, 5.18e-09, 1.14, 1.7),
+    HH_BJET_RESOLUTION_BIN(1.930, 2.043, 2.17e-07, 1.09, 2.08),
+    HH_BJET_RESOLUTION_BIN(2.043, 2.172, 3.65e-07, 1.09, 1.63),
+    HH_BJET_RESOLUTION_BIN(2.172, 2.322, 2.02e-07, 1.09, 1.68),
+    HH_BJET_RESOLUTION_BIN(2.322, 2.500, 5.27e-07, 1.12, 1.78)
+  };
+
+#undef HH_BJET_RESOLUTION_BIN
+
+  const Int_t nBjetResolutionBins = sizeof(bjetResolutionBins)/sizeof(bjetResolutionBins[0]);
+  const Double_t bjetResolutionEtaMax = bjetResolutionBins[nBjetResolutionBins-1].etaHigh;
+
+  // uniform cells in |eta|, each with the lowest bin that can contain an |eta| of the cell; the cells are half as wide
+  // as the narrowest bin, so the bin is found with two comparisons and without data-dependent branches
+  class HHBjetResolutionLookup {
+  public:
+    HHBjetResolutionLookup(){
+      for(Int_t k = 0; k < nCells; k++){
+        const Double_t etaLow = (k - 1) * cellWidth;
+        Int_t bin = 0;
+        while(bin < nBjetResolutionBins - 1 && bjetResolutionBins[bin].etaHigh <= etaLow)
+          bin++;
+        m_firstBin[k] = bin;
+      }
+    }
+
+    // 0 <= abseta < bjetResolutionEtaMax
+    const HHBjetResolutionBin& Find(Double_t abseta) const {
+      Int_t bin = m_firstBin[Int_t(abseta / cellWidth)];
+      bin += abseta >= bjetResolutionBins[bin].etaHigh;
+      bin += abseta >= bjetResolutionBins[bin].etaHigh;
+      return bjetResolutionBins[bin];
+    }
+
+  private:
+    static constexpr Double_t cellWidth = 0.087 / 2;
+    enum { nCells = Int_t(2.500 / cellWidth) + 2 };
+    Int_t m_firstBin[nCells];
+  };
+}
+
+Double_t
+HHKinFitMaster::GetBjetResolution(Double_t eta, Double_t et){
+  // built once on the first call and only read afterwards, so it is shared by all threads
+  static const HHBjetResolutionLookup lookup;
+
+  const Double_t abseta = std::abs(eta);
+  if(!(abseta < bjetResolutionEtaMax))
+    return 10;
+
+  const HHBjetResolutionBin& bin = lookup.Find(abseta);
+  const Double_t det = et * (sqrt(bin.a*bin.a + (bin.b/sqrt(et))*(bin.b/sqrt(et)) + (bin.c/et)*(bin.c/et)));
+  return bin.invSinTheta * det;
+}
+
+Double_t
+HHKinFitMaster::ValidateBjetResolution(Int_t nEta, Int_t nEt){
+  std::vector<Double_t> etas;
+  for(Int_t i = 0; i < nEta; i++)
+    etas.push_back(-3.0 + 6.0 * i / (nEta - 1));
+  for(const HHBjetResolutionBin& bin : bjetResolutionBins){
+    etas.push_back(bin.etaLow);
+    etas.push_back(-bin.etaLow);
+    etas.push_back(std::nextafter(bin.etaHigh, 0.));
+    etas.push_back(bin.etaHigh);
+  }
+
+  Double_t maxDeviation = 0;
+  for(Double_t eta : etas){
+    for(Int_t i = 0; i < nEt; i++){
+      const Double_t et = 1.0 + 2000.0 * i / (nEt - 1);
+      const Double_t reference = GetBjetResolutionReference(eta, et);
+      const Double_t deviation = std::abs(GetBjetResolution(eta, et) - reference) / reference;
+      if(!(deviation <= maxDeviation))
+        maxDeviation = deviation;
+    }
+  }
+  return maxDeviation;
+}
+
 double
-HHKinFitMaster::GetBjetResolution(double eta, double et){
+HHKinFitMaster::GetBjetResolutionReference(double eta, double et){
   double det=0;
   double de=10;
 
@@ -38,7 +38,8 @@ PSMath::PSfit (Int_t iloop, Int_t &iter, Int_t &method, Int_t &mode,
                Bool_t &noNewtonShifts, Int_t printlevel, Int_t np, Double_t a[],
                Double_t astart[], Double_t alimit[][2], Double_t aprec[],
                Double_t daN[], Double_t h[], Double_t aMemory[][5], Double_t chi2,
-               Double_t chi2iter[], Double_t g[], Double_t H[], Double_t Hinv[])
+               Double_t chi2iter[], Double_t g[], Double_t H[], Double_t Hinv[],
+               Bool_t analyticDerivatives)
 {
   // generic fitter using Newton method and Line Search within parameter limits
   // iter:     set iter=0 at start of a new fit, 
@@ -67,13 +68,16 @@ PSMath::PSfit (Int_t iloop, Int_t &iter, Int_t &method, Int_t &mode,
   // H[np*np]    Hesse matrix,   g[] and H[] are also used as 
   //                             intermediate storage of chi2
   // Hinv[np*np] Inverse of Hesse matrix
-
-  static Int_t icallNewton, iterMemory;
-  static Double_t chi2Memory;
-  static Double_t x[4], f[4];
-  static Double_t xx, xlimit[2];
-  static Double_t xh, daNabs;
-  static Double_t epsx = 0.1, epsf = 0.1;
+  // analyticDerivatives: if true, g[] and H[] must contain the derivatives at the current a[]
+  //             whenever method = 2, and no numerical derivatives are calculated
+
+  // the state between the calls of one fit is thread local, so that independent fits can run in parallel
+  static thread_local Int_t icallNewton, iterMemory;
+  static thread_local Double_t chi2Memory;
+  static thread_local Double_t x[4], f[4];
+  static thread_local Double_t xx, xlimit[2];
+  static thread_local Double_t xh, daNabs;
+  static const Double_t epsx = 0.1, epsf = 0.1;
   Int_t convergence;
 
   Int_t /*itemp,*/ ready;
@@ -222,7 +226,9 @@ PSMath::PSfit (Int_t iloop, Int_t &iter, Int_t &method, Int_t &mode,
     }
     if(printlevel >=2)
 	std::cout << "Newton Method! Calc. derivative!" << std::endl;
-    if(np > 1)
+    if(analyticDerivatives)
+      ready = 1;
+    else if(np > 1)
       ready = PSderivative(icallNewton, np, a, h, chi2, chi2iter, g, H);
     else
       ready = PSderivative1(icallNewton, a, h, chi2, g, H);
@@ -473,7 +479,7 @@ PSMath::PSfitShow (Int_t iloop, Int_t convergence, Int_t iter, Int_t method,
   // printlevel: 0: quite mode,      1: one line with fit result
   //             2: full fit result, 3: one line per iteration, 4: more and more
 
-  static Double_t chi2Memory;
+  static thread_local Double_t chi2Memory;
   if (printlevel > 0) {
     if (printlevel >= 2 && iloop == 0) {
       std::cout << "---------- PSfitShow ----------- starts with  " << iloop
@@ -594,7 +600,7 @@ PSMath::PSLineSearch (Int_t & mode, Double_t hh, Double_t xlimit[],
                       Double_t epsx, Double_t epsf, Double_t x[4], Double_t f[],
                       Double_t chi2, Int_t printlevel)
 {      // 1-dim Line-Search, Method from Blobel textbook p. 252
-  static Double_t xt, ft;
+  static thread_local Double_t xt, ft;
   Double_t d31, d32, d21;
   Double_t g, H;
   Double_t tau = 0.618034;
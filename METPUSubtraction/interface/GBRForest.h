@@ -34,6 +34,8 @@
        
        double GetResponse(const float* vector) const;
        double GetClassifier(const float* vector) const;
+       // responses for n_rows input vectors, the i-th of which starts at inputs[i*stride], stored in out[i]
+       void GetResponses(const float* inputs, size_t n_rows, size_t stride, double* out) const;
        
        void SetInitialResponse(double response) { fInitialResponse = response; }
        
@@ -55,6 +57,22 @@ inline double GBRForest::GetResponse(const float* vector) const {
   return response;
 }
 
+//_______________________________________________________________________
+inline void GBRForest::GetResponses(const float* inputs, size_t n_rows, size_t stride, double* out) const {
+  // blocks of rows are passed through all trees while their inputs are in cache;
+  // the tree responses are summed in the same order as in GetResponse
+  static const size_t blockSize = 256;
+  for (size_t i = 0; i < n_rows; ++i) {
+    out[i] = fInitialResponse;
+  }
+  for (size_t first = 0; first < n_rows; first += blockSize) {
+    const size_t n = std::min(blockSize, n_rows - first);
+    for (std::vector<GBRTree>::const_iterator it=fTrees.begin(); it!=fTrees.end(); ++it) {
+      it->GetResponses(inputs + first*stride, n, stride, out + first);
+    }
+  }
+}
+
 //_______________________________________________________________________
 inline double GBRForest::GetClassifier(const float* vector) const {
   double response = GetResponse(vector);
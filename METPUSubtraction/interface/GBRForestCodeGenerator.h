@@ -0,0 +1,160 @@
+#ifndef EGAMMAOBJECTS_GBRForestCodeGenerator
+#define EGAMMAOBJECTS_GBRForestCodeGenerator
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GBRForestCodeGenerator                                               //
+//                                                                      //
+// Translates a GBRForest into C++ code: each tree becomes a function   //
+// of nested if/else statements and the forest becomes a function      //
+// that sums the responses of the trees in the same order as            //
+// GBRForest::GetResponse. Cut values and responses are written with    //
+// enough digits to be read back exactly, so the generated function     //
+// returns bitwise-identical responses.                                 //
+//                                                                      //
+// The fingerprint of a forest is written along with the code, in order //
+// to check that the generated code corresponds to a given forest.      //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "GBRForest.h"
+
+  class GBRForestCodeGenerator {
+
+    public:
+
+       // writes the functions "float <name>_tree<i>(const float* vector)" for each tree and
+       // "double <name>(const float* vector)" for the forest, and the constant "<name>_fingerprint"
+       static void WriteForest(std::ostream &s, const GBRForest &forest, const std::string &name);
+
+       // hash of the structure, cut values and responses of the forest
+       static unsigned long long Fingerprint(const GBRForest &forest);
+
+    private:
+       static void WriteNode(std::ostream &s, const GBRTree &tree, int index, unsigned depth);
+       static void WriteResponse(std::ostream &s, const GBRTree &tree, int index, unsigned depth);
+       static std::string FloatLiteral(float value);
+       static std::string DoubleLiteral(double value);
+       static void Hash(unsigned long long &hash, const void *data, size_t size);
+
+  };
+
+//_______________________________________________________________________
+inline void GBRForestCodeGenerator::WriteForest(std::ostream &s, const GBRForest &forest, const std::string &name) {
+
+  const std::vector<GBRTree> &trees = forest.Trees();
+  for (size_t i = 0; i < trees.size(); ++i) {
+    s << "inline float " << name << "_tree" << i << "(const float* vector)\n{\n";
+    WriteNode(s, trees[i], 0, 1);
+    s << "}\n\n";
+  }
+
+  s << "const unsigned long long " << name << "_fingerprint = " << Fingerprint(forest) << "ULL;\n\n";
+
+  s << "inline double " << name << "(const float* vector)\n{\n";
+  s << "    double response = " << DoubleLiteral(forest.fInitialResponse) << ";\n";
+  for (size_t i = 0; i < trees.size(); ++i) {
+    s << "    response += " << name << "_tree" << i << "(vector);\n";
+  }
+  s << "    return response;\n}\n";
+
+}
+
+//_______________________________________________________________________
+inline unsigned long long GBRForestCodeGenerator::Fingerprint(const GBRForest &forest) {
+
+  unsigned long long hash = 14695981039346656037ULL;
+  Hash(hash, &forest.fInitialResponse, sizeof(forest.fInitialResponse));
+  const std::vector<GBRTree> &trees = forest.Trees();
+  for (std::vector<GBRTree>::const_iterator it=trees.begin(); it!=trees.end(); ++it) {
+    const size_t nNodes = it->CutIndices().size();
+    const size_t nResponses = it->Responses().size();
+    Hash(hash, &nNodes, sizeof(nNodes));
+    Hash(hash, &nResponses, sizeof(nResponses));
+    if (nNodes) {
+      Hash(hash, &it->CutIndices()[0], nNodes*sizeof(unsigned char));
+      Hash(hash, &it->CutVals()[0], nNodes*sizeof(float));
+      Hash(hash, &it->LeftIndices()[0], nNodes*sizeof(int));
+      Hash(hash, &it->RightIndices()[0], nNodes*sizeof(int));
+    }
+    if (nResponses) Hash(hash, &it->Responses()[0], nResponses*sizeof(float));
+  }
+  return hash;
+
+}
+
+//_______________________________________________________________________
+inline void GBRForestCodeGenerator::WriteNode(std::ostream &s, const GBRTree &tree, int index, unsigned depth) {
+
+  // the same comparison as in GBRTree::GetResponse: 'right' daughter if vector[cutindex] > cutval
+  const std::string indent(4*depth, ' ');
+  s << indent << "if (vector[" << static_cast<unsigned>(tree.CutIndices()[index]) << "] > "
+    << FloatLiteral(tree.CutVals()[index]) << ") {\n";
+  WriteResponse(s, tree, tree.RightIndices()[index], depth + 1);
+  s << indent << "} else {\n";
+  WriteResponse(s, tree, tree.LeftIndices()[index], depth + 1);
+  s << indent << "}\n";
+
+}
+
+//_______________________________________________________________________
+inline void GBRForestCodeGenerator::WriteResponse(std::ostream &s, const GBRTree &tree, int index, unsigned depth) {
+
+  // positive indices indicate further intermediate nodes, whereas non-positive indices indicate terminal nodes
+  if (index > 0) {
+    WriteNode(s, tree, index, depth);
+  }
+  else {
+    s << std::string(4*depth, ' ') << "return " << FloatLiteral(tree.Responses()[-index]) << ";\n";
+  }
+
+}
+
+//_______________________________________________________________________
+inline std::string GBRForestCodeGenerator::FloatLiteral(float value) {
+
+  if (!std::isfinite(value)) {
+    std::ostringstream ss;
+    ss << "GBRForestCodeGenerator: non-finite value " << value << " can't be written as a literal.";
+    throw std::runtime_error(ss.str());
+  }
+  std::ostringstream ss;
+  ss << std::scientific << std::setprecision(std::numeric_limits<float>::max_digits10 - 1) << value << "f";
+  return ss.str();
+
+}
+
+//_______________________________________________________________________
+inline std::string GBRForestCodeGenerator::DoubleLiteral(double value) {
+
+  if (!std::isfinite(value)) {
+    std::ostringstream ss;
+    ss << "GBRForestCodeGenerator: non-finite value " << value << " can't be written as a literal.";
+    throw std::runtime_error(ss.str());
+  }
+  std::ostringstream ss;
+  ss << std::scientific << std::setprecision(std::numeric_limits<double>::max_digits10 - 1) << value;
+  return ss.str();
+
+}
+
+//_______________________________________________________________________
+inline void GBRForestCodeGenerator::Hash(unsigned long long &hash, const void *data, size_t size) {
+
+  // FNV-1a
+  const unsigned char *bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+
+}
+
+#endif
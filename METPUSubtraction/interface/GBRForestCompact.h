@@ -0,0 +1,133 @@
+#ifndef EGAMMAOBJECTS_GBRForestCompact
+#define EGAMMAOBJECTS_GBRForestCompact
+
+//////////////////////////////////////////////////////////////////////////
+//                                                                      //
+// GBRForestCompact                                                     //
+//                                                                      //
+// Read-only copy of a GBRForest in a compact node layout, optimized    //
+// for the evaluation of many input vectors at once.                    //
+//                                                                      //
+// The intermediate nodes of all trees are stored in a single array,    //
+// each node holding the variable index, the cut value and the indices  //
+// of both daughter nodes next to each other, so that a daughter is     //
+// selected by indexing with the result of the cut. Non-negative        //
+// daughter indices refer to further intermediate nodes, whereas        //
+// negative indices i refer to the terminal response ~i = -i-1.         //
+// The layout is transient: it is built from a GBRForest after reading  //
+// and is not meant to be stored.                                       //
+//                                                                      //
+//////////////////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include "GBRForest.h"
+
+  class GBRForestCompact {
+
+    public:
+
+       struct Node {
+         int   cutIndex;
+         float cutVal;
+         int   daughters[2]; // index 0 = left (vector[cutIndex] <= cutVal), index 1 = right
+       };
+
+       GBRForestCompact() : fInitialResponse(0.) {}
+       explicit GBRForestCompact(const GBRForest &forest);
+
+       double GetResponse(const float* vector) const;
+       // responses for n_rows input vectors, the i-th of which starts at inputs[i*stride], stored in out[i]
+       void GetResponses(const float* inputs, size_t n_rows, size_t stride, double* out) const;
+
+       bool Empty() const { return fRoots.empty(); }
+
+    private:
+       static int Daughter(int index, int nodeOffset, int responseOffset) {
+         return index > 0 ? nodeOffset + index : ~(responseOffset - index);
+       }
+
+       double            fInitialResponse;
+       std::vector<Node> fNodes;     // intermediate nodes of all trees
+       std::vector<int>  fRoots;     // index of the root node of each tree
+       std::vector<float> fResponses; // terminal responses of all trees
+
+  };
+
+//_______________________________________________________________________
+inline GBRForestCompact::GBRForestCompact(const GBRForest &forest) :
+  fInitialResponse(forest.fInitialResponse)
+{
+  const std::vector<GBRTree> &trees = forest.Trees();
+  fRoots.reserve(trees.size());
+  for (std::vector<GBRTree>::const_iterator it=trees.begin(); it!=trees.end(); ++it) {
+    const int nodeOffset = fNodes.size();
+    const int responseOffset = fResponses.size();
+    fRoots.push_back(nodeOffset);
+    for (size_t index = 0; index < it->CutIndices().size(); ++index) {
+      Node node;
+      node.cutIndex = it->CutIndices()[index];
+      node.cutVal = it->CutVals()[index];
+      node.daughters[0] = Daughter(it->LeftIndices()[index], nodeOffset, responseOffset);
+      node.daughters[1] = Daughter(it->RightIndices()[index], nodeOffset, responseOffset);
+      fNodes.push_back(node);
+    }
+    fResponses.insert(fResponses.end(), it->Responses().begin(), it->Responses().end());
+  }
+}
+
+//_______________________________________________________________________
+inline double GBRForestCompact::GetResponse(const float* vector) const {
+  double response = fInitialResponse;
+  for (std::vector<int>::const_iterator root=fRoots.begin(); root!=fRoots.end(); ++root) {
+    int index = *root;
+    while (index >= 0) {
+      const Node &node = fNodes[index];
+      index = node.daughters[vector[node.cutIndex] > node.cutVal];
+    }
+    response += fResponses[~index];
+  }
+  return response;
+}
+
+//_______________________________________________________________________
+inline void GBRForestCompact::GetResponses(const float* inputs, size_t n_rows, size_t stride, double* out) const {
+
+  // each tree is walked one level at a time for a block of rows; rows that have reached a terminal node
+  // keep their (negative) index until all rows are done. The tree responses are summed in the same order
+  // as in GetResponse.
+  static const size_t blockSize = 64;
+  int indices[blockSize];
+
+  for (size_t i = 0; i < n_rows; ++i) {
+    out[i] = fInitialResponse;
+  }
+
+  for (size_t first = 0; first < n_rows; first += blockSize) {
+    const size_t n = std::min(blockSize, n_rows - first);
+    const float* block = inputs + first*stride;
+
+    for (std::vector<int>::const_iterator root=fRoots.begin(); root!=fRoots.end(); ++root) {
+      std::fill(indices, indices + n, *root);
+      bool active = true;
+      while (active) {
+        active = false;
+        for (size_t i = 0; i < n; ++i) {
+          const int index = indices[i];
+          const Node &node = fNodes[index >= 0 ? index : *root];
+          const int daughter = node.daughters[block[i*stride + node.cutIndex] > node.cutVal];
+          const int next = index >= 0 ? daughter : index;
+          indices[i] = next;
+          active |= next >= 0;
+        }
+      }
+      for (size_t i = 0; i < n; ++i) {
+        out[first + i] += fResponses[~indices[i]];
+      }
+    }
+  }
+
+}
+
+#endif
@@ -25,6 +25,8 @@
 
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <cstddef>
 
   namespace TMVA {
     class DecisionTree;
@@ -41,6 +43,8 @@
        
        double GetResponse(const float* vector) const;
        int TerminalIndex(const float *vector) const;
+       // adds the responses for n_rows input vectors, the i-th of which starts at inputs[i*stride], to out[i]
+       void GetResponses(const float* inputs, size_t n_rows, size_t stride, double* out) const;
        
        std::vector<float> &Responses() { return fResponses; }       
        const std::vector<float> &Responses() const { return fResponses; }
@@ -131,5 +135,44 @@ inline int GBRTree::TerminalIndex(const float* vector) const {
   
 
 }
-  
+
+//_______________________________________________________________________
+inline void GBRTree::GetResponses(const float* inputs, size_t n_rows, size_t stride, double* out) const {
+
+  // the tree is walked one level at a time for a block of rows, selecting the daughter nodes without branches;
+  // rows that have reached a terminal node keep their (non-positive) index until all rows are done
+  static const size_t blockSize = 64;
+  int indices[blockSize];
+  const int* daughters[2] = { &fLeftIndices[0], &fRightIndices[0] };
+
+  for (size_t first = 0; first < n_rows; first += blockSize) {
+    const size_t n = std::min(blockSize, n_rows - first);
+    const float* block = inputs + first*stride;
+
+    bool active = false;
+    for (size_t i = 0; i < n; ++i) {
+      const int index = daughters[block[i*stride + fCutIndices[0]] > fCutVals[0]][0];
+      indices[i] = index;
+      active |= index > 0;
+    }
+
+    while (active) {
+      active = false;
+      for (size_t i = 0; i < n; ++i) {
+        const int index = indices[i];
+        const int node = index > 0 ? index : 0;
+        const int daughter = daughters[block[i*stride + fCutIndices[node]] > fCutVals[node]][node];
+        const int next = index > 0 ? daughter : index;
+        indices[i] = next;
+        active |= next > 0;
+      }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      out[first + i] += fResponses[-indices[i]];
+    }
+  }
+
+}
+
 #endif
@@ -15,17 +15,60 @@
 #include <ostream>
 #include <TMatrixD.h>
 #include "GBRForest.h"
+#include "GBRForestCompact.h"
 #include "mvaMEtUtilities.h"
 
 class PFMETAlgorithmMVA 
 {
  public:
 
+  // MVA input variables, in the order of the inputs of the U regression; the DPhi regression uses the variables
+  // from kNumVertices to kNumJetsPtGt30, the covariance regressions use all of them
+  enum InputVariable { kPfSumEt, kNumVertices, kPfU, kPfPhi, kTkSumEt, kTkU, kTkPhi, kNpuSumEt, kNpuU, kNpuPhi,
+                       kPuSumEt, kPuMEt, kPuPhi, kPucSumEt, kPucU, kPucPhi, kJet1Pt, kJet1Eta, kJet1Phi,
+                       kJet2Pt, kJet2Eta, kJet2Phi, kNumJets, kNumJetsPtGt30, kNumEventInputs,
+                       kCorrectedPhi = kNumEventInputs, kCorrectedU, kNumInputs };
+
+  // input of the MVAs for a single event, as computed by setInput
+  struct EventInput
+  {
+    Float_t variables[kNumEventInputs];
+    double sumLeptonPx;
+    double sumLeptonPy;
+  };
+
+  // output of the MVAs for a single event
+  struct EventOutput
+  {
+    EventOutput() : mvaMEtCov(2, 2) {}
+    Float_t U;
+    Float_t DPhi;
+    Float_t CovU1;
+    Float_t CovU2;
+    TLorentzVector mvaMEt;
+    TMatrixD mvaMEtCov;
+  };
+
+  // sums of the PFCandidates entering the recoils: they depend neither on the leptons nor on the jets,
+  // so they can be computed once per event and reused for all variations of the leptons and jets
+  struct PFCandSums
+  {
+    CommonMETData pfCandSum;     // all PFCandidates
+    CommonMETData trackSumNoPU;  // charged PFCandidates associated to the hard scatter vertex
+    CommonMETData trackSumPU;    // charged PFCandidates from pile-up vertices
+    CommonMETData trackSumPUMEt; // the same for the PU MET, which uses a different dZ cut
+  };
+
+  // MVA compiled into a function (see GBRForestCodeGenerator)
+  typedef double (*CompiledMVA)(const float*);
+
   PFMETAlgorithmMVA(double dZcut);
   ~PFMETAlgorithmMVA();
 
   void initialize(const std::string& inputFileNameU, const std::string& inputFileNameDPhi,
                   const std::string& inputFileNameCovU1, const std::string& inputFileNameCovU2);
+  // use MVAs compiled into the code instead of reading the forests from files
+  void initialize(CompiledMVA mvaU, CompiledMVA mvaDPhi, CompiledMVA mvaCovU1, CompiledMVA mvaCovU2);
 
   void setHasPhotons(bool hasPhotons) { hasPhotons_ = hasPhotons; }
 
@@ -33,9 +76,27 @@ class PFMETAlgorithmMVA
 		const std::vector<mvaMEtUtilities::JetInfo>&,
 		const std::vector<mvaMEtUtilities::pfCandInfo>&,
         const std::vector<TVector3>&);
+  // the same as above, with the PFCandidate sums computed beforehand
+  void setInput(const std::vector<mvaMEtUtilities::leptonInfo>&,
+		const std::vector<mvaMEtUtilities::JetInfo>&,
+		const PFCandSums&,
+        const std::vector<TVector3>&);
+
+  PFCandSums computePFCandSums(const std::vector<mvaMEtUtilities::pfCandInfo>&);
+  // add PFCandidates appended to the collection the sums have been computed for
+  void addToPFCandSums(PFCandSums&, const std::vector<mvaMEtUtilities::pfCandInfo>&);
 
   void evaluateMVA();
 
+  // input of the current event, which can be collected to evaluate the MVAs for several events at once
+  EventInput getEventInput() const;
+
+  // evaluate the MVAs for several events: each regression is evaluated for all events in a single pass
+  // over the compact copies of the forests (or the compiled MVAs), in the order { DPhi, U, CovU1 and CovU2 }
+  void evaluateMVA(const std::vector<EventInput>&, std::vector<EventOutput>&) const;
+  // set the output of the current event, e.g. the one evaluated for an identical input
+  void setOutput(const EventOutput&);
+
   const TLorentzVector& getMEt()    const { return mvaMEt_;    }
   const TMatrixD&                getMEtCov() const { return mvaMEtCov_; }
 
@@ -58,10 +119,8 @@ class PFMETAlgorithmMVA
 		double, double, 
 		double);
 
-  void evaluateU();
-  void evaluateDPhi();
-  void evaluateCovU1();
-  void evaluateCovU2();
+  static void evaluateRegression(const GBRForestCompact&, CompiledMVA, const Float_t*, size_t, double*);
+  void computeMEt(const EventInput&, EventOutput&) const;
 
   mvaMEtUtilities utils_;
     
@@ -98,11 +157,6 @@ class PFMETAlgorithmMVA
   Float_t numJets_;
   Float_t numVertices_;
 
-  Float_t* mvaInputU_;
-  Float_t* mvaInputDPhi_;
-  Float_t* mvaInputCovU1_;
-  Float_t* mvaInputCovU2_;
-  
   Float_t mvaOutputU_;
   Float_t mvaOutputDPhi_;
   Float_t mvaOutputCovU1_;
@@ -120,5 +174,15 @@ class PFMETAlgorithmMVA
   const GBRForest* mvaReaderDPhi_;
   const GBRForest* mvaReaderCovU1_;
   const GBRForest* mvaReaderCovU2_;
+
+  GBRForestCompact mvaCompactU_;
+  GBRForestCompact mvaCompactDPhi_;
+  GBRForestCompact mvaCompactCovU1_;
+  GBRForestCompact mvaCompactCovU2_;
+
+  CompiledMVA compiledMvaU_;
+  CompiledMVA compiledMvaDPhi_;
+  CompiledMVA compiledMvaCovU1_;
+  CompiledMVA compiledMvaCovU2_;
 };
 #endif
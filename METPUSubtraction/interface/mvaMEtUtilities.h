@@ -49,6 +49,9 @@ class mvaMEtUtilities
 				       const std::vector<leptonInfo>&, double, bool);
 
   CommonMETData computePFCandSum(const std::vector<pfCandInfo>&, double, int);
+  // adds PFCandidates to a sum computed by computePFCandSum with the same dZmax and dZflag:
+  // the result is the same as the sum of the concatenated collections
+  void addToPFCandSum(CommonMETData&, const std::vector<pfCandInfo>&, double, int);
   CommonMETData computeJetSum_neutral(const std::vector<JetInfo>&, bool);
 
   CommonMETData computePUMEt(const std::vector<pfCandInfo>&, const std::vector<JetInfo>&, double);
@@ -57,6 +60,15 @@ class mvaMEtUtilities
   CommonMETData computeNegTrackRecoil(const CommonMETData&, const std::vector<pfCandInfo>&, double);
   CommonMETData computeNegNoPURecoil (const CommonMETData&, const std::vector<pfCandInfo>&, const std::vector<JetInfo>&, double);
   CommonMETData computeNegPUCRecoil  (const CommonMETData&, const std::vector<pfCandInfo>&, const std::vector<JetInfo>&, double);
+
+  // the same recoils computed from the PFCandidate sums (dZflag 2 = pfCandSum, 0 = trackSumNoPU, 1 = trackSumPU),
+  // which don't depend on the leptons and on the jets
+  CommonMETData computePUMEt         (const CommonMETData& trackSumPU, const std::vector<JetInfo>&);
+  CommonMETData computeNegPFRecoil   (const CommonMETData&, const CommonMETData& pfCandSum);
+  CommonMETData computeNegTrackRecoil(const CommonMETData&, const CommonMETData& trackSumNoPU);
+  CommonMETData computeNegNoPURecoil (const CommonMETData&, const CommonMETData& trackSumNoPU, const std::vector<JetInfo>&);
+  CommonMETData computeNegPUCRecoil  (const CommonMETData&, const CommonMETData& pfCandSum, const CommonMETData& trackSumPU,
+                                      const std::vector<JetInfo>&);
   CommonMETData computeSumLeptons    (const std::vector<leptonInfo>& leptons, bool iCharged);
   void finalize(CommonMETData& metData);
  protected:
@@ -28,30 +28,21 @@ namespace
 
 PFMETAlgorithmMVA::PFMETAlgorithmMVA(double dZcut)
   : dZcut_(dZcut),
-    mvaInputU_(0),
-    mvaInputDPhi_(0),
-    mvaInputCovU1_(0),
-    mvaInputCovU2_(0),
     mvaMEtCov_(2, 2),
     mvaReaderU_(0),
     mvaReaderDPhi_(0),
     mvaReaderCovU1_(0),
-    mvaReaderCovU2_(0)/*,
+    mvaReaderCovU2_(0),
+    compiledMvaU_(0),
+    compiledMvaDPhi_(0),
+    compiledMvaCovU1_(0),
+    compiledMvaCovU2_(0)/*,
     cfg_(cfg)*/
 {  
-  mvaInputU_     = new Float_t[25];
-  mvaInputDPhi_  = new Float_t[23];
-  mvaInputCovU1_ = new Float_t[26];
-  mvaInputCovU2_ = new Float_t[26];
 }
 
 PFMETAlgorithmMVA::~PFMETAlgorithmMVA()
 {
-    delete mvaInputU_;
-    delete mvaInputDPhi_;
-    delete mvaInputCovU1_;
-    delete mvaInputCovU2_;
-
     delete mvaReaderU_;
     delete mvaReaderDPhi_;
     delete mvaReaderCovU1_;
@@ -70,6 +61,21 @@ void PFMETAlgorithmMVA::initialize(const std::string& inputFileNameU, const std:
     mvaReaderDPhi_  = loadMVAfromFile(inputFileNameDPhi, mvaNameDPhi_);
     mvaReaderCovU1_ = loadMVAfromFile(inputFileNameCovU1, mvaNameCovU1_);
     mvaReaderCovU2_ = loadMVAfromFile(inputFileNameCovU2, mvaNameCovU2_);
+
+    mvaCompactU_     = GBRForestCompact(*mvaReaderU_);
+    mvaCompactDPhi_  = GBRForestCompact(*mvaReaderDPhi_);
+    mvaCompactCovU1_ = GBRForestCompact(*mvaReaderCovU1_);
+    mvaCompactCovU2_ = GBRForestCompact(*mvaReaderCovU2_);
+}
+
+void PFMETAlgorithmMVA::initialize(CompiledMVA mvaU, CompiledMVA mvaDPhi, CompiledMVA mvaCovU1, CompiledMVA mvaCovU2)
+{
+    if ( !mvaU || !mvaDPhi || !mvaCovU1 || !mvaCovU2 )
+      throw std::runtime_error("PFMETAlgorithmMVA::initialize: compiled MVA is not set.");
+    compiledMvaU_     = mvaU;
+    compiledMvaDPhi_  = mvaDPhi;
+    compiledMvaCovU1_ = mvaCovU1;
+    compiledMvaCovU2_ = mvaCovU2;
 }
 
 //-------------------------------------------------------------------------------
@@ -77,6 +83,32 @@ void PFMETAlgorithmMVA::setInput(const std::vector<mvaMEtUtilities::leptonInfo>&
 				 const std::vector<mvaMEtUtilities::JetInfo>& jets,
 				 const std::vector<mvaMEtUtilities::pfCandInfo>& pfCandidates,
                  const std::vector<TVector3>& vertices)
+{
+  setInput(leptons, jets, computePFCandSums(pfCandidates), vertices);
+}
+
+PFMETAlgorithmMVA::PFCandSums PFMETAlgorithmMVA::computePFCandSums(const std::vector<mvaMEtUtilities::pfCandInfo>& pfCandidates)
+{
+  PFCandSums sums;
+  sums.pfCandSum     = utils_.computePFCandSum(pfCandidates, dZcut_, 2);
+  sums.trackSumNoPU  = utils_.computePFCandSum(pfCandidates, dZcut_, 0);
+  sums.trackSumPU    = utils_.computePFCandSum(pfCandidates, dZcut_, 1);
+  sums.trackSumPUMEt = utils_.computePFCandSum(pfCandidates, 0.2, 1); //dZCut bug
+  return sums;
+}
+
+void PFMETAlgorithmMVA::addToPFCandSums(PFCandSums& sums, const std::vector<mvaMEtUtilities::pfCandInfo>& pfCandidates)
+{
+  utils_.addToPFCandSum(sums.pfCandSum,     pfCandidates, dZcut_, 2);
+  utils_.addToPFCandSum(sums.trackSumNoPU,  pfCandidates, dZcut_, 0);
+  utils_.addToPFCandSum(sums.trackSumPU,    pfCandidates, dZcut_, 1);
+  utils_.addToPFCandSum(sums.trackSumPUMEt, pfCandidates, 0.2, 1);
+}
+
+void PFMETAlgorithmMVA::setInput(const std::vector<mvaMEtUtilities::leptonInfo>& leptons,
+				 const std::vector<mvaMEtUtilities::JetInfo>& jets,
+				 const PFCandSums& pfCandSums,
+                 const std::vector<TVector3>& vertices)
 {
   CommonMETData        sumLeptons = utils_.computeSumLeptons(leptons, false);
   CommonMETData chargedSumLeptons = utils_.computeSumLeptons(leptons, true);
@@ -90,11 +122,12 @@ void PFMETAlgorithmMVA::setInput(const std::vector<mvaMEtUtilities::leptonInfo>&
   double ptThreshold = -1000.;
   std::vector<mvaMEtUtilities::JetInfo> jets_cleaned = utils_.cleanJets(jets, leptons, ptThreshold, 0.5);
 
-  CommonMETData pfRecoil_data  = utils_.computeNegPFRecoil   (sumLeptons       , pfCandidates,               dZcut_);
-  CommonMETData tkRecoil_data  = utils_.computeNegTrackRecoil(chargedSumLeptons, pfCandidates,               dZcut_);
-  CommonMETData npuRecoil_data = utils_.computeNegNoPURecoil (chargedSumLeptons, pfCandidates, jets_cleaned, dZcut_);
-  CommonMETData pucRecoil_data = utils_.computeNegPUCRecoil  (sumLeptons       , pfCandidates, jets_cleaned, dZcut_);
-  CommonMETData puMEt_data     = utils_.computePUMEt         (                   pfCandidates, jets_cleaned, 0.2); //dZCut bug
+  CommonMETData pfRecoil_data  = utils_.computeNegPFRecoil   (sumLeptons       , pfCandSums.pfCandSum);
+  CommonMETData tkRecoil_data  = utils_.computeNegTrackRecoil(chargedSumLeptons, pfCandSums.trackSumNoPU);
+  CommonMETData npuRecoil_data = utils_.computeNegNoPURecoil (chargedSumLeptons, pfCandSums.trackSumNoPU, jets_cleaned);
+  CommonMETData pucRecoil_data = utils_.computeNegPUCRecoil  (sumLeptons       , pfCandSums.pfCandSum,
+                                                              pfCandSums.trackSumPU, jets_cleaned);
+  CommonMETData puMEt_data     = utils_.computePUMEt         (pfCandSums.trackSumPUMEt, jets_cleaned);
 
   TLorentzVector jet1P4 = utils_.leadJetP4(jets_cleaned);
   TLorentzVector jet2P4 = utils_.subleadJetP4(jets_cleaned);
@@ -176,164 +209,149 @@ void PFMETAlgorithmMVA::setInput(double pfSumEt, double pfU, double pfPhi,
 }
 //-------------------------------------------------------------------------------
 
+//-------------------------------------------------------------------------------
+PFMETAlgorithmMVA::EventInput PFMETAlgorithmMVA::getEventInput() const
+{
+  EventInput input;
+  input.variables[kPfSumEt]       = pfSumEt_; // PH: helps flattens response vs. Nvtx
+  input.variables[kNumVertices]   = numVertices_;
+  input.variables[kPfU]           = pfU_;
+  input.variables[kPfPhi]         = pfPhi_;
+  input.variables[kTkSumEt]       = tkSumEt_;
+  input.variables[kTkU]           = tkU_;
+  input.variables[kTkPhi]         = tkPhi_;
+  input.variables[kNpuSumEt]      = npuSumEt_;
+  input.variables[kNpuU]          = npuU_;
+  input.variables[kNpuPhi]        = npuPhi_;
+  input.variables[kPuSumEt]       = puSumEt_;
+  input.variables[kPuMEt]         = puMEt_;
+  input.variables[kPuPhi]         = puPhi_;
+  input.variables[kPucSumEt]      = pucSumEt_;
+  input.variables[kPucU]          = pucU_;
+  input.variables[kPucPhi]        = pucPhi_;
+  input.variables[kJet1Pt]        = jet1Pt_;
+  input.variables[kJet1Eta]       = jet1Eta_;
+  input.variables[kJet1Phi]       = jet1Phi_;
+  input.variables[kJet2Pt]        = jet2Pt_;
+  input.variables[kJet2Eta]       = jet2Eta_;
+  input.variables[kJet2Phi]       = jet2Phi_;
+  input.variables[kNumJets]       = numJets_;
+  input.variables[kNumJetsPtGt30] = numJetsPtGt30_;
+  input.sumLeptonPx = sumLeptonPx_;
+  input.sumLeptonPy = sumLeptonPy_;
+  return input;
+}
+
 //-------------------------------------------------------------------------------
 void PFMETAlgorithmMVA::evaluateMVA()
 {
+  std::vector<EventInput> inputs(1, getEventInput());
+  std::vector<EventOutput> outputs;
+  evaluateMVA(inputs, outputs);
+  setOutput(outputs.front());
+}
+
+void PFMETAlgorithmMVA::setOutput(const EventOutput& output)
+{
+  mvaOutputU_     = output.U;
+  mvaOutputDPhi_  = output.DPhi;
+  mvaOutputCovU1_ = output.CovU1;
+  mvaOutputCovU2_ = output.CovU2;
+  mvaMEt_         = output.mvaMEt;
+  mvaMEtCov_      = output.mvaMEtCov;
+}
+
+void PFMETAlgorithmMVA::evaluateMVA(const std::vector<EventInput>& inputs, std::vector<EventOutput>& outputs) const
+{
+  // all regressions read their inputs from the same rows of kNumInputs variables,
+  // the last two of which are filled with the outputs of the preceding regressions
+  const size_t numEvents = inputs.size();
+  std::vector<Float_t> rows(numEvents*kNumInputs);
+  std::vector<double> responses(numEvents);
+  outputs.resize(numEvents);
+  for ( size_t i = 0; i < numEvents; ++i ) {
+    std::copy(inputs[i].variables, inputs[i].variables + kNumEventInputs, rows.begin() + i*kNumInputs);
+  }
+  if ( !numEvents ) return;
+
   // CV: MVAs needs to be evaluated in order { DPhi, U1, CovU1, CovU2 }
   //     as MVA for U1 (CovU1, CovU2) uses output of DPhi (DPhi and U1) MVA
-  evaluateDPhi();
-  evaluateU();
-  evaluateCovU1();
-  evaluateCovU2();
+  evaluateRegression(mvaCompactDPhi_, compiledMvaDPhi_, &rows[kNumVertices], numEvents, &responses[0]);
+  for ( size_t i = 0; i < numEvents; ++i ) {
+    Float_t* row = &rows[i*kNumInputs];
+    outputs[i].DPhi = responses[i];
+    row[kCorrectedPhi] = row[kPfPhi] + outputs[i].DPhi;
+  }
+
+  evaluateRegression(mvaCompactU_, compiledMvaU_, &rows[0], numEvents, &responses[0]);
+  for ( size_t i = 0; i < numEvents; ++i ) {
+    Float_t* row = &rows[i*kNumInputs];
+    outputs[i].U = responses[i];
+    row[kCorrectedU] = outputs[i].U*row[kPfU];
+  }
+
+  // CovU1 and CovU2 share the same inputs
+  evaluateRegression(mvaCompactCovU1_, compiledMvaCovU1_, &rows[0], numEvents, &responses[0]);
+  for ( size_t i = 0; i < numEvents; ++i ) {
+    outputs[i].CovU1 = responses[i]*outputs[i].U*rows[i*kNumInputs + kPfU];
+    /*if ( !isOld42_ )*/ outputs[i].CovU1 *= outputs[i].CovU1; // PH: Training is not on the square anymore
+  }
+  evaluateRegression(mvaCompactCovU2_, compiledMvaCovU2_, &rows[0], numEvents, &responses[0]);
+  for ( size_t i = 0; i < numEvents; ++i ) {
+    outputs[i].CovU2 = responses[i]*outputs[i].U*rows[i*kNumInputs + kPfU];
+    /*if ( !isOld42_ )*/ outputs[i].CovU2 *= outputs[i].CovU2; // PH: Training is not on the square anymore
+  }
+
+  for ( size_t i = 0; i < numEvents; ++i ) {
+    computeMEt(inputs[i], outputs[i]);
+  }
+}
+
+void PFMETAlgorithmMVA::evaluateRegression(const GBRForestCompact& forest, CompiledMVA compiledMVA, const Float_t* rows,
+                                           size_t numEvents, double* responses)
+{
+  if ( compiledMVA ) {
+    for ( size_t i = 0; i < numEvents; ++i ) {
+      responses[i] = compiledMVA(rows + i*kNumInputs);
+    }
+  } else {
+    forest.GetResponses(rows, numEvents, kNumInputs, responses);
+  }
+}
+
+void PFMETAlgorithmMVA::computeMEt(const EventInput& input, EventOutput& output) const
+{
+  const Float_t pfU = input.variables[kPfU];
+  const Float_t pfPhi = input.variables[kPfPhi];
+  const Float_t tkU = input.variables[kTkU];
+  const Float_t npuU = input.variables[kNpuU];
 
   // compute MET(Photon check)
   if(hasPhotons_) { 
     //Fix events with unphysical properties
-    double sumLeptonPt = TMath::Max(sqrt(sumLeptonPx_*sumLeptonPx_+sumLeptonPy_*sumLeptonPy_),1.);
-    if(tkU_/sumLeptonPt < 0.1 || npuU_/sumLeptonPt <  0.1 ) mvaOutputU_      = 1.;
-    if(tkU_/sumLeptonPt < 0.1 || npuU_/sumLeptonPt <  0.1 ) mvaOutputDPhi_   = 0.;
+    double sumLeptonPt = TMath::Max(sqrt(input.sumLeptonPx*input.sumLeptonPx+input.sumLeptonPy*input.sumLeptonPy),1.);
+    if(tkU/sumLeptonPt < 0.1 || npuU/sumLeptonPt <  0.1 ) output.U      = 1.;
+    if(tkU/sumLeptonPt < 0.1 || npuU/sumLeptonPt <  0.1 ) output.DPhi   = 0.;
   }
-  double U      = pfU_*mvaOutputU_;
-  double Phi    = pfPhi_ + mvaOutputDPhi_;
+  double U      = pfU*output.U;
+  double Phi    = pfPhi + output.DPhi;
   if ( U < 0. ) Phi += TMath::Pi();
   double cosPhi = cos(Phi);
   double sinPhi = sin(Phi);
-  double metPx  = U*cosPhi - sumLeptonPx_; // CV: U is actually minus the hadronic recoil in the event
-  double metPy  = U*sinPhi - sumLeptonPy_;
+  double metPx  = U*cosPhi - input.sumLeptonPx; // CV: U is actually minus the hadronic recoil in the event
+  double metPy  = U*sinPhi - input.sumLeptonPy;
   double metPt  = sqrt(metPx*metPx + metPy*metPy);
-  mvaMEt_.SetPxPyPzE(metPx, metPy, 0., metPt);
+  output.mvaMEt.SetPxPyPzE(metPx, metPy, 0., metPt);
 
   // compute MET uncertainties in dirrections parallel and perpendicular to hadronic recoil
   // (neglecting uncertainties on lepton momenta)
-  mvaMEtCov_(0, 0) =  mvaOutputCovU1_*cosPhi*cosPhi + mvaOutputCovU2_*sinPhi*sinPhi;
-  mvaMEtCov_(0, 1) = -mvaOutputCovU1_*sinPhi*cosPhi + mvaOutputCovU2_*sinPhi*cosPhi;
-  mvaMEtCov_(1, 0) = mvaMEtCov_(0, 1);
-  mvaMEtCov_(1, 1) =  mvaOutputCovU1_*sinPhi*sinPhi + mvaOutputCovU2_*cosPhi*cosPhi;
+  output.mvaMEtCov(0, 0) =  output.CovU1*cosPhi*cosPhi + output.CovU2*sinPhi*sinPhi;
+  output.mvaMEtCov(0, 1) = -output.CovU1*sinPhi*cosPhi + output.CovU2*sinPhi*cosPhi;
+  output.mvaMEtCov(1, 0) = output.mvaMEtCov(0, 1);
+  output.mvaMEtCov(1, 1) =  output.CovU1*sinPhi*sinPhi + output.CovU2*cosPhi*cosPhi;
 }
 //-------------------------------------------------------------------------------
 
-//-------------------------------------------------------------------------------
-void PFMETAlgorithmMVA::evaluateU() 
-{ 
-  mvaInputU_[0]  = pfSumEt_; // PH: helps flattens response vs. Nvtx
-  mvaInputU_[1]  = numVertices_;
-  mvaInputU_[2]  = pfU_;
-  mvaInputU_[3]  = pfPhi_;
-  mvaInputU_[4]  = tkSumEt_;
-  mvaInputU_[5]  = tkU_;
-  mvaInputU_[6]  = tkPhi_;
-  mvaInputU_[7]  = npuSumEt_;
-  mvaInputU_[8]  = npuU_;
-  mvaInputU_[9]  = npuPhi_;
-  mvaInputU_[10] = puSumEt_;
-  mvaInputU_[11] = puMEt_;
-  mvaInputU_[12] = puPhi_;
-  mvaInputU_[13] = pucSumEt_;
-  mvaInputU_[14] = pucU_;
-  mvaInputU_[15] = pucPhi_;
-  mvaInputU_[16] = jet1Pt_;
-  mvaInputU_[17] = jet1Eta_;
-  mvaInputU_[18] = jet1Phi_;
-  mvaInputU_[19] = jet2Pt_;
-  mvaInputU_[20] = jet2Eta_;
-  mvaInputU_[21] = jet2Phi_;
-  mvaInputU_[22] = numJets_;
-  mvaInputU_[23] = numJetsPtGt30_;
-  mvaInputU_[24] = pfPhi_ + mvaOutputDPhi_;
-  mvaOutputU_    = mvaReaderU_->GetResponse(mvaInputU_);
-}
-
-void PFMETAlgorithmMVA::evaluateDPhi() 
-{ 
-  mvaInputDPhi_[0]  = numVertices_;
-  mvaInputDPhi_[1]  = pfU_;
-  mvaInputDPhi_[2]  = pfPhi_;
-  mvaInputDPhi_[3]  = tkSumEt_;
-  mvaInputDPhi_[4]  = tkU_;
-  mvaInputDPhi_[5]  = tkPhi_;
-  mvaInputDPhi_[6]  = npuSumEt_;
-  mvaInputDPhi_[7]  = npuU_;
-  mvaInputDPhi_[8]  = npuPhi_;
-  mvaInputDPhi_[9]  = puSumEt_;
-  mvaInputDPhi_[10] = puMEt_;
-  mvaInputDPhi_[11] = puPhi_;
-  mvaInputDPhi_[12] = pucSumEt_;
-  mvaInputDPhi_[13] = pucU_;
-  mvaInputDPhi_[14] = pucPhi_;
-  mvaInputDPhi_[15] = jet1Pt_;
-  mvaInputDPhi_[16] = jet1Eta_;
-  mvaInputDPhi_[17] = jet1Phi_;
-  mvaInputDPhi_[18] = jet2Pt_;
-  mvaInputDPhi_[19] = jet2Eta_;
-  mvaInputDPhi_[20] = jet2Phi_;
-  mvaInputDPhi_[21] = numJets_;
-  mvaInputDPhi_[22] = numJetsPtGt30_;
-  mvaOutputDPhi_    = mvaReaderDPhi_->GetResponse(mvaInputDPhi_);
-}
-
-void PFMETAlgorithmMVA::evaluateCovU1() 
-{ 
-  mvaInputCovU1_[0]  = pfSumEt_; // PH: helps flattens response vs. Nvtx
-  mvaInputCovU1_[1]  = numVertices_;
-  mvaInputCovU1_[2]  = pfU_;
-  mvaInputCovU1_[3]  = pfPhi_;
-  mvaInputCovU1_[4]  = tkSumEt_;
-  mvaInputCovU1_[5]  = tkU_;
-  mvaInputCovU1_[6]  = tkPhi_;
-  mvaInputCovU1_[7]  = npuSumEt_;
-  mvaInputCovU1_[8]  = npuU_;
-  mvaInputCovU1_[9]  = npuPhi_;
-  mvaInputCovU1_[10] = puSumEt_;
-  mvaInputCovU1_[11] = puMEt_;
-  mvaInputCovU1_[12] = puPhi_;
-  mvaInputCovU1_[13] = pucSumEt_;
-  mvaInputCovU1_[14] = pucU_;
-  mvaInputCovU1_[15] = pucPhi_;
-  mvaInputCovU1_[16] = jet1Pt_;
-  mvaInputCovU1_[17] = jet1Eta_;
-  mvaInputCovU1_[18] = jet1Phi_;
-  mvaInputCovU1_[19] = jet2Pt_;
-  mvaInputCovU1_[20] = jet2Eta_;
-  mvaInputCovU1_[21] = jet2Phi_;
-  mvaInputCovU1_[22] = numJets_;
-  mvaInputCovU1_[23] = numJetsPtGt30_;
-  mvaInputCovU1_[24] = pfPhi_ + mvaOutputDPhi_;
-  mvaInputCovU1_[25] = mvaOutputU_*pfU_;
-  mvaOutputCovU1_    = mvaReaderCovU1_->GetResponse(mvaInputCovU1_)*mvaOutputU_*pfU_;
-  /*if ( !isOld42_ )*/ mvaOutputCovU1_ *= mvaOutputCovU1_; // PH: Training is not on the square anymore
-}
-
-void PFMETAlgorithmMVA::evaluateCovU2() 
-{ 
-  mvaInputCovU2_[0]  = pfSumEt_; // PH: helps flattens response vs. Nvtx
-  mvaInputCovU2_[1]  = numVertices_;
-  mvaInputCovU2_[2]  = pfU_;
-  mvaInputCovU2_[3]  = pfPhi_;
-  mvaInputCovU2_[4]  = tkSumEt_;
-  mvaInputCovU2_[5]  = tkU_;
-  mvaInputCovU2_[6]  = tkPhi_;
-  mvaInputCovU2_[7]  = npuSumEt_;
-  mvaInputCovU2_[8]  = npuU_;
-  mvaInputCovU2_[9]  = npuPhi_;
-  mvaInputCovU2_[10] = puSumEt_;
-  mvaInputCovU2_[11] = puMEt_;
-  mvaInputCovU2_[12] = puPhi_;
-  mvaInputCovU2_[13] = pucSumEt_;
-  mvaInputCovU2_[14] = pucU_;
-  mvaInputCovU2_[15] = pucPhi_;
-  mvaInputCovU2_[16] = jet1Pt_;
-  mvaInputCovU2_[17] = jet1Eta_;
-  mvaInputCovU2_[18] = jet1Phi_;
-  mvaInputCovU2_[19] = jet2Pt_;
-  mvaInputCovU2_[20] = jet2Eta_;
-  mvaInputCovU2_[21] = jet2Phi_;
-  mvaInputCovU2_[22] = numJets_;
-  mvaInputCovU2_[23] = numJetsPtGt30_;
-  mvaInputCovU2_[24] = pfPhi_ + mvaOutputDPhi_;
-  mvaInputCovU2_[25] = mvaOutputU_*pfU_;
-  mvaOutputCovU2_    = mvaReaderCovU2_->GetResponse(mvaInputCovU2_)*mvaOutputU_*pfU_;
-  /*if ( !isOld42_ )*/ mvaOutputCovU2_ *= mvaOutputCovU2_; // PH: Training is not on the square anymore
-}
 void PFMETAlgorithmMVA::print(std::ostream& stream) const
 {
   stream << "<PFMETAlgorithmMVA::print>:" << std::endl;
@@ -123,17 +123,22 @@ CommonMETData mvaMEtUtilities::computePFCandSum(const std::vector<pfCandInfo>& p
   retVal.mex   = 0.;
   retVal.mey   = 0.;
   retVal.sumet = 0.;
+  addToPFCandSum(retVal, pfCandidates, dZmax, dZflag);
+  return retVal;
+}
+
+void mvaMEtUtilities::addToPFCandSum(CommonMETData& sum, const std::vector<pfCandInfo>& pfCandidates, double dZmax, int dZflag)
+{
   for ( std::vector<pfCandInfo>::const_iterator pfCandidate = pfCandidates.begin();
 	pfCandidate != pfCandidates.end(); ++pfCandidate ) {
     if ( pfCandidate->dZ_ < 0.    && dZflag != 2 ) continue;
     if ( pfCandidate->dZ_ > dZmax && dZflag == 0 ) continue;
     if ( pfCandidate->dZ_ < dZmax && dZflag == 1 ) continue;
-    retVal.mex   += pfCandidate->p4_.Px();
-    retVal.mey   += pfCandidate->p4_.Py();
-    retVal.sumet += pfCandidate->p4_.Pt();
+    sum.mex   += pfCandidate->p4_.Px();
+    sum.mey   += pfCandidate->p4_.Py();
+    sum.sumet += pfCandidate->p4_.Pt();
   }
-  finalize(retVal);
-  return retVal;
+  finalize(sum);
 }
 
 CommonMETData mvaMEtUtilities::computeSumLeptons(const std::vector<mvaMEtUtilities::leptonInfo>& leptons, bool iCharged)
@@ -176,12 +181,16 @@ CommonMETData mvaMEtUtilities::computeJetSum_neutral(const std::vector<JetInfo>&
 
 CommonMETData mvaMEtUtilities::computePUMEt(const std::vector<pfCandInfo>& pfCandidates, 
 					    const std::vector<JetInfo>& jets, double dZcut)
+{
+  return computePUMEt(computePFCandSum(pfCandidates, dZcut, 1), jets);
+}
+
+CommonMETData mvaMEtUtilities::computePUMEt(const CommonMETData& trackSumPU, const std::vector<JetInfo>& jets)
 {
   CommonMETData retVal;
   retVal.mex   = 0.;
   retVal.mey   = 0.;
   retVal.sumet = 0.;
-  CommonMETData trackSumPU = computePFCandSum(pfCandidates, dZcut, 1);
   CommonMETData jetSumPU_neutral = computeJetSum_neutral(jets, false);
   retVal.mex   = -(trackSumPU.mex + jetSumPU_neutral.mex);
   retVal.mey   = -(trackSumPU.mey + jetSumPU_neutral.mey);
@@ -192,9 +201,13 @@ CommonMETData mvaMEtUtilities::computePUMEt(const std::vector<pfCandInfo>& pfCan
 
 CommonMETData mvaMEtUtilities::computeNegPFRecoil(const CommonMETData& leptons, 
 						  const std::vector<pfCandInfo>& pfCandidates, double dZcut)
+{
+  return computeNegPFRecoil(leptons, computePFCandSum(pfCandidates, dZcut, 2));
+}
+
+CommonMETData mvaMEtUtilities::computeNegPFRecoil(const CommonMETData& leptons, const CommonMETData& pfCandSum)
 {
   CommonMETData retVal;
-  CommonMETData pfCandSum = computePFCandSum(pfCandidates, dZcut, 2);
   retVal.mex   = -pfCandSum.mex + leptons.mex; 
   retVal.mey   = -pfCandSum.mey + leptons.mey;
   retVal.sumet = pfCandSum.sumet - leptons.sumet;
@@ -204,9 +217,13 @@ CommonMETData mvaMEtUtilities::computeNegPFRecoil(const CommonMETData& leptons,
 
 CommonMETData mvaMEtUtilities::computeNegTrackRecoil(const CommonMETData& leptons, 
 						     const std::vector<pfCandInfo>& pfCandidates, double dZcut)
+{
+  return computeNegTrackRecoil(leptons, computePFCandSum(pfCandidates, dZcut, 0));
+}
+
+CommonMETData mvaMEtUtilities::computeNegTrackRecoil(const CommonMETData& leptons, const CommonMETData& trackSum)
 {
   CommonMETData retVal;
-  CommonMETData trackSum = computePFCandSum(pfCandidates, dZcut, 0);
   retVal.mex   = -trackSum.mex  + leptons.mex; 
   retVal.mey   = -trackSum.mey  + leptons.mey;
   retVal.sumet = trackSum.sumet - leptons.sumet;
@@ -217,12 +234,17 @@ CommonMETData mvaMEtUtilities::computeNegTrackRecoil(const CommonMETData& lepton
 CommonMETData mvaMEtUtilities::computeNegNoPURecoil(const CommonMETData& leptons,
 						    const std::vector<pfCandInfo>& pfCandidates, 
 						    const std::vector<JetInfo>& jets, double dZcut)
+{
+  return computeNegNoPURecoil(leptons, computePFCandSum(pfCandidates, dZcut, 0), jets);
+}
+
+CommonMETData mvaMEtUtilities::computeNegNoPURecoil(const CommonMETData& leptons, const CommonMETData& trackSumNoPU,
+						    const std::vector<JetInfo>& jets)
 {
   CommonMETData retVal;
   retVal.mex   = 0.;
   retVal.mey   = 0.;
   retVal.sumet = 0.;
-  CommonMETData trackSumNoPU = computePFCandSum(pfCandidates, dZcut, 0);
   CommonMETData jetSumNoPU_neutral = computeJetSum_neutral(jets, true);
   retVal.mex   = -(trackSumNoPU.mex + jetSumNoPU_neutral.mex)  + leptons.mex;
   retVal.mey   = -(trackSumNoPU.mey + jetSumNoPU_neutral.mey)  + leptons.mey;
@@ -234,13 +256,18 @@ CommonMETData mvaMEtUtilities::computeNegNoPURecoil(const CommonMETData& leptons
 CommonMETData mvaMEtUtilities::computeNegPUCRecoil(const CommonMETData& leptons, 
 						   const std::vector<pfCandInfo>& pfCandidates, 
 						   const std::vector<JetInfo>& jets, double dZcut)
+{
+  return computeNegPUCRecoil(leptons, computePFCandSum(pfCandidates, dZcut, 2), computePFCandSum(pfCandidates, dZcut, 1),
+                             jets);
+}
+
+CommonMETData mvaMEtUtilities::computeNegPUCRecoil(const CommonMETData& leptons, const CommonMETData& pfCandSum,
+						   const CommonMETData& trackSumNoPU, const std::vector<JetInfo>& jets)
 {
    CommonMETData retVal;
   retVal.mex   = 0.;
   retVal.mey   = 0.;
   retVal.sumet = 0.;
-  CommonMETData pfCandSum = computePFCandSum(pfCandidates, dZcut, 2);
-  CommonMETData trackSumNoPU = computePFCandSum(pfCandidates, dZcut, 1);
   CommonMETData jetSumPU_neutral = computeJetSum_neutral(jets, false);
   retVal.mex   = -(pfCandSum.mex - (trackSumNoPU.mex + jetSumPU_neutral.mex))    + leptons.mex;
   retVal.mey   = -(pfCandSum.mey - (trackSumNoPU.mey + jetSumPU_neutral.mey))    + leptons.mey;
@@ -248,4 +275,3 @@ CommonMETData mvaMEtUtilities::computeNegPUCRecoil(const CommonMETData& leptons,
   finalize(retVal);
   return retVal;
 }
-  
@@ -64,7 +64,7 @@ int main(int argc, char *argv[])
 }
 " > $CODE_OUT
 
-g++ -std=c++0x -Wall -O3 \
+g++ -std=c++0x -Wall -pthread -O3 \
         -I. -I$CMSSW_BASE/src -I$CMSSW_RELEASE_BASE/src -I$ROOT_INCLUDE_PATH -I$BOOST_INCLUDE_PATH \
         $( root-config --libs ) -lMathMore -lGenVector -lASImage \
         -o $EXE_NAME $CODE_OUT
@@ -45,4 +45,22 @@ double probTauToLepPhaseSpace(double decayAngle, double nunuMass, double visMass
 */
 double probTauToHadPhaseSpace(double decayAngle, double nunuMass, double visMass, double x, bool applySinTheta, bool verbose = false);
 
+/**
+   \brief   Batched versions of the likelihood functions above
+
+   The functions evaluate the likelihood for numPoints points at once. The per-point inputs are contiguous arrays
+   (structure-of-arrays layout), quantities that are common for all points (visMass, covariance) are scalars.
+   The loops are free of function calls other than the elementary math functions and of data dependent branches,
+   so that they can be auto-vectorized. Up to rounding, the results are identical to the scalar versions.
+
+   probMET stores the likelihood of each point in prob, while the phase space likelihoods multiply it into prob,
+   which allows to build the combined likelihood without temporary arrays.
+*/
+void probMET(const double* dMETX, const double* dMETY, unsigned numPoints, double covDet, const TMatrixD& covInv,
+             double power, double* prob);
+void probTauToLepPhaseSpace(const double* decayAngle, const double* nunuMass, double visMass, const double* x,
+                            unsigned numPoints, bool applySinTheta, double* prob);
+void probTauToHadPhaseSpace(const double* decayAngle, const double* nunuMass, double visMass, const double* x,
+                            unsigned numPoints, bool applySinTheta, double* prob);
+
 } // namespace NSVfitStandalone
@@ -14,6 +14,26 @@
  * NOTE: integrand and callBackFunctions passed to MarkovChainIntegrator class
  *       must not be deleted until all integrations have finished.
  *
+ * The Markov Chains can be run concurrently (see setNumThreads). Each chain has its own random number generator,
+ * seeded from the chain index, and its own workspace, so the integrand must be thread-safe in this case.
+ * The call-back functions are evaluated in the calling thread after all chains have finished, for the positions
+ * of all chains in the order of the chain index. The results therefore do not depend on the number of threads.
+ *
+ * If the integrand can evaluate several points at once (see BatchIntegrand), it is used to compute the gradient
+ * in "Hybrid" mode and the trial points of "multiple-try Metropolis" moves, which are described in:
+ *  [3] "The Multiple-Try Method and Local Optimization in Metropolis Sampling",
+ *      J.S. Liu, F. Liang and W.H. Wong, J. Am. Stat. Assoc. 95 (2000) 121
+ *
+ * The sampling stage can be stopped early once the estimates of a set of observables have converged
+ * (see setConvergenceCriterion). The convergence is judged by the Gelman-Rubin R-hat across the chains in:
+ *  [4] "Inference from Iterative Simulation Using Multiple Sequences",
+ *      A. Gelman and D.B. Rubin, Statist. Sci. 7 (1992) 457
+ * and by the uncertainty on the mean estimated with the method of batch means (section 6.3 of [1]).
+ *
+ * The chains can be warm-started from the final positions of the chains of a previous integration
+ * (see setWarmStart), e.g. for an integrand that differs only slightly from the one integrated before.
+ * Warm-started chains skip the "simulated annealing" stage and run a shorter burn-in stage.
+ *
  * \author Christian Veelken, LLR
  *
  * \version $Revision: 1.8.2.2 $
@@ -30,17 +50,45 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <thread>
+#include <exception>
+#include <algorithm>
 
 namespace NSVfitStandalone{
 
-enum class MoveMode { kMetropolis, kHybrid };
+enum class MoveMode { kMetropolis, kHybrid, kMultipleTry };
 
 enum class InitMode { kUniform, kGaus, kNone };
 
+//--- interface of integrands that evaluate the probability P(q) for several points at once;
+//    the points are passed in structure-of-arrays layout (x[iDimension*stride + iPoint])
+//    and the probabilities are stored in prob[iPoint]
+class BatchIntegrand
+{
+ public:
+  virtual ~BatchIntegrand() {}
+  virtual void evalBatch(const double* x, unsigned numPoints, unsigned stride, double* prob) const = 0;
+};
+
+//--- interface of the observables that are monitored by the convergence criterion
+class ConvergenceObservables
+{
+ public:
+  virtual ~ConvergenceObservables() {}
+  virtual unsigned numObservables() const = 0;
+//  compute the observables at position x in the N-dimensional space in which the integration is performed
+  virtual void evalObservables(const double* x, double* values) const = 0;
+//  required precision on the mean of an observable, given the current estimate of the mean
+  virtual double requiredPrecision(unsigned iObservable, double mean) const = 0;
+};
 
 class MarkovChainIntegrator
 {
  public:
+//--- positions q of the Markov Chains at the end of an integration (index = chain, dimension);
+//    the position of a chain that could not be started is empty
+  typedef std::vector< std::vector<double> > ChainPositions;
+
   MarkovChainIntegrator(const std::string& name, MoveMode moveMode, InitMode initMode,
                         unsigned numIterBurnin, unsigned numIterSampling,
                         unsigned numIterSimAnnealingPhase1, unsigned numIterSimAnnealingPhase2,
@@ -57,6 +105,10 @@ class MarkovChainIntegrator
 //   (eq. (11) in [2])
   void setIntegrand(const ROOT::Math::Functor&);
 
+//--- set batched version of the integrand (optional);
+//    it must return the same values as the function passed to setIntegrand
+  void setBatchIntegrand(const BatchIntegrand&);
+
 //--- set function to evaluate "valid" (physically allowed) start-position 
   void setStartPosition_and_MomentumFinder(const ROOT::Math::Functor&);
 
@@ -79,43 +131,139 @@ class MarkovChainIntegrator
 
   void integrate(const std::vector<double>&, const std::vector<double>&, double&, double&, int&, const std::string& = "");
 
+//--- set maximal number of threads used to run the Markov Chains concurrently (default is 1)
+  void setNumThreads(unsigned numThreads) { numThreads_ = numThreads; }
+
+//--- set number of trial points per "multiple-try Metropolis" move (default is 4)
+  void setNumProposals(unsigned numProposals) { numProposals_ = std::max(numProposals, 1u); }
+
+//--- stop the sampling stage early once the estimates of the given observables have converged (optional):
+//    the chains are advanced in steps of checkInterval sampling moves. After each step, the observables are evaluated
+//    in the calling thread for every thinning-th position of the chains. The sampling stops once, for every observable,
+//    the uncertainty on the mean estimated from the step means is below the required precision and,
+//    in case of several chains, R-hat is below maxRhat.
+  void setConvergenceCriterion(const ConvergenceObservables& observables, unsigned checkInterval, double maxRhat,
+                               unsigned thinning = 10)
+  {
+    convergenceObservables_ = &observables;
+    convergenceCheckInterval_ = std::max(checkInterval, 1u);
+    convergenceMaxRhat_ = maxRhat;
+    convergenceThinning_ = std::max(thinning, 1u);
+  }
+
+//--- number of sampling moves per chain performed by the last integration
+  unsigned getNumIterSampled() const { return numIterSampled_; }
+
+//--- number of chains that have been run by the last integration
+  unsigned getNumChainsRun() const { return numChainsRun_; }
+
+//--- final positions of the chains of the last integration
+  ChainPositions getChainPositions() const;
+
+//--- start the chains of the following integrations from the given positions and run numIterBurnin burn-in moves
+//    without "simulated annealing" instead of the configured burn-in stage;
+//    chains without a valid position (empty, of different dimensionality or of probability zero) are started as usual
+  void setWarmStart(const ChainPositions& positions, unsigned numIterBurnin)
+  {
+    warmStartPositions_ = positions;
+    numIterBurninWarmStart_ = numIterBurnin;
+  }
+  void clearWarmStart() { warmStartPositions_.clear(); }
+
   void print(std::ostream&) const;
 
  protected:
 
-  void initializeStartPosition_and_Momentum();
+  typedef std::vector<double> vdouble;
+
+  // state of a single Markov Chain
+  struct ChainState
+  {
+    // random number generator
+    TRandom3 rnd_;
+
+    // current state of Markov Chain
+    vdouble p_;
+    vdouble q_;
+    vdouble gradE_;
+    double prob_;
+
+    // temporary variables used for computations
+    vdouble u_;
+    vdouble pProposal_;
+    vdouble qProposal_;
+    vdouble x_;
+
+    // points evaluated at once by the batched integrand:
+    // positions q (index = point*numDimensions + dimension), positions x (index = dimension*numPoints + point)
+    // and probabilities (index = point)
+    vdouble qBatch_;
+    vdouble xBatch_;
+    vdouble probBatch_;
+
+    // positions x of all sampling moves, stored to evaluate "call-back" functions after all chains have finished
+    // (index = move*numDimensions + dimension)
+    vdouble samples_;
+
+    // sums of the observables monitored by the convergence criterion and their means for each step
+    // (index = step*numObservables + observable)
+    vdouble observableSum_;
+    vdouble observableSum2_;
+    vdouble observableStepMeans_;
+    long numObservableSamples_;
+
+    bool isValid_;
+    long numMoves_accepted_;
+    long numMoves_rejected_;
+  };
+
+  void runChainsConcurrently(unsigned, unsigned);
+  void runChains(unsigned, unsigned, unsigned, unsigned, std::exception_ptr&);
+  void startChain(unsigned, ChainState&);
+  bool warmStartChain(unsigned, ChainState&);
+  void advanceChain(unsigned, ChainState&, unsigned, unsigned);
+
+  bool isConverged(unsigned, unsigned);
 
-  void makeStochasticMove(unsigned, bool&, bool&);
-  void makeDynamicMoves(const std::vector<double>&);
+  void initializeStartPosition_and_Momentum(ChainState&);
+
+  void makeStochasticMove(ChainState&, unsigned, bool&, bool&);
+  void makeDynamicMoves(ChainState&, const std::vector<double>&);
+  void makeMultipleTryMove(ChainState&, unsigned, const std::vector<double>&, bool&);
   
-  void sampleSphericallyRandom();
+  void sampleSphericallyRandom(ChainState&);
 
-  void updateX(const std::vector<double>&);
+  void updateX(const std::vector<double>&, vdouble&) const;
 
-  double evalProb(const std::vector<double>&);
-  double evalE(const std::vector<double>&);
-  double evalK(const std::vector<double>&, unsigned, unsigned);
+  double evalProb(const std::vector<double>&, vdouble&) const;
+  void evalProbBatch(ChainState&, unsigned) const;
+  double evalE(const std::vector<double>&, vdouble&) const;
+  double evalK(const std::vector<double>&, unsigned, unsigned) const;
   
-  void updateGradE(std::vector<double>&);
+  void updateGradE(ChainState&, std::vector<double>&);
 
   std::string name_;
 
   const ROOT::Math::Functor* integrand_;
 
+  const BatchIntegrand* batchIntegrand_;
+
   const ROOT::Math::Functor* startPosition_and_MomentumFinder_;
 
   std::vector<const ROOT::Math::Functor*> callBackFunctions_;
     
-  // parameter defining whether to run integration in "Metropolis" or "Hybrid" mode
+  // parameter defining whether to run integration in "Metropolis", "Hybrid" or "multiple-try Metropolis" mode
   MoveMode moveMode_;
 
+  // number of trial points per "multiple-try Metropolis" move
+  unsigned numProposals_;
+
   // parameters defining integration region
   //  numDimensions: dimensionality of integration region (Hypercube)
   //  xMin:          lower boundaries of integration region 
   //  xMax:          upper boundaries of integration region
   //  initMode:      flag indicating how initial position of Markov Chain is chosen (uniform/Gaus distribution)
   unsigned numDimensions_;
-  double* x_;
   std::vector<double> xMin_; // index = dimension
   std::vector<double> xMax_; // index = dimension
   InitMode initMode_;
@@ -129,6 +277,21 @@ class MarkovChainIntegrator
   unsigned numIterBurnin_;
   unsigned numIterSampling_;
 
+  // parameters of the optional convergence criterion for the sampling stage
+  //  (see setConvergenceCriterion)
+  const ConvergenceObservables* convergenceObservables_;
+  unsigned convergenceCheckInterval_;
+  double convergenceMaxRhat_;
+  unsigned convergenceThinning_;
+
+  // number of sampling moves per chain performed by the last integration
+  unsigned numIterSampled_;
+
+  // positions from which the chains are warm-started and number of burn-in moves of warm-started chains
+  //  (see setWarmStart)
+  ChainPositions warmStartPositions_;
+  unsigned numIterBurninWarmStart_;
+
   // maximum number of attempts to find a valid starting-position for the Markov Chain
   // (i.e. an initial point of non-zero probability)
   unsigned maxCallsStartingPos_;
@@ -148,6 +311,9 @@ class MarkovChainIntegrator
   // number of Markov Chains run in parallel
   unsigned numChains_;
 
+  // maximal number of threads used to run the Markov Chains
+  unsigned numThreads_;
+
   // number of iterations per batch
   // (used for estimation of uncertainty on computed integral value,
   //  according to eqs. (6.39) and (6.40) in [1])
@@ -158,7 +324,6 @@ class MarkovChainIntegrator
   //  L:        number of "dynamical moves" performed per "stochastic move"
   //  epsilon0: average step-size used for "dynamical moves"
   //  nu:       spread of step-sizes used for "dynamical moves"
-  typedef std::vector<double> vdouble;
   vdouble dqDerr_; // index = dimension
   unsigned L_;
   double epsilon0_;
@@ -166,19 +331,11 @@ class MarkovChainIntegrator
   bool useVariableEpsilon0_;
   double nu_;
 
-  // random number generator
-  TRandom3 rnd_;
-
-  // internal variables storing current state of Markov Chain
-  vdouble p_;
-  vdouble q_;
-  vdouble gradE_;
-  double prob_;
+  // requested start position of the Markov Chains
+  vdouble qStart_;
 
-  // temporary variables used for computations
-  vdouble u_;
-  vdouble pProposal_;
-  vdouble qProposal_;
+  // state of each Markov Chain
+  std::vector<ChainState> chains_;
 
   vdouble probSum_; // index = chain*numBatches + batch 
   vdouble integral_;
@@ -193,7 +350,7 @@ class MarkovChainIntegrator
   long numMovesTotal_rejected_;
 
   void openMonitorFile(const std::string&);
-  void updateMonitorFile();
+  void updateMonitorFile(const double*);
   void closeMonitorFile();
 
   TFile* monitorFile_;
@@ -4,10 +4,14 @@
 #include "../interface/MarkovChainIntegrator.h"
 #include "../interface/svFitAuxFunctions.h"
 
+#include <algorithm>
+
 #include <TMath.h>
 #include <TArrayF.h>
 #include <TString.h>
 
+namespace ROOT { namespace Math { class GSLMCIntegrator; } }
+
 /**
    \class   ObjectFunctionAdapter NSVfitStandaloneAlgorithm.h "TauAnalysis/CandidateTools/interface/NSVfitStandaloneAlgorithm.h"
    
@@ -52,27 +56,51 @@ namespace NSVfitStandalone{
 
   // for markov chain integration
   void map_x(const double*, int, double*);
+  // same as above for numPoints points in structure-of-arrays layout (x[iDimension*stride + iPoint],
+  // x_mapped[iParameter*strideMapped + iPoint])
+  void map_x(const double*, int, unsigned, unsigned, double*, unsigned);
   // class definitions for markov chain integration method
-  class MCObjectiveFunctionAdapter : public ROOT::Math::Functor
+  // NOTE: the objective function is evaluated concurrently by the Markov Chains, so it must not have a mutable state
+  //       and it refers to the likelihood explicitly, since the global likelihood pointer is thread local
+  class MCObjectiveFunctionAdapter : public ROOT::Math::Functor, public BatchIntegrand
   {
    public:
+    MCObjectiveFunctionAdapter() : nll_(NSVfitStandaloneLikelihood::gNSVfitStandaloneLikelihood), nDim_(0) {}
+    void SetLikelihood(const NSVfitStandaloneLikelihood* nll) { nll_ = nll; }
     void SetNDim(int nDim) { nDim_ = nDim; }
     unsigned int NDim() const { return nDim_; }
+    virtual void evalBatch(const double* x, unsigned numPoints, unsigned stride, double* probs) const
+    {
+      const unsigned batchSize = 64;
+      double x_mapped[6*batchSize];
+      for ( unsigned first = 0; first < numPoints; first += batchSize ) {
+        const unsigned n = std::min(numPoints - first, batchSize);
+        map_x(x + first, nDim_, n, stride, x_mapped, batchSize);
+        nll_->prob(x_mapped, n, batchSize, probs + first);
+      }
+      for ( unsigned i = 0; i < numPoints; ++i ) {
+        if ( TMath::IsNaN(probs[i]) ) probs[i] = 0.;
+      }
+    }
    private:
     virtual double DoEval(const double* x) const
     {
-      map_x(x, nDim_, x_mapped_);
-      double prob = NSVfitStandaloneLikelihood::gNSVfitStandaloneLikelihood->prob(x_mapped_);
+      double x_mapped[6];
+      map_x(x, nDim_, x_mapped);
+      double prob = nll_->prob(x_mapped);
       if ( TMath::IsNaN(prob) ) prob = 0.;
       return prob;
     }
-    mutable double x_mapped_[6];
+    const NSVfitStandaloneLikelihood* nll_;
     int nDim_;
   };
-  class MCPtEtaPhiMassAdapter : public ROOT::Math::Functor
+  // NOTE: the callback and the convergence observables are evaluated serially in the thread calling the integration
+  class MCPtEtaPhiMassAdapter : public ROOT::Math::Functor, public ConvergenceObservables
   {
    public:
+    enum { kMass, kPt, kEta, kPhi, kNumObservables };
     MCPtEtaPhiMassAdapter()
+      : referencePhi_(0.), convergencePrecision_(0.)
     {
       histogramPt_ = makeHistogram("NSVfitStandaloneAlgorithm_histogramPt", 1., 1.e+3, 1.025);
       histogramPt_density_ = (TH1*)histogramPt_->Clone(Form("%s_density", histogramPt_->GetName()));
@@ -96,6 +124,27 @@ namespace NSVfitStandalone{
     }
     void SetNDim(int nDim) { nDim_ = nDim; }
     unsigned int NDim() const { return nDim_; }
+    /// phi with respect to which the phi observable is measured, to avoid the discontinuity at +/- pi
+    void SetReferencePhi(double referencePhi) { referencePhi_ = referencePhi; }
+    /// relative precision required on the mean mass and pt, absolute precision required on the mean eta and phi
+    void SetConvergencePrecision(double precision) { convergencePrecision_ = precision; }
+    virtual unsigned numObservables() const { return kNumObservables; }
+    virtual void evalObservables(const double* x, double* values) const
+    {
+      compFittedDiTauSystem(x);
+      values[kMass] = fittedDiTauSystem_.mass();
+      values[kPt] = fittedDiTauSystem_.pt();
+      values[kEta] = fittedDiTauSystem_.eta();
+      double dPhi = fittedDiTauSystem_.phi() - referencePhi_;
+      if ( dPhi > +TMath::Pi() ) dPhi -= 2.*TMath::Pi();
+      if ( dPhi < -TMath::Pi() ) dPhi += 2.*TMath::Pi();
+      values[kPhi] = dPhi;
+    }
+    virtual double requiredPrecision(unsigned iObservable, double mean) const
+    {
+      if ( iObservable == kMass || iObservable == kPt ) return convergencePrecision_*std::abs(mean);
+      return convergencePrecision_;
+    }
     void Reset()
     {
       histogramPt_->Reset();
@@ -125,11 +174,15 @@ namespace NSVfitStandalone{
       TH1* histogram = new TH1D(histogramName.data(), histogramName.data(), numBins, binning.GetArray());
       return histogram;
     }
-    virtual double DoEval(const double* x) const
+    void compFittedDiTauSystem(const double* x) const
     {
       map_x(x, nDim_, x_mapped_);
       NSVfitStandaloneLikelihood::gNSVfitStandaloneLikelihood->results(fittedTauLeptons_, x_mapped_);
       fittedDiTauSystem_ = fittedTauLeptons_[0] + fittedTauLeptons_[1];
+    }
+    virtual double DoEval(const double* x) const
+    {
+      compFittedDiTauSystem(x);
       //std::cout << "<MCPtEtaPhiMassAdapter::DoEval>" << std::endl;
       //std::cout << " Pt = " << fittedDiTauSystem_.pt() << ","
       //	  << " eta = " << fittedDiTauSystem_.eta() << ","
@@ -185,6 +238,8 @@ namespace NSVfitStandalone{
     mutable TH1* histogramMass_density_;
     mutable double x_mapped_[6];
     int nDim_;
+    double referencePhi_;
+    double convergencePrecision_;
   };
 
 /**
@@ -246,10 +301,20 @@ namespace NSVfitStandalone{
    \var metPower : indicating an additional power to enhance the MET likelihood (default is 1.)
    \var addLogM : specifying whether to use the LogM penalty term or not (default is true)     
    \var maxObjFunctionCalls : the maximum of function calls before the minimization procedure is terminated (default is 5000)
+
+   The mass scan of the VEGAS integration mode can be switched from the linear scan to the adaptive scan: 
+
+   algo.vegasScanMode(NSVfitStandaloneAlgorithm::kAdaptiveScan, 0.5, 60000);
+
+   The adaptive scan locates the peak of the likelihood with a coarse scan and refines it by golden-section search until
+   the mass interval is below the given tolerance (in GeV) or the budget of integrand calls is exhausted.
 */
 class NSVfitStandaloneAlgorithm
 {
  public:
+  /// mass scan strategies of the VEGAS integration mode
+  enum VegasScanMode { kLinearScan, kAdaptiveScan };
+
   /// constructor from a minimal set of configurables
   NSVfitStandaloneAlgorithm(std::vector<MeasuredTauLepton> measuredTauLeptons, Vector measuredMET, const TMatrixD& covMET, unsigned int verbosity = 0);
   /// destructor
@@ -261,6 +326,45 @@ class NSVfitStandaloneAlgorithm
   void metPower(double value) { nll_->metPower(value); }
   /// maximum function calls after which to stop the minimization procedure (default is 5000)
   void maxObjFunctionCalls(double value) { maxObjFunctionCalls_ = value; }
+  /// number of Markov Chains used by the Markov Chain integration, which share the total number of sampling moves,
+  /// and maximal number of threads that run them concurrently (default is 1 chain); the result depends only on the
+  /// number of chains
+  void markovChains(unsigned int numChains, unsigned int numThreads = 1)
+  {
+    numChains2_ = std::max(numChains, 1u);
+    numThreads2_ = std::max(numThreads, 1u);
+  }
+  /// number of trial points per move of the Markov Chain integration (default is 1). With more than one trial point,
+  /// "multiple-try Metropolis" moves are used: the trial points are evaluated at once by the batched likelihood and
+  /// the number of moves is reduced by the number of trial points, since each move explores the parameter space
+  /// correspondingly further
+  void markovChainProposals(unsigned int numProposals) { numProposals2_ = std::max(numProposals, 1u); }
+  /// stop the sampling of the Markov Chain integration once the means of the di-tau mass, pt, eta and phi are known
+  /// with the given precision (relative for mass and pt, absolute for eta and phi) and the chains agree within the
+  /// given Gelman-Rubin R-hat; convergence is checked every checkInterval moves of each chain (default is disabled,
+  /// i.e. precision = 0)
+  void markovChainConvergence(double precision, unsigned int checkInterval = 1000, double maxRhat = 1.1)
+  {
+    convergencePrecision2_ = std::max(precision, 0.);
+    convergenceCheckInterval2_ = std::max(checkInterval, 1u);
+    convergenceMaxRhat2_ = maxRhat;
+  }
+  /// start the Markov Chain integration from the final chain positions of the integration of a similar event (e.g. the
+  /// same event with a different energy scale), with a burn-in stage shortened to the given fraction of the default one
+  /// and without simulated annealing (default is to start from the fixed start position with the full burn-in stage)
+  void markovChainWarmStart(const MarkovChainIntegrator::ChainPositions& positions, double burninFraction = 0.1)
+  {
+    warmStartPositions2_ = positions;
+    warmStartBurninFraction2_ = std::max(burninFraction, 0.);
+  }
+  /// mass scan strategy of the VEGAS integration, mass tolerance and maximal number of integrand calls of the adaptive
+  /// scan (default is the linear scan)
+  void vegasScanMode(VegasScanMode mode, double massTolerance = 1., unsigned int maxIntegrandCalls = 80000)
+  {
+    vegasScanMode_ = mode;
+    vegasMassTolerance_ = massTolerance;
+    vegasMaxIntegrandCalls_ = maxIntegrandCalls;
+  }
 
   /// fit to be called from outside
   void fit();
@@ -294,6 +398,10 @@ class NSVfitStandaloneAlgorithm
   double massUncert() const { return massUncert_; };
   /// return mass of the di-tau system (kept for legacy)
   double getMass() const {return mass();};
+  /// return final positions of the chains of the last Markov Chain integration, to warm-start another integration
+  MarkovChainIntegrator::ChainPositions markovChainPositions() const { return integrator2_ ? integrator2_->getChainPositions() : MarkovChainIntegrator::ChainPositions(); }
+  /// return number of sampling moves made by all chains of the last Markov Chain integration
+  unsigned int numMarkovChainMoves() const { return integrator2_ ? integrator2_->getNumIterSampled()*integrator2_->getNumChainsRun() : 0; }
 
   /// return pt, eta, phi values and their uncertainties
   /*
@@ -329,6 +437,12 @@ class NSVfitStandaloneAlgorithm
  private:
   /// setup the starting values for the minimization (default values for the fit parameters are taken from src/SVFitParameters.cc in the same package)
   void setup();
+  /// integral of the likelihood for the given di-tau mass in the VEGAS integration mode
+  double integrateVEGASAtMass(ROOT::Math::GSLMCIntegrator& integrator, int par, double mtest);
+  /// scan of the di-tau mass in fixed steps, starting from the visible mass; returns the maximal likelihood
+  double scanMassLinearVEGAS(ROOT::Math::GSLMCIntegrator& integrator, int par);
+  /// coarse scan of the di-tau mass followed by golden-section refinement around the peak; returns the maximal likelihood
+  double scanMassAdaptiveVEGAS(ROOT::Math::GSLMCIntegrator& integrator, int par);
 
  private:
   /// return whether this is a valid solution or not
@@ -339,6 +453,11 @@ class NSVfitStandaloneAlgorithm
   unsigned int verbosity_;
   /// stop minimization after a maximal number of function calls
   unsigned int maxObjFunctionCalls_;
+  /// mass scan strategy of the VEGAS integration
+  VegasScanMode vegasScanMode_;
+  /// required precision on the mass and maximal number of integrand calls of the adaptive mass scan
+  double vegasMassTolerance_;
+  unsigned int vegasMaxIntegrandCalls_;
 
   /// minuit instance 
   ROOT::Math::Minimizer* minimizer_;
@@ -362,6 +481,14 @@ class NSVfitStandaloneAlgorithm
   int integrator2_nDim_;
   bool isInitialized2_;
   unsigned maxObjFunctionCalls2_;
+  unsigned numChains2_;
+  unsigned numThreads2_;
+  unsigned numProposals2_;
+  double convergencePrecision2_;
+  unsigned convergenceCheckInterval2_;
+  double convergenceMaxRhat2_;
+  MarkovChainIntegrator::ChainPositions warmStartPositions2_;
+  double warmStartBurninFraction2_;
 
   /// pt of di-tau system
   double pt_;
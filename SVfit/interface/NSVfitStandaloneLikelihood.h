@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <atomic>
 
 #include "TMath.h"
 #include "TMatrixD.h"
@@ -119,8 +120,9 @@ namespace NSVfitStandalone {
     NSVfitStandaloneLikelihood(std::vector<MeasuredTauLepton> measuredTauLeptons, Vector measuredMET, const TMatrixD& covMET, bool verbose);
     /// default destructor
     ~NSVfitStandaloneLikelihood() {}
-    /// static pointer to this (needed for the minuit function calls)
-    static const NSVfitStandaloneLikelihood* gNSVfitStandaloneLikelihood;
+    /// static pointer to this (needed for the minuit function calls); thread local, so that independent fits can run
+    /// concurrently
+    static thread_local const NSVfitStandaloneLikelihood* gNSVfitStandaloneLikelihood;
 
     /// add an additional logM(tau,tau) term to the nll to suppress tails on M(tau,tau) (default is true)
     void addLogM(bool value) { addLogM_ = value; }
@@ -140,6 +142,12 @@ namespace NSVfitStandalone {
     double prob(const double* x) const;
     /// same as above but for integration mode.     
     double probint(const double* x, const double mtt, const int par) const;	
+    /// batched version of prob for numPoints sets of fit parameters in structure-of-arrays layout
+    /// (x[iParameter*stride + iPoint]). The likelihoods are stored in probs. Debug output is provided by the scalar
+    /// version only, which is used in verbose mode.
+    void prob(const double* x, unsigned numPoints, unsigned stride, double* probs) const;
+    /// same as above but for integration mode.
+    void probint(const double* x, unsigned numPoints, unsigned stride, const double mtt, const int par, double* probs) const;
     /// read out potential likelihood errors
     unsigned error() const { return errorCode_; }
 
@@ -163,6 +171,22 @@ namespace NSVfitStandalone {
     /// of kPhi within the fit parameters (kFitParams). It is only used in fit mode. In integration mode the passed on value 
     /// is always 0. 
     double prob(const double* xPrime, double phiPenalty) const;
+
+    /// maximal number of points processed at once by the batched functions (size of the temporary arrays)
+    enum { kMaxBatchSize = 64 };
+    /// batched versions of transform and transformint for at most kMaxBatchSize points. The transformed parameters
+    /// are stored in structure-of-arrays layout (xPrime[iNLLParameter*kMaxBatchSize + iPoint]). In integration
+    /// mode, points without a physical solution are flagged in isValid.
+    void transformBatch(double* xPrime, const double* x, unsigned numPoints, unsigned stride) const;
+    void transformintBatch(double* xPrime, bool* isValid, const double* x, unsigned numPoints, unsigned stride,
+                           const double mtt, const int par) const;
+    /// kinematics of the fitted tau lepton idx for the batched transformations: fills the decay angle in the
+    /// restframe and adds the four-momentum of the tau lepton to diTauP4 (px, py, pz and E arrays of kMaxBatchSize)
+    void addFittedTauLeptonBatch(unsigned idx, const double* nunuMass, const double* labframeXFrac,
+                                 const double* labframePhi, unsigned numPoints, double* restframeDecayAngle,
+                                 double* diTauP4) const;
+    /// batched version of the combined likelihood for at most kMaxBatchSize points; phiPenalty can be 0
+    void probBatch(const double* xPrime, const double* phiPenalty, unsigned numPoints, double* probs) const;
     
   private:
     /// additional power to enhance MET term in the nll (default is 1.)
@@ -178,7 +202,7 @@ namespace NSVfitStandalone {
     /// verbosity level
     bool verbose_;
     /// monitor the number of function calls
-    mutable unsigned int idxObjFunctionCall_;
+    mutable std::atomic<unsigned int> idxObjFunctionCall_;
 
     /// measured tau leptons
     std::vector<MeasuredTauLepton> measuredTauLeptons_;
@@ -1,4 +1,6 @@
 #include <iostream>
+#include <cmath>
+#include <limits>
 
 #include "TMath.h"
 
@@ -63,4 +65,58 @@ double probTauToHadPhaseSpace(double decayAngle, double nunuMass, double visMass
   return prob;
 }
 
+void probMET(const double* dMETX, const double* dMETY, unsigned numPoints, double covDet, const TMatrixD& covInv,
+             double power, double* prob)
+{
+  if ( covDet == 0. ) {
+    const double prob0 = std::exp(-power*std::numeric_limits<float>::max());
+    for ( unsigned i = 0; i < numPoints; ++i ) prob[i] = prob0;
+    return;
+  }
+  const double nll0 = std::log(2*TMath::Pi()) + 0.5*std::log(std::abs(covDet));
+  const double c00 = covInv(0,0), c01 = covInv(0,1), c10 = covInv(1,0), c11 = covInv(1,1);
+  for ( unsigned i = 0; i < numPoints; ++i ) {
+    const double dx = dMETX[i], dy = dMETY[i];
+    const double nll = nll0 + 0.5*(dx*(c00*dx + c01*dy) + dy*(c10*dx + c11*dy));
+    prob[i] = std::exp(-power*nll);
+  }
+}
+
+void probTauToLepPhaseSpace(const double* decayAngle, const double* nunuMass, double visMass, const double* x,
+                            unsigned numPoints, bool applySinTheta, double* prob)
+{
+  for ( unsigned i = 0; i < numPoints; ++i ) {
+    const double nuMass2 = nunuMass[i]*nunuMass[i];
+    // protect against rounding errors that may lead to negative masses
+    const double nuMass = nunuMass[i] < 0. ? 0. : nunuMass[i];
+    const double nuMass_limit = std::sqrt((1. - x[i])*tauLeptonMass2);
+    // outside of the physical region, the likelihood at the boundary is suppressed by a penalty term
+    const bool isPhysical = nuMass < nuMass_limit;
+    const double m = isPhysical ? nuMass : nuMass_limit;
+    const double m2 = isPhysical ? nuMass2 : nuMass_limit*nuMass_limit;
+    const double penalty = isPhysical ? 1. : 1. + 1.e+6*square(nuMass - nuMass_limit);
+    double p = (13./tauLeptonMass4)*(tauLeptonMass2 - m2)*(tauLeptonMass2 + 2.*m2)*m;
+    p /= penalty;
+    if ( applySinTheta ) p *= (0.5*std::sin(decayAngle[i]));
+    prob[i] *= p;
+  }
+}
+
+void probTauToHadPhaseSpace(const double* decayAngle, const double* nunuMass, double visMass, const double* x,
+                            unsigned numPoints, bool applySinTheta, double* prob)
+{
+  const double visMass2 = visMass*visMass;
+  const double x_limit = visMass2/tauLeptonMass2;
+  const double twoTauLeptonMass = 2.*tauLeptonMass;
+  for ( unsigned i = 0; i < numPoints; ++i ) {
+    const double Pvis_rf = std::sqrt((tauLeptonMass2 - square(visMass + nunuMass[i]))
+                                    *(tauLeptonMass2 - square(visMass - nunuMass[i])))/twoTauLeptonMass;
+    double p = tauLeptonMass/(2.*Pvis_rf);
+    const double dx = x[i] < x_limit ? x[i] - x_limit : (x[i] > 1. ? x[i] - 1. : 0.);
+    p /= (1. + 1.e+6*square(dx));
+    if ( applySinTheta ) p *= (0.5*std::sin(decayAngle[i]));
+    prob[i] *= p;
+  }
+}
+
 } // namespace NSVfitStandalone
@@ -5,6 +5,8 @@
 
 #include <iomanip>
 #include <limits>
+#include <algorithm>
+#include <functional>
 #include <assert.h>
 
 namespace NSVfitStandalone{
@@ -16,8 +18,16 @@ MarkovChainIntegrator::MarkovChainIntegrator(const std::string& name, MoveMode m
                                              unsigned L, double epsilon0, double nu, int verbosity)
   : name_(name),
     integrand_(0),
+    batchIntegrand_(0),
     startPosition_and_MomentumFinder_(0),
-    x_(0),
+    numProposals_(4),
+    convergenceObservables_(0),
+    convergenceCheckInterval_(0),
+    convergenceMaxRhat_(0.),
+    convergenceThinning_(1),
+    numIterSampled_(0),
+    numIterBurninWarmStart_(0),
+    numThreads_(1),
     numIntegrationCalls_(0),
     numMovesTotal_accepted_(0),
     numMovesTotal_rejected_(0),
@@ -95,8 +105,6 @@ MarkovChainIntegrator::~MarkovChainIntegrator()
 	      << "%)" << std::endl;
   }
 
-  delete [] x_;
-
   delete monitorTree_;
   delete monitorFile_;
 }
@@ -106,9 +114,6 @@ void MarkovChainIntegrator::setIntegrand(const ROOT::Math::Functor& integrand)
   integrand_ = &integrand;
   numDimensions_ = integrand.NDim();
 
-  delete [] x_;
-  x_ = new double[numDimensions_];
-
   xMin_.resize(numDimensions_); 
   xMax_.resize(numDimensions_);  
 
@@ -131,14 +136,20 @@ void MarkovChainIntegrator::setIntegrand(const ROOT::Math::Functor& integrand)
     }
   }
 
-  p_.resize(2*numDimensions_);   // first N entries = "significant" components, last N entries = "dummy" components
-  q_.resize(numDimensions_);     // "potential energy" E(q) depends in the first N "significant" components only
-  gradE_.resize(numDimensions_); 
-  prob_ = 0.;
-
-  u_.resize(2*numDimensions_);   // first N entries = "significant" components, last N entries = "dummy" components
-  pProposal_.resize(numDimensions_);
-  qProposal_.resize(numDimensions_);
+  qStart_.resize(numDimensions_);
+  chains_.resize(numChains_);
+  for ( std::vector<ChainState>::iterator chain = chains_.begin();
+	chain != chains_.end(); ++chain ) {
+    chain->p_.resize(2*numDimensions_);   // first N entries = "significant" components, last N entries = "dummy" components
+    chain->q_.resize(numDimensions_);     // "potential energy" E(q) depends in the first N "significant" components only
+    chain->gradE_.resize(numDimensions_); 
+    chain->prob_ = 0.;
+
+    chain->u_.resize(2*numDimensions_);   // first N entries = "significant" components, last N entries = "dummy" components
+    chain->pProposal_.resize(numDimensions_);
+    chain->qProposal_.resize(numDimensions_);
+    chain->x_.resize(numDimensions_);
+  }
 
   probSum_.resize(numChains_*numBatches_);  
   for ( vdouble::iterator probSum_i = probSum_.begin();
@@ -148,6 +159,11 @@ void MarkovChainIntegrator::setIntegrand(const ROOT::Math::Functor& integrand)
   integral_.resize(numChains_*numBatches_);  
 }
 
+void MarkovChainIntegrator::setBatchIntegrand(const BatchIntegrand& batchIntegrand)
+{
+  batchIntegrand_ = &batchIntegrand;
+}
+
 void MarkovChainIntegrator::setStartPosition_and_MomentumFinder(const ROOT::Math::Functor& startPosition_and_MomentumFinder)
 {
   startPosition_and_MomentumFinder_ = &startPosition_and_MomentumFinder;
@@ -192,124 +208,82 @@ void MarkovChainIntegrator::integrate(const std::vector<double>& xMin, const std
     }
   }
   
-//--- CV: set random number generator used to initialize starting-position
-//        for each integration, in order to make integration results independent of processing history
-  rnd_.SetSeed(12345);
-
-  numMoves_accepted_ = 0;
-  numMoves_rejected_ = 0;
-
-  unsigned k = numChains_*numBatches_;  
   unsigned m = numIterSampling_/numBatches_;
 
-  numChainsRun_ = 0; 
+  for ( vdouble::iterator probSum_i = probSum_.begin();
+	probSum_i != probSum_.end(); ++probSum_i ) {
+    (*probSum_i) = 0.;
+  }
 
-  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
-    bool isValidStartPos = false;
-    if ( initMode_ == InitMode::kNone ) {
-      prob_ = evalProb(q_);
-      if ( prob_ > 0. ) {
-	bool isWithinBounds = true;
-	for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-	  double q_i = q_[iDimension];
-	  if ( !(q_i > 0. && q_i < 1.) ) isWithinBounds = false;
-	}
-	if ( isWithinBounds ) {
-	  isValidStartPos = true;
-	} else {
-      std::cerr << "MarkovChainIntegrator::integrate : Requested start-position = " << format_vdouble(q_)
-                << " not within interval ]0..1[ --> searching for valid alternative !!" << std::endl;
-	}
-      } else {
-          std::cerr << "MarkovChainIntegrator::integrate : Requested start-position = " << format_vdouble(q_)
-                    << " returned probability zero --> searching for valid alternative !!" << std::endl;
-      }
-    }    
-    unsigned iTry = 0;
-    while ( !isValidStartPos && iTry < maxCallsStartingPos_ ) {
-      initializeStartPosition_and_Momentum();
-//--- CV: check if start-position is within "valid" (physically allowed) region 
-      bool isWithinPhysicalRegion = true;
-      if ( startPosition_and_MomentumFinder_ ) {
-	updateX(q_);
-	isWithinPhysicalRegion = ((*startPosition_and_MomentumFinder_)(x_) > 0.5);
-      }
-      if ( isWithinPhysicalRegion ) {
-	prob_ = evalProb(q_);
-	if ( prob_ > 0. ) {
-	  isValidStartPos = true;
-	} else {
-	  if ( iTry > 0 && (iTry % 100000) == 0 ) {
-	    if ( iTry == 100000 ) std::cout << "<MarkovChainIntegrator::integrate (name = " << name_ << ")>:" << std::endl;
-	    std::cout << "try #" << iTry << ": did not find valid start-position yet." << std::endl;
-	    //std::cout << "(q = " << format_vdouble(q_) << ", prob = " << prob_ << ")" << std::endl;
-	  }
+//--- run the chains in steps of checkInterval sampling moves, if the convergence criterion is used;
+//    the "call-back" functions are evaluated after each step for the positions of all chains in the order of the chain index
+  unsigned numIterStep = ( convergenceObservables_ ) ?
+    convergenceCheckInterval_ : numIterSampling_;
+  numIterSampled_ = 0;
+  do {
+    unsigned firstMove = numIterSampled_;
+    numIterSampled_ = std::min(firstMove + numIterStep, numIterSampling_);
+    runChainsConcurrently(firstMove, numIterSampled_);
+    for ( std::vector<ChainState>::const_iterator chain = chains_.begin();
+	  chain != chains_.end(); ++chain ) {
+      if ( !chain->isValid_ ) continue;
+      for ( unsigned iMove = firstMove; iMove < numIterSampled_; ++iMove ) {
+	const double* x = &chain->samples_[iMove*numDimensions_];
+	for ( std::vector<const ROOT::Math::Functor*>::const_iterator callBackFunction = callBackFunctions_.begin();
+	      callBackFunction != callBackFunctions_.end(); ++callBackFunction ) {
+	  (**callBackFunction)(x);
 	}
+	if ( monitorFile_ ) updateMonitorFile(x);
       }
-      ++iTry;
     }
-    if ( !isValidStartPos ) continue;
-
-    for ( unsigned iMove = 0; iMove < numIterBurnin_; ++iMove ) {
-//--- propose Markov Chain transition to new, randomly chosen, point
-      if ( verbosity_ >= 2 ) std::cout << "burn-in move #" << iMove << ":" << std::endl;
-      bool isAccepted = false;
-      bool isValid = true;
-      do {
-	makeStochasticMove(iMove, isAccepted, isValid);
-      } while ( !isValid );
-    }
-
-    unsigned idxBatch = iChain*numBatches_;
-
-    for ( unsigned iMove = 0; iMove < numIterSampling_; ++iMove ) {
-//--- propose Markov Chain transition to new, randomly chosen, point;
-//    evaluate "call-back" functions at this point
-      if ( verbosity_ >= 2 ) std::cout << "sampling move #" << iMove << ":" << std::endl;
-      bool isAccepted = false;
-      bool isValid = true;
-      do {
-	makeStochasticMove(numIterBurnin_ + iMove, isAccepted, isValid);
-      } while ( !isValid );
-      if ( isAccepted ) {
-	++numMoves_accepted_;
-      } else {
-	++numMoves_rejected_;
+    if ( convergenceObservables_ && numIterSampled_ < numIterSampling_ && isConverged(firstMove, numIterSampled_) ) {
+      if ( verbosity_ >= 1 ) {
+	std::cout << "<MarkovChainIntegrator::integrate (name = " << name_ << ")>:" << std::endl;
+	std::cout << " converged after " << numIterSampled_ << " sampling moves per chain." << std::endl;
       }
-
-      updateX(q_);
-      for ( std::vector<const ROOT::Math::Functor*>::const_iterator callBackFunction = callBackFunctions_.begin();
-	    callBackFunction != callBackFunctions_.end(); ++callBackFunction ) {
-	(**callBackFunction)(x_);
-      }
-
-      if ( iMove > 0 && (iMove % m) == 0 ) ++idxBatch;
-      probSum_[idxBatch] += prob_;
-
-      if ( monitorFile_ ) updateMonitorFile();
+      break;
     }
+  } while ( numIterSampled_ < numIterSampling_ );
 
+  numMoves_accepted_ = 0;
+  numMoves_rejected_ = 0;
+  numChainsRun_ = 0; 
+  for ( std::vector<ChainState>::const_iterator chain = chains_.begin();
+	chain != chains_.end(); ++chain ) {
+    if ( !chain->isValid_ ) continue;
+    numMoves_accepted_ += chain->numMoves_accepted_;
+    numMoves_rejected_ += chain->numMoves_rejected_;
     ++numChainsRun_;
   }
 
   for ( unsigned idxBatch = 0; idxBatch < probSum_.size(); ++idxBatch ) {  
-    integral_[idxBatch] = probSum_[idxBatch]/m;
+    unsigned firstMoveOfBatch = (idxBatch % numBatches_)*m;
+    unsigned numMovesOfBatch = ( numIterSampled_ > firstMoveOfBatch ) ?
+      std::min(numIterSampled_ - firstMoveOfBatch, m) : 0;
+    integral_[idxBatch] = ( numMovesOfBatch > 0 ) ?
+      probSum_[idxBatch]/numMovesOfBatch : 0.;
     //if ( verbosity_ >= 1 ) std::cout << "integral[" << idxBatch << "] = " << integral_[idxBatch] << std::endl;
   }
 
   //if ( verbosity_ >= 1 ) print(std::cout);
 
 //--- compute integral value and uncertainty
-//   (eqs. (6.39) and (6.40) in [1])   
+//   (eqs. (6.39) and (6.40) in [1]), using the batches that have been sampled
+  unsigned numBatchesSampled = (numIterSampled_ + m - 1)/m;
+  unsigned k = numChains_*numBatchesSampled;
   integral = 0.;
-  for ( unsigned i = 0; i < k; ++i ) {    
-    integral += integral_[i];
+  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+    for ( unsigned iBatch = 0; iBatch < numBatchesSampled; ++iBatch ) {
+      integral += integral_[iChain*numBatches_ + iBatch];
+    }
   }
   integral /= k;
 
   integralErr = 0.;
-  for ( unsigned i = 0; i < k; ++i ) {
-    integralErr += square(integral_[i] - integral);
+  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+    for ( unsigned iBatch = 0; iBatch < numBatchesSampled; ++iBatch ) {
+      integralErr += square(integral_[iChain*numBatches_ + iBatch] - integral);
+    }
   }
   if ( k >= 2 ) integralErr /= (k*(k - 1));
   integralErr = TMath::Sqrt(integralErr);
@@ -326,6 +300,275 @@ void MarkovChainIntegrator::integrate(const std::vector<double>& xMin, const std
   if ( monitorFile_ ) closeMonitorFile();
 }
 
+void MarkovChainIntegrator::runChainsConcurrently(unsigned firstMove, unsigned lastMove)
+{
+//--- debug output is readable only if all chains are run in the calling thread
+  unsigned numThreads = ( verbosity_ >= 1 ) ? 1 : std::min(std::max(numThreads_, 1u), numChains_);
+  std::vector<std::exception_ptr> errors(numThreads);
+  if ( numThreads == 1 ) {
+    runChains(0, 1, firstMove, lastMove, errors[0]);
+  } else {
+    std::vector<std::thread> threads;
+    for ( unsigned iThread = 0; iThread < numThreads; ++iThread ) {
+      threads.push_back(std::thread(&MarkovChainIntegrator::runChains, this, iThread, numThreads, firstMove, lastMove,
+				    std::ref(errors[iThread])));
+    }
+    for ( std::vector<std::thread>::iterator thread = threads.begin();
+	  thread != threads.end(); ++thread ) {
+      thread->join();
+    }
+  }
+  for ( std::vector<std::exception_ptr>::const_iterator error = errors.begin();
+	error != errors.end(); ++error ) {
+    if ( *error ) std::rethrow_exception(*error);
+  }
+}
+
+void MarkovChainIntegrator::runChains(unsigned firstChain, unsigned chainStep, unsigned firstMove, unsigned lastMove,
+				      std::exception_ptr& error)
+{
+  try {
+    for ( unsigned iChain = firstChain; iChain < numChains_; iChain += chainStep ) {
+      ChainState& chain = chains_[iChain];
+      if ( firstMove == 0 ) startChain(iChain, chain);
+      if ( chain.isValid_ ) advanceChain(iChain, chain, firstMove, lastMove);
+    }
+  } catch ( ... ) {
+    error = std::current_exception();
+  }
+}
+
+void MarkovChainIntegrator::startChain(unsigned iChain, ChainState& chain)
+{
+//--- CV: set random number generator used to initialize starting-position
+//        for each integration, in order to make integration results independent of processing history;
+//        each chain uses an independent stream, so that the results do not depend on the order in which chains are run
+  chain.rnd_.SetSeed(12345 + 1000003*iChain);
+
+  chain.isValid_ = false;
+  chain.numMoves_accepted_ = 0;
+  chain.numMoves_rejected_ = 0;
+  chain.samples_.resize(numIterSampling_*numDimensions_);
+  // batches consist either of the points needed for the gradient or of the trial points of a move
+  unsigned maxBatchSize = std::max(numDimensions_ + 1, numProposals_);
+  chain.qBatch_.resize(maxBatchSize*numDimensions_);
+  chain.xBatch_.resize(maxBatchSize*numDimensions_);
+  chain.probBatch_.resize(maxBatchSize);
+  chain.observableSum_.clear();
+  chain.observableSum2_.clear();
+  chain.observableStepMeans_.clear();
+  chain.numObservableSamples_ = 0;
+
+  if ( warmStartChain(iChain, chain) ) {
+    chain.isValid_ = true;
+    return;
+  }
+
+  bool isValidStartPos = false;
+  if ( initMode_ == InitMode::kNone ) {
+    chain.q_ = qStart_;
+    chain.prob_ = evalProb(chain.q_, chain.x_);
+    if ( chain.prob_ > 0. ) {
+      bool isWithinBounds = true;
+      for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+	double q_i = chain.q_[iDimension];
+	if ( !(q_i > 0. && q_i < 1.) ) isWithinBounds = false;
+      }
+      if ( isWithinBounds ) {
+	isValidStartPos = true;
+      } else {
+    std::cerr << "MarkovChainIntegrator::integrate : Requested start-position = " << format_vdouble(chain.q_)
+              << " not within interval ]0..1[ --> searching for valid alternative !!" << std::endl;
+      }
+    } else {
+        std::cerr << "MarkovChainIntegrator::integrate : Requested start-position = " << format_vdouble(chain.q_)
+                  << " returned probability zero --> searching for valid alternative !!" << std::endl;
+    }
+  }    
+  unsigned iTry = 0;
+  while ( !isValidStartPos && iTry < maxCallsStartingPos_ ) {
+    initializeStartPosition_and_Momentum(chain);
+//--- CV: check if start-position is within "valid" (physically allowed) region 
+    bool isWithinPhysicalRegion = true;
+    if ( startPosition_and_MomentumFinder_ ) {
+      updateX(chain.q_, chain.x_);
+      isWithinPhysicalRegion = ((*startPosition_and_MomentumFinder_)(&chain.x_[0]) > 0.5);
+    }
+    if ( isWithinPhysicalRegion ) {
+      chain.prob_ = evalProb(chain.q_, chain.x_);
+      if ( chain.prob_ > 0. ) {
+	isValidStartPos = true;
+      } else {
+	if ( iTry > 0 && (iTry % 100000) == 0 ) {
+	  if ( iTry == 100000 ) std::cout << "<MarkovChainIntegrator::integrate (name = " << name_ << ")>:" << std::endl;
+	  std::cout << "try #" << iTry << ": did not find valid start-position yet." << std::endl;
+	  //std::cout << "(q = " << format_vdouble(chain.q_) << ", prob = " << chain.prob_ << ")" << std::endl;
+	}
+      }
+    }
+    ++iTry;
+  }
+  if ( !isValidStartPos ) return;
+
+  for ( unsigned iMove = 0; iMove < numIterBurnin_; ++iMove ) {
+//--- propose Markov Chain transition to new, randomly chosen, point
+    if ( verbosity_ >= 2 ) std::cout << "burn-in move #" << iMove << ":" << std::endl;
+    bool isAccepted = false;
+    bool isValid = true;
+    do {
+      makeStochasticMove(chain, iMove, isAccepted, isValid);
+    } while ( !isValid );
+  }
+
+  chain.isValid_ = true;
+}
+
+bool MarkovChainIntegrator::warmStartChain(unsigned iChain, ChainState& chain)
+{
+//--- start chain from its final position of a previous integration, if available and of non-zero probability
+  if ( iChain >= warmStartPositions_.size() || warmStartPositions_[iChain].size() != numDimensions_ ) return false;
+  chain.q_ = warmStartPositions_[iChain];
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    double q_i = chain.q_[iDimension];
+    if ( !(q_i > 0. && q_i < 1.) ) return false;
+  }
+  chain.prob_ = evalProb(chain.q_, chain.x_);
+  if ( !(chain.prob_ > 0.) ) return false;
+
+//--- the chain is already close to the region of high probability, so "simulated annealing" is not needed
+  for ( unsigned iMove = 0; iMove < numIterBurninWarmStart_; ++iMove ) {
+    if ( verbosity_ >= 2 ) std::cout << "warm-start burn-in move #" << iMove << ":" << std::endl;
+    bool isAccepted = false;
+    bool isValid = true;
+    do {
+      makeStochasticMove(chain, numIterSimAnnealingPhase1plus2_ + iMove, isAccepted, isValid);
+    } while ( !isValid );
+  }
+  return true;
+}
+
+void MarkovChainIntegrator::advanceChain(unsigned iChain, ChainState& chain, unsigned firstMove, unsigned lastMove)
+{
+  unsigned m = numIterSampling_/numBatches_;
+
+  for ( unsigned iMove = firstMove; iMove < lastMove; ++iMove ) {
+//--- propose Markov Chain transition to new, randomly chosen, point;
+//    store the position for evaluation of "call-back" functions
+    if ( verbosity_ >= 2 ) std::cout << "sampling move #" << iMove << ":" << std::endl;
+    bool isAccepted = false;
+    bool isValid = true;
+    do {
+      makeStochasticMove(chain, numIterBurnin_ + iMove, isAccepted, isValid);
+    } while ( !isValid );
+    if ( isAccepted ) {
+      ++chain.numMoves_accepted_;
+    } else {
+      ++chain.numMoves_rejected_;
+    }
+
+    updateX(chain.q_, chain.x_);
+    std::copy(chain.x_.begin(), chain.x_.end(), chain.samples_.begin() + iMove*numDimensions_);
+
+    probSum_[iChain*numBatches_ + iMove/m] += chain.prob_;
+  }
+}
+
+bool MarkovChainIntegrator::isConverged(unsigned firstMove, unsigned lastMove)
+{
+//--- update sums and step means of the observables with the positions of the last step
+  unsigned numObservables = convergenceObservables_->numObservables();
+  unsigned thinning = std::min(convergenceThinning_, lastMove - firstMove);
+  vdouble values(numObservables);
+  vdouble stepSum(numObservables);
+  std::vector<const ChainState*> validChains;
+  for ( std::vector<ChainState>::iterator chain = chains_.begin();
+	chain != chains_.end(); ++chain ) {
+    if ( !chain->isValid_ ) continue;
+    validChains.push_back(&(*chain));
+    chain->observableSum_.resize(numObservables);
+    chain->observableSum2_.resize(numObservables);
+    std::fill(stepSum.begin(), stepSum.end(), 0.);
+    unsigned numStepSamples = 0;
+    for ( unsigned iMove = firstMove; iMove < lastMove; iMove += thinning ) {
+      convergenceObservables_->evalObservables(&chain->samples_[iMove*numDimensions_], &values[0]);
+      for ( unsigned iObservable = 0; iObservable < numObservables; ++iObservable ) {
+	double value = values[iObservable];
+	chain->observableSum_[iObservable] += value;
+	chain->observableSum2_[iObservable] += value*value;
+	stepSum[iObservable] += value;
+      }
+      ++numStepSamples;
+    }
+    chain->numObservableSamples_ += numStepSamples;
+    for ( unsigned iObservable = 0; iObservable < numObservables; ++iObservable ) {
+      chain->observableStepMeans_.push_back(stepSum[iObservable]/numStepSamples);
+    }
+  }
+
+//--- at least minNumSteps step means are needed to estimate the uncertainty on the mean
+  const unsigned minNumSteps = 4;
+  unsigned numChainsValid = validChains.size();
+  if ( numChainsValid == 0 ) return false;
+  unsigned numStepsPerChain = validChains.front()->observableStepMeans_.size()/numObservables;
+  unsigned numSteps = numChainsValid*numStepsPerChain;
+  if ( numSteps < minNumSteps ) return false;
+
+  for ( unsigned iObservable = 0; iObservable < numObservables; ++iObservable ) {
+//--- standard error on the mean, estimated from the step means (method of batch means, section 6.3 of [1])
+    double mean = 0.;
+    for ( unsigned iChain = 0; iChain < numChainsValid; ++iChain ) {
+      for ( unsigned iStep = 0; iStep < numStepsPerChain; ++iStep ) {
+	mean += validChains[iChain]->observableStepMeans_[iStep*numObservables + iObservable];
+      }
+    }
+    mean /= numSteps;
+    double stepVariance = 0.;
+    for ( unsigned iChain = 0; iChain < numChainsValid; ++iChain ) {
+      for ( unsigned iStep = 0; iStep < numStepsPerChain; ++iStep ) {
+	stepVariance += square(validChains[iChain]->observableStepMeans_[iStep*numObservables + iObservable] - mean);
+      }
+    }
+    stepVariance /= (numSteps - 1);
+    double meanErr = TMath::Sqrt(stepVariance/numSteps);
+    if ( verbosity_ >= 2 ) std::cout << "observable #" << iObservable << ": mean = " << mean << " +/- " << meanErr << std::endl;
+    if ( !(meanErr <= convergenceObservables_->requiredPrecision(iObservable, mean)) ) return false;
+
+//--- Gelman-Rubin potential scale reduction factor R-hat, comparing the variances within and between the chains
+    if ( numChainsValid >= 2 ) {
+      double n = validChains.front()->numObservableSamples_;
+      double W = 0.;
+      double meanOfChainMeans = 0.;
+      for ( unsigned iChain = 0; iChain < numChainsValid; ++iChain ) {
+	double chainMean = validChains[iChain]->observableSum_[iObservable]/n;
+	W += (validChains[iChain]->observableSum2_[iObservable] - n*chainMean*chainMean)/(n - 1.);
+	meanOfChainMeans += chainMean;
+      }
+      W /= numChainsValid;
+      meanOfChainMeans /= numChainsValid;
+      double B_over_n = 0.;
+      for ( unsigned iChain = 0; iChain < numChainsValid; ++iChain ) {
+	B_over_n += square(validChains[iChain]->observableSum_[iObservable]/n - meanOfChainMeans);
+      }
+      B_over_n /= (numChainsValid - 1);
+      if ( W > 0. ) {
+	double Rhat = TMath::Sqrt(((n - 1.)/n*W + B_over_n)/W);
+	if ( verbosity_ >= 2 ) std::cout << "observable #" << iObservable << ": R-hat = " << Rhat << std::endl;
+	if ( !(Rhat <= convergenceMaxRhat_) ) return false;
+      } else if ( B_over_n > 0. ) return false;
+    }
+  }
+  return true;
+}
+
+MarkovChainIntegrator::ChainPositions MarkovChainIntegrator::getChainPositions() const
+{
+  ChainPositions positions(chains_.size());
+  for ( unsigned iChain = 0; iChain < chains_.size(); ++iChain ) {
+    if ( chains_[iChain].isValid_ ) positions[iChain] = chains_[iChain].q_;
+  }
+  return positions;
+}
+
 void MarkovChainIntegrator::print(std::ostream& stream) const
 {
   stream << "<MarkovChainIntegrator::print>:" << std::endl;
@@ -365,7 +608,7 @@ void MarkovChainIntegrator::initializeStartPosition_and_Momentum(const std::vect
     for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
       double q_i = q[iDimension];
       if ( q_i > 0. && q_i < 1. ) {
-	q_[iDimension] = q_i;
+	qStart_[iDimension] = q_i;
       } else {
           std::ostringstream ss;
           ss << "MarkovChainIntegrator : Invalid start-position coordinates = "  << format_vdouble(q) << " !!";
@@ -380,17 +623,17 @@ void MarkovChainIntegrator::initializeStartPosition_and_Momentum(const std::vect
   }
 }
 
-void MarkovChainIntegrator::initializeStartPosition_and_Momentum()
+void MarkovChainIntegrator::initializeStartPosition_and_Momentum(ChainState& chain)
 {
 //--- randomly choose start position of Markov Chain in N-dimensional space
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
     bool isInitialized = false;
     while ( !isInitialized ) {
       double q0 = 0.;
-      if ( initMode_ == InitMode::kGaus ) q0 = rnd_.Gaus(0.5, 0.5);
-      else q0 = rnd_.Uniform(0., 1.);
+      if ( initMode_ == InitMode::kGaus ) q0 = chain.rnd_.Gaus(0.5, 0.5);
+      else q0 = chain.rnd_.Uniform(0., 1.);
       if ( q0 > 0. && q0 < 1. ) {
-	q_[iDimension] = q0;
+	chain.q_[iDimension] = q0;
 	isInitialized = true;
       }
     }
@@ -398,11 +641,11 @@ void MarkovChainIntegrator::initializeStartPosition_and_Momentum()
 
   if ( verbosity_ >= 1 ) {
     std::cout << "<MarkovChainIntegrator::initializeStartPosition_and_Momentum>:" << std::endl;
-    std::cout << " q = " << format_vdouble(q_) << std::endl;
+    std::cout << " q = " << format_vdouble(chain.q_) << std::endl;
   }
 }
 
-void MarkovChainIntegrator::sampleSphericallyRandom()
+void MarkovChainIntegrator::sampleSphericallyRandom(ChainState& chain)
 {
 //--- compute vector of unit length
 //    pointing in random direction in N-dimensional space
@@ -413,26 +656,26 @@ void MarkovChainIntegrator::sampleSphericallyRandom()
 //
   double uMag2 = 0.;
   for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-    double u_i = rnd_.Gaus(0., 1.);
-    u_[iDimension] = u_i;
+    double u_i = chain.rnd_.Gaus(0., 1.);
+    chain.u_[iDimension] = u_i;
     uMag2 += (u_i*u_i);
   }
   double uMag = TMath::Sqrt(uMag2);
   for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-    u_[iDimension] /= uMag;
+    chain.u_[iDimension] /= uMag;
   }
 }
 
-void MarkovChainIntegrator::makeStochasticMove(unsigned idxMove, bool& isAccepted, bool& isValid)
+void MarkovChainIntegrator::makeStochasticMove(ChainState& chain, unsigned idxMove, bool& isAccepted, bool& isValid)
 {
 //--- perform "stochastic" move
 //   (eq. 24 in [2])
   if ( verbosity_ >= 2 ) {
     std::cout << "<MarkovChainIntegrator::makeStochasticMove>:" << std::endl;
     std::cout << " idx = " << idxMove << std::endl;
-    std::cout << " q = " << format_vdouble(q_) << std::endl;
-    std::cout << " prob = " << prob_ << std::endl;
-    //std::cout << " Ks = " << evalK(p_, 0, numDimensions_) << std::endl;
+    std::cout << " q = " << format_vdouble(chain.q_) << std::endl;
+    std::cout << " prob = " << chain.prob_ << std::endl;
+    //std::cout << " Ks = " << evalK(chain.p_, 0, numDimensions_) << std::endl;
   }
   //if ( (idxMove % 1000) == 0 ) std::cout << "computing move #" << idxMove << "..." << std::endl;
 
@@ -440,37 +683,37 @@ void MarkovChainIntegrator::makeStochasticMove(unsigned idxMove, bool& isAccepte
   if ( idxMove < numIterSimAnnealingPhase1_ ) {
     //std::cout << "case 1" << std::endl;
     for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-      p_[iDimension] = sqrtT0_*rnd_.Gaus(0., 1.);
+      chain.p_[iDimension] = sqrtT0_*chain.rnd_.Gaus(0., 1.);
     }
   } else if ( idxMove < numIterSimAnnealingPhase1plus2_ ) {
     //std::cout << "case 2" << std::endl;
     double pMag2 = 0.;
     for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-      double p_i = p_[iDimension];
+      double p_i = chain.p_[iDimension];
       pMag2 += p_i*p_i;
     }
     double pMag = TMath::Sqrt(pMag2);
-    sampleSphericallyRandom();
+    sampleSphericallyRandom(chain);
     for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-      p_[iDimension] = alpha_*pMag*u_[iDimension] + (1. - alpha2_)*rnd_.Gaus(0., 1.);
+      chain.p_[iDimension] = alpha_*pMag*chain.u_[iDimension] + (1. - alpha2_)*chain.rnd_.Gaus(0., 1.);
     }
   } else {
     //std::cout << "case 3" << std::endl;
     for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-      p_[iDimension] = rnd_.Gaus(0., 1.);
+      chain.p_[iDimension] = chain.rnd_.Gaus(0., 1.);
     }
   }
 
   if ( verbosity_ >= 2 ) {
-    std::cout << "p(updated) = " << format_vdouble(p_) << std::endl;
-    //std::cout << " Ks = " << evalK(p_, 0, numDimensions_) << std::endl;
-    //std::cout << " Kd = " << evalK(p_, numDimensions_, 2*numDimensions_) << std::endl;
+    std::cout << "p(updated) = " << format_vdouble(chain.p_) << std::endl;
+    //std::cout << " Ks = " << evalK(chain.p_, 0, numDimensions_) << std::endl;
+    //std::cout << " Kd = " << evalK(chain.p_, numDimensions_, 2*numDimensions_) << std::endl;
   }
 
 //--- choose random step size 
   double exp_nu_times_C = 0.;
   do {
-    double C = rnd_.BreitWigner(0., 1.);
+    double C = chain.rnd_.BreitWigner(0., 1.);
     exp_nu_times_C = TMath::Exp(nu_*C);
   } while ( TMath::IsNaN(exp_nu_times_C) || !TMath::Finite(exp_nu_times_C) || exp_nu_times_C > 1.e+6 );
   vdouble epsilon(numDimensions_);
@@ -479,77 +722,162 @@ void MarkovChainIntegrator::makeStochasticMove(unsigned idxMove, bool& isAccepte
   }
   if ( verbosity_ >= 2 ) std::cout << "epsilon = " << format_vdouble(epsilon) << std::endl;
 
+  if ( moveMode_ == MoveMode::kMultipleTry ) {
+    makeMultipleTryMove(chain, idxMove, epsilon, isAccepted);
+    return;
+  }
+
   if        ( moveMode_ == MoveMode::kMetropolis ) { // Metropolis algorithm: move according to eq. (27) in [2]
 //--- update position components
 //    by single step of chosen size in direction of the momentum components
     for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {    
-      qProposal_[iDimension] = q_[iDimension] + epsilon[iDimension]*p_[iDimension];
+      chain.qProposal_[iDimension] = chain.q_[iDimension] + epsilon[iDimension]*chain.p_[iDimension];
     }
   } else if ( moveMode_ == MoveMode::kHybrid     ) { // Hybrid algorithm: move according to eqs. (20)-(23) in [2]
 //--- initialize position components
     for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-      qProposal_[iDimension] = q_[iDimension];
+      chain.qProposal_[iDimension] = chain.q_[iDimension];
     }
 //--- evolve momentum and position components
 //    according to discretized Hamiltonian mechanics 
     for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-      pProposal_[iDimension] = p_[iDimension];
+      chain.pProposal_[iDimension] = chain.p_[iDimension];
     }
-    makeDynamicMoves(epsilon);
+    makeDynamicMoves(chain, epsilon);
   } else assert(0);
 
-  if ( verbosity_ >= 2 ) std::cout << "q(proposed) = " << format_vdouble(qProposal_) << std::endl;
+  if ( verbosity_ >= 2 ) std::cout << "q(proposed) = " << format_vdouble(chain.qProposal_) << std::endl;
 
 //--- ensure that proposed new point is within integration region
 //   (take integration region to be "cyclic")
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {         
-    double q_i = qProposal_[iDimension];
+    double q_i = chain.qProposal_[iDimension];
     q_i = q_i - TMath::Floor(q_i);
     assert(q_i >= 0. && q_i <= 1.);
-    qProposal_[iDimension] = q_i;
+    chain.qProposal_[iDimension] = q_i;
   }
 
 //--- check if proposed move of Markov Chain to new position is accepted or not:
 //    compute change in phase-space volume for "dummy" momentum components
 //   (eqs. 25 in [2])
-  double probProposal = evalProb(qProposal_);
+  double probProposal = evalProb(chain.qProposal_, chain.x_);
   if ( verbosity_ >= 2 ) std::cout << "prob(proposed) = " << probProposal << std::endl;
 
   double deltaE = 0.;
-  if      ( probProposal > 0. && prob_ > 0. ) deltaE = -TMath::Log(probProposal/prob_);
+  if      ( probProposal > 0. && chain.prob_ > 0. ) deltaE = -TMath::Log(probProposal/chain.prob_);
   else if ( probProposal > 0.               ) deltaE = -std::numeric_limits<double>::max();
-  else if (                      prob_ > 0. ) deltaE = +std::numeric_limits<double>::max();
+  else if (                      chain.prob_ > 0. ) deltaE = +std::numeric_limits<double>::max();
   else assert(0);
   //if ( verbosity_ >= 1 ) std::cout << " deltaE = " << deltaE << std::endl;
 
   double deltaE_or_H = deltaE;
   if ( moveMode_ == MoveMode::kHybrid ) {
-    double Ks = evalK(p_, 0, numDimensions_);
-    double KsProposal = evalK(pProposal_, 0, numDimensions_);
+    double Ks = evalK(chain.p_, 0, numDimensions_);
+    double KsProposal = evalK(chain.pProposal_, 0, numDimensions_);
     deltaE_or_H += (KsProposal - Ks);
     //if ( verbosity_ >= 1 ) std::cout << " deltaH = " << deltaE_or_H << std::endl;
   }
   
-  double Kd = evalK(p_, numDimensions_, 2*numDimensions_);
+  double Kd = evalK(chain.p_, numDimensions_, 2*numDimensions_);
   //if ( verbosity_ >= 1 ) std::cout << " Kd = " << Kd << std::endl;
   double base = 1. - deltaE_or_H/Kd;
   double rho = ( base > 0. ) ? 
     TMath::Power(base, 0.5*numDimensions_ - 1.) : 0.;
   if ( verbosity_ >= 2 ) std::cout << " rho = " << rho << std::endl;
   
-  double u = rnd_.Uniform(0., 1.);
+  double u = chain.rnd_.Uniform(0., 1.);
   if ( verbosity_ >= 2 ) std::cout << "u = " << u << std::endl;
   if ( u < rho ) {
     if ( verbosity_ >= 2 ) std::cout << "move accepted." << std::endl;
     for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {    
-      q_[iDimension] = qProposal_[iDimension];
+      chain.q_[iDimension] = chain.qProposal_[iDimension];
     }
     if ( moveMode_ == MoveMode::kHybrid ) {
       for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-	p_[iDimension] = pProposal_[iDimension];
+	chain.p_[iDimension] = chain.pProposal_[iDimension];
       }
     }
-    prob_ = evalProb(q_);
+    chain.prob_ = evalProb(chain.q_, chain.x_);
+    isAccepted = true;
+  } else {
+    if ( verbosity_ >= 2 ) std::cout << "move rejected." << std::endl;
+    isAccepted = false;
+  }
+}
+
+void MarkovChainIntegrator::makeMultipleTryMove(ChainState& chain, unsigned idxMove, const std::vector<double>& epsilon,
+                                                bool& isAccepted)
+{
+//--- perform "multiple-try Metropolis" move with symmetric proposal function
+//   (section 2 of [3], with weights equal to P(q)):
+//    numProposals trial points are drawn around the current position and evaluated at once,
+//    one of them is selected with probability proportional to P(q) and accepted with probability
+//    min(1, sum of P over trial points/sum of P over reference points);
+//    the reference points are drawn around the selected point, plus the current position
+  double pScale = ( idxMove < numIterSimAnnealingPhase1_ ) ?
+    sqrtT0_ : 1.;
+  for ( unsigned iProposal = 0; iProposal < numProposals_; ++iProposal ) {
+    double* q = &chain.qBatch_[iProposal*numDimensions_];
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+//--- the first trial point uses the momentum components updated by makeStochasticMove
+      double p_i = ( iProposal == 0 ) ?
+	chain.p_[iDimension] : pScale*chain.rnd_.Gaus(0., 1.);
+      double q_i = chain.q_[iDimension] + epsilon[iDimension]*p_i;
+      q[iDimension] = q_i - TMath::Floor(q_i);
+    }
+  }
+  evalProbBatch(chain, numProposals_);
+  double probSum = 0.;
+  for ( unsigned iProposal = 0; iProposal < numProposals_; ++iProposal ) {
+    probSum += chain.probBatch_[iProposal];
+  }
+  if ( verbosity_ >= 2 ) std::cout << "sum of prob(proposed) = " << probSum << std::endl;
+  if ( !(probSum > 0.) ) {
+    if ( verbosity_ >= 2 ) std::cout << "move rejected." << std::endl;
+    isAccepted = false;
+    return;
+  }
+
+  double uSelect = chain.rnd_.Uniform(0., probSum);
+  unsigned selected = numProposals_ - 1;
+  double probCumulative = 0.;
+  for ( unsigned iProposal = 0; iProposal < numProposals_; ++iProposal ) {
+    probCumulative += chain.probBatch_[iProposal];
+    if ( uSelect < probCumulative ) {
+      selected = iProposal;
+      break;
+    }
+  }
+  std::copy(chain.qBatch_.begin() + selected*numDimensions_, chain.qBatch_.begin() + (selected + 1)*numDimensions_,
+	    chain.qProposal_.begin());
+  double probProposal = chain.probBatch_[selected];
+  if ( verbosity_ >= 2 ) {
+    std::cout << "q(selected) = " << format_vdouble(chain.qProposal_) << std::endl;
+    std::cout << "prob(selected) = " << probProposal << std::endl;
+  }
+
+  for ( unsigned iReference = 0; iReference < numProposals_ - 1; ++iReference ) {
+    double* q = &chain.qBatch_[iReference*numDimensions_];
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+      double q_i = chain.qProposal_[iDimension] + epsilon[iDimension]*pScale*chain.rnd_.Gaus(0., 1.);
+      q[iDimension] = q_i - TMath::Floor(q_i);
+    }
+  }
+  evalProbBatch(chain, numProposals_ - 1);
+  double probSumReference = chain.prob_;
+  for ( unsigned iReference = 0; iReference < numProposals_ - 1; ++iReference ) {
+    probSumReference += chain.probBatch_[iReference];
+  }
+
+  double rho = probSum/probSumReference;
+  if ( verbosity_ >= 2 ) std::cout << " rho = " << rho << std::endl;
+
+  double u = chain.rnd_.Uniform(0., 1.);
+  if ( verbosity_ >= 2 ) std::cout << "u = " << u << std::endl;
+  if ( u < rho ) {
+    if ( verbosity_ >= 2 ) std::cout << "move accepted." << std::endl;
+    std::copy(chain.qProposal_.begin(), chain.qProposal_.end(), chain.q_.begin());
+    chain.prob_ = probProposal;
     isAccepted = true;
   } else {
     if ( verbosity_ >= 2 ) std::cout << "move rejected." << std::endl;
@@ -557,48 +885,48 @@ void MarkovChainIntegrator::makeStochasticMove(unsigned idxMove, bool& isAccepte
   }
 }
 
-void MarkovChainIntegrator::makeDynamicMoves(const std::vector<double>& epsilon)
+void MarkovChainIntegrator::makeDynamicMoves(ChainState& chain, const std::vector<double>& epsilon)
 {
 //--- perform "dynamical move"
 //   (execute series of L "leap-frog" steps, eqs. 20-23 in [2])
   for ( unsigned iLeapFrogStep = 0; iLeapFrogStep < L_; ++iLeapFrogStep ) {
     //if ( verbosity_ >= 1 ) std::cout << "leap-frog step #" << iLeapFrogStep << ":" << std::endl;    
-    updateGradE(qProposal_);
-    //if ( verbosity_ >= 1 ) std::cout << " gradE = " << format_vdouble(gradE_) << std::endl;
+    updateGradE(chain, chain.qProposal_);
+    //if ( verbosity_ >= 1 ) std::cout << " gradE = " << format_vdouble(chain.gradE_) << std::endl;
     double step_p = ( iLeapFrogStep == 0 ) ? 
       0.5 : 1.0;
     for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-      pProposal_[iDimension] -= step_p*epsilon[iDimension]*gradE_[iDimension];
-      qProposal_[iDimension] += epsilon[iDimension]*pProposal_[iDimension];
+      chain.pProposal_[iDimension] -= step_p*epsilon[iDimension]*chain.gradE_[iDimension];
+      chain.qProposal_[iDimension] += epsilon[iDimension]*chain.pProposal_[iDimension];
     }
     //if ( verbosity_ >= 1 ) {
-    //  std::cout << " p(" << (iLeapFrogStep + 0.5) << ") = " << format_vdouble(pProposal_) << std::endl;
-    //  std::cout << " q(" << (iLeapFrogStep + 1) << ") = " << format_vdouble(qProposal_) << std::endl;
-    //  std::cout << "(prob = " << evalProb(qProposal_) << ", E = " << evalE(qProposal_) << "," 
-    //		  << " Ks = " << evalK(pProposal_, 0, numDimensions_) << ","
-    //		  << " E + Ks = " << (evalE(qProposal_) + evalK(pProposal_, 0, numDimensions_)) << ")" << std::endl;
+    //  std::cout << " p(" << (iLeapFrogStep + 0.5) << ") = " << format_vdouble(chain.pProposal_) << std::endl;
+    //  std::cout << " q(" << (iLeapFrogStep + 1) << ") = " << format_vdouble(chain.qProposal_) << std::endl;
+    //  std::cout << "(prob = " << evalProb(chain.qProposal_, chain.x_) << ", E = " << evalE(chain.qProposal_) << "," 
+    //		  << " Ks = " << evalK(chain.pProposal_, 0, numDimensions_) << ","
+    //		  << " E + Ks = " << (evalE(chain.qProposal_) + evalK(chain.pProposal_, 0, numDimensions_)) << ")" << std::endl;
     //}
   }
-  updateGradE(qProposal_);
-  //if ( verbosity_ >= 1 ) std::cout << " gradE = " << format_vdouble(gradE_) << std::endl;
+  updateGradE(chain, chain.qProposal_);
+  //if ( verbosity_ >= 1 ) std::cout << " gradE = " << format_vdouble(chain.gradE_) << std::endl;
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-    pProposal_[iDimension] -= 0.5*epsilon[iDimension]*gradE_[iDimension];
+    chain.pProposal_[iDimension] -= 0.5*epsilon[iDimension]*chain.gradE_[iDimension];
   }
   //if ( verbosity_ >= 1 ) {  
-  //  std::cout << " p(" << L_ << ") = " << format_vdouble(pProposal_) << std::endl;
-  //  std::cout << "(prob = " << evalProb(qProposal_) << ", E = " << evalE(qProposal_) << "," 
-  //	        << " Ks = " << evalK(pProposal_, 0, numDimensions_) << ","
-  //	        << " E + Ks = " << (evalE(qProposal_) + evalK(pProposal_, 0, numDimensions_)) << ")" << std::endl;
+  //  std::cout << " p(" << L_ << ") = " << format_vdouble(chain.pProposal_) << std::endl;
+  //  std::cout << "(prob = " << evalProb(chain.qProposal_, chain.x_) << ", E = " << evalE(chain.qProposal_) << "," 
+  //	        << " Ks = " << evalK(chain.pProposal_, 0, numDimensions_) << ","
+  //	        << " E + Ks = " << (evalE(chain.qProposal_) + evalK(chain.pProposal_, 0, numDimensions_)) << ")" << std::endl;
   //}
 }
 
-void MarkovChainIntegrator::updateX(const std::vector<double>& q)
+void MarkovChainIntegrator::updateX(const std::vector<double>& q, vdouble& x) const
 {
   //std::cout << "<MarkovChainIntegrator::updateX>:" << std::endl;
   //std::cout << " q = " << format_vdouble(q) << std::endl;
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
     double q_i = q[iDimension];
-    x_[iDimension] = (1. - q_i)*xMin_[iDimension] + q_i*xMax_[iDimension];
+    x[iDimension] = (1. - q_i)*xMin_[iDimension] + q_i*xMax_[iDimension];
     //std::cout << " x[" << iDimension << "] = " << x_[iDimension] << " ";
     //std::cout << "(xMin[" << iDimension << "] = " << xMin_[iDimension] << ","
     //          << " xMax[" << iDimension << "] = " << xMax_[iDimension] << ")";
@@ -606,21 +934,47 @@ void MarkovChainIntegrator::updateX(const std::vector<double>& q)
   }
 }
 
-double MarkovChainIntegrator::evalProb(const std::vector<double>& q)
+double MarkovChainIntegrator::evalProb(const std::vector<double>& q, vdouble& x) const
 {
-  updateX(q);
-  double prob = (*integrand_)(x_);
+  updateX(q, x);
+  double prob = (*integrand_)(&x[0]);
   return prob;
 }
 
-double MarkovChainIntegrator::evalE(const std::vector<double>& q)
+void MarkovChainIntegrator::evalProbBatch(ChainState& chain, unsigned numPoints) const
+{
+//--- evaluate probability for the first numPoints positions in chain.qBatch_;
+//    the integrand is called once per point if it has no batched version
+  if ( !batchIntegrand_ ) {
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+	double q_i = chain.qBatch_[iPoint*numDimensions_ + iDimension];
+	chain.x_[iDimension] = (1. - q_i)*xMin_[iDimension] + q_i*xMax_[iDimension];
+      }
+      chain.probBatch_[iPoint] = (*integrand_)(&chain.x_[0]);
+    }
+    return;
+  }
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    double xMin_i = xMin_[iDimension];
+    double xMax_i = xMax_[iDimension];
+    double* x = &chain.xBatch_[iDimension*numPoints];
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      double q_i = chain.qBatch_[iPoint*numDimensions_ + iDimension];
+      x[iPoint] = (1. - q_i)*xMin_i + q_i*xMax_i;
+    }
+  }
+  batchIntegrand_->evalBatch(&chain.xBatch_[0], numPoints, numPoints, &chain.probBatch_[0]);
+}
+
+double MarkovChainIntegrator::evalE(const std::vector<double>& q, vdouble& x) const
 {
-  double prob = evalProb(q);
+  double prob = evalProb(q, x);
   double E = -TMath::Log(prob);
   return E;
 }
 
-double MarkovChainIntegrator::evalK(const std::vector<double>& p, unsigned idxFirst, unsigned idxLast)
+double MarkovChainIntegrator::evalK(const std::vector<double>& p, unsigned idxFirst, unsigned idxLast) const
 {
 //--- compute "kinetic energy"
 //   (of either the "significant" or "dummy" momentum components) 
@@ -634,7 +988,7 @@ double MarkovChainIntegrator::evalK(const std::vector<double>& p, unsigned idxFi
   return K;
 }
 
-void MarkovChainIntegrator::updateGradE(std::vector<double>& q)
+void MarkovChainIntegrator::updateGradE(ChainState& chain, std::vector<double>& q)
 {
 //--- numerically compute gradient of "potential energy" E = -log(P(q)) at point q
   //if ( verbosity_ >= 1 ) {
@@ -642,25 +996,32 @@ void MarkovChainIntegrator::updateGradE(std::vector<double>& q)
   //  std::cout << " q(1) = " << format_vdouble(q) << std::endl;
   //}
 
-  double prob_q = evalProb(q);  
-  //if ( verbosity_ >= 1 ) std::cout << " prob(q) = " << prob_q << std::endl;
-
+//    (the point q and the N points shifted along each dimension are evaluated at once)
+  for ( unsigned iPoint = 0; iPoint <= numDimensions_; ++iPoint ) {
+    std::copy(q.begin(), q.end(), chain.qBatch_.begin() + iPoint*numDimensions_);
+  }
+  vdouble dq(numDimensions_);
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
     double q_i = q[iDimension];
     double dqDerr_i = dqDerr_[iDimension];
-    double dq = ( (q_i + dqDerr_i) < 1. ) ? +dqDerr_i : -dqDerr_i;
-    double q_plus_dq = q_i + dq;
-    q[iDimension] = q_plus_dq;
-    double prob_q_plus_dq = evalProb(q);
-    double gradE_i = -(prob_q_plus_dq - prob_q)/dq;
+    dq[iDimension] = ( (q_i + dqDerr_i) < 1. ) ? +dqDerr_i : -dqDerr_i;
+    chain.qBatch_[(iDimension + 1)*numDimensions_ + iDimension] = q_i + dq[iDimension];
+  }
+  evalProbBatch(chain, numDimensions_ + 1);
+
+  double prob_q = chain.probBatch_[0];
+  //if ( verbosity_ >= 1 ) std::cout << " prob(q) = " << prob_q << std::endl;
+
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    double prob_q_plus_dq = chain.probBatch_[iDimension + 1];
+    double gradE_i = -(prob_q_plus_dq - prob_q)/dq[iDimension];
     if ( prob_q > 0. ) gradE_i /= prob_q;
-    gradE_[iDimension] = gradE_i;
-    q[iDimension] = q_i;
+    chain.gradE_[iDimension] = gradE_i;
   }
 
   //if ( verbosity_ >= 1 ) {
   //  std::cout << " q(2) = " << format_vdouble(q) << std::endl;
-  //  std::cout << "--> gradE = " << format_vdouble(gradE_) << std::endl;
+  //  std::cout << "--> gradE = " << format_vdouble(chain.gradE_) << std::endl;
   //}
 }
 
@@ -689,16 +1050,16 @@ void MarkovChainIntegrator::openMonitorFile(const std::string& monitorFileName)
   }
 }
 
-void MarkovChainIntegrator::updateMonitorFile()
+void MarkovChainIntegrator::updateMonitorFile(const double* x)
 {
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-    double x_i = x_[iDimension];
+    double x_i = x[iDimension];
     branchValues_[iDimension] = x_i;
   }
   
   for ( std::vector<monitorElementType>::iterator extraMonitorBranch = extraMonitorBranches_.begin();
 	extraMonitorBranch != extraMonitorBranches_.end(); ++extraMonitorBranch ) {
-    extraMonitorBranch->branchValue_ = (*extraMonitorBranch->f_)(x_);
+    extraMonitorBranch->branchValue_ = (*extraMonitorBranch->f_)(x);
   }
 
   monitorTree_->Fill();
@@ -38,17 +38,47 @@ namespace NSVfitStandalone
     //}
   }
 
+  void map_x(const double* x, int nDim, unsigned numPoints, unsigned stride, double* x_mapped, unsigned strideMapped)
+  {
+    // source dimension for each fit parameter, -1 for the neutrino mass of hadronic tau decays
+    static const int mapping4[6] = { 0, -1, 1, 2, -1, 3 };
+    static const int mapping5[6] = { 0,  1, 2, 3, -1, 4 };
+    static const int mapping6[6] = { 0,  1, 2, 3,  4, 5 };
+    const int* mapping = 0;
+    if(nDim == 4) mapping = mapping4;
+    else if(nDim == 5) mapping = mapping5;
+    else if(nDim == 6) mapping = mapping6;
+    else assert(0);
+    for(int iParam = 0; iParam < 2*kMaxFitParams; ++iParam){
+      double* x_mapped_param = x_mapped + iParam*strideMapped;
+      if(mapping[iParam] < 0) std::fill(x_mapped_param, x_mapped_param + numPoints, 0.);
+      else std::copy(x + mapping[iParam]*stride, x + mapping[iParam]*stride + numPoints, x_mapped_param);
+    }
+  }
+
+  /// number of integrand calls of VEGAS for each tested di-tau mass
+  const unsigned int vegasCallsPerMassPoint = 2000;
 
 NSVfitStandaloneAlgorithm::NSVfitStandaloneAlgorithm(std::vector<NSVfitStandalone::MeasuredTauLepton> measuredTauLeptons, NSVfitStandalone::Vector measuredMET , const TMatrixD& covMET, unsigned int verbosity) : 
   fitStatus_(-1), 
   verbosity_(verbosity), 
   maxObjFunctionCalls_(5000),
+  vegasScanMode_(kLinearScan),
+  vegasMassTolerance_(1.),
+  vegasMaxIntegrandCalls_(80000),
   mcObjectiveFunctionAdapter_(0),
   mcPtEtaPhiMassAdapter_(0),
   integrator2_(0),
   integrator2_nDim_(0),
   isInitialized2_(false),
-  maxObjFunctionCalls2_(100000)
+  maxObjFunctionCalls2_(100000),
+  numChains2_(1),
+  numThreads2_(1),
+  numProposals2_(1),
+  convergencePrecision2_(0.),
+  convergenceCheckInterval2_(1000),
+  convergenceMaxRhat2_(1.1),
+  warmStartBurninFraction2_(0.1)
 { 
   // instantiate minuit, the arguments might turn into configurables once
   minimizer_ = ROOT::Math::Factory::CreateMinimizer("Minuit2", "Migrad");
@@ -198,7 +228,6 @@ NSVfitStandaloneAlgorithm::integrateVEGAS()
     std::cout << "<NSVfitStandaloneAlgorithm::integrateVEGAS()>:" << std::endl;
   }
 
-  double pi = 3.14159265;
   // number of hadrponic decays
   int khad = 0;
   for(unsigned int idx=0; idx<nll_->measuredTauLeptons().size(); ++idx){
@@ -208,6 +237,34 @@ NSVfitStandaloneAlgorithm::integrateVEGAS()
   }
   // number of parameters for fit
   int par = nll_->measuredTauLeptons().size()*NSVfitStandalone::kMaxFitParams - (khad + 1);
+
+  // integrator instance
+  //ROOT::Math::IntegratorMultiDim ig2(ROOT::Math::IntegrationMultiDim::kVEGAS, 1.e-12, 1.e-5);
+  ROOT::Math::GSLMCIntegrator ig2("vegas", 1.e-12, 1.e-5, vegasCallsPerMassPoint);
+  ROOT::Math::Functor toIntegrate(&standaloneObjectiveFunctionAdapter_, &ObjectiveFunctionAdapter::Eval, par); 
+  standaloneObjectiveFunctionAdapter_.SetPar(par);
+  ig2.SetFunction(toIntegrate);
+  nll_->addDelta(true);
+  nll_->addSinTheta(false);
+  nll_->addPhiPenalty(false);
+  double pMax = 0.;
+  if(vegasScanMode_ == kAdaptiveScan){
+    pMax = scanMassAdaptiveVEGAS(ig2, par);
+  } else {
+    pMax = scanMassLinearVEGAS(ig2, par);
+  }
+  if ( verbosity_ > 0 ) {
+    std::cout << "--> mass  = " << mass_  << std::endl;
+    std::cout << "--> pmax  = " << pMax   << std::endl;
+  }
+}
+
+double
+NSVfitStandaloneAlgorithm::integrateVEGASAtMass(ROOT::Math::GSLMCIntegrator& ig2, int par, double mtest)
+{
+  using namespace NSVfitStandalone;
+
+  const double pi = 3.14159265;
   /* --------------------------------------------------------------------------------------
      lower and upper bounds for integration. Boundaries are deefined for each decay channel
      separately. The order is: 
@@ -230,32 +287,30 @@ NSVfitStandaloneAlgorithm::integrateVEGAS()
   double xl5[5] = { 0.0, 0.0, -pi, 0.0, -pi };
   double xu5[5] = { 1.0, tauLeptonMass, pi, tauLeptonMass, pi };
 
-  // integrator instance
-  //ROOT::Math::IntegratorMultiDim ig2(ROOT::Math::IntegrationMultiDim::kVEGAS, 1.e-12, 1.e-5);
-  ROOT::Math::GSLMCIntegrator ig2("vegas", 1.e-12, 1.e-5, 2000);
-  ROOT::Math::Functor toIntegrate(&standaloneObjectiveFunctionAdapter_, &ObjectiveFunctionAdapter::Eval, par); 
-  standaloneObjectiveFunctionAdapter_.SetPar(par);
-  ig2.SetFunction(toIntegrate);
-  nll_->addDelta(true);
-  nll_->addSinTheta(false);
-  nll_->addPhiPenalty(false);
+  standaloneObjectiveFunctionAdapter_.SetM(mtest);
+  double p = -1.;
+  if(par == 4){
+    p = ig2.Integral(xl4, xu4);
+  } else if(par == 5){
+    p = ig2.Integral(xl5, xu5);
+  } else if(par == 3){
+    p = ig2.Integral(xl3, xu3);
+  } else{
+    std::cout << " >> ERROR : the nubmer of measured leptons must be 2" << std::endl;
+    assert(0);
+  }
+  return p;
+}
+
+double
+NSVfitStandaloneAlgorithm::scanMassLinearVEGAS(ROOT::Math::GSLMCIntegrator& ig2, int par)
+{
   int count = 0;
   double pMax = 0.;
   double mtest = measuredDiTauSystem().mass();
   bool skiphighmasstail = false;
   for(int i=0; i<100 && (!skiphighmasstail); ++i){
-    standaloneObjectiveFunctionAdapter_.SetM(mtest);
-    double p = -1.;
-    if(par == 4){
-      p = ig2.Integral(xl4, xu4);
-    } else if(par == 5){
-      p = ig2.Integral(xl5, xu5);
-    } else if(par == 3){
-      p = ig2.Integral(xl3, xu3);
-    } else{
-      std::cout << " >> ERROR : the nubmer of measured leptons must be 2" << std::endl;
-      assert(0);
-    }
+    double p = integrateVEGASAtMass(ig2, par, mtest);
     if(verbosity_>1){
       std::cout << "--> scan idx = " << i << "  mtest = " << mtest << "  p = " << p << "  pmax = " << pMax << std::endl;
     }
@@ -281,10 +336,85 @@ NSVfitStandaloneAlgorithm::integrateVEGAS()
     //mtest += TMath::Max(0.1, 0.001*mtest);
   }
   if ( verbosity_ > 0 ) {
-    std::cout << "--> mass  = " << mass_  << std::endl;
-    std::cout << "--> pmax  = " << pMax   << std::endl;
     std::cout << "--> count = " << count  << std::endl;
   }
+  return pMax;
+}
+
+double
+NSVfitStandaloneAlgorithm::scanMassAdaptiveVEGAS(ROOT::Math::GSLMCIntegrator& ig2, int par)
+{
+  // the coarse pass uses 4 times larger steps than the linear scan and stops after 2 consecutive points below half of
+  // the maximum, which corresponds to the same mass range as the 5 points of the linear scan
+  const unsigned int maxEvaluations = TMath::Max(3u, vegasMaxIntegrandCalls_/vegasCallsPerMassPoint);
+  unsigned int nEvaluations = 0;
+  std::vector<double> masses, probabilities;
+  double pMax = 0.;
+  size_t best = 0;
+  int count = 0;
+  double mtest = measuredDiTauSystem().mass();
+  while(count < 2 && masses.size() < 25 && nEvaluations + 2 < maxEvaluations){
+    const double p = integrateVEGASAtMass(ig2, par, mtest);
+    ++nEvaluations;
+    if(verbosity_>1){
+      std::cout << "--> coarse scan idx = " << masses.size() << "  mtest = " << mtest << "  p = " << p << "  pmax = " << pMax << std::endl;
+    }
+    masses.push_back(mtest);
+    probabilities.push_back(p);
+    if(p>pMax){
+      best = masses.size() - 1;
+      pMax = p;
+      count = 0;
+    } else if(p<(0.5*pMax)){
+      ++count;
+    } else {
+      count = 0;
+    }
+    mtest += TMath::Max(10., 0.1*mtest);
+  }
+  mass_ = masses.at(best);
+
+  // golden-section search of the maximum inside the interval between the neighbours of the best coarse point
+  const double invPhi = 0.5*(TMath::Sqrt(5.) - 1.);
+  double a = best > 0 ? masses.at(best - 1) : masses.at(best);
+  double b = best + 1 < masses.size() ? masses.at(best + 1) : mtest;
+  double x1 = b - invPhi*(b - a);
+  double x2 = a + invPhi*(b - a);
+  double p1 = integrateVEGASAtMass(ig2, par, x1);
+  double p2 = integrateVEGASAtMass(ig2, par, x2);
+  nEvaluations += 2;
+  while(true){
+    if(p1>pMax){
+      mass_ = x1;
+      pMax = p1;
+    }
+    if(p2>pMax){
+      mass_ = x2;
+      pMax = p2;
+    }
+    if(b - a <= vegasMassTolerance_ || nEvaluations >= maxEvaluations) break;
+    if(p1>p2){
+      b = x2;
+      x2 = x1;
+      p2 = p1;
+      x1 = b - invPhi*(b - a);
+      p1 = integrateVEGASAtMass(ig2, par, x1);
+    } else {
+      a = x1;
+      x1 = x2;
+      p1 = p2;
+      x2 = a + invPhi*(b - a);
+      p2 = integrateVEGASAtMass(ig2, par, x2);
+    }
+    ++nEvaluations;
+    if(verbosity_>1){
+      std::cout << "--> refinement [" << a << ", " << b << "]  pmax = " << pMax << std::endl;
+    }
+  }
+  if ( verbosity_ > 0 ) {
+    std::cout << "--> number of mass points = " << nEvaluations << std::endl;
+  }
+  return pMax;
 }
 
 void
@@ -293,20 +423,33 @@ NSVfitStandaloneAlgorithm::integrateMarkovChain()
   if(verbosity_>0){
     std::cout << "<NSVfitStandaloneAlgorithm::integrateMarkovChain()>:" << std::endl;
   }
+  // the sampling moves are shared among the chains, while each chain has the full burn-in stage;
+  // multiple-try moves replace numProposals2_ ordinary moves each
+  const unsigned numMoves = maxObjFunctionCalls2_/numProposals2_;
+  const unsigned numIterBurnin = TMath::Nint(0.10*numMoves);
   if(isInitialized2_){
     mcPtEtaPhiMassAdapter_->Reset();
   }
   else{
 
-    integrator2_ = new MarkovChainIntegrator("NSVfitStandaloneAlgorithm", MoveMode::kMetropolis, InitMode::kNone,
-                                             TMath::Nint(0.10*maxObjFunctionCalls2_), maxObjFunctionCalls2_,
-                                             TMath::Nint(0.02*maxObjFunctionCalls2_), TMath::Nint(0.06*maxObjFunctionCalls2_),
-                                             15., 1.0 - 1.e+2/maxObjFunctionCalls2_, 1, 1, 1, 1.e-2, 0.71, -1);
+    const MoveMode moveMode = numProposals2_ > 1 ? MoveMode::kMultipleTry : MoveMode::kMetropolis;
+    integrator2_ = new MarkovChainIntegrator("NSVfitStandaloneAlgorithm", moveMode, InitMode::kNone,
+                                             numIterBurnin, numMoves/numChains2_,
+                                             TMath::Nint(0.02*numMoves), TMath::Nint(0.06*numMoves),
+                                             15., 1.0 - 1.e+2/numMoves, numChains2_, 1, 1, 1.e-2, 0.71, -1);
+    integrator2_->setNumThreads(numThreads2_);
+    integrator2_->setNumProposals(numProposals2_);
     mcObjectiveFunctionAdapter_ = new MCObjectiveFunctionAdapter();
+    mcObjectiveFunctionAdapter_->SetLikelihood(nll_);
     integrator2_->setIntegrand(*mcObjectiveFunctionAdapter_);
+    integrator2_->setBatchIntegrand(*mcObjectiveFunctionAdapter_);
     integrator2_nDim_ = 0;
     mcPtEtaPhiMassAdapter_ = new MCPtEtaPhiMassAdapter();
     integrator2_->registerCallBackFunction(*mcPtEtaPhiMassAdapter_);
+    if(convergencePrecision2_ > 0.){
+      mcPtEtaPhiMassAdapter_->SetConvergencePrecision(convergencePrecision2_);
+      integrator2_->setConvergenceCriterion(*mcPtEtaPhiMassAdapter_, convergenceCheckInterval2_, convergenceMaxRhat2_);
+    }
     isInitialized2_= true;
   }
 
@@ -382,6 +525,12 @@ NSVfitStandaloneAlgorithm::integrateMarkovChain()
     //std::cout << "x0[" << i << "] = " << x0[i] << std::endl;
   }
   integrator2_->initializeStartPosition_and_Momentum(x0);
+  if(!warmStartPositions2_.empty()){
+    integrator2_->setWarmStart(warmStartPositions2_, TMath::Nint(warmStartBurninFraction2_*numIterBurnin));
+  } else {
+    integrator2_->clearWarmStart();
+  }
+  mcPtEtaPhiMassAdapter_->SetReferencePhi(measuredDiTauSystem().phi());
   nll_->addDelta(false);
   nll_->addSinTheta(false);
   nll_->addPhiPenalty(false);
@@ -1,3 +1,6 @@
+#include <cmath>
+#include <algorithm>
+
 #include "../interface/svFitAuxFunctions.h"
 #include "../interface/LikelihoodFunctions.h"
 #include "../interface/NSVfitStandaloneLikelihood.h"
@@ -5,9 +8,9 @@
 namespace NSVfitStandalone {
 
 /// global function pointer for minuit or VEGAS
-const NSVfitStandaloneLikelihood* NSVfitStandaloneLikelihood::gNSVfitStandaloneLikelihood = 0;
+thread_local const NSVfitStandaloneLikelihood* NSVfitStandaloneLikelihood::gNSVfitStandaloneLikelihood = 0;
 /// indicate first iteration for integration or fit cycle for debugging
-static bool FIRST = true;
+static thread_local bool FIRST = true;
 
 NSVfitStandaloneLikelihood::NSVfitStandaloneLikelihood(std::vector<MeasuredTauLepton> measuredTauLeptons, Vector measuredMET, const TMatrixD& covMET, bool verbose) :  
   metPower_(1.0), 
@@ -357,6 +360,253 @@ NSVfitStandaloneLikelihood::prob(const double* xPrime, double phiPenalty) const
   return prob;
 }
 
+void
+NSVfitStandaloneLikelihood::addFittedTauLeptonBatch(unsigned idx, const double* nunuMass, const double* labframeXFrac,
+                                                    const double* labframePhi, unsigned numPoints,
+                                                    double* restframeDecayAngle, double* diTauP4) const
+{
+  const double labframeVisMom = measuredTauLeptons_[idx].momentum();
+  const double labframeVisEn  = measuredTauLeptons_[idx].energy();
+  // same protection against zero visible mass as in the scalar version
+  const double visMass = std::max(measuredTauLeptons_[idx].mass(), 5.1e-4);
+  const double visMass2 = square(visMass);
+  // rotation from the frame in which the visible momentum defines the z axis into the labframe (see rotateUz)
+  const Vector visDir = measuredTauLeptons_[idx].direction();
+  const double u1 = visDir.x(), u2 = visDir.y(), u3 = visDir.z();
+  const double up = std::sqrt(u1*u1 + u2*u2);
+  double rot[3][3] = { { 1., 0., 0. }, { 0., 1., 0. }, { 0., 0., 1. } };
+  if(up > 0.){
+    const double rotUp[3][3] = { { u1*u3/up, -u2/up, u1 }, { u2*u3/up, u1/up, u2 }, { (u3*u3 - 1.)/up, 0., u3 } };
+    std::copy(&rotUp[0][0], &rotUp[0][0] + 9, &rot[0][0]);
+  }
+  else if(u3 < 0.){
+    rot[0][0] = rot[2][2] = -1.;
+  }
+  double* diTauPx = diTauP4;
+  double* diTauPy = diTauP4 + kMaxBatchSize;
+  double* diTauPz = diTauP4 + 2*kMaxBatchSize;
+  double* diTauEn = diTauP4 + 3*kMaxBatchSize;
+  for(unsigned i=0; i<numPoints; ++i){
+    // the same steps as pVisRestFrame, gjAngleFromX, gjAngleToLabFrame, motherMomentumLabFrame, motherDirection
+    // and motherP4, inlined to allow auto-vectorization
+    const double nunuMass_i = nunuMass[i];
+    const double restframeVisMom = std::sqrt((tauLeptonMass2 - square(visMass + nunuMass_i))
+                                            *(tauLeptonMass2 - square(visMass - nunuMass_i)))/(2.*tauLeptonMass);
+    const double restframeVisEn = std::sqrt(visMass2 + square(restframeVisMom));
+    const double beta = std::sqrt(1. - square(tauLeptonMass*labframeXFrac[i]/labframeVisEn));
+    const double cosGjAngle = (tauLeptonMass*labframeXFrac[i] - restframeVisEn)/(restframeVisMom*beta);
+    const double gjAngle = std::acos(cosGjAngle);
+    const double labframeDecayAngle = std::asin(restframeVisMom*std::sin(gjAngle)/labframeVisMom);
+    const double labframeVisMom_parallel = labframeVisMom*std::cos(labframeDecayAngle);
+    const double restframeVisMom_parallel = restframeVisMom*std::cos(gjAngle);
+    const double gamma = (restframeVisEn*std::sqrt(square(restframeVisEn) + square(labframeVisMom_parallel)
+                                                   - square(restframeVisMom_parallel))
+                          - restframeVisMom_parallel*labframeVisMom_parallel)
+                         /(square(restframeVisEn) - square(restframeVisMom_parallel));
+    const double labframeTauMom = std::sqrt(square(gamma) - 1)*tauLeptonMass;
+    // tau lepton direction in the frame of the visible momentum and in the labframe
+    const double sinTheta = std::sin(labframeDecayAngle);
+    const double dx = sinTheta*std::cos(labframePhi[i]);
+    const double dy = sinTheta*std::sin(labframePhi[i]);
+    const double dz = std::cos(labframeDecayAngle);
+    double tauDirX = rot[0][0]*dx + rot[0][1]*dy + rot[0][2]*dz;
+    double tauDirY = rot[1][0]*dx + rot[1][1]*dy + rot[1][2]*dz;
+    double tauDirZ = rot[2][0]*dx + rot[2][1]*dy + rot[2][2]*dz;
+    const double tauDirMag = std::sqrt(tauDirX*tauDirX + tauDirY*tauDirY + tauDirZ*tauDirZ);
+    tauDirX /= tauDirMag;
+    tauDirY /= tauDirMag;
+    tauDirZ /= tauDirMag;
+    diTauPx[i] += tauDirX*labframeTauMom;
+    diTauPy[i] += tauDirY*labframeTauMom;
+    diTauPz[i] += tauDirZ*labframeTauMom;
+    diTauEn[i] += std::sqrt(labframeTauMom*labframeTauMom + tauLeptonMass2);
+    restframeDecayAngle[i] = gjAngle;
+  }
+}
+
+void
+NSVfitStandaloneLikelihood::transformBatch(double* xPrime, const double* x, unsigned numPoints, unsigned stride) const
+{
+  double diTauP4[4*kMaxBatchSize];
+  std::fill(diTauP4, diTauP4 + 4*kMaxBatchSize, 0.);
+  for(unsigned int idx=0; idx<measuredTauLeptons_.size(); ++idx){
+    const double* nunuMass      = x + (idx*kMaxFitParams + kMNuNu)*stride;
+    const double* labframeXFrac = x + (idx*kMaxFitParams + kXFrac)*stride;
+    const double* labframePhi   = x + (idx*kMaxFitParams + kPhi  )*stride;
+    double* xPrimeNuNuMass   = xPrime + (idx==0 ? kNuNuMass1    : kNuNuMass2         )*kMaxBatchSize;
+    double* xPrimeVisMass    = xPrime + (idx==0 ? kVisMass1     : kVisMass2          )*kMaxBatchSize;
+    double* xPrimeDecayAngle = xPrime + (idx==0 ? kDecayAngle1  : kDecayAngle2       )*kMaxBatchSize;
+    double* xPrimeXFrac      = xPrime + (idx==0 ? kMaxNLLParams : (kMaxNLLParams + 1))*kMaxBatchSize;
+    addFittedTauLeptonBatch(idx, nunuMass, labframeXFrac, labframePhi, numPoints, xPrimeDecayAngle, diTauP4);
+    std::copy(nunuMass, nunuMass + numPoints, xPrimeNuNuMass);
+    std::fill(xPrimeVisMass, xPrimeVisMass + numPoints, std::max(measuredTauLeptons_[idx].mass(), 5.1e-4));
+    std::copy(labframeXFrac, labframeXFrac + numPoints, xPrimeXFrac);
+  }
+  const Vector measuredVis = measuredTauLeptons_[0].p() + measuredTauLeptons_[1].p();
+  for(unsigned i=0; i<numPoints; ++i){
+    const double px = diTauP4[i], py = diTauP4[kMaxBatchSize + i], pz = diTauP4[2*kMaxBatchSize + i];
+    const double en = diTauP4[3*kMaxBatchSize + i];
+    xPrime[kDMETx*kMaxBatchSize + i] = measuredMET_.x() - (px - measuredVis.x());
+    xPrime[kDMETy*kMaxBatchSize + i] = measuredMET_.y() - (py - measuredVis.y());
+    // same convention as LorentzVector::mass for space-like vectors
+    const double mass2 = en*en - (px*px + py*py + pz*pz);
+    xPrime[kMTauTau*kMaxBatchSize + i] = mass2 >= 0. ? std::sqrt(mass2) : -std::sqrt(-mass2);
+  }
+}
+
+void
+NSVfitStandaloneLikelihood::transformintBatch(double* xPrime, bool* isValid, const double* x, unsigned numPoints,
+                                              unsigned stride, const double mtest, const int par) const
+{
+  // used for determination of xFrac for second lepton
+  const double vmm = (measuredTauLeptons_[0].p4() + measuredTauLeptons_[1].p4()).mass();
+  const double vmm_over_mtest2 = std::pow(vmm/mtest, 2);
+  double zeros[kMaxBatchSize];
+  std::fill(zeros, zeros + kMaxBatchSize, 0.);
+  double diTauP4[4*kMaxBatchSize];
+  std::fill(diTauP4, diTauP4 + 4*kMaxBatchSize, 0.);
+  // the integration parameters are ordered in the same way as in transformint
+  unsigned ip = 1;
+  for(unsigned int idx=0; idx<measuredTauLeptons_.size(); ++idx){
+    double* xPrimeXFrac = xPrime + (idx==0 ? kMaxNLLParams : (kMaxNLLParams + 1))*kMaxBatchSize;
+    if(idx == 0){
+      std::copy(x, x + numPoints, xPrimeXFrac);
+      std::fill(isValid, isValid + numPoints, true);
+    }
+    else{
+      for(unsigned i=0; i<numPoints; ++i){
+        xPrimeXFrac[i] = vmm_over_mtest2/x[i];
+        isValid[i] = !(xPrimeXFrac[i] > 1.);
+      }
+    }
+    const double* nunuMass = zeros;
+    if((par == 5 || par == 4) && measuredTauLeptons_[idx].decayType() == kLepDecay){
+      nunuMass = x + ip*stride;
+      ++ip;
+    }
+    const double* labframePhi = x + ip*stride;
+    ++ip;
+    double* xPrimeNuNuMass   = xPrime + (idx==0 ? kNuNuMass1   : kNuNuMass2  )*kMaxBatchSize;
+    double* xPrimeVisMass    = xPrime + (idx==0 ? kVisMass1    : kVisMass2   )*kMaxBatchSize;
+    double* xPrimeDecayAngle = xPrime + (idx==0 ? kDecayAngle1 : kDecayAngle2)*kMaxBatchSize;
+    addFittedTauLeptonBatch(idx, nunuMass, xPrimeXFrac, labframePhi, numPoints, xPrimeDecayAngle, diTauP4);
+    std::copy(nunuMass, nunuMass + numPoints, xPrimeNuNuMass);
+    std::fill(xPrimeVisMass, xPrimeVisMass + numPoints, std::max(measuredTauLeptons_[idx].mass(), 5.1e-4));
+  }
+  const Vector measuredVis = measuredTauLeptons_[0].p() + measuredTauLeptons_[1].p();
+  for(unsigned i=0; i<numPoints; ++i){
+    xPrime[kDMETx*kMaxBatchSize + i] = measuredMET_.x() - (diTauP4[i] - measuredVis.x());
+    xPrime[kDMETy*kMaxBatchSize + i] = measuredMET_.y() - (diTauP4[kMaxBatchSize + i] - measuredVis.y());
+    xPrime[kMTauTau*kMaxBatchSize + i] = mtest;
+  }
+}
+
+void
+NSVfitStandaloneLikelihood::probBatch(const double* xPrime, const double* phiPenalty, unsigned numPoints,
+                                      double* probs) const
+{
+  const double* mTauTau = xPrime + kMTauTau*kMaxBatchSize;
+  probMET(xPrime + kDMETx*kMaxBatchSize, xPrime + kDMETy*kMaxBatchSize, numPoints, covDet_, invCovMET_, metPower_,
+          probs);
+  for(unsigned int idx=0; idx<measuredTauLeptons_.size(); ++idx){
+    const double* decayAngle = xPrime + (idx==0 ? kDecayAngle1  : kDecayAngle2       )*kMaxBatchSize;
+    const double* nunuMass   = xPrime + (idx==0 ? kNuNuMass1    : kNuNuMass2         )*kMaxBatchSize;
+    const double* xFrac      = xPrime + (idx==0 ? kMaxNLLParams : (kMaxNLLParams + 1))*kMaxBatchSize;
+    const double visMass = xPrime[(idx==0 ? kVisMass1 : kVisMass2)*kMaxBatchSize];
+    switch(measuredTauLeptons_[idx].decayType()){
+    case kHadDecay :
+      probTauToHadPhaseSpace(decayAngle, nunuMass, visMass, xFrac, numPoints, addSinTheta_, probs);
+      break;
+    case kLepDecay :
+      probTauToLepPhaseSpace(decayAngle, nunuMass, visMass, xFrac, numPoints, addSinTheta_, probs);
+      break;
+    }
+  }
+  if(addLogM_){
+    for(unsigned i=0; i<numPoints; ++i){
+      if(mTauTau[i]>0.) probs[i] *= (1.0/mTauTau[i]);
+    }
+  }
+  if(addDelta_){
+    const double* xFrac1 = xPrime + kMaxNLLParams*kMaxBatchSize;
+    for(unsigned i=0; i<numPoints; ++i){
+      probs[i] *= (2.0*xFrac1[i]/mTauTau[i]);
+    }
+  }
+  if(phiPenalty){
+    for(unsigned i=0; i<numPoints; ++i){
+      if(phiPenalty[i]>0.) probs[i] *= std::exp(-phiPenalty[i]);
+    }
+  }
+  FIRST=false;
+}
+
+void
+NSVfitStandaloneLikelihood::prob(const double* x, unsigned numPoints, unsigned stride, double* probs) const
+{
+  // in case of initialization errors don't start to do anything
+  if(error()){
+    std::fill(probs, probs + numPoints, 0.);
+    return;
+  }
+  if(verbose_){
+    double xPoint[2*kMaxFitParams];
+    for(unsigned i=0; i<numPoints; ++i){
+      for(unsigned iParam=0; iParam<2*kMaxFitParams; ++iParam) xPoint[iParam] = x[iParam*stride + i];
+      probs[i] = prob(xPoint);
+    }
+    return;
+  }
+  idxObjFunctionCall_ += numPoints;
+  double xPrime[(kMaxNLLParams + 2)*kMaxBatchSize];
+  double phiPenalty[kMaxBatchSize];
+  for(unsigned first=0; first<numPoints; first+=kMaxBatchSize){
+    const unsigned n = std::min(numPoints - first, unsigned(kMaxBatchSize));
+    const double* xBatch = x + first;
+    // the same phi penalty as in the scalar version
+    std::fill(phiPenalty, phiPenalty + n, 0.);
+    if(addPhiPenalty_){
+      for(unsigned int idx=0; idx<measuredTauLeptons_.size(); ++idx){
+        for(unsigned i=0; i<n; ++i){
+          const double phi = xBatch[kPhi*stride + i];
+          if(std::abs(idx*kMaxFitParams + phi)>TMath::Pi()) phiPenalty[i] += square(std::abs(phi) - TMath::Pi());
+        }
+      }
+    }
+    transformBatch(xPrime, xBatch, n, stride);
+    probBatch(xPrime, phiPenalty, n, probs + first);
+  }
+}
+
+void
+NSVfitStandaloneLikelihood::probint(const double* x, unsigned numPoints, unsigned stride, const double mtest,
+                                    const int par, double* probs) const
+{
+  // in case of initialization errors don't start to do anything
+  if(error()){
+    std::fill(probs, probs + numPoints, 0.);
+    return;
+  }
+  if(verbose_){
+    double xPoint[2*kMaxFitParams];
+    for(unsigned i=0; i<numPoints; ++i){
+      for(int iParam=0; iParam<par; ++iParam) xPoint[iParam] = x[iParam*stride + i];
+      probs[i] = probint(xPoint, mtest, par);
+    }
+    return;
+  }
+  double xPrime[(kMaxNLLParams + 2)*kMaxBatchSize];
+  bool isValid[kMaxBatchSize];
+  for(unsigned first=0; first<numPoints; first+=kMaxBatchSize){
+    const unsigned n = std::min(numPoints - first, unsigned(kMaxBatchSize));
+    transformintBatch(xPrime, isValid, x + first, n, stride, mtest, par);
+    probBatch(xPrime, 0, n, probs + first);
+    for(unsigned i=0; i<n; ++i){
+      if(!isValid[i]) probs[first + i] = 0.;
+    }
+  }
+}
+
 void
 NSVfitStandaloneLikelihood::results(std::vector<LorentzVector>& fittedTauLeptons, const double* x) const
 {
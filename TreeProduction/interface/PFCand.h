@@ -1,6 +1,6 @@
 /*!
  * \file PFCand.h
- * \brief Definiton of ntuple::PFCandTree and ntuple::PFCand classes.
+ * \brief Definiton of ntuple::PFCandTree, ntuple::PFCandColumnsTree and ntuple::PFCand classes.
  * \author Konstantin Androsov (University of Siena, INFN Pisa)
  * \author Maria Teresa Grippo (University of Siena, INFN Pisa)
  * \date 2014-05-30 created
@@ -61,5 +61,36 @@ TREE_CLASS_WITH_EVENT_ID(ntuple, PFCandTree, PFCANDIDATE_DATA, PFCand, "PFCand",
 TREE_CLASS_WITH_EVENT_ID_INITIALIZE(ntuple, PFCandTree, PFCANDIDATE_DATA)
 #undef SIMPLE_VAR
 #undef VECTOR_VAR
+
+// Columnar layout: all candidates of an event are stored in a single entry, one vector per variable.
+#define SIMPLE_VAR(type, name) DECLARE_SIMPLE_COLUMN_VARIABLE(type, name)
+#define VECTOR_VAR(type, name) DECLARE_VECTOR_COLUMN_VARIABLE(type, name)
+DATA_CLASS(ntuple, PFCandColumns, PFCANDIDATE_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) SIMPLE_COLUMN_TREE_BRANCH(type, name)
+#define VECTOR_VAR(type, name) VECTOR_COLUMN_TREE_BRANCH(type, name)
+TREE_CLASS_WITH_EVENT_ID(ntuple, PFCandColumnsTree, PFCANDIDATE_DATA, PFCandColumns, "PFCandColumns", false)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) ADD_SIMPLE_COLUMN_TREE_BRANCH(name)
+#define VECTOR_VAR(type, name) ADD_VECTOR_COLUMN_TREE_BRANCH(name)
+TREE_CLASS_WITH_EVENT_ID_INITIALIZE(ntuple, PFCandColumnsTree, PFCANDIDATE_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) APPEND_SIMPLE_COLUMN_VALUE(name)
+#define VECTOR_VAR(type, name) APPEND_VECTOR_COLUMN_VALUE(name)
+COLUMNS_APPEND_FUNCTION(ntuple, PFCand, PFCandColumns, PFCANDIDATE_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) EXTRACT_SIMPLE_COLUMN(name)
+#define VECTOR_VAR(type, name) EXTRACT_VECTOR_COLUMN(name)
+COLUMNS_EXTRACT_FUNCTION(ntuple, PFCand, PFCandColumns, PFCANDIDATE_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
 #undef PFCANDIDATE_DATA
 
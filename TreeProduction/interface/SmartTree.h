@@ -27,32 +27,96 @@
 #include <sstream>
 #include <memory>
 #include <iostream>
+#include <fstream>
+#include <map>
+#include <set>
+#include <functional>
 
 #include <TFile.h>
 #include <TTree.h>
 #include <Rtypes.h>
 
+#define BRANCH_HANDLE(name) \
+private: root_ext::detail::BranchHandle _##name##_handle; \
+public:
+
+#define ACCESS_BRANCH(name) _##name##_handle.Access();
+
 #define SIMPLE_TREE_BRANCH(type, name) \
 private: type _##name; \
-public:  type& name() { return _##name; }
+BRANCH_HANDLE(name) \
+public:  type& name() { ACCESS_BRANCH(name) return _##name; }
 
 #define VECTOR_TREE_BRANCH(type, name) \
 private: std::vector< type > _##name; \
-public:  std::vector< type >& name() { return _##name; }
+BRANCH_HANDLE(name) \
+public:  std::vector< type >& name() { ACCESS_BRANCH(name) return _##name; }
 
 #define SIMPLE_DATA_TREE_BRANCH(type, name) \
-    type& name() { return data.name; }
+    BRANCH_HANDLE(name) \
+    type& name() { ACCESS_BRANCH(name) return _data.name; }
 
 #define VECTOR_DATA_TREE_BRANCH(type, name) \
-    std::vector< type >& name() { return data.name; }
+    BRANCH_HANDLE(name) \
+    std::vector< type >& name() { ACCESS_BRANCH(name) return _data.name; }
 
 #define DECLARE_SIMPLE_BRANCH_VARIABLE(type, name) type name;
 #define DECLARE_VECTOR_BRANCH_VARIABLE(type, name) std::vector< type > name;
 
-#define ADD_SIMPLE_TREE_BRANCH(name) AddSimpleBranch(#name, _##name);
-#define ADD_SIMPLE_DATA_TREE_BRANCH(name) AddSimpleBranch(#name, data.name);
-#define ADD_VECTOR_TREE_BRANCH(name) AddVectorBranch(#name, _##name);
-#define ADD_VECTOR_DATA_TREE_BRANCH(name) AddVectorBranch(#name, data.name);
+#define ADD_SIMPLE_TREE_BRANCH(name) AddSimpleBranch(#name, _##name, _##name##_handle);
+#define ADD_SIMPLE_DATA_TREE_BRANCH(name) AddSimpleBranch(#name, _data.name, _##name##_handle);
+#define ADD_VECTOR_TREE_BRANCH(name) AddVectorBranch(#name, _##name, _##name##_handle);
+#define ADD_VECTOR_DATA_TREE_BRANCH(name) AddVectorBranch(#name, _data.name, _##name##_handle);
+
+#define DECLARE_SIMPLE_COLUMN_VARIABLE(type, name) std::vector< type > name;
+#define DECLARE_VECTOR_COLUMN_VARIABLE(type, name) std::vector< type > name; std::vector< UInt_t > name##_size;
+
+#define SIMPLE_COLUMN_TREE_BRANCH(type, name) \
+    BRANCH_HANDLE(name) \
+    std::vector< type >& name() { ACCESS_BRANCH(name) return _data.name; }
+
+#define VECTOR_COLUMN_TREE_BRANCH(type, name) \
+    BRANCH_HANDLE(name) \
+    BRANCH_HANDLE(name##_size) \
+    std::vector< type >& name() { ACCESS_BRANCH(name) return _data.name; } \
+    std::vector< UInt_t >& name##_size() { ACCESS_BRANCH(name##_size) return _data.name##_size; }
+
+#define ADD_SIMPLE_COLUMN_TREE_BRANCH(name) AddVectorBranch(#name, _data.name, _##name##_handle);
+#define ADD_VECTOR_COLUMN_TREE_BRANCH(name) \
+    AddVectorBranch(#name, _data.name, _##name##_handle); \
+    AddVectorBranch(#name "_size", _data.name##_size, _##name##_size_handle);
+
+#define APPEND_SIMPLE_COLUMN_VALUE(name) root_ext::detail::AppendSimpleColumnValue(object.name, columns.name);
+#define APPEND_VECTOR_COLUMN_VALUE(name) \
+    root_ext::detail::AppendVectorColumnValue(object.name, columns.name, columns.name##_size);
+
+#define EXTRACT_SIMPLE_COLUMN(name) \
+    root_ext::detail::ExtractSimpleColumn(columns.name, objects, first, &DataClass::name);
+#define EXTRACT_VECTOR_COLUMN(name) \
+    root_ext::detail::ExtractVectorColumn(columns.name, columns.name##_size, objects, first, &DataClass::name);
+
+/// Defines AppendToColumns function that adds an object to the columnar layout, where all objects of an event are
+/// stored in a single tree entry.
+#define COLUMNS_APPEND_FUNCTION(namespace_name, data_class_name, columns_class_name, data_macro) \
+    namespace namespace_name { \
+        inline void AppendToColumns(const data_class_name& object, columns_class_name& columns) \
+        { \
+            data_macro() \
+        } \
+    } \
+    /**/
+
+/// Defines ExtractFromColumns function that appends all objects stored in the columnar layout to the vector.
+#define COLUMNS_EXTRACT_FUNCTION(namespace_name, data_class_name, columns_class_name, data_macro) \
+    namespace namespace_name { \
+        inline void ExtractFromColumns(const columns_class_name& columns, std::vector< data_class_name >& objects) \
+        { \
+            typedef data_class_name DataClass; \
+            const size_t first = objects.size(); \
+            data_macro() \
+        } \
+    } \
+    /**/
 
 #define DATA_CLASS(namespace_name, class_name, data_macro) \
     namespace namespace_name { \
@@ -71,7 +135,10 @@ public:  std::vector< type >& name() { return _##name; }
             : SmartTree(Name(), directory, readMode) { Initialize(); } \
         tree_class_name(const std::string& name, TDirectory* directory, bool readMode) \
             : SmartTree(name, directory, readMode) { Initialize(); } \
-        data_class_name data; \
+        data_class_name& data() { PrepareDataAccess(); return _data; } \
+    private: \
+        data_class_name _data; \
+    public: \
         data_macro() \
     private: \
         inline void Initialize(); \
@@ -89,7 +156,10 @@ public:  std::vector< type >& name() { return _##name; }
             : SmartTree(Name(), directory, readMode) { Initialize(); } \
         tree_class_name(const std::string& name, TDirectory* directory, bool readMode) \
             : SmartTree(name, directory, readMode) { Initialize(); } \
-        data_class_name data; \
+        data_class_name& data() { PrepareDataAccess(); return _data; } \
+    private: \
+        data_class_name _data; \
+    public: \
         SIMPLE_TREE_BRANCH(UInt_t, RunId) \
         SIMPLE_TREE_BRANCH(UInt_t, LumiBlock) \
         SIMPLE_TREE_BRANCH(UInt_t, EventId) \
@@ -139,12 +209,109 @@ namespace detail {
     struct BaseDataClass {
         virtual ~BaseDataClass() {}
     };
+
+    /// Read position of a tree that is shared by all its branch handles.
+    struct ReadState {
+        Long64_t entry;
+        bool lazyLoading;
+        ReadState() : entry(-1), lazyLoading(false) {}
+    };
+
+    /// State of a single branch in the read mode. It is resolved once, when the branch is added to the tree, and is
+    /// checked by the generated accessor on each access.
+    class BranchHandle {
+    public:
+        BranchHandle() : branch(nullptr), readState(nullptr), loadedEntry(-1), disabled(false), used(false) {}
+
+        /// Throws if the branch is disabled, marks it as used and, in the lazy mode, reads the current entry of the
+        /// branch if it isn't read yet.
+        void Access()
+        {
+            if(disabled)
+                ThrowDisabled();
+            used = true;
+            if(readState && readState->lazyLoading)
+                Load();
+        }
+
+        void Load()
+        {
+            if(!branch || disabled || loadedEntry == readState->entry) return;
+            branch->GetEntry(readState->entry);
+            loadedEntry = readState->entry;
+        }
+
+    private:
+        void ThrowDisabled() const
+        {
+            std::ostringstream ss;
+            ss << "Branch '" << name << "' is disabled by the branch whitelist.";
+            throw std::runtime_error(ss.str());
+        }
+
+    public:
+        std::string name;
+        TBranch* branch;
+        const ReadState* readState;
+        Long64_t loadedEntry;
+        bool disabled, used;
+    };
+
+    template<typename DataType>
+    inline void AppendSimpleColumnValue(const DataType& value, std::vector<DataType>& column)
+    {
+        column.push_back(value);
+    }
+
+    template<typename DataType>
+    inline void AppendVectorColumnValue(const std::vector<DataType>& value, std::vector<DataType>& column,
+                                        std::vector<UInt_t>& sizes)
+    {
+        column.insert(column.end(), value.begin(), value.end());
+        sizes.push_back(value.size());
+    }
+
+    template<typename Object>
+    inline void ResizeForColumn(std::vector<Object>& objects, size_t first, size_t column_size)
+    {
+        if(objects.size() == first)
+            objects.resize(first + column_size);
+        else if(objects.size() != first + column_size)
+            throw std::runtime_error("Inconsistent column sizes.");
+    }
+
+    template<typename Object, typename DataType>
+    inline void ExtractSimpleColumn(const std::vector<DataType>& column, std::vector<Object>& objects, size_t first,
+                                    DataType Object::*member)
+    {
+        ResizeForColumn(objects, first, column.size());
+        for(size_t n = 0; n < column.size(); ++n)
+            objects[first + n].*member = column[n];
+    }
+
+    template<typename Object, typename DataType>
+    inline void ExtractVectorColumn(const std::vector<DataType>& column, const std::vector<UInt_t>& sizes,
+                                    std::vector<Object>& objects, size_t first, std::vector<DataType> Object::*member)
+    {
+        ResizeForColumn(objects, first, sizes.size());
+        size_t offset = 0;
+        for(size_t n = 0; n < sizes.size(); ++n) {
+            if(offset + sizes[n] > column.size())
+                throw std::runtime_error("Inconsistent column sizes.");
+            std::vector<DataType>& value = objects[first + n].*member;
+            value.assign(column.begin() + offset, column.begin() + offset + sizes[n]);
+            offset += sizes[n];
+        }
+        if(offset != column.size())
+            throw std::runtime_error("Inconsistent column sizes.");
+    }
 } // detail
 
 class SmartTree {
 public:
     SmartTree(const std::string& _name, TDirectory* _directory, bool _readMode)
-        : name(_name), directory(_directory), readMode(_readMode)
+        : name(_name), directory(_directory), readMode(_readMode), readState(new detail::ReadState()),
+          n_disabled(0), requiredBranchesDeclared(false), fullDataAccessed(false)
     {
         static const Long64_t maxVirtualSize = 10000000;
 
@@ -171,6 +338,11 @@ public:
         entries = other.entries;
         readMode = other.readMode;
         tree = other.tree;
+        branches = other.branches;
+        readState = other.readState;
+        n_disabled = other.n_disabled;
+        requiredBranchesDeclared = other.requiredBranchesDeclared;
+        fullDataAccessed = other.fullDataAccessed;
     }
 
     virtual ~SmartTree()
@@ -188,23 +360,162 @@ public:
 
     Long64_t GetEntries() const { return tree->GetEntries(); }
     Long64_t GetReadEntry() const { return tree->GetReadEntry(); }
-    Int_t GetEntry(Long64_t entry) { return tree->GetEntry(entry); }
+    /// Reads all enabled branches. In the lazy mode only moves the tree to the entry: each branch is read on its first
+    /// access through the accessor or by data().
+    Int_t GetEntry(Long64_t entry)
+    {
+        readState->entry = entry;
+        if(readState->lazyLoading)
+            return tree->LoadTree(entry) < 0 ? 0 : 1;
+        return tree->GetEntry(entry);
+    }
+
+    /// Enables the lazy mode, see GetEntry.
+    void EnableLazyLoading()
+    {
+        if(!readMode)
+            throw std::runtime_error("Lazy loading is available only in the read mode.");
+        readState->lazyLoading = true;
+        readState->entry = tree->GetReadEntry();
+        for(auto& branch : branches)
+            branch.second.handle->loadedEntry = readState->entry;
+    }
+    /// Reads only the specified branch, which should be enabled.
+    Int_t GetBranchEntry(const std::string& branch_name, Long64_t entry)
+    {
+        TBranch* branch = tree->GetBranch(branch_name.c_str());
+        if(!branch) {
+            std::ostringstream ss;
+            ss << "Branch '" << branch_name << "' is not found.";
+            throw std::runtime_error(ss.str());
+        }
+        return branch->GetEntry(entry);
+    }
+
+    void EnableCache(Long64_t cacheSize)
+    {
+        static const Long64_t learnEntries = 10;
+        tree->SetCacheSize(cacheSize);
+        tree->SetCacheLearnEntries(learnEntries);
+    }
     void Write()
     {
         if(directory)
             directory->WriteTObject(tree, tree->GetName(), "WriteDelete");
     }
 
+    static std::set<std::string> ReadBranchWhitelist(const std::string& fileName)
+    {
+        std::ifstream f(fileName.c_str());
+        if(!f.is_open())
+            throw std::runtime_error("Unable to open branch whitelist file '" + fileName + "'.");
+        std::set<std::string> whitelist;
+        std::string line;
+        while(std::getline(f, line)) {
+            if(!line.size() || line.at(0) == '#') continue;
+            whitelist.insert(line);
+        }
+        return whitelist;
+    }
+
+    /// Names of the branches that have been accessed through the accessors or data(), i.e. the branch whitelist of
+    /// the reader, which can be produced by a profiling run.
+    std::set<std::string> GetUsedBranches() const
+    {
+        std::set<std::string> used;
+        for(const auto& branch : branches) {
+            if(branch.second.handle->used)
+                used.insert(branch.first);
+        }
+        return used;
+    }
+
+    /// Writes the branches used so far into a whitelist file that can be read by ReadBranchWhitelist.
+    void WriteBranchWhitelist(const std::string& fileName) const
+    {
+        std::ofstream f(fileName.c_str());
+        if(!f.is_open())
+            throw std::runtime_error("Unable to create branch whitelist file '" + fileName + "'.");
+        f << "# Branches of the tree '" << name << "' used by the profiling run.\n";
+        for(const std::string& branch_name : GetUsedBranches())
+            f << branch_name << "\n";
+    }
+
+    /// Disables all branches that are not in the whitelist, so they are not read by GetEntry, and resets their values.
+    /// Accessors of the disabled branches throw. requiredBranches are the branches that the reader accesses through
+    /// data(), i.e. bypassing the accessors: the method throws if any of them is not in the whitelist. Once branches
+    /// are disabled, data() throws unless the required branches were declared. Returns the number of the disabled
+    /// branches.
+    size_t ApplyBranchWhitelist(const std::set<std::string>& whitelist,
+                                const std::set<std::string>& requiredBranches = std::set<std::string>())
+    {
+        if(!readMode)
+            throw std::runtime_error("Branch whitelist is available only in the read mode.");
+        CheckBranchNames(whitelist, "the whitelist");
+        CheckBranchNames(requiredBranches, "the required branches");
+        for(const std::string& branch_name : requiredBranches) {
+            if(!whitelist.count(branch_name)) {
+                std::ostringstream ss;
+                ss << "Branch '" << branch_name << "' of the tree '" << name
+                   << "' is required by the reader, but it is not in the branch whitelist.";
+                throw std::runtime_error(ss.str());
+            }
+        }
+        size_t n_newly_disabled = 0;
+        for(auto& branch : branches) {
+            BranchState& state = branch.second;
+            if(whitelist.count(branch.first) || state.handle->disabled) continue;
+            if(state.handle->branch)
+                tree->SetBranchStatus(branch.first.c_str(), 0);
+            state.handle->disabled = true;
+            state.reset();
+            ++n_newly_disabled;
+        }
+        n_disabled += n_newly_disabled;
+        requiredBranchesDeclared = !requiredBranches.empty();
+        return n_newly_disabled;
+    }
+
+    size_t GetNumberOfBranches() const { return branches.size(); }
+
 protected:
+    /// Prepares the access to the data of all branches, which bypasses the accessors. If branches are disabled by the
+    /// whitelist, the access is allowed only if the branches required by the reader were declared in
+    /// ApplyBranchWhitelist. In the lazy mode, all enabled branches are read.
+    void PrepareDataAccess()
+    {
+        if(!readMode) return;
+        if(n_disabled && !requiredBranchesDeclared) {
+            std::ostringstream ss;
+            ss << n_disabled << " branches of the tree '" << name << "' are disabled by the branch whitelist, so "
+               << "its data can't be accessed directly. Use the branch accessors or declare the branches required by "
+               << "the reader in ApplyBranchWhitelist.";
+            throw std::runtime_error(ss.str());
+        }
+        if(fullDataAccessed && !readState->lazyLoading) return;
+        for(auto& branch : branches) {
+            detail::BranchHandle& handle = *branch.second.handle;
+            if(handle.disabled) continue;
+            handle.used = true;
+            if(readState->lazyLoading)
+                handle.Load();
+        }
+        fullDataAccessed = true;
+    }
+
     template<typename DataType>
-    void AddSimpleBranch(const std::string& branch_name, DataType& value)
+    void AddSimpleBranch(const std::string& branch_name, DataType& value, detail::BranchHandle& handle)
     {
         if(readMode) {
+            RegisterBranch(branch_name, handle, [&value]() { value = DataType(); });
             try {
                 EnableBranch(branch_name);
                 tree->SetBranchAddress(branch_name.c_str(), &value);
-                if(tree->GetReadEntry() >= 0)
-                    tree->GetBranch(branch_name.c_str())->GetEntry(tree->GetReadEntry());
+                handle.branch = tree->GetBranch(branch_name.c_str());
+                if(tree->GetReadEntry() >= 0) {
+                    handle.branch->GetEntry(tree->GetReadEntry());
+                    handle.loadedEntry = tree->GetReadEntry();
+                }
             } catch(std::runtime_error& error) {
                 std::cerr << "ERROR: " << error.what() << std::endl;
             }
@@ -217,7 +528,7 @@ protected:
     }
 
     template<typename DataType>
-    void AddVectorBranch(const std::string& branch_name, std::vector<DataType>& value)
+    void AddVectorBranch(const std::string& branch_name, std::vector<DataType>& value, detail::BranchHandle& handle)
     {
         typedef detail::SmartTreeVectorPtrEntry<DataType> PtrEntry;
         auto entry = std::shared_ptr<PtrEntry>( new PtrEntry(value) );
@@ -225,11 +536,15 @@ protected:
             throw std::runtime_error("Entry is already defined.");
         entries[branch_name] = entry;
         if(readMode) {
+            RegisterBranch(branch_name, handle, [&value]() { value.clear(); });
             try {
                 EnableBranch(branch_name);
                 tree->SetBranchAddress(branch_name.c_str(), &entry->value);
-                if(tree->GetReadEntry() >= 0)
-                    tree->GetBranch(branch_name.c_str())->GetEntry(tree->GetReadEntry());
+                handle.branch = tree->GetBranch(branch_name.c_str());
+                if(tree->GetReadEntry() >= 0) {
+                    handle.branch->GetEntry(tree->GetReadEntry());
+                    handle.loadedEntry = tree->GetReadEntry();
+                }
             } catch(std::runtime_error& error) {
                 std::cerr << "ERROR: " << error.what() << std::endl;
             }
@@ -253,14 +568,44 @@ protected:
     }
 
 private:
+    struct BranchState {
+        detail::BranchHandle* handle;
+        std::function<void()> reset;
+    };
+
     SmartTree(const SmartTree& other) { throw std::runtime_error("Can't copy a smart tree"); }
 
+    void RegisterBranch(const std::string& branch_name, detail::BranchHandle& handle,
+                        const std::function<void()>& reset)
+    {
+        handle.name = branch_name;
+        handle.readState = readState.get();
+        const BranchState state = { &handle, reset };
+        branches[branch_name] = state;
+    }
+
+    void CheckBranchNames(const std::set<std::string>& branch_names, const std::string& source) const
+    {
+        for(const std::string& branch_name : branch_names) {
+            if(!branches.count(branch_name)) {
+                std::ostringstream ss;
+                ss << "Branch '" << branch_name << "' from " << source << " is not defined for the tree '" << name
+                   << "'.";
+                throw std::runtime_error(ss.str());
+            }
+        }
+    }
+
 private:
     std::string name;
     TDirectory* directory;
     std::map< std::string, std::shared_ptr<detail::BaseSmartTreeEntry> > entries;
     bool readMode;
     TTree* tree;
+    std::map<std::string, BranchState> branches;
+    std::shared_ptr<detail::ReadState> readState;
+    size_t n_disabled;
+    bool requiredBranchesDeclared, fullDataAccessed;
 };
 
 } // root_ext
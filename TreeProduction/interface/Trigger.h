@@ -1,6 +1,6 @@
 /*!
  * \file Trigger.h
- * \brief Definiton of ntuple::TriggerTree and ntuple::Trigger classes.
+ * \brief Definiton of ntuple::TriggerTree, ntuple::CompactTriggerTree and ntuple::Trigger classes.
  * \author Konstantin Androsov (University of Siena, INFN Pisa)
  * \author Maria Teresa Grippo (University of Siena, INFN Pisa)
  * \date 2014-03-25 created
@@ -26,7 +26,7 @@
 
 #pragma once
 
-#include "SmartTree.h"
+#include "TriggerPathTable.h"
 
 #define TRIGGER_DATA() \
     VECTOR_VAR(Bool_t, l1physbits) \
@@ -54,3 +54,71 @@ TREE_CLASS_WITH_EVENT_ID_INITIALIZE(ntuple, TriggerTree, TRIGGER_DATA)
 #undef SIMPLE_VAR
 #undef VECTOR_VAR
 #undef TRIGGER_DATA
+
+// Compact format: hltresults is a bitset over the indices of the paths in the path table of the run and
+// hltprescales is ordered as the path table.
+#define COMPACT_TRIGGER_DATA() \
+    VECTOR_VAR(Bool_t, l1physbits) \
+    VECTOR_VAR(Bool_t, l1techbits) \
+    VECTOR_VAR(ULong64_t, hltresults) \
+    VECTOR_VAR(UInt_t, hltprescales) \
+    /**/
+
+#define SIMPLE_VAR(type, name) DECLARE_SIMPLE_BRANCH_VARIABLE(type, name)
+#define VECTOR_VAR(type, name) DECLARE_VECTOR_BRANCH_VARIABLE(type, name)
+DATA_CLASS(ntuple, CompactTrigger, COMPACT_TRIGGER_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) SIMPLE_DATA_TREE_BRANCH(type, name)
+#define VECTOR_VAR(type, name) VECTOR_DATA_TREE_BRANCH(type, name)
+TREE_CLASS_WITH_EVENT_ID(ntuple, CompactTriggerTree, COMPACT_TRIGGER_DATA, CompactTrigger, "compactTriggers", false)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) ADD_SIMPLE_DATA_TREE_BRANCH(name)
+#define VECTOR_VAR(type, name) ADD_VECTOR_DATA_TREE_BRANCH(name)
+TREE_CLASS_WITH_EVENT_ID_INITIALIZE(ntuple, CompactTriggerTree, COMPACT_TRIGGER_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+#undef COMPACT_TRIGGER_DATA
+
+namespace ntuple {
+/// Converts the trigger information of an event into the compact format. All events of a run should have the same
+/// list of paths, which becomes the path table of the run. Throws if the list of paths changes within a run, because
+/// the events that are already converted refer to all paths of the table.
+inline void ConvertToCompact(const Trigger& trigger, UInt_t run, TriggerPathTableBuilder& pathTables,
+                             CompactTrigger& compact)
+{
+    if(trigger.hltresults.size() != trigger.hltpaths.size() || trigger.hltprescales.size() != trigger.hltpaths.size())
+        throw std::runtime_error("Inconsistent trigger information: numbers of the trigger paths, results and"
+                                 " prescales are different.");
+    pathTables.SetPaths(run, trigger.hltpaths);
+    compact.l1physbits = trigger.l1physbits;
+    compact.l1techbits = trigger.l1techbits;
+    compact.hltresults.clear();
+    for(size_t n = 0; n < trigger.hltpaths.size(); ++n) {
+        if(trigger.hltresults.at(n))
+            SetTriggerPathBit(compact.hltresults, n);
+    }
+    compact.hltprescales = trigger.hltprescales;
+}
+
+/// Restores the trigger information of an event stored in the compact format, given the path table of its run.
+inline void ExpandFromCompact(const CompactTrigger& compact, const TriggerPathTables::PathVector& paths,
+                              TriggerVector& triggers)
+{
+    if(compact.hltprescales.size() != paths.size())
+        throw std::runtime_error("Inconsistent compact trigger information: number of prescales doesn't match the"
+                                 " size of the trigger path table.");
+    triggers.push_back(Trigger());
+    Trigger& trigger = triggers.back();
+    trigger.l1physbits = compact.l1physbits;
+    trigger.l1techbits = compact.l1techbits;
+    trigger.hltpaths = paths;
+    trigger.hltresults.reserve(paths.size());
+    for(size_t n = 0; n < paths.size(); ++n)
+        trigger.hltresults.push_back(TestTriggerPathBit(compact.hltresults, n));
+    trigger.hltprescales = compact.hltprescales;
+}
+} // ntuple
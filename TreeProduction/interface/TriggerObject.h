@@ -1,6 +1,7 @@
 /*!
  * \file TriggerObject.h
- * \brief Definiton of ntuple::TriggerObjectTree and ntuple::TriggerObject classes.
+ * \brief Definiton of ntuple::TriggerObjectTree, ntuple::TriggerObjectColumnsTree,
+ *        ntuple::CompactTriggerObjectColumnsTree and ntuple::TriggerObject classes.
  * \author Konstantin Androsov (University of Siena, INFN Pisa)
  * \author Maria Teresa Grippo (University of Siena, INFN Pisa)
  * \date 2014-03-25 created
@@ -26,7 +27,9 @@
 
 #pragma once
 
-#include "SmartTree.h"
+#include <algorithm>
+
+#include "TriggerPathTable.h"
 
 #define TRIGGER_OBJECT_DATA() \
     SIMPLE_VAR(Float_t, pt) \
@@ -55,4 +58,137 @@ TREE_CLASS_WITH_EVENT_ID(ntuple, TriggerObjectTree, TRIGGER_OBJECT_DATA, Trigger
 TREE_CLASS_WITH_EVENT_ID_INITIALIZE(ntuple, TriggerObjectTree, TRIGGER_OBJECT_DATA)
 #undef SIMPLE_VAR
 #undef VECTOR_VAR
+
+// Columnar layout: all trigger objects of an event are stored in a single entry, one vector per variable.
+#define SIMPLE_VAR(type, name) DECLARE_SIMPLE_COLUMN_VARIABLE(type, name)
+#define VECTOR_VAR(type, name) DECLARE_VECTOR_COLUMN_VARIABLE(type, name)
+DATA_CLASS(ntuple, TriggerObjectColumns, TRIGGER_OBJECT_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) SIMPLE_COLUMN_TREE_BRANCH(type, name)
+#define VECTOR_VAR(type, name) VECTOR_COLUMN_TREE_BRANCH(type, name)
+TREE_CLASS_WITH_EVENT_ID(ntuple, TriggerObjectColumnsTree, TRIGGER_OBJECT_DATA, TriggerObjectColumns,
+                         "triggerObjectColumns", false)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) ADD_SIMPLE_COLUMN_TREE_BRANCH(name)
+#define VECTOR_VAR(type, name) ADD_VECTOR_COLUMN_TREE_BRANCH(name)
+TREE_CLASS_WITH_EVENT_ID_INITIALIZE(ntuple, TriggerObjectColumnsTree, TRIGGER_OBJECT_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) APPEND_SIMPLE_COLUMN_VALUE(name)
+#define VECTOR_VAR(type, name) APPEND_VECTOR_COLUMN_VALUE(name)
+COLUMNS_APPEND_FUNCTION(ntuple, TriggerObject, TriggerObjectColumns, TRIGGER_OBJECT_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) EXTRACT_SIMPLE_COLUMN(name)
+#define VECTOR_VAR(type, name) EXTRACT_VECTOR_COLUMN(name)
+COLUMNS_EXTRACT_FUNCTION(ntuple, TriggerObject, TriggerObjectColumns, TRIGGER_OBJECT_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
 #undef TRIGGER_OBJECT_DATA
+
+// Compact format, always in the columnar layout: pathBits and pathValueBits are bitsets over the indices of the paths
+// in the trigger object path table of the run.
+#define COMPACT_TRIGGER_OBJECT_DATA() \
+    SIMPLE_VAR(Float_t, pt) \
+    SIMPLE_VAR(Float_t, eta) \
+    SIMPLE_VAR(Float_t, phi) \
+    SIMPLE_VAR(Float_t, mass) \
+    SIMPLE_VAR(Int_t, pdgId) \
+    VECTOR_VAR(ULong64_t, pathBits) \
+    VECTOR_VAR(ULong64_t, pathValueBits) \
+    /**/
+
+#define SIMPLE_VAR(type, name) DECLARE_SIMPLE_BRANCH_VARIABLE(type, name)
+#define VECTOR_VAR(type, name) DECLARE_VECTOR_BRANCH_VARIABLE(type, name)
+DATA_CLASS(ntuple, CompactTriggerObject, COMPACT_TRIGGER_OBJECT_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) DECLARE_SIMPLE_COLUMN_VARIABLE(type, name)
+#define VECTOR_VAR(type, name) DECLARE_VECTOR_COLUMN_VARIABLE(type, name)
+DATA_CLASS(ntuple, CompactTriggerObjectColumns, COMPACT_TRIGGER_OBJECT_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) SIMPLE_COLUMN_TREE_BRANCH(type, name)
+#define VECTOR_VAR(type, name) VECTOR_COLUMN_TREE_BRANCH(type, name)
+TREE_CLASS_WITH_EVENT_ID(ntuple, CompactTriggerObjectColumnsTree, COMPACT_TRIGGER_OBJECT_DATA,
+                         CompactTriggerObjectColumns, "compactTriggerObjects", false)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) ADD_SIMPLE_COLUMN_TREE_BRANCH(name)
+#define VECTOR_VAR(type, name) ADD_VECTOR_COLUMN_TREE_BRANCH(name)
+TREE_CLASS_WITH_EVENT_ID_INITIALIZE(ntuple, CompactTriggerObjectColumnsTree, COMPACT_TRIGGER_OBJECT_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) APPEND_SIMPLE_COLUMN_VALUE(name)
+#define VECTOR_VAR(type, name) APPEND_VECTOR_COLUMN_VALUE(name)
+COLUMNS_APPEND_FUNCTION(ntuple, CompactTriggerObject, CompactTriggerObjectColumns, COMPACT_TRIGGER_OBJECT_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) EXTRACT_SIMPLE_COLUMN(name)
+#define VECTOR_VAR(type, name) EXTRACT_VECTOR_COLUMN(name)
+COLUMNS_EXTRACT_FUNCTION(ntuple, CompactTriggerObject, CompactTriggerObjectColumns, COMPACT_TRIGGER_OBJECT_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+#undef COMPACT_TRIGGER_OBJECT_DATA
+
+namespace ntuple {
+inline void ConvertToCompact(const TriggerObject& triggerObject, UInt_t run, TriggerPathTableBuilder& pathTables,
+                             CompactTriggerObject& compact)
+{
+    compact.pt = triggerObject.pt;
+    compact.eta = triggerObject.eta;
+    compact.phi = triggerObject.phi;
+    compact.mass = triggerObject.mass;
+    compact.pdgId = triggerObject.pdgId;
+    compact.pathBits.clear();
+    compact.pathValueBits.clear();
+    for(size_t n = 0; n < triggerObject.pathNames.size(); ++n) {
+        const size_t index = pathTables.GetIndex(run, triggerObject.pathNames.at(n));
+        SetTriggerPathBit(compact.pathBits, index);
+        if(triggerObject.pathValues.at(n))
+            SetTriggerPathBit(compact.pathValueBits, index);
+    }
+}
+
+/// Restores the trigger objects of an event stored in the compact format, given the path table of its run.
+/// The path names of each object are sorted, as they are in TriggerObjectTree.
+inline void ExpandFromCompact(const CompactTriggerObjectColumns& columns, const TriggerPathTables::PathVector& paths,
+                              TriggerObjectVector& triggerObjects)
+{
+    CompactTriggerObjectVector compactObjects;
+    ExtractFromColumns(columns, compactObjects);
+    std::vector<size_t> indices;
+    for(const CompactTriggerObject& compact : compactObjects) {
+        triggerObjects.push_back(TriggerObject());
+        TriggerObject& triggerObject = triggerObjects.back();
+        triggerObject.pt = compact.pt;
+        triggerObject.eta = compact.eta;
+        triggerObject.phi = compact.phi;
+        triggerObject.mass = compact.mass;
+        triggerObject.pdgId = compact.pdgId;
+
+        indices.clear();
+        for(size_t n = 0; n < paths.size(); ++n) {
+            if(TestTriggerPathBit(compact.pathBits, n))
+                indices.push_back(n);
+        }
+        std::sort(indices.begin(), indices.end(),
+                  [&](size_t a, size_t b) { return paths.at(a) < paths.at(b); });
+        for(size_t n : indices) {
+            triggerObject.pathNames.push_back(paths.at(n));
+            triggerObject.pathValues.push_back(TestTriggerPathBit(compact.pathValueBits, n));
+        }
+    }
+}
+} // ntuple
@@ -0,0 +1,212 @@
+/*!
+ * \file TriggerPathTable.h
+ * \brief Definiton of ntuple::TriggerPathTable class and of the tools to store trigger paths in the compact format.
+ * \author Konstantin Androsov (University of Siena, INFN Pisa)
+ *
+ * Copyright 2015 Konstantin Androsov <konstantin.androsov@gmail.com>
+ *
+ * This file is part of X->HH->bbTauTau.
+ *
+ * X->HH->bbTauTau is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * X->HH->bbTauTau is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with X->HH->bbTauTau.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "SmartTree.h"
+
+// In the compact format the names of the trigger paths are stored once per run in a path table, while the events
+// and the trigger objects refer to the paths by their index in the table of the run.
+#define TRIGGER_PATH_TABLE_DATA() \
+    SIMPLE_VAR(UInt_t, run) \
+    VECTOR_VAR(std::string, paths) \
+    /**/
+
+#define SIMPLE_VAR(type, name) DECLARE_SIMPLE_BRANCH_VARIABLE(type, name)
+#define VECTOR_VAR(type, name) DECLARE_VECTOR_BRANCH_VARIABLE(type, name)
+DATA_CLASS(ntuple, TriggerPathTable, TRIGGER_PATH_TABLE_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) SIMPLE_DATA_TREE_BRANCH(type, name)
+#define VECTOR_VAR(type, name) VECTOR_DATA_TREE_BRANCH(type, name)
+TREE_CLASS(ntuple, TriggerPathTableTree, TRIGGER_PATH_TABLE_DATA, TriggerPathTable, "triggerPathTables", false)
+TREE_CLASS(ntuple, TriggerObjectPathTableTree, TRIGGER_PATH_TABLE_DATA, TriggerPathTable, "triggerObjectPathTables",
+           false)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+
+#define SIMPLE_VAR(type, name) ADD_SIMPLE_DATA_TREE_BRANCH(name)
+#define VECTOR_VAR(type, name) ADD_VECTOR_DATA_TREE_BRANCH(name)
+TREE_CLASS_INITIALIZE(ntuple, TriggerPathTableTree, TRIGGER_PATH_TABLE_DATA)
+TREE_CLASS_INITIALIZE(ntuple, TriggerObjectPathTableTree, TRIGGER_PATH_TABLE_DATA)
+#undef SIMPLE_VAR
+#undef VECTOR_VAR
+#undef TRIGGER_PATH_TABLE_DATA
+
+namespace ntuple {
+
+typedef ULong64_t TriggerPathBitsWord;
+typedef std::vector<TriggerPathBitsWord> TriggerPathBits;
+
+inline void SetTriggerPathBit(TriggerPathBits& bits, size_t index)
+{
+    static const size_t wordSize = 8 * sizeof(TriggerPathBitsWord);
+    const size_t n = index / wordSize;
+    if(n >= bits.size())
+        bits.resize(n + 1, 0);
+    bits.at(n) |= TriggerPathBitsWord(1) << (index % wordSize);
+}
+
+inline bool TestTriggerPathBit(const TriggerPathBits& bits, size_t index)
+{
+    static const size_t wordSize = 8 * sizeof(TriggerPathBitsWord);
+    const size_t n = index / wordSize;
+    return n < bits.size() && ((bits.at(n) >> (index % wordSize)) & 1);
+}
+
+/// Path tables of all runs of an input file.
+class TriggerPathTables {
+public:
+    typedef std::vector<std::string> PathVector;
+
+    template<typename PathTableTree>
+    void Read(TDirectory* directory)
+    {
+        tables.clear();
+        PathTableTree tree(directory, true);
+        for(Long64_t n = 0; n < tree.GetEntries(); ++n) {
+            if(tree.GetEntry(n) < 0)
+                throw std::runtime_error("An I/O error while reading tree.");
+            const auto iter = tables.find(tree.data().run);
+            if(iter == tables.end())
+                tables[tree.data().run] = tree.data().paths;
+            else if(iter->second != tree.data().paths) {
+                std::ostringstream ss;
+                ss << "Inconsistent trigger path tables for run " << tree.data().run << " in '"
+                   << PathTableTree::Name() << "'.";
+                throw std::runtime_error(ss.str());
+            }
+        }
+    }
+
+    const PathVector& Get(UInt_t run) const
+    {
+        const auto iter = tables.find(run);
+        if(iter == tables.end()) {
+            std::ostringstream ss;
+            ss << "Trigger path table for run " << run << " not found.";
+            throw std::runtime_error(ss.str());
+        }
+        return iter->second;
+    }
+
+private:
+    std::map<UInt_t, PathVector> tables;
+};
+
+/// Assigns indices to the trigger paths of each run while the trigger information is written in the compact format.
+/// A path that is seen for the first time in a run is appended to the table of the run, so the indices that are
+/// already stored never change. The table of a run can instead be set as a whole with SetPaths, if the stored data
+/// refer to all paths of the table (e.g. the prescales of the events). Such a table can't change anymore.
+/// The tables of all runs are written at the end of the job.
+class TriggerPathTableBuilder {
+public:
+    typedef std::vector<std::string> PathVector;
+
+    size_t GetIndex(UInt_t run, const std::string& path)
+    {
+        Table& table = tables[run];
+        const auto iter = table.indices.find(path);
+        if(iter != table.indices.end())
+            return iter->second;
+        if(table.isComplete) {
+            std::ostringstream ss;
+            ss << "Trigger path '" << path << "' is not in the complete path table of run " << run << ".";
+            throw std::runtime_error(ss.str());
+        }
+        const size_t index = table.paths.size();
+        table.paths.push_back(path);
+        table.indices[path] = index;
+        return index;
+    }
+
+    /// Sets the complete path table of the run. Throws if the run already has a different table.
+    void SetPaths(UInt_t run, const PathVector& paths)
+    {
+        const auto iter = tables.find(run);
+        if(iter != tables.end()) {
+            if(iter->second.isComplete && iter->second.paths == paths) return;
+            std::ostringstream ss;
+            ss << "Trigger paths of run " << run << " differ from the path table that is already used for this run.";
+            throw std::runtime_error(ss.str());
+        }
+        Table& table = tables[run];
+        table.paths = paths;
+        for(size_t n = 0; n < paths.size(); ++n) {
+            if(!table.indices.insert(std::make_pair(paths.at(n), n)).second) {
+                tables.erase(run);
+                std::ostringstream ss;
+                ss << "Trigger path '" << paths.at(n) << "' appears more than once in run " << run << ".";
+                throw std::runtime_error(ss.str());
+            }
+        }
+        table.isComplete = true;
+    }
+
+    size_t GetNumberOfPaths(UInt_t run) const
+    {
+        const auto iter = tables.find(run);
+        return iter == tables.end() ? 0 : iter->second.paths.size();
+    }
+
+    const PathVector& GetPaths(UInt_t run) const
+    {
+        const auto iter = tables.find(run);
+        if(iter == tables.end()) {
+            std::ostringstream ss;
+            ss << "Trigger path table for run " << run << " not found.";
+            throw std::runtime_error(ss.str());
+        }
+        return iter->second.paths;
+    }
+
+    template<typename PathTableTree>
+    void Write(TDirectory* directory) const
+    {
+        PathTableTree tree(directory, false);
+        for(const auto& table : tables) {
+            tree.run() = table.first;
+            tree.paths() = table.second.paths;
+            tree.Fill();
+        }
+        tree.Write();
+    }
+
+private:
+    struct Table {
+        PathVector paths;
+        std::unordered_map<std::string, size_t> indices;
+        bool isComplete;
+        Table() : isComplete(false) {}
+    };
+
+    std::map<UInt_t, Table> tables;
+};
+
+} // ntuple
@@ -55,23 +55,42 @@
 class PFCandBlock : public edm::EDAnalyzer {
 public:
     explicit PFCandBlock(const edm::ParameterSet& iConfig) :
-        _inputTag(iConfig.getParameter<edm::InputTag>("srcPFCandidates")),
-        pfCandTree(&edm::Service<TFileService>()->file(), false) {}
+        _inputTag(iConfig.getParameter<edm::InputTag>("srcPFCandidates"))
+    {
+        TFile& file = edm::Service<TFileService>()->file();
+        if(iConfig.getParameter<bool>("columnarLayout"))
+            pfCandColumnsTree = std::shared_ptr<ntuple::PFCandColumnsTree>(
+                        new ntuple::PFCandColumnsTree(&file, false));
+        else
+            pfCandTree = std::shared_ptr<ntuple::PFCandTree>(new ntuple::PFCandTree(&file, false));
+    }
 
 private:
-    virtual void endJob() { pfCandTree.Write(); }
+    virtual void endJob()
+    {
+        if(pfCandTree) pfCandTree->Write();
+        if(pfCandColumnsTree) pfCandColumnsTree->Write();
+    }
     virtual void analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup);
 
+    template<typename Tree>
+    static void SetEventId(Tree& tree, const edm::Event& iEvent)
+    {
+        tree.RunId() = iEvent.id().run();
+        tree.LumiBlock() = iEvent.id().luminosityBlock();
+        tree.EventId() = iEvent.id().event();
+    }
+
 private:
     edm::InputTag _inputTag;
-    ntuple::PFCandTree pfCandTree;
+    std::shared_ptr<ntuple::PFCandTree> pfCandTree;
+    std::shared_ptr<ntuple::PFCandColumnsTree> pfCandColumnsTree;
 };
 
 void PFCandBlock::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 {
-    pfCandTree.RunId() = iEvent.id().run();
-    pfCandTree.LumiBlock() = iEvent.id().luminosityBlock();
-    pfCandTree.EventId() = iEvent.id().event();
+    if(pfCandTree) SetEventId(*pfCandTree, iEvent);
+    if(pfCandColumnsTree) SetEventId(*pfCandColumnsTree, iEvent);
 
     edm::Handle<reco::PFCandidateCollection> pfCandHandle;
     iEvent.getByLabel(_inputTag, pfCandHandle);
@@ -84,26 +103,36 @@ void PFCandBlock::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetu
 
     for (const reco::PFCandidate& PFCand : *pfCandidates) {
         // Store Tau variables
-        pfCandTree.eta()    = PFCand.eta();
-        pfCandTree.phi()    = PFCand.phi();
-        pfCandTree.pt()     = PFCand.pt();
-        pfCandTree.mass() = PFCand.mass();
-        pfCandTree.charge() = PFCand.charge();
+        ntuple::PFCand candidate;
+        candidate.eta    = PFCand.eta();
+        candidate.phi    = PFCand.phi();
+        candidate.pt     = PFCand.pt();
+        candidate.mass = PFCand.mass();
+        candidate.charge = PFCand.charge();
 
         const reco::TrackBase* track = nullptr;
         if(PFCand.trackRef().isNonnull()) track = PFCand.trackRef().get();
         else if(PFCand.gsfTrackRef().isNonnull()) track = PFCand.gsfTrackRef().get();
 
-        pfCandTree.haveTrackInfo() = track != nullptr;
+        candidate.haveTrackInfo = track != nullptr;
+        candidate.trk_vx = candidate.trk_vy = candidate.trk_vz = 0;
         if(track) {
             const reco::TrackBase::Point& trk_vertex = track->vertex();
-            pfCandTree.trk_vx() = trk_vertex.x();
-            pfCandTree.trk_vy() = trk_vertex.y();
-            pfCandTree.trk_vz() = trk_vertex.z();
+            candidate.trk_vx = trk_vertex.x();
+            candidate.trk_vy = trk_vertex.y();
+            candidate.trk_vz = trk_vertex.z();
         }
 
-        pfCandTree.Fill();
+        if(pfCandTree) {
+            pfCandTree->data() = candidate;
+            pfCandTree->Fill();
+        } else
+            ntuple::AppendToColumns(candidate, pfCandColumnsTree->data());
     }
+
+    // In the columnar layout there is exactly one entry per event, even if the event has no candidates.
+    if(pfCandColumnsTree)
+        pfCandColumnsTree->Fill();
 }
 
 #include "FWCore/Framework/interface/MakerMacros.h"
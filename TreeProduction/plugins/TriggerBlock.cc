@@ -66,14 +66,36 @@ public:
       _verbosity(iConfig.getParameter<int>("verbosity")),
       _l1InputTag(iConfig.getParameter<edm::InputTag>("l1InputTag")),
       _hltInputTag(iConfig.getParameter<edm::InputTag>("hltInputTag")),
-      _hltPathsOfInterest(iConfig.getParameter<std::vector<std::string> > ("hltPathsOfInterest")),
-      triggerTree(&edm::Service<TFileService>()->file(), false) {}
+      _hltPathsOfInterest(iConfig.getParameter<std::vector<std::string> > ("hltPathsOfInterest"))
+    {
+        TFile& file = edm::Service<TFileService>()->file();
+        if(iConfig.getParameter<bool>("compactFormat"))
+            compactTriggerTree = std::shared_ptr<ntuple::CompactTriggerTree>(
+                        new ntuple::CompactTriggerTree(&file, false));
+        else
+            triggerTree = std::shared_ptr<ntuple::TriggerTree>(new ntuple::TriggerTree(&file, false));
+    }
 
 private:
     virtual void beginRun(edm::Run const& iRun, edm::EventSetup const& iSetup);
-    virtual void endJob() { triggerTree.Write(); }
+    virtual void endJob()
+    {
+        if(triggerTree) triggerTree->Write();
+        if(compactTriggerTree) {
+            compactTriggerTree->Write();
+            pathTables.Write<ntuple::TriggerPathTableTree>(&edm::Service<TFileService>()->file());
+        }
+    }
     virtual void analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup);
 
+    template<typename Tree>
+    static void SetEventId(Tree& tree, const edm::Event& iEvent)
+    {
+        tree.RunId() = iEvent.id().run();
+        tree.LumiBlock() = iEvent.id().luminosityBlock();
+        tree.EventId() = iEvent.id().event();
+    }
+
 
 private:
   int _verbosity;
@@ -81,7 +103,9 @@ private:
   const edm::InputTag _hltInputTag;
   const std::vector<std::string> _hltPathsOfInterest;
   HLTConfigProvider hltConfig;
-  ntuple::TriggerTree triggerTree;
+  std::shared_ptr<ntuple::TriggerTree> triggerTree;
+  std::shared_ptr<ntuple::CompactTriggerTree> compactTriggerTree;
+  ntuple::TriggerPathTableBuilder pathTables;
 
 
 };
@@ -108,10 +132,9 @@ void TriggerBlock::beginRun(edm::Run const& iRun, edm::EventSetup const& iSetup)
 
 void TriggerBlock::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup) {
 
-    triggerTree.RunId() = iEvent.id().run();
-    triggerTree.LumiBlock() = iEvent.id().luminosityBlock();
-    triggerTree.EventId() = iEvent.id().event();
-
+    if(triggerTree) SetEventId(*triggerTree, iEvent);
+    if(compactTriggerTree) SetEventId(*compactTriggerTree, iEvent);
+    ntuple::Trigger trigger;
 
   edm::Handle<L1GlobalTriggerReadoutRecord> l1GtReadoutRecord;
   iEvent.getByLabel(_l1InputTag, l1GtReadoutRecord);
@@ -123,8 +146,8 @@ void TriggerBlock::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
     }
     edm::LogInfo("TriggerBlock") << "Successfully obtained L1GlobalTriggerReadoutRecord for label: "
                                  << _l1InputTag;
-    triggerTree.l1physbits() = l1GtReadoutRecord->decisionWord();
-    triggerTree.l1techbits() = l1GtReadoutRecord->technicalTriggerWord();
+    trigger.l1physbits = l1GtReadoutRecord->decisionWord();
+    trigger.l1techbits = l1GtReadoutRecord->technicalTriggerWord();
 
     edm::Handle<edm::TriggerResults> triggerResults;
     iEvent.getByLabel(_hltInputTag, triggerResults);
@@ -147,7 +170,7 @@ void TriggerBlock::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
         }
             if (!nmatch) continue;
         }
-        triggerTree.hltpaths().push_back(*it);
+        trigger.hltpaths.push_back(*it);
 
         bool fired = false;
         unsigned int index = hltConfig.triggerIndex(*it);
@@ -157,7 +180,7 @@ void TriggerBlock::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
         else {
             edm::LogInfo("TriggerBlock") << "Requested HLT path \"" << (*it) << "\" does not exist";
         }
-        triggerTree.hltresults().push_back(fired);
+        trigger.hltresults.push_back(fired);
 
         unsigned prescale = std::numeric_limits<unsigned>::max();
         if (hltConfig.prescaleSet(iEvent, iSetup) < 0) {
@@ -166,7 +189,7 @@ void TriggerBlock::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
         else {
             prescale = hltConfig.prescaleValue(iEvent, iSetup, *it);
         }
-        triggerTree.hltprescales().push_back(prescale);
+        trigger.hltprescales.push_back(prescale);
 
         if (_verbosity)
         std::cout << ">>> Path: " << (*it)
@@ -174,7 +197,14 @@ void TriggerBlock::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
                   << ", fired: " << fired
                   << std::endl;
     }
-    triggerTree.Fill();
+
+    if(triggerTree) {
+        triggerTree->data() = trigger;
+        triggerTree->Fill();
+    } else {
+        ntuple::ConvertToCompact(trigger, iEvent.id().run(), pathTables, compactTriggerTree->data());
+        compactTriggerTree->Fill();
+    }
 
 }
 #include "FWCore/Framework/interface/MakerMacros.h"
@@ -61,14 +61,42 @@ public:
         _triggerEventTag(iConfig.getParameter<edm::InputTag>("triggerEventTag")),
         _hltPathsOfInterest(iConfig.getParameter<std::vector<std::string> > ("hltPathsOfInterest")),
         _may10ReRecoData(iConfig.getParameter<bool>("May10ReRecoData")),
-        _firingFlag(_may10ReRecoData),
-        triggerObjectTree(&edm::Service<TFileService>()->file(), false) {}
+        _firingFlag(_may10ReRecoData)
+    {
+        TFile& file = edm::Service<TFileService>()->file();
+        // The compact format is always stored in the columnar layout.
+        if(iConfig.getParameter<bool>("compactFormat"))
+            compactTriggerObjectTree = std::shared_ptr<ntuple::CompactTriggerObjectColumnsTree>(
+                        new ntuple::CompactTriggerObjectColumnsTree(&file, false));
+        else if(iConfig.getParameter<bool>("columnarLayout"))
+            triggerObjectColumnsTree = std::shared_ptr<ntuple::TriggerObjectColumnsTree>(
+                        new ntuple::TriggerObjectColumnsTree(&file, false));
+        else
+            triggerObjectTree = std::shared_ptr<ntuple::TriggerObjectTree>(
+                        new ntuple::TriggerObjectTree(&file, false));
+    }
 
 private:
-    virtual void endJob() { triggerObjectTree.Write(); }
+    virtual void endJob()
+    {
+        if(triggerObjectTree) triggerObjectTree->Write();
+        if(triggerObjectColumnsTree) triggerObjectColumnsTree->Write();
+        if(compactTriggerObjectTree) {
+            compactTriggerObjectTree->Write();
+            pathTables.Write<ntuple::TriggerObjectPathTableTree>(&edm::Service<TFileService>()->file());
+        }
+    }
     virtual void beginRun(edm::Run const& iRun, edm::EventSetup const& iSetup);
     virtual void analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup);
 
+    template<typename Tree>
+    static void SetEventId(Tree& tree, const edm::Event& iEvent)
+    {
+        tree.RunId() = iEvent.id().run();
+        tree.LumiBlock() = iEvent.id().luminosityBlock();
+        tree.EventId() = iEvent.id().event();
+    }
+
 private:
     int _verbosity;
     const edm::InputTag _hltInputTag;
@@ -79,7 +107,10 @@ private:
     bool _may10ReRecoData;
     bool _firingFlag;
 
-    ntuple::TriggerObjectTree triggerObjectTree;
+    std::shared_ptr<ntuple::TriggerObjectTree> triggerObjectTree;
+    std::shared_ptr<ntuple::TriggerObjectColumnsTree> triggerObjectColumnsTree;
+    std::shared_ptr<ntuple::CompactTriggerObjectColumnsTree> compactTriggerObjectTree;
+    ntuple::TriggerPathTableBuilder pathTables;
     HLTConfigProvider hltConfig;
 };
 
@@ -100,13 +131,25 @@ void TriggerObjectBlock::beginRun(edm::Run const& iRun, edm::EventSetup const& i
         // In this case, all access methods will return empty values!
         throw std::runtime_error("HLT config extraction failed.");
     }
+
+    // The paths of interest of the menu are added to the path table in the menu order, so that the table of a run
+    // doesn't depend on the order in which the paths are matched to the trigger objects.
+    if(compactTriggerObjectTree) {
+        for(const std::string& name : hltConfig.triggerNames()) {
+            for(const std::string& path_int : _hltPathsOfInterest) {
+                if(name.find(path_int) == std::string::npos) continue;
+                pathTables.GetIndex(iRun.run(), name);
+                break;
+            }
+        }
+    }
 }
 
 void TriggerObjectBlock::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup)
 {
-    triggerObjectTree.RunId() = iEvent.id().run();
-    triggerObjectTree.LumiBlock() = iEvent.id().luminosityBlock();
-    triggerObjectTree.EventId() = iEvent.id().event();
+    if(triggerObjectTree) SetEventId(*triggerObjectTree, iEvent);
+    if(triggerObjectColumnsTree) SetEventId(*triggerObjectColumnsTree, iEvent);
+    if(compactTriggerObjectTree) SetEventId(*compactTriggerObjectTree, iEvent);
 
     if (_verbosity) {
         std::cout << setiosflags(std::ios::fixed);
@@ -147,19 +190,35 @@ void TriggerObjectBlock::analyze(const edm::Event& iEvent, const edm::EventSetup
 
         if (!pathInfoMap.size()) continue;
 
-        triggerObjectTree.eta()    = (**it).eta();
-        triggerObjectTree.phi()    = (**it).phi();
-        triggerObjectTree.pt()     = (**it).pt();
-        triggerObjectTree.mass() = (**it).mass();
-        triggerObjectTree.pdgId() = (**it).pdgId();
+        ntuple::TriggerObject triggerObject;
+        triggerObject.eta    = (**it).eta();
+        triggerObject.phi    = (**it).phi();
+        triggerObject.pt     = (**it).pt();
+        triggerObject.mass = (**it).mass();
+        triggerObject.pdgId = (**it).pdgId();
 
         for (const auto& imap : pathInfoMap) {
-            triggerObjectTree.pathNames().push_back(imap.first);
-            triggerObjectTree.pathValues().push_back(imap.second);
+            triggerObject.pathNames.push_back(imap.first);
+            triggerObject.pathValues.push_back(imap.second);
         }
 
-        triggerObjectTree.Fill();
+        if(triggerObjectTree) {
+            triggerObjectTree->data() = triggerObject;
+            triggerObjectTree->Fill();
+        } else if(triggerObjectColumnsTree)
+            ntuple::AppendToColumns(triggerObject, triggerObjectColumnsTree->data());
+        else {
+            ntuple::CompactTriggerObject compactObject;
+            ntuple::ConvertToCompact(triggerObject, iEvent.id().run(), pathTables, compactObject);
+            ntuple::AppendToColumns(compactObject, compactTriggerObjectTree->data());
+        }
     }
+
+    // In the columnar layout there is exactly one entry per event, even if the event has no trigger objects.
+    if(triggerObjectColumnsTree)
+        triggerObjectColumnsTree->Fill();
+    if(compactTriggerObjectTree)
+        compactTriggerObjectTree->Fill();
 }
 #include "FWCore/Framework/interface/MakerMacros.h"
 DEFINE_FWK_MODULE(TriggerObjectBlock);
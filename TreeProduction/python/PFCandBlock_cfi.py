@@ -26,4 +26,5 @@ import FWCore.ParameterSet.Config as cms
 
 pfCandBlock = cms.EDAnalyzer("PFCandBlock",
     srcPFCandidates = cms.InputTag('particleFlow'),
+    columnarLayout = cms.bool(False),
 )
@@ -37,5 +37,6 @@ triggerBlock = cms.EDAnalyzer("TriggerBlock",
                                     "HLT_TripleMu",
                                     "IsoPFTau",
                                     "TrkIsoT", 
-                                    "HLT_Ele")
+                                    "HLT_Ele"),
+  compactFormat = cms.bool(False)
 )
@@ -38,5 +38,7 @@ triggerObjectBlock = cms.EDAnalyzer("TriggerObjectBlock",
                                     "IsoPFTau",
                                     "TrkIsoT",
                                     "HLT_Ele"),
-  May10ReRecoData = cms.bool(False)
+  May10ReRecoData = cms.bool(False),
+  columnarLayout = cms.bool(False),
+  compactFormat = cms.bool(False)
 )